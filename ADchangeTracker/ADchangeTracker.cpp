@@ -25,9 +25,24 @@ int _tmain(int argc, _TCHAR* argv[])
 		SvcUninstall();
 		return 0;
 	}
+	else if (lstrcmpi(argv[1], L"-gaps") == 0)
+	{
+		// List gaps in EventRecordIDs delivered (from file saved by the service).
+		char szGapFile[MAX_PATH];
+		strcpy_s(szGapFile, theLog.GetLogPath());
+		strcat_s(szGapFile, GAP_FILE_NAME);
+		CGapTracker::PrintGaps(szGapFile);
+		return 0;
+	}
 
 	// Read service configuration file. Note settings are stored in theService object.
-	ReadConfigFile();
+	ReadConfigFile(theService.GetConfigStruct(), theService.GetFilterRules());
+
+	// If command-line parameters are "-replay <file>", send events in file to SQL (load test).
+	if (argc > 2 && lstrcmpi(argv[1], L"-replay") == 0)
+	{
+		return theService.Replay(argv[2]) ? 0 : 1;
+	}
 
 	// Connect the main thread of a service process to the service control manager, 
 	// which causes the thread to be the service control dispatcher thread for 
@@ -48,7 +63,9 @@ int _tmain(int argc, _TCHAR* argv[])
 			printf("This is a service.\n"
 				"To install or uninstall the service run a Command Prompt as a Administrator\n"
 				"Do: ADchangeTracker -install\n"
-				"Or: ADchangeTracker -uninstall\n\n");
+				"Or: ADchangeTracker -uninstall\n"
+				"List gaps in EventRecordIDs stored: ADchangeTracker -gaps\n"
+				"Send events in file to SQL (load test): ADchangeTracker -replay <file | ->\n\n");
 		}
 	}
 
@@ -155,55 +172,61 @@ VOID  SvcUninstall()
 	CloseServiceHandle(hSCManager);
 }
 
+// Config file is the .exe file name with .cfg (in the same folder).
+BOOL GetConfigFileName(char *szFile, int nSize)
+{
+	// Get module (exefile) name and path.
+	int nLen = GetModuleFileNameA(GetModuleHandle(NULL), szFile, nSize);
+	if (nLen == 0 || nLen >= nSize)
+	{
+		theLog.SysErr(MOD_NAME, "Failed to get module name in function GetConfigFileName", "", GetLastError());
+		return FALSE;
+	}
+	// Replace .exe in string with .cfg
+	while (nLen > 0 && szFile[nLen] != '.')	// find last '.' in string.
+		nLen--;
+	strcpy_s(&szFile[nLen + 1], 4, "cfg");
+	return TRUE;
+}
+
 // Read service configuration settings from file.
 // FIle is expected to be UNICODE and in the same folder as the 
 // ADchangeTracker.exe file.
-BOOL ReadConfigFile()
+BOOL ReadConfigFile(EVENT_PROCESSING_CONFIG &config, CFilterRules &rules)
 {
-	// Get module (exefile) name and path.
 	char szFN[MAX_PATH];
-	int nLen = GetModuleFileNameA(GetModuleHandle(NULL), szFN, sizeof(szFN));
-	if (nLen)
-	{	// Replace .exe in string with .cfg
-		while (nLen > 0 && szFN[nLen] != '.')	// find last '.' in string.
-			nLen--;
-		strcpy_s(&szFN[nLen + 1], 4, "cfg");
-	}
-	else
-	{
-		theLog.SysErr(MOD_NAME, "Failed to get module name in function ReadConfigFile", "", GetLastError());
+	if (!GetConfigFileName(szFN, sizeof(szFN)))
 		return FALSE;
-	}
 	HANDLE hFile = CreateFileA(szFN, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (INVALID_HANDLE_VALUE == hFile)
 	{
 		theLog.SysErr(MOD_NAME, "Failed to open service config file", szFN, GetLastError());
 		return FALSE;
 	}
+	BOOL fResult = FALSE;
+	BYTE *pFileData = NULL;
+	DWORD dwBytesRead = 0;
 	LARGE_INTEGER nFileSize;
 	if (!GetFileSizeEx(hFile, &nFileSize))
 	{
 		theLog.SysErr(MOD_NAME, "Failed to get size of service config file", szFN, GetLastError());
-		return FALSE;
+		goto cleanup;
 	}
-	BYTE *pFileData = (BYTE *)malloc(nFileSize.LowPart + 2);
+	pFileData = (BYTE *)malloc(nFileSize.LowPart + 2);
 	if (NULL == pFileData)
 	{
 		theLog.Error(MOD_NAME, "Failed to allocate memory for service config file", szFN);
-		return FALSE;
+		goto cleanup;
 	}
-	BOOL fResult = TRUE;
-	DWORD dwBytesRead = 0;
 	if (!ReadFile(hFile, pFileData, nFileSize.LowPart, &dwBytesRead, NULL))
 	{
 		theLog.SysErr(MOD_NAME, "Failed to read service config file", szFN, GetLastError());
-		fResult = FALSE;
 		goto cleanup;
 	}
 	// Terminate data with 0x00 - needed by _tcstok_s
 	*(WORD *)(pFileData + dwBytesRead) = 0;
 
-	ProcessConfigFile(pFileData, dwBytesRead);
+	fResult = ProcessConfigFile(pFileData, dwBytesRead, config, rules);
 
 cleanup:
 	if (pFileData)
@@ -212,7 +235,8 @@ cleanup:
 	return fResult;
 }
 
-void ProcessConfigFile(BYTE *pFileData, DWORD dwDataLen)
+BOOL ProcessConfigFile(BYTE *pFileData, DWORD dwDataLen, EVENT_PROCESSING_CONFIG &config,
+	CFilterRules &rules)
 {
 	// Check for unicode signature.
 	BOOL fIsUnicode = FALSE;
@@ -226,31 +250,36 @@ void ProcessConfigFile(BYTE *pFileData, DWORD dwDataLen)
 	if (!fIsUnicode)
 	{
 		theLog.Error(MOD_NAME, "Service config file is not UNICODE");
-		return;
+		return FALSE;
 	}
 
 	TCHAR seps[] = L"\r\n";
 	TCHAR* token, *next = 0;
 	TCHAR *pszSrc = (TCHAR *)pFileData;
 
+	BOOL fResult = TRUE;
 	token = _tcstok_s(pszSrc, seps, &next);
 	while (token != NULL)
 	{
-		ParseConfigFileLine(token);
+		if (!ParseConfigFileLine(token, config, rules))
+			fResult = FALSE;
 		token = _tcstok_s(NULL, seps, &next);
 	}
+	return fResult;
 }
 
-void ParseConfigFileLine(TCHAR *szLine)
+// Returns FALSE if the setting is not valid (it is logged).
+BOOL ParseConfigFileLine(TCHAR *szLine, EVENT_PROCESSING_CONFIG &config, CFilterRules &rules)
 {
 	if (szLine[0] == '#')
-		return;				// Ignore comment lines.
+		return TRUE;		// Ignore comment lines.
 	TCHAR *next = 0;
 	TCHAR *setting = _tcstok_s(szLine, L"=", &next);
 	if (!setting)
-		return;
-	EVENT_PROCESSING_CONFIG &config = theService.GetConfigStruct();
+		return TRUE;
 	TCHAR *param = _tcstok_s(NULL, L"\r\n", &next);
+	if (!param)
+		return TRUE;		// Setting without value.
 	if (_tcsstr(setting, L"SqlConnString") != NULL)
 	{
 		// TODO: trim white space.
@@ -258,13 +287,27 @@ void ParseConfigFileLine(TCHAR *szLine)
 	}
 	else if (_tcsstr(setting, L"AcceptedEventIDs") != NULL)
 	{
-		config.nNumElemAcceptedEvts = ParseAcceptedIDs(param,
-			config.narrAcceptedEvents, sizeof(config.narrAcceptedEvents) / sizeof(int));
+		if (!rules.AddAcceptedEventIDs(param))
+		{
+			theLog.Error(MOD_NAME, "Invalid AcceptedEventIDs setting", rules.GetError());
+			return FALSE;
+		}
 	}
 	else if (_tcsstr(setting, L"IgnoredEvents") != NULL)
 	{
-		config.nNumElemIgnoreEvts = ParseIgnoredEvts(param, 
-			config.sarrIgnoreEvts, sizeof(config.sarrIgnoreEvts) / sizeof(IGNORE_EVENTS));
+		if (!rules.AddIgnoredObjClasses(param))
+		{
+			theLog.Error(MOD_NAME, "Invalid IgnoredEvents setting", rules.GetError());
+			return FALSE;
+		}
+	}
+	else if (_tcsstr(setting, L"DropRule") != NULL)
+	{
+		if (!rules.AddDropRule(param))
+		{
+			theLog.Error(MOD_NAME, "Invalid DropRule setting - rule not used", rules.GetError());
+			return FALSE;
+		}
 	}
 	else if (_tcsstr(setting, L"VerboseLogging") != NULL)
 	{
@@ -274,45 +317,51 @@ void ParseConfigFileLine(TCHAR *szLine)
 	{
 		config.nDaysToKeepOldLogFiles = ParseIntParam(param);
 	}
-}
-
-int ParseAcceptedIDs(TCHAR *szEventIDs, int *pnarrEvents, int nNumElem)
-{
-	TCHAR szSrc[4096];
-	StringCchCopy(szSrc, sizeof(szSrc), szEventIDs);
-	TCHAR seps[] = L" ,";
-	TCHAR* token, *next = 0;
-	int var;
-	int elem = 0;
-
-	token = _tcstok_s(szSrc, seps, &next);
-	while (token != NULL && elem < nNumElem)
+	else if (_tcsstr(setting, L"MaxLogFileSizeMB") != NULL)
 	{
-		_stscanf_s(token, L"%d", &var);
-		pnarrEvents[elem++] = var;
-
-		token = _tcstok_s(NULL, seps, &next);
+		config.nMaxLogFileSizeMB = ParseIntParam(param);
 	}
-	return elem;
-}
-
-int ParseIgnoredEvts(TCHAR *szIgnoredEvts, IGNORE_EVENTS *psarrIgnoreEvents, int nNumElem)
-{
-	TCHAR szSrc[4096];
-	StringCchCopy(szSrc, sizeof(szSrc), szIgnoredEvts);
-	TCHAR seps[] = L" ,";
-	TCHAR* token, *next = 0;
-	int elem = 0;
-
-	token = _tcstok_s(szSrc, seps, &next);
-	while (token != NULL && elem < nNumElem)
+	else if (_tcsstr(setting, L"CompressOldLogFiles") != NULL)
 	{
-		StringCchCopy(psarrIgnoreEvents[elem].szObjectClass, 
-			sizeof(psarrIgnoreEvents[elem].szObjectClass), token);
-		++elem;
-		token = _tcstok_s(NULL, seps, &next);
+		config.fIsCompressOldLogFiles = ParseBoolParam(param);
+	}
+	else if (_tcsstr(setting, L"StagedIngest") != NULL)
+	{
+		config.fIsStagedIngest = ParseBoolParam(param);
+	}
+	else if (_tcsstr(setting, L"AsyncLogging") != NULL)
+	{
+		config.fIsAsyncLogging = ParseBoolParam(param);
+	}
+	else if (_tcsstr(setting, L"AsyncLogDropWhenFull") != NULL)
+	{
+		config.fIsAsyncLogDropWhenFull = ParseBoolParam(param);
+	}
+	else if (_tcsstr(setting, L"BinaryLogFormat") != NULL)
+	{
+		config.fIsBinaryLogFormat = ParseBoolParam(param);
+	}
+	else if (_tcsstr(setting, L"StatisticsInterval") != NULL)
+	{
+		config.nStatisticsInterval = ParseIntParam(param);
+	}
+	else if (_tcsstr(setting, L"MetricsInterval") != NULL)
+	{
+		config.nMetricsInterval = ParseIntParam(param);
+	}
+	else if (_tcsstr(setting, L"MetricsPipe") != NULL)
+	{
+		config.fIsMetricsPipe = ParseBoolParam(param);
+	}
+	else if (_tcsstr(setting, L"LagWarningSeconds") != NULL)
+	{
+		config.nLagWarningSeconds = ParseIntParam(param);
+	}
+	else if (_tcsstr(setting, L"BacklogWarningEvents") != NULL)
+	{
+		config.nBacklogWarningEvents = ParseIntParam(param);
 	}
-	return elem;
+	return TRUE;
 }
 
 BOOL ParseBoolParam(TCHAR *szParam)
@@ -4,11 +4,12 @@
 VOID SvcInstall();
 VOID SvcUninstall();
 
-// Read config file functions.
-BOOL ReadConfigFile();
-void ProcessConfigFile(BYTE *pFileData, DWORD dwDataLen);
-void ParseConfigFileLine(TCHAR *szLine);
-int ParseAcceptedIDs(TCHAR *szEventIDs, int *pnarrEvents, int nNumElem);
-int ParseIgnoredEvts(TCHAR *szIgnoredEvts, IGNORE_EVENTS *psarrIgnoreEvents, int nNumElem);
+// Read config file functions. Settings are stored in config and rules.
+// Return FALSE if the file could not be read or has an invalid setting (other settings are read).
+BOOL GetConfigFileName(char *szFile, int nSize);
+BOOL ReadConfigFile(EVENT_PROCESSING_CONFIG &config, CFilterRules &rules);
+BOOL ProcessConfigFile(BYTE *pFileData, DWORD dwDataLen, EVENT_PROCESSING_CONFIG &config,
+	CFilterRules &rules);
+BOOL ParseConfigFileLine(TCHAR *szLine, EVENT_PROCESSING_CONFIG &config, CFilterRules &rules);
 BOOL ParseBoolParam(TCHAR *szParam);
 int ParseIntParam(TCHAR *szParam);
@@ -0,0 +1,218 @@
+-- Creates the ADeventSummary table, the trigger that maintains it and the
+-- usp_GetADeventSummary procedure used by the management dashboard.
+-- Run once on an existing AD_DW database (after CreateAD_DWdatabase.sql).
+--
+-- The summary holds change counts per period, EventID, SourceDC and ModifiedBy
+-- at two grains: 'H' = hourly and 'D' = daily. Period start is in UTC (same as
+-- ADevents.EventTime). A trigger on ADevents appends the counts of each insert to
+-- ADeventSummaryDelta, whatever path inserts into ADevents. The trigger only
+-- appends rows, so concurrent ingest calls for the same EventID, DC and hour do
+-- not wait on one summary row. The SQL Agent job 'AD_DW - Fold AD event summary'
+-- runs usp_FoldADeventSummaryDelta every minute to add the deltas to ADeventSummary.
+-- Dashboard queries should use usp_GetADeventSummary (it also counts deltas not
+-- folded yet) and not touch ADevents.
+
+USE [AD_DW]
+GO
+SET ANSI_NULLS ON
+GO
+SET QUOTED_IDENTIFIER ON
+GO
+CREATE TABLE [dbo].[ADeventSummary](
+	[Grain] [char](1) NOT NULL,
+	[PeriodStart] [datetime2](0) NOT NULL,
+	[EventID] [int] NOT NULL,
+	[SourceDC] [nvarchar](128) NOT NULL,
+	[ModifiedBy] [nvarchar](128) NOT NULL,
+	[EventCount] [int] NOT NULL,
+ CONSTRAINT [PK_ADeventSummary] PRIMARY KEY CLUSTERED
+(
+	[Grain] ASC,
+	[PeriodStart] ASC,
+	[EventID] ASC,
+	[SourceDC] ASC,
+	[ModifiedBy] ASC
+)WITH (PAD_INDEX = OFF, STATISTICS_NORECOMPUTE = OFF, IGNORE_DUP_KEY = OFF, ALLOW_ROW_LOCKS = ON, ALLOW_PAGE_LOCKS = ON, FILLFACTOR = 90) ON [PRIMARY],
+ CONSTRAINT [CK_ADeventSummary_Grain] CHECK ([Grain] IN ('H', 'D'))
+) ON [PRIMARY]
+GO
+-- Counts of inserts into ADevents not yet added to ADeventSummary (append only).
+CREATE TABLE [dbo].[ADeventSummaryDelta](
+	[DeltaID] [bigint] IDENTITY(1,1) NOT NULL,
+	[Grain] [char](1) NOT NULL,
+	[PeriodStart] [datetime2](0) NOT NULL,
+	[EventID] [int] NOT NULL,
+	[SourceDC] [nvarchar](128) NOT NULL,
+	[ModifiedBy] [nvarchar](128) NOT NULL,
+	[EventCount] [int] NOT NULL,
+ CONSTRAINT [PK_ADeventSummaryDelta] PRIMARY KEY CLUSTERED
+(
+	[DeltaID] ASC
+)WITH (PAD_INDEX = OFF, STATISTICS_NORECOMPUTE = OFF, IGNORE_DUP_KEY = OFF, ALLOW_ROW_LOCKS = ON, ALLOW_PAGE_LOCKS = ON, FILLFACTOR = 100) ON [PRIMARY]
+) ON [PRIMARY]
+GO
+
+-- Lock ADevents while the trigger is created and existing rows are summarized,
+-- so no event is counted twice or missed if the service is running.
+BEGIN TRANSACTION
+SELECT TOP (0) EventRecordID FROM dbo.ADevents WITH (TABLOCKX, HOLDLOCK);
+GO
+-- =============================================
+-- Create date: 19.10.2026
+-- Description:	Append the hourly and daily counts of new ADevents
+-- rows to ADeventSummaryDelta (one set-based insert per statement, no
+-- read or update of ADeventSummary in the ingest transaction).
+-- =============================================
+CREATE TRIGGER [dbo].[TR_ADevents_Summary] ON [dbo].[ADevents]
+AFTER INSERT
+AS
+BEGIN
+	SET NOCOUNT ON;
+
+	INSERT INTO dbo.ADeventSummaryDelta (Grain, PeriodStart, EventID, SourceDC, ModifiedBy, EventCount)
+		SELECT p.Grain, p.PeriodStart, i.EventID, i.SourceDC, ISNULL(i.ModifiedBy, ''), COUNT(*)
+		FROM inserted i
+		CROSS APPLY (VALUES
+			('H', DATEADD(hour, DATEDIFF(hour, '19000101', i.EventTime), CAST('19000101' AS datetime2(0)))),
+			('D', CAST(CAST(i.EventTime AS date) AS datetime2(0)))
+			) AS p(Grain, PeriodStart)
+		GROUP BY p.Grain, p.PeriodStart, i.EventID, i.SourceDC, ISNULL(i.ModifiedBy, '');
+END
+GO
+-- Summarize the events already stored in ADevents.
+INSERT INTO dbo.ADeventSummary (Grain, PeriodStart, EventID, SourceDC, ModifiedBy, EventCount)
+	SELECT p.Grain, p.PeriodStart, e.EventID, e.SourceDC, ISNULL(e.ModifiedBy, ''), COUNT(*)
+	FROM dbo.ADevents e
+	CROSS APPLY (VALUES
+		('H', DATEADD(hour, DATEDIFF(hour, '19000101', e.EventTime), CAST('19000101' AS datetime2(0)))),
+		('D', CAST(CAST(e.EventTime AS date) AS datetime2(0)))
+		) AS p(Grain, PeriodStart)
+	GROUP BY p.Grain, p.PeriodStart, e.EventID, e.SourceDC, ISNULL(e.ModifiedBy, '');
+COMMIT TRANSACTION
+GO
+
+SET ANSI_NULLS ON
+GO
+SET QUOTED_IDENTIFIER ON
+GO
+-- =============================================
+-- Create date: 19.10.2026
+-- Description:	Add the counts in ADeventSummaryDelta to ADeventSummary.
+-- Deltas are taken @BatchSize rows at a time, grouped and merged into
+-- ADeventSummary with one MERGE per batch (one transaction per batch).
+-- Only this procedure updates ADeventSummary, so the MERGE does not wait
+-- on ingestion. Returns number of delta rows folded.
+-- =============================================
+CREATE PROCEDURE [dbo].[usp_FoldADeventSummaryDelta]
+	@BatchSize int = 50000,
+	@RowsFolded int = 0 OUTPUT
+AS
+BEGIN
+	SET NOCOUNT ON;
+	SET XACT_ABORT ON;
+
+	DECLARE @Delta TABLE (Grain char(1), PeriodStart datetime2(0), EventID int,
+		SourceDC nvarchar(128), ModifiedBy nvarchar(128), EventCount int);
+	DECLARE @Rows int;
+	SET @RowsFolded = 0;
+
+	WHILE 1 = 1
+	BEGIN
+		DELETE FROM @Delta;
+		BEGIN TRANSACTION;
+		DELETE TOP (@BatchSize) FROM dbo.ADeventSummaryDelta
+			OUTPUT deleted.Grain, deleted.PeriodStart, deleted.EventID, deleted.SourceDC,
+				deleted.ModifiedBy, deleted.EventCount
+			INTO @Delta;
+		SET @Rows = @@ROWCOUNT;
+		IF @Rows = 0
+		BEGIN
+			COMMIT TRANSACTION;
+			BREAK;
+		END
+
+		MERGE dbo.ADeventSummary WITH (HOLDLOCK) AS s
+		USING (
+			SELECT Grain, PeriodStart, EventID, SourceDC, ModifiedBy, SUM(EventCount) AS EventCount
+			FROM @Delta
+			GROUP BY Grain, PeriodStart, EventID, SourceDC, ModifiedBy
+		) AS n
+		ON s.Grain = n.Grain AND s.PeriodStart = n.PeriodStart AND s.EventID = n.EventID
+			AND s.SourceDC = n.SourceDC AND s.ModifiedBy = n.ModifiedBy
+		WHEN MATCHED THEN
+			UPDATE SET s.EventCount = s.EventCount + n.EventCount
+		WHEN NOT MATCHED THEN
+			INSERT (Grain, PeriodStart, EventID, SourceDC, ModifiedBy, EventCount)
+			VALUES (n.Grain, n.PeriodStart, n.EventID, n.SourceDC, n.ModifiedBy, n.EventCount);
+		COMMIT TRANSACTION;
+
+		SET @RowsFolded = @RowsFolded + @Rows;
+	END
+	RETURN @RowsFolded;
+END
+GO
+
+SET ANSI_NULLS ON
+GO
+SET QUOTED_IDENTIFIER ON
+GO
+-- =============================================
+-- Create date: 19.10.2026
+-- Description:	Get AD event counts for the management dashboard.
+-- @Grain = 'H' for hourly counts or 'D' for daily counts.
+-- Periods from the one @DateFrom is in up to (not including) @DateTo.
+-- Empty string filter parameters are ignored (same as usp_GetADevents).
+-- Counts not folded into ADeventSummary yet are included.
+-- =============================================
+CREATE PROCEDURE [dbo].[usp_GetADeventSummary]
+	@Grain char(1),
+	@DateFrom DATETIME,
+	@DateTo DATETIME,
+	@SourceDC nvarchar(64),
+	@ModifiedBy nvarchar(64),
+	@EventIDs nvarchar(128)
+AS
+BEGIN
+	SET NOCOUNT ON;
+
+	-- Periods start at the hour (H) or at midnight (D) - the period @DateFrom is in
+	-- starts at or before it.
+	DECLARE @PeriodFrom datetime2(0) = CASE WHEN @Grain = 'H'
+		THEN DATEADD(hour, DATEDIFF(hour, 0, @DateFrom), 0)
+		ELSE DATEADD(day, DATEDIFF(day, 0, @DateFrom), 0) END;
+
+	SELECT s.PeriodStart, s.EventID, d.Description, s.SourceDC, s.ModifiedBy,
+		SUM(s.EventCount) AS EventCount
+	FROM (
+		SELECT Grain, PeriodStart, EventID, SourceDC, ModifiedBy, EventCount
+			FROM dbo.ADeventSummary
+		UNION ALL
+		SELECT Grain, PeriodStart, EventID, SourceDC, ModifiedBy, EventCount
+			FROM dbo.ADeventSummaryDelta
+		) s
+	LEFT JOIN dbo.EventDescription d ON s.EventID = d.EventID
+	WHERE s.Grain = @Grain
+		AND s.PeriodStart >= @PeriodFrom AND s.PeriodStart < @DateTo
+		AND (@SourceDC = '' OR s.SourceDC LIKE '%' + @SourceDC + '%')
+		AND (@ModifiedBy = '' OR s.ModifiedBy LIKE '%' + @ModifiedBy + '%')
+		AND (@EventIDs = '' OR ',' + REPLACE(@EventIDs, ' ', '') + ','
+			LIKE '%,' + CONVERT(nvarchar, s.EventID) + ',%')
+	GROUP BY s.PeriodStart, s.EventID, d.Description, s.SourceDC, s.ModifiedBy
+	ORDER BY s.PeriodStart, s.EventID, s.SourceDC, s.ModifiedBy
+	OPTION (RECOMPILE);
+END
+GO
+
+-- SQL Agent job that runs usp_FoldADeventSummaryDelta every minute.
+USE [msdb]
+GO
+EXEC dbo.sp_add_job @job_name = N'AD_DW - Fold AD event summary',
+	@description = N'Adds the counts in ADeventSummaryDelta to ADeventSummary.';
+EXEC dbo.sp_add_jobstep @job_name = N'AD_DW - Fold AD event summary',
+	@step_name = N'Fold summary deltas', @subsystem = N'TSQL', @database_name = N'AD_DW',
+	@command = N'EXEC dbo.usp_FoldADeventSummaryDelta @BatchSize = 50000;';
+EXEC dbo.sp_add_jobschedule @job_name = N'AD_DW - Fold AD event summary',
+	@name = N'Every minute', @freq_type = 4, @freq_interval = 1,
+	@freq_subday_type = 4, @freq_subday_interval = 1;
+EXEC dbo.sp_add_jobserver @job_name = N'AD_DW - Fold AD event summary';
+GO
@@ -8,6 +8,7 @@
 CAdoSqlServer::CAdoSqlServer()
 {
 	m_fIsConnected = m_fIsInitialized = m_fConnectionLost = m_fRetryingToConnect = FALSE;
+	m_fIsStagedIngest = FALSE;
 	m_nRetryConnectCount = 0;
 	m_szConnectionString[0] = 0;
 	m_nLastRetryConnectTime = 0;
@@ -133,22 +134,27 @@ int CAdoSqlServer::GetSecondsSinceLastRetry()
 	return secs;
 }
 
-BOOL CAdoSqlServer::Call_usp_ADchgEventEx(LPWSTR pwstrXmlData, const long lNumBytes)
+BOOL CAdoSqlServer::Call_usp_ADchgEventEx(BSTR bstrXmlData)
 {
 	_ConnectionPtr pSQLConn = OpenSqlConnection();
 	if( pSQLConn == NULL )
 		return FALSE;
 	BOOL fRetval = TRUE;
+	// The BSTR is put in the VARIANT as is (_bstr_t would copy it) - detached below so
+	// the caller's BSTR is not freed.
+	_variant_t vtXmlData;
+	V_VT(&vtXmlData) = VT_BSTR;
+	V_BSTR(&vtXmlData) = bstrXmlData;
 	try
 	{
 		_CommandPtr CommandPtr = NULL;
 		CommandPtr.CreateInstance(__uuidof(Command));
 		CommandPtr->ActiveConnection = pSQLConn;
 		CommandPtr->CommandType = adCmdStoredProc;
-		CommandPtr->CommandText = _bstr_t("usp_ADchgEventEx");
+		CommandPtr->CommandText = _bstr_t(m_fIsStagedIngest ? "usp_ADchgEventStage" : "usp_ADchgEventEx");
 		CommandPtr->NamedParameters = true;
 		_ParameterPtr ParamPtr = CommandPtr->CreateParameter(_bstr_t("@XmlData"), adVarWChar,
-			adParamInput, lNumBytes, _bstr_t(pwstrXmlData));
+			adParamInput, SysStringByteLen(bstrXmlData) + sizeof(WCHAR), vtXmlData);
 		CommandPtr->Parameters->Append(ParamPtr);
 		_RecordsetPtr RecordsetPtr = CommandPtr->Execute(NULL, NULL, adCmdStoredProc);
 	}
@@ -157,6 +163,7 @@ BOOL CAdoSqlServer::Call_usp_ADchgEventEx(LPWSTR pwstrXmlData, const long lNumBy
 		LogComError( e );
 		fRetval = FALSE;
 	}
+	vtXmlData.Detach();
 	if( (pSQLConn->Errors->Count) > 0 )
 		fRetval = FALSE;
 	return fRetval;
@@ -28,7 +28,12 @@ public:
 
 	BOOL Call_usp_CheckConnection();
 
-	BOOL Call_usp_ADchgEventEx( LPWSTR pwstrXmlData, const long lNumBytes );
+	// Sends event XML to usp_ADchgEventEx, or to usp_ADchgEventStage when staged ingest is set.
+	// bstrXmlData is used as parameter value without copy (caller frees it).
+	BOOL Call_usp_ADchgEventEx( BSTR bstrXmlData );
+
+	// TRUE = send events to the memory-optimized staging table (see IngestStaging.sql).
+	void SetStagedIngest(BOOL fIsStagedIngest) { m_fIsStagedIngest = fIsStagedIngest; }
 
 	void LogComError( _com_error &e );
 
@@ -44,6 +49,7 @@ private:
 	int				m_nRetryConnectCount;
 	BOOL			m_fRetryingToConnect;
 	int				m_nSQLconnUseCount;
+	BOOL			m_fIsStagedIngest;
 	__int64			m_nLastRetryConnectTime;	// Set to current time when connection lost
 												// and when RetrySqlConnection called.
 	void SetRetryConnectTime();
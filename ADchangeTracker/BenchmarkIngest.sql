@@ -0,0 +1,116 @@
+-- Ingest throughput benchmark for AD_DW.
+-- Run on a TEST copy of AD_DW only - synthetic rows are inserted into ADevents
+-- (SourceDC 'BENCH-DC<n>') and removed again at the end.
+--
+-- Measures events per second for:
+--  1. usp_ADchgEventEx (current path).
+--  2. usp_ADchgEventStage (staged ingest, IngestStaging.sql must be installed)
+--     followed by usp_MoveStagedADevents to drain the staging table. Rows the
+--     mover could not store (ADeventStagingError) are reported as a separate
+--     test row and should be 0, otherwise batches fell back to per-row moves.
+-- The synthetic load mimics several DCs: each DC's clock is skewed by
+-- @DCSkewSeconds and every @ReplayEvery-th event is a late replay from
+-- @ReplaySeconds ago, so events arrive out of EventTime order.
+-- Fragmentation and page count of the ADevents indexes are reported after each
+-- test. Run before and after ClusterADeventsByIngestSeq.sql to compare.
+-- Set the parameters below. Results are returned as two result sets.
+
+USE [AD_DW]
+GO
+SET NOCOUNT ON;
+
+DECLARE @NumEvents int = 20000, @NumDCs int = 4, @DCSkewSeconds int = 30,
+	@ReplayEvery int = 20, @ReplaySeconds int = 3600;
+
+DECLARE @Results TABLE (Test nvarchar(64), NumEvents int, Milliseconds int, EventsPerSec decimal(12, 1));
+DECLARE @Fragmentation TABLE (Test nvarchar(64), IndexName sysname NULL, IndexType nvarchar(60),
+	AvgFragmentationPercent float, PageCount bigint, AvgPageSpaceUsedPercent float);
+DECLARE @BaseTime datetime2 = SYSUTCDATETIME();
+DECLARE @Xml TABLE (n int PRIMARY KEY, XmlData nvarchar(max));
+DECLARE @BaseRecordID bigint = 900000000;
+-- Removes the BENCH rows after each test. ADeventXml rows must go as well, otherwise
+-- the next test's inserts fail on PK_ADeventXml; the summary tables are only
+-- maintained on insert.
+DECLARE @Cleanup nvarchar(max) = N'
+	DELETE FROM dbo.ADevents WHERE SourceDC LIKE N''BENCH-DC%'';
+	IF OBJECT_ID(N''dbo.ADeventXml'') IS NOT NULL
+		DELETE FROM dbo.ADeventXml WHERE SourceDC LIKE N''BENCH-DC%'';
+	IF OBJECT_ID(N''dbo.ADeventSummaryDelta'') IS NOT NULL
+		DELETE FROM dbo.ADeventSummaryDelta WHERE SourceDC LIKE N''BENCH-DC%'';
+	IF OBJECT_ID(N''dbo.ADeventSummary'') IS NOT NULL
+		DELETE FROM dbo.ADeventSummary WHERE SourceDC LIKE N''BENCH-DC%'';';
+
+-- Build synthetic 5136 events spread over @NumDCs domain controllers.
+;WITH Numbers AS (
+	SELECT TOP (@NumEvents) ROW_NUMBER() OVER (ORDER BY (SELECT NULL)) AS n
+	FROM sys.all_objects a CROSS JOIN sys.all_objects b
+)
+INSERT INTO @Xml (n, XmlData)
+	SELECT n, N'<Event xmlns=''http://schemas.microsoft.com/win/2004/08/events/event''><System>'
+		+ N'<Provider Name=''Microsoft-Windows-Security-Auditing''/><EventID>5136</EventID>'
+		+ N'<TimeCreated SystemTime=''' + CONVERT(nvarchar(33), DATEADD(millisecond, n * 10
+			- (n % @NumDCs) * @DCSkewSeconds * 1000
+			- CASE WHEN n % @ReplayEvery = 0 THEN @ReplaySeconds * 1000 ELSE 0 END, @BaseTime), 126) + N'Z''/>'
+		+ N'<EventRecordID>' + CONVERT(nvarchar, @BaseRecordID + n) + N'</EventRecordID>'
+		+ N'<Channel>Security</Channel><Computer>BENCH-DC' + CONVERT(nvarchar, n % @NumDCs) + N'.bench.local</Computer>'
+		+ N'</System><EventData>'
+		+ N'<Data Name=''SubjectUserName''>svc_provision</Data><Data Name=''SubjectDomainName''>BENCH</Data>'
+		+ N'<Data Name=''ObjectDN''>CN=User' + CONVERT(nvarchar, n) + N',OU=Bench,DC=bench,DC=local</Data>'
+		+ N'<Data Name=''ObjectClass''>user</Data><Data Name=''AttributeLDAPDisplayName''>description</Data>'
+		+ N'<Data Name=''AttributeValue''>Benchmark ' + CONVERT(nvarchar, n) + N'</Data>'
+		+ N'<Data Name=''OperationType''>%%14674</Data></EventData></Event>'
+	FROM Numbers;
+
+DECLARE @n int, @XmlData nvarchar(max), @t0 datetime2;
+
+-- 1. usp_ADchgEventEx, one call per event (as the service does).
+SET @t0 = SYSUTCDATETIME();
+SET @n = 1;
+WHILE @n <= @NumEvents
+BEGIN
+	SELECT @XmlData = XmlData FROM @Xml WHERE n = @n;
+	EXEC dbo.usp_ADchgEventEx @XmlData;
+	SET @n = @n + 1;
+END
+INSERT INTO @Results SELECT N'usp_ADchgEventEx', @NumEvents, DATEDIFF(millisecond, @t0, SYSUTCDATETIME()), 0;
+INSERT INTO @Fragmentation
+	SELECT N'usp_ADchgEventEx', i.name, s.index_type_desc, s.avg_fragmentation_in_percent,
+		s.page_count, s.avg_page_space_used_in_percent
+	FROM sys.dm_db_index_physical_stats(DB_ID(), OBJECT_ID(N'dbo.ADevents'), NULL, NULL, 'SAMPLED') s
+	JOIN sys.indexes i ON i.object_id = s.object_id AND i.index_id = s.index_id
+	WHERE s.alloc_unit_type_desc = N'IN_ROW_DATA';
+
+EXEC (@Cleanup);
+
+-- 2. usp_ADchgEventStage (service call) and usp_MoveStagedADevents (background mover).
+IF OBJECT_ID(N'dbo.usp_ADchgEventStage') IS NOT NULL
+BEGIN
+	SET @t0 = SYSUTCDATETIME();
+	SET @n = 1;
+	WHILE @n <= @NumEvents
+	BEGIN
+		SELECT @XmlData = XmlData FROM @Xml WHERE n = @n;
+		EXEC dbo.usp_ADchgEventStage @XmlData;
+		SET @n = @n + 1;
+	END
+	INSERT INTO @Results SELECT N'usp_ADchgEventStage', @NumEvents, DATEDIFF(millisecond, @t0, SYSUTCDATETIME()), 0;
+
+	DECLARE @Errors int = (SELECT COUNT(*) FROM dbo.ADeventStagingError);
+	SET @t0 = SYSUTCDATETIME();
+	EXEC dbo.usp_MoveStagedADevents @BatchSize = 500, @MaxSeconds = 3600;
+	INSERT INTO @Results SELECT N'usp_MoveStagedADevents', @NumEvents, DATEDIFF(millisecond, @t0, SYSUTCDATETIME()), 0;
+	INSERT INTO @Results SELECT N'ADeventStagingError rows', (SELECT COUNT(*) FROM dbo.ADeventStagingError) - @Errors, NULL, NULL;
+	INSERT INTO @Fragmentation
+		SELECT N'usp_MoveStagedADevents', i.name, s.index_type_desc, s.avg_fragmentation_in_percent,
+			s.page_count, s.avg_page_space_used_in_percent
+		FROM sys.dm_db_index_physical_stats(DB_ID(), OBJECT_ID(N'dbo.ADevents'), NULL, NULL, 'SAMPLED') s
+		JOIN sys.indexes i ON i.object_id = s.object_id AND i.index_id = s.index_id
+		WHERE s.alloc_unit_type_desc = N'IN_ROW_DATA';
+
+	EXEC (@Cleanup);
+END
+
+UPDATE @Results SET EventsPerSec = NumEvents * 1000.0 / NULLIF(Milliseconds, 0);
+SELECT * FROM @Results;
+SELECT * FROM @Fragmentation;
+GO
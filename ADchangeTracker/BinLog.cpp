@@ -0,0 +1,404 @@
+// Binary log format - see BinLog.h.
+// Note - portable C++, compiled without precompiled header.
+#include "BinLog.h"
+#include <string.h>
+
+int BinLogPutVarint(unsigned char *pBuf, unsigned long long nValue)
+{
+	int nLen = 0;
+	while (nValue >= 0x80)
+	{
+		pBuf[nLen++] = (unsigned char)(nValue | 0x80);
+		nValue >>= 7;
+	}
+	pBuf[nLen++] = (unsigned char)nValue;
+	return nLen;
+}
+
+int BinLogGetVarint(const unsigned char *pBuf, const unsigned char *pEnd, unsigned long long *pnValue)
+{
+	unsigned long long nValue = 0;
+	int nShift = 0, nLen = 0;
+	while (pBuf + nLen < pEnd && nShift < 64)
+	{
+		unsigned char c = pBuf[nLen++];
+		nValue |= (unsigned long long)(c & 0x7F) << nShift;
+		if (!(c & 0x80))
+		{
+			*pnValue = nValue;
+			return nLen;
+		}
+		nShift += 7;
+	}
+	return 0;	// Truncated or invalid.
+}
+
+static void PutU32(unsigned char *p, unsigned int n)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (unsigned char)(n >> (i * 8));
+}
+
+static void PutU64(unsigned char *p, unsigned long long n)
+{
+	for (int i = 0; i < 8; i++)
+		p[i] = (unsigned char)(n >> (i * 8));
+}
+
+static unsigned int GetU32(const unsigned char *p)
+{
+	unsigned int n = 0;
+	for (int i = 3; i >= 0; i--)
+		n = (n << 8) | p[i];
+	return n;
+}
+
+static unsigned long long GetU64(const unsigned char *p)
+{
+	unsigned long long n = 0;
+	for (int i = 7; i >= 0; i--)
+		n = (n << 8) | p[i];
+	return n;
+}
+
+void BinLogPutIndexBlock(unsigned char *pBuf, const BINLOG_INDEX_BLOCK *pBlock)
+{
+	PutU64(pBuf, pBlock->nOffset);
+	PutU32(pBuf + 8, pBlock->nLength);
+	PutU32(pBuf + 12, pBlock->nRecords);
+	PutU64(pBuf + 16, (unsigned long long)pBlock->tFirst);
+	PutU64(pBuf + 24, (unsigned long long)pBlock->tLast);
+	PutU64(pBuf + 32, pBlock->nMinRecID);
+	PutU64(pBuf + 40, pBlock->nMaxRecID);
+	PutU32(pBuf + 48, pBlock->nLevelMask);
+	PutU64(pBuf + 52, pBlock->nModuleMask);
+}
+
+void BinLogGetIndexBlock(const unsigned char *pBuf, BINLOG_INDEX_BLOCK *pBlock)
+{
+	pBlock->nOffset = GetU64(pBuf);
+	pBlock->nLength = GetU32(pBuf + 8);
+	pBlock->nRecords = GetU32(pBuf + 12);
+	pBlock->tFirst = (long long)GetU64(pBuf + 16);
+	pBlock->tLast = (long long)GetU64(pBuf + 24);
+	pBlock->nMinRecID = GetU64(pBuf + 32);
+	pBlock->nMaxRecID = GetU64(pBuf + 40);
+	pBlock->nLevelMask = GetU32(pBuf + 48);
+	pBlock->nModuleMask = GetU64(pBuf + 52);
+}
+
+bool BinLogIsRecordID(const char *sz, unsigned long long *pnRecID)
+{
+	// Note - no leading zeros and max 19 digits, so the decoded text is identical.
+	if (!sz || sz[0] < '1' || sz[0] > '9')
+		return false;
+	unsigned long long n = 0;
+	int i = 0;
+	for (; sz[i]; i++)
+	{
+		if (sz[i] < '0' || sz[i] > '9' || i >= 19)
+			return false;
+		n = n * 10 + (sz[i] - '0');
+	}
+	*pnRecID = n;
+	return true;
+}
+
+// Days since 1970-01-01 from civil date (proleptic Gregorian).
+static long long DaysFromCivil(int y, int m, int d)
+{
+	y -= m <= 2;
+	long long era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (long long)doe - 719468;
+}
+
+static void PutDigits(char *pBuf, unsigned int nValue, int nDigits)
+{
+	for (int i = nDigits - 1; i >= 0; i--)
+	{
+		pBuf[i] = (char)('0' + nValue % 10);
+		nValue /= 10;
+	}
+}
+
+void BinLogFormatTime(long long tLocal, char *szBuf)
+{
+	long long nDays = tLocal >= 0 ? tLocal / 86400 : (tLocal - 86399) / 86400;
+	int nSecs = (int)(tLocal - nDays * 86400);
+
+	// Civil date from days since 1970-01-01.
+	long long z = nDays + 719468;
+	long long era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned doe = (unsigned)(z - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	long long y = (long long)yoe + era * 400;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	unsigned d = doy - (153 * mp + 2) / 5 + 1;
+	unsigned m = mp < 10 ? mp + 3 : mp - 9;
+	y += (m <= 2);
+
+	// Note - no sprintf, this file is also compiled with SDL checks (C4996 is an error).
+	PutDigits(szBuf, (unsigned)y, 4);
+	szBuf[4] = '-';
+	PutDigits(szBuf + 5, m, 2);
+	szBuf[7] = '-';
+	PutDigits(szBuf + 8, d, 2);
+	szBuf[10] = ' ';
+	PutDigits(szBuf + 11, nSecs / 3600, 2);
+	szBuf[13] = ':';
+	PutDigits(szBuf + 14, (nSecs / 60) % 60, 2);
+	szBuf[16] = ':';
+	PutDigits(szBuf + 17, nSecs % 60, 2);
+	szBuf[19] = 0;
+}
+
+// Parse unsigned number of 1..nMaxDigits digits. Returns chars used, 0 if none.
+static int GetNumber(const char *sz, int nMaxDigits, int *pnValue)
+{
+	int n = 0, i = 0;
+	for (; i < nMaxDigits && sz[i] >= '0' && sz[i] <= '9'; i++)
+		n = n * 10 + (sz[i] - '0');
+	*pnValue = n;
+	return i;
+}
+
+bool BinLogParseTime(const char *sz, long long *ptLocal)
+{
+	int y, mo, d, h = 0, mi = 0, s = 0, n;
+	if (!(n = GetNumber(sz, 4, &y)) || sz[n] != '-')
+		return false;
+	sz += n + 1;
+	if (!(n = GetNumber(sz, 2, &mo)) || sz[n] != '-')
+		return false;
+	sz += n + 1;
+	if (!(n = GetNumber(sz, 2, &d)))
+		return false;
+	sz += n;
+	if (*sz == ' ' || *sz == 'T')
+	{
+		sz++;
+		if (!(n = GetNumber(sz, 2, &h)) || sz[n] != ':')
+			return false;
+		sz += n + 1;
+		if (!(n = GetNumber(sz, 2, &mi)) || sz[n] != ':')
+			return false;
+		sz += n + 1;
+		if (!(n = GetNumber(sz, 2, &s)))
+			return false;
+		sz += n;
+	}
+	if (*sz || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 59)
+		return false;
+	*ptLocal = DaysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// CBinLogWriter
+
+CBinLogWriter::CBinLogWriter()
+{
+	m_nFileOffset = 0;
+	m_nNumStrings = 0;
+	memset(m_narrHash, 0, sizeof(m_narrHash));
+	ResetBlock();
+}
+
+void CBinLogWriter::ResetBlock()
+{
+	memset(&m_sBlock, 0, sizeof(m_sBlock));
+	m_sBlock.nOffset = m_nFileOffset;
+	m_sBlock.nMinRecID = ~0ULL;
+}
+
+int CBinLogWriter::BeginFile(unsigned char *pBuf, int nBufSize, const char *szWorkstation,
+	const char *szUser)
+{
+	int nWsLen = (int)strlen(szWorkstation), nUserLen = (int)strlen(szUser);
+	if (nBufSize < BINLOG_MAGIC_LEN + 32 + nWsLen + nUserLen)
+		return 0;
+
+	m_nNumStrings = 0;
+	memset(m_narrHash, 0, sizeof(m_narrHash));
+
+	int nPos = 0;
+	memcpy(pBuf, BINLOG_MAGIC, BINLOG_MAGIC_LEN);	// Incl. terminating 0.
+	nPos += BINLOG_MAGIC_LEN;
+	nPos += BinLogPutVarint(pBuf + nPos, BINLOG_VERSION);
+	nPos += BinLogPutVarint(pBuf + nPos, nWsLen);
+	memcpy(pBuf + nPos, szWorkstation, nWsLen);
+	nPos += nWsLen;
+	nPos += BinLogPutVarint(pBuf + nPos, nUserLen);
+	memcpy(pBuf + nPos, szUser, nUserLen);
+	nPos += nUserLen;
+
+	m_nFileOffset = nPos;
+	ResetBlock();
+	return nPos;
+}
+
+// Returns id of interned string (1...BINLOG_MAX_STRINGS), 0 for empty string
+// or -1 if the string can't be interned.
+int CBinLogWriter::Intern(const char *sz, int nLen, bool *pfNew)
+{
+	*pfNew = false;
+	if (nLen == 0)
+		return 0;
+	if (nLen > BINLOG_MAX_STRING_LEN)
+		return -1;
+
+	// FNV-1a hash.
+	unsigned int nHash = 2166136261u;
+	for (int i = 0; i < nLen; i++)
+		nHash = (nHash ^ (unsigned char)sz[i]) * 16777619u;
+
+	const int nMask = BINLOG_MAX_STRINGS * 2 - 1;
+	for (int i = nHash & nMask;; i = (i + 1) & nMask)
+	{
+		int nID = m_narrHash[i];
+		if (nID == 0)
+		{	// Not found - add string.
+			if (m_nNumStrings >= BINLOG_MAX_STRINGS)
+				return -1;
+			nID = ++m_nNumStrings;
+			memcpy(m_szStrings[nID - 1], sz, nLen);
+			m_szStrings[nID - 1][nLen] = 0;
+			m_narrHash[i] = (unsigned short)nID;
+			*pfNew = true;
+			return nID;
+		}
+		if (memcmp(m_szStrings[nID - 1], sz, nLen) == 0 && m_szStrings[nID - 1][nLen] == 0)
+			return nID;
+	}
+}
+
+int CBinLogWriter::PutStrRef(unsigned char *pBuf, const char *sz, int nLen, int nID)
+{
+	if (nID >= 0)
+		return BinLogPutVarint(pBuf, (unsigned long long)nID << 1);
+	int nPos = BinLogPutVarint(pBuf, ((unsigned long long)nLen << 1) | 1);
+	memcpy(pBuf + nPos, sz, nLen);
+	return nPos + nLen;
+}
+
+int CBinLogWriter::EncodeRecord(const BINLOG_FIELDS *pFields, unsigned char *pBuf, int nBufSize,
+	unsigned char *pIdx, int nIdxSize, int *pnIdxLen)
+{
+	const char *szarrRef[3] = { pFields->szLevel, pFields->szModule, pFields->szEvent };
+	const char *szDesc = pFields->szDescription ? pFields->szDescription : "";
+	const char *szNotes = pFields->szNotes ? pFields->szNotes : "";
+	int narrLen[3], narrID[3];
+	int nDescLen = (int)strlen(szDesc), nNotesLen = (int)strlen(szNotes);
+
+	int nNeeded = nDescLen + nNotesLen + 64, nIdxNeeded = BINLOG_IDX_BLOCK_SIZE + 32;
+	for (int i = 0; i < 3; i++)
+	{
+		if (!szarrRef[i])
+			szarrRef[i] = "";
+		narrLen[i] = (int)strlen(szarrRef[i]);
+		nNeeded += narrLen[i] * 2 + 32;
+		nIdxNeeded += narrLen[i] + 16;
+	}
+	*pnIdxLen = 0;
+	if (nBufSize < nNeeded || nIdxSize < nIdxNeeded)
+		return 0;
+
+	// Definitions of new interned strings go first (to data and index file).
+	int nPos = 0, nIdxPos = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		bool fNew;
+		narrID[i] = Intern(szarrRef[i], narrLen[i], &fNew);
+		if (!fNew)
+			continue;
+		unsigned char def[BINLOG_MAX_STRING_LEN + 16];
+		int nDefLen = BinLogPutVarint(def, narrID[i]);
+		nDefLen += BinLogPutVarint(def + nDefLen, narrLen[i]);
+		memcpy(def + nDefLen, szarrRef[i], narrLen[i]);
+		nDefLen += narrLen[i];
+
+		pBuf[nPos++] = BINLOG_REC_STRING;
+		nPos += BinLogPutVarint(pBuf + nPos, nDefLen);
+		memcpy(pBuf + nPos, def, nDefLen);
+		nPos += nDefLen;
+
+		pIdx[nIdxPos++] = BINLOG_IDX_STRING;
+		memcpy(pIdx + nIdxPos, def, nDefLen);
+		nIdxPos += nDefLen;
+	}
+
+	// Record body is built after a gap for the record header, then moved in place.
+	unsigned char *pBody = pBuf + nPos + 12;
+	int nBody = 0;
+	nBody += BinLogPutVarint(pBody + nBody, (unsigned long long)pFields->tLocal);
+	nBody += BinLogPutVarint(pBody + nBody, pFields->nThreadID);
+	for (int i = 0; i < 3; i++)
+		nBody += PutStrRef(pBody + nBody, szarrRef[i], narrLen[i], narrID[i]);
+	unsigned long long nRecID = 0;
+	bool fIsRecID = BinLogIsRecordID(szDesc, &nRecID);
+	nBody += BinLogPutVarint(pBody + nBody, fIsRecID ? BINLOG_FLAG_RECID : 0);
+	if (fIsRecID)
+		nBody += BinLogPutVarint(pBody + nBody, nRecID);
+	else
+	{
+		nBody += BinLogPutVarint(pBody + nBody, nDescLen);
+		memcpy(pBody + nBody, szDesc, nDescLen);
+		nBody += nDescLen;
+	}
+	nBody += BinLogPutVarint(pBody + nBody, nNotesLen);
+	memcpy(pBody + nBody, szNotes, nNotesLen);
+	nBody += nNotesLen;
+
+	int nRecStart = nPos;
+	pBuf[nPos++] = BINLOG_REC_LOG;
+	nPos += BinLogPutVarint(pBuf + nPos, nBody);
+	memmove(pBuf + nPos, pBody, nBody);
+	nPos += nBody;
+
+	// Update current index block.
+	if (m_sBlock.nRecords == 0)
+	{
+		m_sBlock.nOffset = m_nFileOffset + nRecStart;
+		m_sBlock.tFirst = m_sBlock.tLast = pFields->tLocal;
+	}
+	if (pFields->tLocal < m_sBlock.tFirst)
+		m_sBlock.tFirst = pFields->tLocal;
+	if (pFields->tLocal > m_sBlock.tLast)
+		m_sBlock.tLast = pFields->tLocal;
+	if (fIsRecID)
+	{
+		if (nRecID < m_sBlock.nMinRecID)
+			m_sBlock.nMinRecID = nRecID;
+		if (nRecID > m_sBlock.nMaxRecID)
+			m_sBlock.nMaxRecID = nRecID;
+	}
+	if (narrID[0] >= 0)
+		m_sBlock.nLevelMask |= 1u << (narrID[0] & 31);
+	else m_sBlock.nLevelMask = ~0u;			// Literal - block can't be skipped by level.
+	if (narrID[1] >= 0)
+		m_sBlock.nModuleMask |= 1ULL << (narrID[1] & 63);
+	else m_sBlock.nModuleMask = ~0ULL;
+	m_sBlock.nRecords++;
+	m_nFileOffset += nPos;
+	m_sBlock.nLength = (unsigned int)(m_nFileOffset - m_sBlock.nOffset);
+
+	if (m_sBlock.nRecords >= BINLOG_RECORDS_PER_BLOCK)
+		nIdxPos += FinishBlock(pIdx + nIdxPos, nIdxSize - nIdxPos);
+
+	*pnIdxLen = nIdxPos;
+	return nPos;
+}
+
+int CBinLogWriter::FinishBlock(unsigned char *pIdx, int nIdxSize)
+{
+	if (m_sBlock.nRecords == 0 || nIdxSize < BINLOG_IDX_BLOCK_SIZE + 1)
+		return 0;
+	pIdx[0] = BINLOG_IDX_BLOCK;
+	BinLogPutIndexBlock(pIdx + 1, &m_sBlock);
+	ResetBlock();
+	return BINLOG_IDX_BLOCK_SIZE + 1;
+}
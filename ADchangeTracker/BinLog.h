@@ -0,0 +1,114 @@
+#pragma once
+// Compact binary log format written by CLogSys when LogFormat = Binary.
+// Note - this file (and BinLog.cpp) is portable C++ and is also used by the ADlogTool
+// decoder / query tool. Do not include Windows headers here.
+//
+// Data file ("*.blog"):
+//   File header:  "ADBLOG1" + 0x00, varint version, string WorkStation, string UserName.
+//   Then records: u8 type, varint body length, body.
+//     BINLOG_REC_STRING - interned string definition: varint id, string.
+//     BINLOG_REC_LOG    - log record: varint local time (seconds since 1970, wall clock),
+//                         varint thread ID, strref level, strref module, strref event,
+//                         varint flags, description (varint EventRecordID if
+//                         BINLOG_FLAG_RECID is set, else string), string notes.
+//   string = varint length + bytes. strref = varint (id << 1) for an interned string
+//   or varint (length << 1 | 1) + bytes for a literal string. id 0 = empty string.
+//
+// Sparse index file ("*.bidx"), one per data file:
+//   u8 BINLOG_IDX_STRING, varint id, string                 - same as in data file.
+//   u8 BINLOG_IDX_BLOCK, BINLOG_INDEX_BLOCK (fixed 60 bytes) - one per block of records.
+
+#define BINLOG_MAGIC			"ADBLOG1"
+#define BINLOG_MAGIC_LEN		8
+#define BINLOG_VERSION			1
+
+#define BINLOG_REC_STRING		1
+#define BINLOG_REC_LOG			2
+
+#define BINLOG_IDX_STRING		1
+#define BINLOG_IDX_BLOCK		2
+#define BINLOG_IDX_BLOCK_SIZE	60		// Serialized size of BINLOG_INDEX_BLOCK.
+
+#define BINLOG_FLAG_RECID		1		// Description is an EventRecordID (stored as varint).
+
+#define BINLOG_MAX_STRINGS		1024	// Max interned strings per file (others are literal).
+#define BINLOG_MAX_STRING_LEN	128		// Longer strings are never interned.
+#define BINLOG_RECORDS_PER_BLOCK 256	// Records per sparse index block.
+
+#define BINLOG_HEADER_LINE \
+	"ThreadID\tLogDate\tWorkStation\tUserName\tModule\tLogLevel\tLogEvent\tDescription\tNotes\r\n"
+
+// Summary of a block of records in the data file - used to skip blocks when querying.
+typedef struct tagBinLogIndexBlock
+{
+	unsigned long long nOffset;			// Offset of first record in block.
+	unsigned int nLength;				// Bytes in block.
+	unsigned int nRecords;				// Records in block.
+	long long tFirst, tLast;			// Min and max local time in block.
+	unsigned long long nMinRecID;		// Min and max EventRecordID in block
+	unsigned long long nMaxRecID;		// (nMinRecID > nMaxRecID if none).
+	unsigned int nLevelMask;			// Bit (level id & 31) set for each level in block.
+	unsigned long long nModuleMask;		// Bit (module id & 63) set for each module in block.
+} BINLOG_INDEX_BLOCK;
+
+// Fields of one log record.
+typedef struct tagBinLogFields
+{
+	long long tLocal;					// Local wall clock time, seconds since 1970.
+	unsigned int nThreadID;
+	const char *szLevel;
+	const char *szModule;
+	const char *szEvent;
+	const char *szDescription;
+	const char *szNotes;
+} BINLOG_FIELDS;
+
+// Varint (LEB128) helpers. Get functions return 0 if buffer is too short.
+int BinLogPutVarint(unsigned char *pBuf, unsigned long long nValue);
+int BinLogGetVarint(const unsigned char *pBuf, const unsigned char *pEnd, unsigned long long *pnValue);
+void BinLogPutIndexBlock(unsigned char *pBuf, const BINLOG_INDEX_BLOCK *pBlock);
+void BinLogGetIndexBlock(const unsigned char *pBuf, BINLOG_INDEX_BLOCK *pBlock);
+
+// Returns TRUE (and the number) if sz is a plain decimal number, e.g. an EventRecordID.
+bool BinLogIsRecordID(const char *sz, unsigned long long *pnRecID);
+
+// Format local wall clock time as "YYYY-MM-DD HH:MM:SS" (szBuf must hold 20 chars).
+void BinLogFormatTime(long long tLocal, char *szBuf);
+// Parse "YYYY-MM-DD[ HH:MM:SS]" to local wall clock time. Returns false if invalid.
+bool BinLogParseTime(const char *sz, long long *ptLocal);
+
+// Encodes log records into the binary format. One object per data file.
+// Note - not thread safe, caller must serialize calls.
+class CBinLogWriter
+{
+public:
+	CBinLogWriter();
+
+	// Start a new data file. Returns length of file header written to pBuf.
+	int BeginFile(unsigned char *pBuf, int nBufSize, const char *szWorkstation, const char *szUser);
+
+	// Encode one record (preceded by definitions of any new interned strings) into pBuf.
+	// Index data (new strings and completed blocks) is written to pIdx, *pnIdxLen = its length.
+	// Returns length written to pBuf or 0 if pBuf or pIdx is too small.
+	// pBuf should be at least 4 * total length of strings + 64 bytes,
+	// pIdx at least 3 * total length of strings + BINLOG_IDX_BLOCK_SIZE + 32 bytes.
+	int EncodeRecord(const BINLOG_FIELDS *pFields, unsigned char *pBuf, int nBufSize,
+		unsigned char *pIdx, int nIdxSize, int *pnIdxLen);
+
+	// Write index entry for the last (partial) block, e.g. when the file is closed.
+	// Returns length written to pIdx.
+	int FinishBlock(unsigned char *pIdx, int nIdxSize);
+
+protected:
+	int Intern(const char *sz, int nLen, bool *pfNew);
+	int PutStrRef(unsigned char *pBuf, const char *sz, int nLen, int nID);
+	void ResetBlock();
+
+	unsigned long long m_nFileOffset;
+	BINLOG_INDEX_BLOCK m_sBlock;
+
+	// Interned strings - open addressing hash table of ids, strings stored in m_szStrings.
+	int m_nNumStrings;
+	unsigned short m_narrHash[BINLOG_MAX_STRINGS * 2];
+	char m_szStrings[BINLOG_MAX_STRINGS][BINLOG_MAX_STRING_LEN + 1];
+};
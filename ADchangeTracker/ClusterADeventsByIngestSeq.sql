@@ -0,0 +1,32 @@
+-- Optional: cluster ADevents on an ever-increasing ingest sequence.
+-- Run once on an existing AD_DW database while the ADchangeTracker services are
+-- stopped (the table is rebuilt).
+--
+-- By default ADevents is clustered on EventTime. Events from several DCs, and
+-- events replayed after a DC reconnects to SQL, arrive out of time order and
+-- cause page splits in the middle of the clustered index. With this option new
+-- rows are always appended at the end of the clustered index on [IngestSeq].
+-- [EventTime] is kept as a nonclustered index that covers the report queries
+-- (usp_GetADevents), so reports do not need key lookups.
+--
+-- Use BenchmarkIngest.sql before and after on a test copy of AD_DW to compare
+-- insert throughput and fragmentation.
+
+USE [AD_DW]
+GO
+ALTER TABLE [dbo].[ADevents] ADD [IngestSeq] [bigint] IDENTITY(1,1) NOT NULL
+GO
+DROP INDEX [IX_EventTime] ON [dbo].[ADevents]
+GO
+CREATE UNIQUE CLUSTERED INDEX [CIX_ADevents_IngestSeq] ON [dbo].[ADevents]
+(
+	[IngestSeq] ASC
+)WITH (PAD_INDEX = OFF, STATISTICS_NORECOMPUTE = OFF, SORT_IN_TEMPDB = OFF, DROP_EXISTING = OFF, ONLINE = OFF, ALLOW_ROW_LOCKS = ON, ALLOW_PAGE_LOCKS = ON, FILLFACTOR = 100) ON [PRIMARY]
+GO
+CREATE NONCLUSTERED INDEX [IX_EventTime] ON [dbo].[ADevents]
+(
+	[EventTime] ASC
+)
+INCLUDE ([SourceDC], [EventRecordID], [EventID], [ObjClass], [Target], [Changes], [ModifiedBy])
+WITH (PAD_INDEX = OFF, STATISTICS_NORECOMPUTE = OFF, SORT_IN_TEMPDB = OFF, DROP_EXISTING = OFF, ONLINE = OFF, ALLOW_ROW_LOCKS = ON, ALLOW_PAGE_LOCKS = ON, FILLFACTOR = 90) ON [PRIMARY]
+GO
@@ -21,6 +21,11 @@ USE [AD_DW]
 GO
 GRANT EXECUTE ON [dbo].[usp_GetADevents] TO [DOMAIN\SG-ADreports]
 GO
+USE [AD_DW]
+GO
+-- Run after ADeventSummary.sql.
+GRANT EXECUTE ON [dbo].[usp_GetADeventSummary] TO [DOMAIN\SG-ADreports]
+GO
 
 
 USE [master]
@@ -39,5 +44,8 @@ GRANT EXECUTE ON [dbo].[usp_ADchgEventEx] TO [DOMAIN\ad_audit]
 GO
 GRANT EXECUTE ON [dbo].[usp_CheckConnection] TO [DOMAIN\ad_audit]
 GO
+-- Run after IngestStaging.sql (only needed when StagedIngest = ON).
+GRANT EXECUTE ON [dbo].[usp_ADchgEventStage] TO [DOMAIN\ad_audit]
+GO
 
 
@@ -0,0 +1,345 @@
+// Event fields and filter - see EventFilter.h.
+// Note - portable C++, compiled without precompiled header.
+#include "EventFilter.h"
+#include <string.h>
+
+// SSE2 search in GetRawEventFields (always there on x64 and with /arch:SSE2 on x86).
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FILTER_SIMD
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+using namespace pugi;
+
+static const char_t *s_szarrQueryPaths[QUERY_COUNT] = {
+	PUGIXML_TEXT("//Data[@Name='ObjectClass']/text()") };
+static xpath_query *s_parrQueries[QUERY_COUNT];
+static bool s_fQueriesCompiled;
+
+// Paths of ScanEventFields - same fields as GetEventFields.
+enum SCAN_FIELD
+{
+	SCAN_EVENTRECORDID = 0,
+	SCAN_EVENTID,
+	SCAN_COMPUTER,
+	SCAN_TIMECREATED,
+	SCAN_OBJCLASS,
+	SCAN_FIELD_COUNT
+};
+static const char *s_szarrScanPaths[SCAN_FIELD_COUNT] = { "/Event/System/EventRecordID",
+	"/Event/System/EventID", "/Event/System/Computer", "/Event/System/TimeCreated/@SystemTime",
+	"/Event/EventData/Data[@Name='ObjectClass']" };
+
+// Decimal number at start of sz (0 if none). Works for char and wchar_t strings.
+static unsigned long long ToNumber(const char_t *sz)
+{
+	unsigned long long n = 0;
+	for (; *sz >= '0' && *sz <= '9'; sz++)
+		n = n * 10 + (*sz - '0');
+	return n;
+}
+
+// Rule field System/<element>, others are EventData Data names.
+static bool IsSystemField(const char_t *szField)
+{
+	static const char_t s_szSystem[] = PUGIXML_TEXT("System/");
+	for (int i = 0; s_szSystem[i]; i++)
+	{
+		if (szField[i] != s_szSystem[i])
+			return false;
+	}
+	return true;
+}
+
+bool CompileEventQueries()
+{
+	if (s_fQueriesCompiled)
+		return s_parrQueries[0] != NULL;
+	s_fQueriesCompiled = true;
+	for (int i = 0; i < QUERY_COUNT; i++)
+	{
+		try
+		{
+			s_parrQueries[i] = new xpath_query(s_szarrQueryPaths[i]);
+		}
+		catch (...)		// xpath_exception (bad path) or out of memory.
+		{
+			for (int j = 0; j < i; j++)
+			{
+				delete s_parrQueries[j];
+				s_parrQueries[j] = NULL;
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+const char_t *GetEventQueryPath(EVENT_QUERY query)
+{
+	return s_szarrQueryPaths[query];
+}
+
+const xpath_query *GetEventQuery(EVENT_QUERY query)
+{
+	return s_parrQueries[query];
+}
+
+static xpath_node SelectNode(const xml_document &doc, EVENT_QUERY query)
+{
+	if (s_parrQueries[query])
+		return doc.select_node(*s_parrQueries[query]);
+	return doc.select_node(s_szarrQueryPaths[query]);
+}
+
+void GetEventFields(const CEventFilter &filter, const xml_document &doc, EVENT_FIELDS &fields)
+{
+	xml_node event = doc.child(PUGIXML_TEXT("Event"));
+	xml_node system = event.child(PUGIXML_TEXT("System"));
+	fields.szEventRecordID = system.child(PUGIXML_TEXT("EventRecordID")).child_value();
+	fields.nEventRecordID = ToNumber(fields.szEventRecordID);
+	fields.nEventID = (int)ToNumber(system.child(PUGIXML_TEXT("EventID")).child_value());
+	fields.szComputer = system.child(PUGIXML_TEXT("Computer")).child_value();
+	fields.szTimeCreated = system.child(PUGIXML_TEXT("TimeCreated"))
+		.attribute(PUGIXML_TEXT("SystemTime")).value();
+
+	xpath_node objclass = SelectNode(doc, QUERY_OBJCLASS);
+	fields.szObjClass = objclass ? objclass.node().value() : PUGIXML_TEXT("");
+
+	// Rule fields - System/<element> or EventData Data with Name.
+	const CDropRules &rules = filter.GetDropRules();
+	unsigned int nFieldMask = rules.GetFieldMask(fields.nEventID);
+	xml_node eventData = event.child(PUGIXML_TEXT("EventData"));
+	for (int i = 0; i < RULE_MAX_FIELDS; i++)
+	{
+		fields.szarrRuleFields[i] = NULL;
+		if (!(nFieldMask & (1u << i)))
+			continue;
+		const char_t *szField = rules.GetField(i);
+		xml_node node = IsSystemField(szField) ? system.child(szField + 7)
+			: eventData.find_child_by_attribute(PUGIXML_TEXT("Data"), PUGIXML_TEXT("Name"), szField);
+		if (node)
+			fields.szarrRuleFields[i] = node.child_value();
+	}
+}
+
+// ObjectClass is only used for events 5136...5141 (IgnoredEvents) and rule fields only for
+// EventIDs with rules - for other events the scan ends at Computer, the last System field.
+static unsigned int OnScanValue(int nPath, const char_t *szValue, void *pContext)
+{
+	if (nPath != SCAN_EVENTID)
+		return 0;
+	const CEventFilter *pFilter = (const CEventFilter *)pContext;
+	unsigned long long nEventID = ToNumber(szValue);
+	unsigned int nFieldMask = pFilter->GetDropRules().GetFieldMask((int)nEventID), nSkip = 0;
+	if (nEventID < 5136 || nEventID > 5141)
+		nSkip |= 1u << SCAN_OBJCLASS;
+	for (int i = 0; i < pFilter->GetDropRules().GetNumFields(); i++)
+	{
+		if (!(nFieldMask & (1u << i)) && pFilter->GetFieldPath(i) >= 0)
+			nSkip |= 1u << pFilter->GetFieldPath(i);
+	}
+	return nSkip;
+}
+
+bool ScanEventFields(const CEventFilter &filter, const unsigned short *pXML, size_t nChars,
+	EVENT_FIELDS &fields, SCAN_RESULT &scan)
+{
+	if (!filter.GetScanner().Scan(pXML, nChars, scan, OnScanValue, (void *)&filter))
+		return false;
+	const char_t **pszarrValues = scan.szarrValues;
+	for (int i = 0; i < SCAN_FIELD_COUNT; i++)
+	{
+		if (!pszarrValues[i])
+			pszarrValues[i] = PUGIXML_TEXT("");
+	}
+	fields.szEventRecordID = pszarrValues[SCAN_EVENTRECORDID];
+	fields.nEventRecordID = ToNumber(fields.szEventRecordID);
+	fields.nEventID = (int)ToNumber(pszarrValues[SCAN_EVENTID]);
+	fields.szComputer = pszarrValues[SCAN_COMPUTER];
+	fields.szTimeCreated = pszarrValues[SCAN_TIMECREATED];
+	fields.szObjClass = pszarrValues[SCAN_OBJCLASS];
+
+	unsigned int nFieldMask = filter.GetDropRules().GetFieldMask(fields.nEventID);
+	for (int i = 0; i < RULE_MAX_FIELDS; i++)
+	{
+		fields.szarrRuleFields[i] = NULL;
+		if (!(nFieldMask & (1u << i)))
+			continue;
+		if (filter.GetFieldPath(i) < 0)
+			return false;	// Field is not scanned.
+		fields.szarrRuleFields[i] = pszarrValues[filter.GetFieldPath(i)];
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Prefilter on the rendered event.
+
+static bool IsTagAt(const unsigned short *p, const char *szTag, size_t nLen)
+{
+	for (size_t i = 0; i < nLen; i++)
+	{
+		if (p[i] != (unsigned char)szTag[i])
+			return false;
+	}
+	return true;
+}
+
+#ifdef FILTER_SIMD
+static unsigned int FirstBit(unsigned int nMask)
+{
+#ifdef _MSC_VER
+	unsigned long nIndex;
+	_BitScanForward(&nIndex, nMask);
+	return nIndex;
+#else
+	return (unsigned int)__builtin_ctz(nMask);
+#endif
+}
+#endif
+
+// First szTag (ASCII, nLen characters) in [p, pEnd) - NULL if not found. 8 positions per step:
+// candidates are where first and last character of szTag match, these are then compared.
+static const unsigned short *FindTag(const unsigned short *p, const unsigned short *pEnd,
+	const char *szTag, size_t nLen)
+{
+#ifdef FILTER_SIMD
+	const __m128i first = _mm_set1_epi16((short)szTag[0]);
+	const __m128i last = _mm_set1_epi16((short)szTag[nLen - 1]);
+	for (; pEnd - p >= (ptrdiff_t)(nLen - 1 + 8); p += 8)
+	{
+		__m128i eqFirst = _mm_cmpeq_epi16(first, _mm_loadu_si128((const __m128i *)p));
+		__m128i eqLast = _mm_cmpeq_epi16(last, _mm_loadu_si128((const __m128i *)(p + nLen - 1)));
+		unsigned int nMask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(eqFirst, eqLast));
+		while (nMask)
+		{
+			unsigned int i = FirstBit(nMask) / 2;
+			if (IsTagAt(p + i, szTag, nLen))
+				return p + i;
+			nMask &= ~(3u << (i * 2));		// 2 mask bits per character.
+		}
+	}
+#endif
+	for (; pEnd - p >= (ptrdiff_t)nLen; p++)
+	{
+		if (IsTagAt(p, szTag, nLen))
+			return p;
+	}
+	return NULL;
+}
+
+// Decimal number of element text at p (up to '<'). Returns position of '<' or NULL.
+static const unsigned short *ParseNumber(const unsigned short *p, const unsigned short *pEnd,
+	unsigned long long &n)
+{
+	const unsigned short *pStart = p;
+	n = 0;
+	for (; p < pEnd && *p >= '0' && *p <= '9'; p++)
+		n = n * 10 + (*p - '0');
+	if (p == pStart || p - pStart > 19 || p == pEnd || *p != '<')
+		return NULL;
+	return p;
+}
+
+// Text up to cEnd - NULL if not found or if text has an entity or markup.
+static const unsigned short *ParseText(const unsigned short *p, const unsigned short *pEnd,
+	unsigned short cEnd, size_t &nLen)
+{
+	const unsigned short *pStart = p;
+	for (; p < pEnd && *p != cEnd; p++)
+	{
+		if (*p == '&' || *p == '<')
+			return NULL;
+	}
+	if (p == pEnd)
+		return NULL;
+	nLen = p - pStart;
+	return p;
+}
+
+bool GetRawEventFields(const unsigned short *pXML, size_t nChars, RAW_EVENT_FIELDS &fields)
+{
+	// Fields are searched in the order of EvtRender and only in the System element.
+	const unsigned short *pEnd = FindTag(pXML, pXML + nChars, "</System>", 9);
+	if (!pEnd)
+		return false;
+
+	unsigned long long n;
+	const unsigned short *p = FindTag(pXML, pEnd, "<EventID", 8);
+	if (!p || (p[8] != '>' && p[8] != ' '))
+		return false;
+	for (p += 8; p < pEnd && *p != '>'; p++)	// Qualifiers='...'
+		;
+	if (p == pEnd || !(p = ParseNumber(p + 1, pEnd, n)) || n > 65535)
+		return false;
+	fields.nEventID = (int)n;
+
+	if (!(p = FindTag(p, pEnd, "<TimeCreated SystemTime=", 24)))
+		return false;
+	p += 24;
+	unsigned short cQuote = *p++;
+	if ((cQuote != '\'' && cQuote != '"') || !(fields.pTimeCreated = p)
+		|| !(p = ParseText(p, pEnd, cQuote, fields.nTimeCreatedLen)))
+		return false;
+
+	if (!(p = FindTag(p, pEnd, "<EventRecordID>", 15)) || !(p = ParseNumber(p + 15, pEnd, n)))
+		return false;
+	fields.nEventRecordID = n;
+
+	if (!(p = FindTag(p, pEnd, "<Computer>", 10)))
+		return false;
+	fields.pComputer = p + 10;
+	return ParseText(fields.pComputer, pEnd, '<', fields.nComputerLen) != NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+CEventFilter::CEventFilter()
+{
+	CFilterRules none;
+	Compile(none);
+}
+
+void CEventFilter::Compile(const CFilterRules &rules)
+{
+	memset(m_narrAccepted, 0, sizeof(m_narrAccepted));
+	const std::vector<int> &accepted = rules.GetAcceptedEventIDs();
+	for (size_t i = 0; i < accepted.size(); i++)
+	{
+		unsigned int nEventID = (unsigned int)accepted[i];
+		if (nEventID < FILTER_EVENTID_COUNT)
+			m_narrAccepted[nEventID >> 5] |= 1u << (nEventID & 31);
+	}
+	m_dropRules.Compile(rules);
+
+	// Scan paths - a field with a name that is not ASCII or does not fit in a path is not
+	// scanned (events with rules that test it are parsed).
+	m_scanner.Clear();
+	for (int i = 0; i < SCAN_FIELD_COUNT; i++)
+		m_scanner.AddPath(s_szarrScanPaths[i]);
+	for (int i = 0; i < RULE_MAX_FIELDS; i++)
+	{
+		m_narrFieldPaths[i] = -1;
+		if (i >= m_dropRules.GetNumFields())
+			continue;
+		const char_t *szField = m_dropRules.GetField(i);
+		bool fSystem = IsSystemField(szField);
+		std::string strPath(fSystem ? "/Event/System/" : "/Event/EventData/Data[@Name='");
+		const char_t *p = fSystem ? szField + 7 : szField;
+		for (; *p; p++)
+		{
+			if (*p < 0x21 || *p > 0x7E || *p == '\'' || *p == '"')
+				break;
+			strPath += (char)*p;
+		}
+		if (*p)
+			continue;
+		if (!fSystem)
+			strPath += "']";
+		m_narrFieldPaths[i] = m_scanner.AddPath(strPath.c_str());
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+// Event fields and accept / ignore filter used by FilterAndSendEventToSql.
+// Note - this file (and EventFilter.cpp) is portable C++ and is also used by PipelineBench.
+// Do not include Windows headers here.
+// Strings are pugi::char_t - wchar_t (UTF-16) in the service, which is built with
+// PUGIXML_WCHAR_MODE so events from EvtRender are parsed without conversion to UTF-8.
+#include "pugixml.hpp"
+#include "EventScanner.h"
+#include "FilterRules.h"
+
+#define FILTER_EVENTID_COUNT	65536	// EventIDs are 16-bit.
+#define FILTER_OBJCLASS_LEN		128
+
+class CEventFilter;
+
+// Fields of one event. Strings point into the XML document (empty if not in event).
+typedef struct tagEventFields
+{
+	const pugi::char_t *szEventRecordID;
+	unsigned long long nEventRecordID;	// 0 if not in event.
+	int nEventID;						// 0 if not in event.
+	const pugi::char_t *szComputer;		// SourceDC.
+	const pugi::char_t *szTimeCreated;	// TimeCreated/@SystemTime.
+	const pugi::char_t *szObjClass;		// EventData ObjectClass (5136...5141 events).
+	// Fields drop rules test (CDropRules::GetField) - NULL if not in event or no rule for the
+	// EventID tests the field.
+	const pugi::char_t *szarrRuleFields[RULE_MAX_FIELDS];
+} EVENT_FIELDS;
+
+// Fields found by XPath (EventData values) - query paths in EventFilter.cpp.
+enum EVENT_QUERY
+{
+	QUERY_OBJCLASS = 0,		// EventData ObjectClass.
+	QUERY_COUNT
+};
+
+// Compile the XPath queries of GetEventFields once; they are shared by all threads
+// (evaluation of a compiled query is const). Call at startup before any thread has a parse
+// context (CXmlParseContext::GetForThread) - compiled queries must be in heap memory, not in
+// a thread's arena. Later calls do nothing. Returns false if a query did not compile
+// (GetEventFields then evaluates the query path as before).
+bool CompileEventQueries();
+const pugi::char_t *GetEventQueryPath(EVENT_QUERY query);
+const pugi::xpath_query *GetEventQuery(EVENT_QUERY query);	// NULL if not compiled.
+
+// Rule fields are the fields of filter's drop rules.
+void GetEventFields(const CEventFilter &filter, const pugi::xml_document &doc, EVENT_FIELDS &fields);
+
+// Fields of the event without parsing it (CEventScanner of filter): the scan stops when all
+// fields are found and skips elements that have none (RenderingInfo, EventData not tested).
+// ObjectClass is only got for events 5136...5141 (empty for others), rule fields only for
+// EventIDs with rules that test them. Strings point into scan. Returns false if the event
+// could not be scanned - then parse it and use GetEventFields.
+bool ScanEventFields(const CEventFilter &filter, const unsigned short *pXML, size_t nChars,
+	EVENT_FIELDS &fields, SCAN_RESULT &scan);
+
+// System fields of an event found in the rendered XML (UTF-16, as from EvtRender) without
+// parsing it. Strings point into the XML and are not terminated.
+typedef struct tagRawEventFields
+{
+	unsigned long long nEventRecordID;
+	int nEventID;
+	const unsigned short *pComputer;		// SourceDC.
+	size_t nComputerLen;
+	const unsigned short *pTimeCreated;		// TimeCreated/@SystemTime.
+	size_t nTimeCreatedLen;
+} RAW_EVENT_FIELDS;
+
+// Prefilter: find EventID (also with Qualifiers attribute), TimeCreated, EventRecordID and
+// Computer in the System element of the rendered event with a SIMD search - so events that are
+// not accepted need no XML parse. Returns false if the event is not in the layout EvtRender
+// writes (or a field has an entity) - then parse the event and use GetEventFields.
+bool GetRawEventFields(const unsigned short *pXML, size_t nChars, RAW_EVENT_FIELDS &fields);
+
+// Accept / drop filter compiled from CFilterRules: a bit per EventID for accepted EventIDs and
+// the drop rules (CDropRules), so the check of an event is constant time however many
+// EventIDs and rules there are. Also has the scanner of ScanEventFields (its paths depend on
+// the fields rules test). Compile once (at startup), then the filter is only read and can be
+// used by any number of threads.
+class CEventFilter
+{
+public:
+	CEventFilter();		// Accepts no events.
+
+	void Compile(const CFilterRules &rules);
+
+	bool IsAccepted(int nEventID) const
+	{
+		return (unsigned int)nEventID < FILTER_EVENTID_COUNT
+			&& (m_narrAccepted[nEventID >> 5] >> (nEventID & 31)) & 1;
+	}
+	// Index of drop rule (in CFilterRules::GetDropRules) the event matches, -1 if none.
+	int FindDropRule(const EVENT_FIELDS &fields) const
+	{
+		return m_dropRules.Find(fields.nEventID, fields.szarrRuleFields);
+	}
+
+	const CDropRules &GetDropRules() const { return m_dropRules; }
+	const CEventScanner &GetScanner() const { return m_scanner; }
+	// Scan path of rule field, -1 if the field can't be scanned (event is parsed then).
+	int GetFieldPath(int nField) const { return m_narrFieldPaths[nField]; }
+
+protected:
+	unsigned int m_narrAccepted[FILTER_EVENTID_COUNT / 32];
+	CDropRules m_dropRules;
+	CEventScanner m_scanner;		// Paths: fields of EVENT_FIELDS, then rule fields.
+	int m_narrFieldPaths[RULE_MAX_FIELDS];
+};
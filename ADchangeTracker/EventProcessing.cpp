@@ -1,5 +1,5 @@
 #include "stdafx.h"
-#include "EventProcessing.h"
+#include "ADchangeTracker.h"
 #include "LogSys.h"
 
 using namespace pugi;
@@ -28,9 +28,16 @@ CEventProcessing theService;
 CEventProcessing::CEventProcessing()
 {
 	m_hSubscription = m_hBookmark = NULL;
-	memset(&m_config, 0, sizeof(m_config));
-	m_config.fIsVerboseLogging = TRUE;
+	SetDefaultConfig(m_config);
 	m_hEvent_SqlConnLost = m_hEvent_ServiceStop = NULL;
+	m_szGapFile[0] = 0;
+	m_pActive = m_pRetired = NULL;
+	m_nActiveEvents = 0;
+	m_hEvent_ConfigReload = m_hConfigChange = NULL;
+	m_szConfigFile[0] = 0;
+	memset(&m_ftConfigWrite, 0, sizeof(m_ftConfigWrite));
+	m_nReloadTick = 0;
+	RegisterMetrics();
 
 	m_hSvcStatusHandle = 0;
 	memset(&m_sSvcStatus, 0, sizeof(m_sSvcStatus));
@@ -43,7 +50,18 @@ CEventProcessing::~CEventProcessing()
 	assert(m_hSubscription == NULL
 		&& m_hBookmark == NULL
 		&& m_hEvent_SqlConnLost == NULL
-		&& m_hEvent_ServiceStop == NULL);
+		&& m_hEvent_ServiceStop == NULL
+		&& m_hEvent_ConfigReload == NULL
+		&& m_hConfigChange == NULL);
+}
+
+void CEventProcessing::SetDefaultConfig(EVENT_PROCESSING_CONFIG &config)
+{
+	memset(&config, 0, sizeof(config));
+	config.fIsVerboseLogging = TRUE;
+	config.fIsAsyncLogDropWhenFull = TRUE;
+	config.nMaxLogFileSizeMB = 100;
+	config.fIsCompressOldLogFiles = TRUE;
 }
 
 void CEventProcessing::ServiceMain()
@@ -74,7 +92,7 @@ void CEventProcessing::ServiceMain()
 		theLog.Error(MOD_NAME, "SQL connection string missing");
 		fIsInitialized = FALSE;
 	}
-	if (m_config.nNumElemAcceptedEvts == 0)
+	if (m_filterRules.GetAcceptedEventIDs().empty())
 	{
 		theLog.Warning(MOD_NAME, "List of accepted EventIDs missing", "This service will do nothing");
 		fIsInitialized = FALSE;
@@ -94,12 +112,24 @@ void CEventProcessing::ServiceMain()
 		fIsInitialized = FALSE;
 	}
 
+	// Create a event object - that will signal when config file should be reloaded.
+	if ((m_hEvent_ConfigReload = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL)
+	{
+		theLog.SysErr(MOD_NAME, "Create config reload event failed", "", GetLastError());
+		fIsInitialized = FALSE;
+	}
+
 	// Initialize SQL server connection (not connecting at this time).
 	if (!m_sqlServer.InitSqlConnection(m_config.szConnectionString))
 	{
 		theLog.Error(MOD_NAME, "Initialize SQL ADO failed");
 		fIsInitialized = FALSE;
 	}
+	m_sqlServer.SetStagedIngest(m_config.fIsStagedIngest);
+	if (m_config.fIsStagedIngest)
+	{
+		theLog.Info(MOD_NAME, "Staged ingest enabled", "Events are sent to usp_ADchgEventStage");
+	}
 
 	if (FALSE == fIsInitialized)	// Initialize failed - service can't start.
 	{
@@ -110,6 +140,38 @@ void CEventProcessing::ServiceMain()
 
 	// Set days to keep old log files (note setting kicks in next time create new log file is called).
 	theLog.SetDaysToKeepOldLogFiles(m_config.nDaysToKeepOldLogFiles);
+	theLog.SetLogRotation(m_config.nMaxLogFileSizeMB, m_config.fIsCompressOldLogFiles);
+
+	InitFilter();
+	CXmlParseContext::InstallAllocator();
+	static const char *s_szarrSimdLevels[] = { "scalar", "SSE2", "AVX2" };
+	theLog.Info(MOD_NAME, "XML text scanning", s_szarrSimdLevels[pugi::get_simd_level()]);
+	m_stats.SetInterval(m_config.nStatisticsInterval);
+	m_watermarks.SetThresholds(m_config.nLagWarningSeconds, m_config.nBacklogWarningEvents);
+
+	strcpy_s(m_szGapFile, theLog.GetLogPath());
+	strcat_s(m_szGapFile, GAP_FILE_NAME);
+
+	if (m_config.nMetricsInterval > 0 || m_config.fIsMetricsPipe)
+	{
+		char szMetricsFile[MAX_PATH];
+		strcpy_s(szMetricsFile, sizeof(szMetricsFile), theLog.GetLogPath());
+		strcat_s(szMetricsFile, sizeof(szMetricsFile), "ADchangeTracker.prom");
+		m_metricsExporter.Start(&m_metrics, szMetricsFile, m_config.nMetricsInterval,
+			m_config.fIsMetricsPipe);
+	}
+
+	if (m_config.fIsBinaryLogFormat)
+	{
+		theLog.SetBinaryLogFormat(TRUE);
+	}
+
+	if (m_config.fIsAsyncLogging)
+	{
+		theLog.StartAsyncLogging(m_config.fIsAsyncLogDropWhenFull);
+	}
+
+	StartConfigWatch();
 
 	// Report running status when initialization is complete.
 	ReportServiceStatus(SERVICE_RUNNING, NO_ERROR, 0);
@@ -123,6 +185,13 @@ void CEventProcessing::ServiceMain()
 	theLog.Info(MOD_NAME, "Service is stopping");
 
 	StopEventSubscription();
+	StopConfigWatch();
+
+	if (m_stats.IsEnabled())
+	{
+		m_stats.LogSummary();	// Events since last summary.
+	}
+	FreeConfig();
 
 	m_sqlServer.ExitConnection();
 
@@ -132,8 +201,16 @@ void CEventProcessing::ServiceMain()
 	CloseHandle(m_hEvent_ServiceStop);
 	m_hEvent_ServiceStop = NULL;
 
+	CloseHandle(m_hEvent_ConfigReload);
+	m_hEvent_ConfigReload = NULL;
+
 	CoUninitialize();
 
+	m_metricsExporter.Stop();
+
+	// Write queued log records to file before the service reports stopped.
+	theLog.StopAsyncLogging();
+
 	ReportServiceStatus(SERVICE_STOPPED, NO_ERROR, 0);
 	theLog.Info(MOD_NAME, "Service stopped");
 }
@@ -153,6 +230,13 @@ void CEventProcessing::ServiceCtrlHandler(DWORD dwCtrl)
 		SetEvent(m_hEvent_ServiceStop);
 		return;
 
+	case SERVICE_CONTROL_PARAMCHANGE:
+		theLog.Info(MOD_NAME, "SERVICE_CONTROL_PARAMCHANGE command received");
+
+		// Signal the service to reload the config file.
+		SetEvent(m_hEvent_ConfigReload);
+		return;
+
 	case SERVICE_CONTROL_INTERROGATE:
 		break;
 
@@ -175,11 +259,43 @@ void CEventProcessing::Start()
 		SetEvent(m_hEvent_SqlConnLost);
 	}
 
-	HANDLE harrEvents[2] = { m_hEvent_ServiceStop, m_hEvent_SqlConnLost };
-	DWORD dwNumEvents = sizeof(harrEvents) / sizeof(HANDLE);
+	// Note - m_hEvent_SqlConnLost is last: it stays signaled until SQL connection regained and
+	// WaitForMultipleObjects returns the first signaled handle.
+	HANDLE harrEvents[4] = { m_hEvent_ServiceStop, m_hEvent_ConfigReload };
+	DWORD dwNumEvents = 2, dwConfigChange = WAIT_TIMEOUT;
+	if (m_hConfigChange)
+	{
+		dwConfigChange = WAIT_OBJECT_0 + dwNumEvents;
+		harrEvents[dwNumEvents++] = m_hConfigChange;
+	}
+	DWORD dwSqlConnLost = WAIT_OBJECT_0 + dwNumEvents;
+	harrEvents[dwNumEvents++] = m_hEvent_SqlConnLost;
 	while (TRUE)
 	{
-		DWORD dwWaitResult = WaitForMultipleObjects(dwNumEvents, harrEvents, FALSE, INFINITE);
+		// Note - wakes up when the next event statistics summary (if statistics on),
+		// watermark check, EventRecordID range file save or config reload is due.
+		DWORD dwTimeout = m_stats.LogSummaryIfDue();
+		DWORD dwWatermarkTimeout = m_watermarks.CheckIfDue();
+		if (dwWatermarkTimeout < dwTimeout)
+			dwTimeout = dwWatermarkTimeout;
+		DWORD dwGapTimeout = m_gaps.SaveIfDue(m_szGapFile);
+		if (dwGapTimeout < dwTimeout)
+			dwTimeout = dwGapTimeout;
+		FreeRetiredConfig();
+		if (m_pRetired && dwTimeout > 1000)
+			dwTimeout = 1000;	// Check again for events in flight.
+		if (m_nReloadTick)
+		{
+			ULONGLONG nNow = GetTickCount64();
+			if (nNow >= m_nReloadTick)
+			{
+				m_nReloadTick = 0;
+				ReloadConfig();
+			}
+			else if (m_nReloadTick - nNow < dwTimeout)
+				dwTimeout = (DWORD)(m_nReloadTick - nNow);
+		}
+		DWORD dwWaitResult = WaitForMultipleObjects(dwNumEvents, harrEvents, FALSE, dwTimeout);
 
 		// Check whether to stop the service.
 		if (dwWaitResult == WAIT_OBJECT_0)
@@ -189,8 +305,18 @@ void CEventProcessing::Start()
 			break;	// Stop the service.
 		}
 
-		// m_hEvent_SqlConnLost event is in signaled state until SQL connection regained.
 		if (dwWaitResult == (WAIT_OBJECT_0 + 1))
+		{
+			// SERVICE_CONTROL_PARAMCHANGE - reload now.
+			m_nReloadTick = GetTickCount64();
+		}
+		else if (dwWaitResult == dwConfigChange)
+		{
+			CheckConfigFileChange();
+		}
+
+		// m_hEvent_SqlConnLost event is in signaled state until SQL connection regained.
+		if (dwWaitResult == dwSqlConnLost)
 		{
 			// Stop event subscription - (if needed).
 			StopEventSubscription();
@@ -210,6 +336,119 @@ void CEventProcessing::Start()
 	}	// endof while loop
 }
 
+BOOL CEventProcessing::Replay(const TCHAR *szFile)
+{
+	theLog.Info(MOD_NAME, "Replay started");
+	BOOL fReturn = FALSE;
+	FILE *pFile = NULL;
+	char *pLine = NULL;
+	LPWSTR pXML = NULL;
+	BSTR bstrXML = NULL;
+	ULONGLONG nEvents = 0, nSkipped = 0;
+	ULONGLONG nStartTick = GetTickCount64(), nLastReportTick = nStartTick;
+	BOOL fTooLong = FALSE;	// TRUE while skipping rest of a line longer than buffer.
+
+	CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+	if (!m_sqlServer.InitSqlConnection(m_config.szConnectionString) || !m_sqlServer.OpenSqlConnection())
+	{
+		printf("Connect to SQL failed - see log file.\n");
+		goto cleanup;
+	}
+	m_sqlServer.SetStagedIngest(m_config.fIsStagedIngest);
+	InitFilter();
+	CXmlParseContext::InstallAllocator();
+	m_stats.SetInterval(m_config.nStatisticsInterval);
+
+	if (_tcscmp(szFile, L"-") == 0)
+		pFile = stdin;
+	else if (_tfopen_s(&pFile, szFile, L"rb") != 0)
+	{
+		theLog.SysErr(MOD_NAME, "Open replay file failed", "", GetLastError());
+		printf("Can't open %S\n", szFile);
+		pFile = NULL;
+		goto cleanup;
+	}
+	pLine = (char *)malloc(REPLAY_MAX_EVENT_SIZE);
+	pXML = (LPWSTR)malloc(REPLAY_MAX_EVENT_SIZE * sizeof(WCHAR));
+	if (!pLine || !pXML)
+	{
+		theLog.Error(MOD_NAME, "malloc failed in function Replay");
+		goto cleanup;
+	}
+
+	while (fgets(pLine, REPLAY_MAX_EVENT_SIZE, pFile))
+	{
+		size_t nLen = strlen(pLine);
+		BOOL fEndOfLine = nLen && pLine[nLen - 1] == '\n';
+		if (fTooLong || (!fEndOfLine && nLen == REPLAY_MAX_EVENT_SIZE - 1))
+		{
+			if (!fTooLong)
+				nSkipped++;
+			fTooLong = !fEndOfLine;
+			continue;
+		}
+		while (nLen && (pLine[nLen - 1] == '\n' || pLine[nLen - 1] == '\r'))
+			pLine[--nLen] = 0;
+		if (!nLen)
+			continue;
+
+		int nChars = MultiByteToWideChar(CP_UTF8, 0, pLine, (int)nLen + 1, pXML, REPLAY_MAX_EVENT_SIZE);
+		if (!nChars)
+		{
+			nSkipped++;
+			continue;
+		}
+		// Note - nChars includes terminating zero.
+		bstrXML = SysAllocStringLen(pXML, nChars - 1);
+		if (!bstrXML)
+		{
+			theLog.Error(MOD_NAME, "SysAllocStringLen failed in function Replay");
+			goto cleanup;
+		}
+		FilterAndSendEventToSql(bstrXML);
+		SysFreeString(bstrXML);
+		bstrXML = NULL;
+		nEvents++;
+		if (m_sqlServer.IsSqlConnectionLost())
+		{
+			printf("SQL connection lost - see log file.\n");
+			goto cleanup;
+		}
+
+		m_stats.LogSummaryIfDue();
+		ULONGLONG nNow = GetTickCount64();
+		if (nNow - nLastReportTick >= 10000)
+		{
+			printf("%llu events, %.0f events/s\n", nEvents, nEvents * 1000.0 / (nNow - nStartTick));
+			nLastReportTick = nNow;
+		}
+	}
+	fReturn = TRUE;
+
+cleanup:
+	ULONGLONG nMs = GetTickCount64() - nStartTick;
+	printf("Replayed %llu events in %.1f s (%.0f events/s): sent %llu, failed %llu, ignored %llu, "
+		"not accepted %llu, skipped (bad or too long) %llu\n", nEvents, nMs / 1000.0,
+		nMs ? nEvents * 1000.0 / nMs : 0.0, m_parrEventCounter[EVT_RESULT_SENT]->Get(),
+		m_parrEventCounter[EVT_RESULT_FAILED]->Get(), m_parrEventCounter[EVT_RESULT_IGNORED]->Get(),
+		m_parrEventCounter[EVT_RESULT_NOT_ACCEPTED]->Get(), nSkipped);
+	if (m_stats.IsEnabled())
+	{
+		m_stats.LogSummary();
+	}
+	FreeConfig();
+	if (pFile && pFile != stdin)
+		fclose(pFile);
+	if (pLine)
+		free(pLine);
+	if (pXML)
+		free(pXML);
+	m_sqlServer.ExitConnection();
+	CoUninitialize();
+	theLog.Info(MOD_NAME, "Replay ended");
+	return fReturn;
+}
+
 //   Sets the current service status and reports it to the SCM.
 // Parameters:
 //   dwCurrentState - The current state (see SERVICE_STATUS)
@@ -225,7 +464,7 @@ void CEventProcessing::ReportServiceStatus(DWORD dwCurrentState,
 
 	if (dwCurrentState == SERVICE_START_PENDING)
 		m_sSvcStatus.dwControlsAccepted = 0;
-	else m_sSvcStatus.dwControlsAccepted = SERVICE_ACCEPT_STOP;
+	else m_sSvcStatus.dwControlsAccepted = SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_PARAMCHANGE;
 
 	if ((dwCurrentState == SERVICE_RUNNING) || (dwCurrentState == SERVICE_STOPPED))
 		m_sSvcStatus.dwCheckPoint = 0;
@@ -244,6 +483,9 @@ BOOL CEventProcessing::StartEventSubscription()
 
 	DWORD status = ERROR_SUCCESS;
 	LPWSTR pwsPath = L"Security";
+	// Note - all events (not only accepted EventIDs): EventRecordID gaps and watermarks are
+	// tracked for every event, and a config reload changes accepted EventIDs without a new
+	// subscription.
 	LPWSTR pwsQuery = L"*";
 	BOOL fReturn = TRUE;
 
@@ -305,23 +547,26 @@ DWORD WINAPI CEventProcessing::SubscriptionCallback(EVT_SUBSCRIBE_NOTIFY_ACTION
 void CEventProcessing::ProcessEvent(EVT_HANDLE hEvent)
 {
 	DWORD status = ERROR_SUCCESS, dwBufferSize = 0, dwBufferUsed = 0, dwPropertyCount = 0;
-	LPWSTR pRenderedContent = NULL;
+	BSTR bstrRenderedContent = NULL;
+	unsigned long long nStartNs = MetricsNowNs();
 
-	if (!EvtRender(NULL, hEvent, EvtRenderEventXml, dwBufferSize, pRenderedContent,
+	if (!EvtRender(NULL, hEvent, EvtRenderEventXml, dwBufferSize, bstrRenderedContent,
 		&dwBufferUsed, &dwPropertyCount))
 	{
 		if (ERROR_INSUFFICIENT_BUFFER == (status = GetLastError()))
 		{
+			// Render into a BSTR - it is sent to SQL as is (ADO parameter value without copy).
+			// dwBufferUsed is bytes including terminating zero, SysAllocStringLen adds room for it.
 			dwBufferSize = dwBufferUsed;
-			pRenderedContent = (LPWSTR)malloc(dwBufferSize);
-			if (pRenderedContent)
+			bstrRenderedContent = SysAllocStringLen(NULL, dwBufferSize / sizeof(WCHAR) - 1);
+			if (bstrRenderedContent)
 			{
 				EvtRender(NULL, hEvent, EvtRenderEventXml, dwBufferSize,
-					pRenderedContent, &dwBufferUsed, &dwPropertyCount);
+					bstrRenderedContent, &dwBufferUsed, &dwPropertyCount);
 			}
 			else
 			{
-				theLog.Error(MOD_NAME, "malloc failed in function ProcessEvent");
+				theLog.Error(MOD_NAME, "SysAllocStringLen failed in function ProcessEvent");
 				goto cleanup;
 			}
 		}
@@ -332,10 +577,12 @@ void CEventProcessing::ProcessEvent(EVT_HANDLE hEvent)
 			goto cleanup;
 		}
 	}
+	m_parrStageHist[STAGE_RENDER]->RecordSince(nStartNs);
 
-	if (FilterAndSendEventToSql(pRenderedContent, dwBufferUsed + 1))
+	if (FilterAndSendEventToSql(bstrRenderedContent))
 	{
 		// Update bookmark following successful processing of an event.
+		unsigned long long nBookmarkNs = MetricsNowNs();
 		if (!EvtUpdateBookmark(m_hBookmark, hEvent))
 		{
 			status = GetLastError();
@@ -343,6 +590,7 @@ void CEventProcessing::ProcessEvent(EVT_HANDLE hEvent)
 				"EvtUpdateBookmark failed in SubscriptionCallback function", "", status);
 			goto cleanup;
 		}
+		m_parrStageHist[STAGE_BOOKMARK]->RecordSince(nBookmarkNs);
 	}
 
 	if (m_sqlServer.IsSqlConnectionLost())
@@ -351,53 +599,118 @@ void CEventProcessing::ProcessEvent(EVT_HANDLE hEvent)
 	}
 
 cleanup:
-	if (pRenderedContent)
-		free(pRenderedContent);
+	if (bstrRenderedContent)
+		SysFreeString(bstrRenderedContent);
+	m_parrStageHist[STAGE_TOTAL]->RecordSince(nStartNs);
 }
 
-BOOL CEventProcessing::FilterAndSendEventToSql(LPWSTR pXML, DWORD dwXMLlen)
+// Copy event field to char string - for log, statistics and trackers that use char strings.
+static const char *FieldToChar(const WCHAR *wszField, char *szBuffer, int nSize)
 {
+	if (!WideCharToMultiByte(CP_UTF8, 0, wszField, -1, szBuffer, nSize, NULL, NULL))
+		szBuffer[0] = 0;
+	return szBuffer;
+}
+
+// Same for a field of RAW_EVENT_FIELDS (not terminated).
+static const char *RawFieldToChar(const unsigned short *pField, size_t nLen, char *szBuffer, int nSize)
+{
+	int nChars = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)pField, (int)nLen, szBuffer, nSize - 1,
+		NULL, NULL);
+	szBuffer[nChars > 0 ? nChars : 0] = 0;
+	return szBuffer;
+}
+
+BOOL CEventProcessing::FilterAndSendEventToSql(BSTR bstrXML)
+{
+	// Count the event in flight before taking the config - see FreeRetiredConfig.
+	::InterlockedIncrement(&m_nActiveEvents);
+	BOOL fReturn = FilterAndSendEventToSql(*m_pActive, bstrXML);
+	::InterlockedDecrement(&m_nActiveEvents);
+	return fReturn;
+}
+
+BOOL CEventProcessing::FilterAndSendEventToSql(const ACTIVE_CONFIG &active, BSTR bstrXML)
+{
+	const CEventFilter &filter = active.filter;
 	BOOL fReturn = TRUE;
-	xml_document doc;
-	// load document from immutable memory block.
-	xml_parse_result result = doc.load_buffer(pXML, dwXMLlen);
+	unsigned long long nStageNs = MetricsNowNs();
 
-	// Get EventRecordID, EventID and ObjectClass (if exists) from Event XML.
-	char szEventRecordID[128] = { 0 }, szEventID[128] = { 0 };
-	int nEventID = 0;
-	xml_node evtrecid = doc.first_element_by_path("/Event/System/EventRecordID");
-	if (evtrecid)
+	// Most events of Security log are not accepted - these are rejected on the rendered XML
+	// without parsing it (if System element is not as expected the event is parsed below).
+	RAW_EVENT_FIELDS raw;
+	if (GetRawEventFields((const unsigned short *)bstrXML, SysStringLen(bstrXML), raw)
+		&& !filter.IsAccepted(raw.nEventID))
 	{
-		strcpy_s(szEventRecordID, evtrecid.first_child().value());
-	}
-	xml_node evtid = doc.first_element_by_path("/Event/System/EventID");
-	if (evtid)
-	{
-		strcpy_s(szEventID, evtid.first_child().value());
-		nEventID = atoi(szEventID);
+		m_parrStageHist[STAGE_FILTER]->RecordSince(nStageNs);
+		AddEventResult(raw.nEventID, "", EVT_RESULT_NOT_ACCEPTED);
+		char szComputer[GAP_SOURCEDC_LEN], szTimeCreated[64];
+		RawFieldToChar(raw.pComputer, raw.nComputerLen, szComputer, sizeof(szComputer));
+		RawFieldToChar(raw.pTimeCreated, raw.nTimeCreatedLen, szTimeCreated, sizeof(szTimeCreated));
+		m_watermarks.AddEvent(szComputer, raw.nEventRecordID, szTimeCreated, FALSE);
+		m_gaps.AddEvent(szComputer, raw.nEventRecordID);
+		return TRUE;
 	}
 
-	char szOC[128] = { 0 };
-	TCHAR szObjClass[128] = { 0 };
-	xpath_node objclass = doc.select_node("//Data[@Name='ObjectClass']/text()");
-	if (objclass)
+	// Get EventRecordID, EventID, Computer, TimeCreated and ObjectClass (if exists) from Event XML.
+	// Only the elements of these are read, the scan stops when all are found.
+	EVENT_FIELDS fields;
+	SCAN_RESULT scan;
+	if (!ScanEventFields(filter, (const unsigned short *)bstrXML, SysStringLen(bstrXML), fields, scan))
 	{
-		// Make (buffer) safe copy of ObjClass from XML.
-		strcpy_s(szOC, objclass.node().value());
-		OemToChar(szOC, szObjClass);	// Convert to UNICODE
+		// Document and arena of this thread are reused for each event (no heap allocations).
+		CXmlParseContext *pParse = CXmlParseContext::GetForThread();
+		if (!pParse)
+		{
+			theLog.Error(MOD_NAME, "Create XML parse context failed in function FilterAndSendEventToSql");
+			return FALSE;
+		}
+		// pugixml is built with PUGIXML_WCHAR_MODE - the UTF-16 event is parsed as is (no conversion).
+		// Note - not parsed in place, bstrXML is sent to SQL unchanged.
+		pParse->Parse(bstrXML, SysStringByteLen(bstrXML), encoding_wchar);
+		GetEventFields(filter, pParse->GetDocument(), fields);
 	}
-	if (IsAcceptedEvent(nEventID))
+	nStageNs = m_parrStageHist[STAGE_PARSE]->RecordSince(nStageNs);
+	int nEventID = fields.nEventID;
+	char szOC[FILTER_OBJCLASS_LEN] = { 0 }, szEventRecordID[24] = { 0 };
+	if (fields.szObjClass[0])
+		FieldToChar(fields.szObjClass, szOC, sizeof(szOC));
+	if (active.config.fIsVerboseLogging)
+		_ui64toa_s(fields.nEventRecordID, szEventRecordID, sizeof(szEventRecordID), 10);
+
+	BOOL fSent = FALSE;
+	if (filter.IsAccepted(nEventID))
 	{
-		if (IsIgnoredEvent(nEventID, szObjClass))
+		if (filter.FindDropRule(fields) >= 0)
 		{
-			LogInfo("Event ignored", szEventRecordID, szOC);
+			m_parrStageHist[STAGE_FILTER]->RecordSince(nStageNs);
+			LogInfo(active, "Event ignored", szEventRecordID, szOC);
+			AddEventResult(nEventID, szOC, EVT_RESULT_IGNORED);
 		}
 		else
 		{	// Send event to SQL.
-			fReturn = m_sqlServer.Call_usp_ADchgEventEx(pXML, dwXMLlen);
-			LogInfo("Event sent to SQL", szEventRecordID);
+			nStageNs = m_parrStageHist[STAGE_FILTER]->RecordSince(nStageNs);
+			fReturn = m_sqlServer.Call_usp_ADchgEventEx(bstrXML);
+			m_parrStageHist[STAGE_SQL]->RecordSince(nStageNs);
+			fSent = fReturn;
+			LogInfo(active, "Event sent to SQL", szEventRecordID);
+			AddEventResult(nEventID, szOC, fReturn ? EVT_RESULT_SENT : EVT_RESULT_FAILED);
 		}
 	}
+	else
+	{
+		m_parrStageHist[STAGE_FILTER]->RecordSince(nStageNs);
+		AddEventResult(nEventID, szOC, EVT_RESULT_NOT_ACCEPTED);
+	}
+
+	if (fReturn)	// Bookmark is updated.
+	{
+		char szComputer[GAP_SOURCEDC_LEN], szTimeCreated[64];
+		FieldToChar(fields.szComputer, szComputer, sizeof(szComputer));
+		FieldToChar(fields.szTimeCreated, szTimeCreated, sizeof(szTimeCreated));
+		m_watermarks.AddEvent(szComputer, fields.nEventRecordID, szTimeCreated, fSent);
+		m_gaps.AddEvent(szComputer, fields.nEventRecordID);
+	}
 	return fReturn;
 }
 
@@ -453,6 +766,9 @@ BOOL CEventProcessing::GetBookmark()
 
 no_bookmark_file:	// Note - bookmark is created "blank" if no bookmark file.
 
+	// EventRecordIDs delivered before - new gaps are detected from the bookmark on.
+	m_gaps.Load(m_szGapFile);
+
 	BOOL fReturn = TRUE;
 	m_hBookmark = EvtCreateBookmark(pBookmarkXml);
 	if (NULL == m_hBookmark)
@@ -527,6 +843,8 @@ BOOL CEventProcessing::SaveBookmark()
 	}
 	CloseHandle(hFile);
 
+	m_gaps.Save(m_szGapFile);
+
 	fReturn = TRUE;	// Save Bookmark OK.
 
 cleanup:
@@ -536,35 +854,236 @@ cleanup:
 	return fReturn;
 }
 
-BOOL CEventProcessing::IsAcceptedEvent(int EventID)
+void CEventProcessing::InitFilter()
 {
-	int numElem = sizeof(m_config.narrAcceptedEvents) / sizeof(int);
-	for (int i = 0; i < numElem; i++)
+	m_pActive = CompileConfig(m_config, m_filterRules);
+	if (!CompileEventQueries())
 	{
-		if (EventID == m_config.narrAcceptedEvents[i])
-			return TRUE;
+		theLog.Warning(MOD_NAME, "Compile XPath queries failed", "Queries are parsed for each event");
 	}
-	return FALSE;
 }
 
-BOOL CEventProcessing::IsIgnoredEvent(int nEventID, TCHAR *szObjectClass)
+ACTIVE_CONFIG *CEventProcessing::CompileConfig(const EVENT_PROCESSING_CONFIG &config,
+	const CFilterRules &rules)
 {
-	if (nEventID < 5136 || nEventID > 5141)
-		return FALSE;
-	int numElem = sizeof(m_config.sarrIgnoreEvts) / sizeof(IGNORE_EVENTS);
-	for (int i = 0; i < numElem; i++)
+	ACTIVE_CONFIG *pActive = new ACTIVE_CONFIG;	// Large (filter tables) - not on stack.
+	pActive->config = config;
+	pActive->filter.Compile(rules);
+	const CEventFilter &filter = pActive->filter;
+	char szFilter[128];
+	sprintf_s(szFilter, "%u accepted EventIDs, %u drop rules testing %d fields",
+		(unsigned)rules.GetAcceptedEventIDs().size(), (unsigned)rules.GetDropRules().size(),
+		filter.GetDropRules().GetNumFields());
+	theLog.Info(MOD_NAME, "Filter compiled", szFilter);
+	for (int i = 0; i < filter.GetDropRules().GetNumFields(); i++)
+	{
+		if (filter.GetFieldPath(i) < 0)
+		{
+			char szField[FILTER_OBJCLASS_LEN];
+			theLog.Warning(MOD_NAME, "Drop rule field can't be scanned - events are parsed",
+				FieldToChar(filter.GetDropRules().GetField(i), szField, sizeof(szField)));
+		}
+	}
+	return pActive;
+}
+
+void CEventProcessing::LogDropRuleHits(const ACTIVE_CONFIG &active)
+{
+	const CDropRules &rules = active.filter.GetDropRules();
+	for (int i = 0; i < rules.GetNumRules(); i++)
+	{
+		if (rules.GetHits(i))
+		{
+			char szHits[32];
+			_ui64toa_s(rules.GetHits(i), szHits, sizeof(szHits), 10);
+			theLog.Info(MOD_NAME, "Drop rule hits", szHits, rules.GetRuleText(i));
+		}
+	}
+}
+
+// Note - call when no event is processed (subscription stopped).
+void CEventProcessing::FreeConfig()
+{
+	FreeRetiredConfig();
+	if (m_pActive)
+	{
+		LogDropRuleHits(*m_pActive);
+		delete m_pActive;
+		m_pActive = NULL;
+	}
+}
+
+// Watch the folder of the config file - it is reloaded when its last write time changes.
+void CEventProcessing::StartConfigWatch()
+{
+	if (!GetConfigFileName(m_szConfigFile, sizeof(m_szConfigFile)))
+		return;
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	if (GetFileAttributesExA(m_szConfigFile, GetFileExInfoStandard, &attr))
+		m_ftConfigWrite = attr.ftLastWriteTime;
+
+	char szFolder[MAX_PATH];
+	strcpy_s(szFolder, m_szConfigFile);
+	char *pFileName = strrchr(szFolder, '\\');
+	if (pFileName)
+		*pFileName = 0;
+	// Note - editors may save by writing a new file and renaming it.
+	m_hConfigChange = FindFirstChangeNotificationA(szFolder, FALSE,
+		FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (INVALID_HANDLE_VALUE == m_hConfigChange)
+	{
+		theLog.SysErr(MOD_NAME, "Watch of config file folder failed",
+			"Use SERVICE_CONTROL_PARAMCHANGE to reload config file", GetLastError());
+		m_hConfigChange = NULL;
+	}
+}
+
+void CEventProcessing::StopConfigWatch()
+{
+	if (m_hConfigChange)
 	{
-		if (_tcscmp(szObjectClass, m_config.sarrIgnoreEvts[i].szObjectClass) == 0)
-			return TRUE;
+		FindCloseChangeNotification(m_hConfigChange);
+		m_hConfigChange = NULL;
 	}
-	return false;
 }
 
-void CEventProcessing::LogInfo(const char *szLogEvent,
+// A file in the config file folder changed. Reload the config file CONFIG_RELOAD_DELAY_MS after
+// its last change (an editor may write it in parts).
+void CEventProcessing::CheckConfigFileChange()
+{
+	if (!FindNextChangeNotification(m_hConfigChange))
+	{
+		theLog.SysErr(MOD_NAME, "Watch of config file folder failed",
+			"Use SERVICE_CONTROL_PARAMCHANGE to reload config file", GetLastError());
+		StopConfigWatch();
+		return;
+	}
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	if (GetFileAttributesExA(m_szConfigFile, GetFileExInfoStandard, &attr)
+		&& CompareFileTime(&attr.ftLastWriteTime, &m_ftConfigWrite) != 0)
+	{
+		m_ftConfigWrite = attr.ftLastWriteTime;
+		m_nReloadTick = GetTickCount64() + CONFIG_RELOAD_DELAY_MS;
+	}
+}
+
+// Settings used at service start only - a changed value is used after restart.
+static void KeepStartupSetting(const char *szSetting, int nCurrent, int &nNew)
+{
+	if (nNew != nCurrent)
+	{
+		theLog.Warning(MOD_NAME, "Setting change is used after service restart", szSetting);
+		nNew = nCurrent;
+	}
+}
+
+// Read the config file again, compile it and publish the new filter and settings with a swap of
+// m_pActive: events in flight finish with the config they started with, the old config is
+// deleted by FreeRetiredConfig when no event uses it. If the file has an invalid setting nothing
+// is changed. Note - called by the service main thread only.
+void CEventProcessing::ReloadConfig()
+{
+	if (m_pRetired)
+	{	// Previous config still used by an event - try again.
+		m_nReloadTick = GetTickCount64() + 100;
+		return;
+	}
+	theLog.Info(MOD_NAME, "Reloading config file");
+	EVENT_PROCESSING_CONFIG config;
+	SetDefaultConfig(config);
+	CFilterRules rules;
+	if (!ReadConfigFile(config, rules))
+	{
+		theLog.Warning(MOD_NAME, "Config file not reloaded", "Error in file (see above) - settings not changed");
+		return;
+	}
+	if (rules.GetAcceptedEventIDs().empty())
+	{
+		theLog.Warning(MOD_NAME, "Config file not reloaded", "List of accepted EventIDs missing - settings not changed");
+		return;
+	}
+	if (_tcscmp(config.szConnectionString, m_config.szConnectionString) != 0)
+	{
+		theLog.Warning(MOD_NAME, "Setting change is used after service restart", "SqlConnString");
+		StringCchCopy(config.szConnectionString, sizeof(config.szConnectionString) / sizeof(TCHAR),
+			m_config.szConnectionString);
+	}
+	KeepStartupSetting("StagedIngest", m_config.fIsStagedIngest, config.fIsStagedIngest);
+	KeepStartupSetting("AsyncLogging", m_config.fIsAsyncLogging, config.fIsAsyncLogging);
+	KeepStartupSetting("AsyncLogDropWhenFull", m_config.fIsAsyncLogDropWhenFull,
+		config.fIsAsyncLogDropWhenFull);
+	KeepStartupSetting("BinaryLogFormat", m_config.fIsBinaryLogFormat, config.fIsBinaryLogFormat);
+	KeepStartupSetting("MetricsInterval", m_config.nMetricsInterval, config.nMetricsInterval);
+	KeepStartupSetting("MetricsPipe", m_config.fIsMetricsPipe, config.fIsMetricsPipe);
+
+	// Publish - the old config is retired (events may still use it).
+	m_pRetired = (ACTIVE_CONFIG *)::InterlockedExchangePointer((PVOID volatile *)&m_pActive,
+		CompileConfig(config, rules));
+	m_config = config;
+	m_filterRules = rules;
+
+	theLog.SetDaysToKeepOldLogFiles(m_config.nDaysToKeepOldLogFiles);
+	theLog.SetLogRotation(m_config.nMaxLogFileSizeMB, m_config.fIsCompressOldLogFiles);
+	if (m_config.nStatisticsInterval != m_pRetired->config.nStatisticsInterval)
+		m_stats.SetInterval(m_config.nStatisticsInterval);
+	m_watermarks.SetThresholds(m_config.nLagWarningSeconds, m_config.nBacklogWarningEvents);
+	theLog.Info(MOD_NAME, "Config file reloaded");
+}
+
+// Delete the config replaced by ReloadConfig if no event uses it. An event counts itself in
+// m_nActiveEvents before it reads m_pActive, so when the count is 0 after the swap every event
+// that could have read the old pointer is done. Note - events of the subscription are delivered
+// one at a time, so the count is 0 between events.
+void CEventProcessing::FreeRetiredConfig()
+{
+	if (!m_pRetired || m_nActiveEvents != 0)
+		return;
+	LogDropRuleHits(*m_pRetired);
+	delete m_pRetired;
+	m_pRetired = NULL;
+}
+
+void CEventProcessing::LogInfo(const ACTIVE_CONFIG &active, const char *szLogEvent,
 	const char *szDescription /*= 0*/, const char *szNotes /*= 0*/)
 {
-	if (!m_config.fIsVerboseLogging)
+	if (!active.config.fIsVerboseLogging)
 		return;
 	theLog.Info(MOD_NAME, szLogEvent, szDescription, szNotes);
 }
 
+void CEventProcessing::RegisterMetrics()
+{
+	static const char *s_szarrStageLabels[STAGE_COUNT] = { "stage=\"render\"", "stage=\"parse\"",
+		"stage=\"filter\"", "stage=\"sql\"", "stage=\"bookmark\"", "stage=\"total\"" };
+	static const char *s_szarrResultLabels[EVT_RESULT_COUNT] = { "result=\"not_accepted\"",
+		"result=\"ignored\"", "result=\"sent\"", "result=\"failed\"" };
+
+	// Note - registry has room for all metrics (METRICS_MAX), so Add... never returns NULL here.
+	for (int i = 0; i < STAGE_COUNT; i++)
+	{
+		m_parrStageHist[i] = m_metrics.AddHistogram("adct_stage_duration_seconds", s_szarrStageLabels[i],
+			"Time spent in each event processing stage.");
+	}
+	for (int i = 0; i < EVT_RESULT_COUNT; i++)
+	{
+		m_parrEventCounter[i] = m_metrics.AddCounter("adct_events_total", s_szarrResultLabels[i],
+			"Events received from Security event log, by result.");
+	}
+	m_watermarks.SetMetrics(
+		m_metrics.AddHistogram("adct_capture_to_commit_seconds", "",
+			"Time from event TimeCreated to event committed to SQL.", LAG_EXPORT_MIN_EXP, LAG_EXPORT_MAX_EXP),
+		m_metrics.AddGauge("adct_backlog_events", "",
+			"Events in local Security log after bookmark (checked every 60 seconds)."));
+	m_gaps.SetMetrics(
+		m_metrics.AddGauge("adct_recordid_gaps", "",
+			"Ranges of EventRecordIDs never delivered (all SourceDCs)."),
+		m_metrics.AddGauge("adct_recordid_missing", "",
+			"EventRecordIDs never delivered (all SourceDCs)."));
+}
+
+void CEventProcessing::AddEventResult(int nEventID, const char *szObjClass, EVENT_RESULT eResult)
+{
+	m_stats.AddEvent(nEventID, szObjClass, eResult);
+	m_parrEventCounter[eResult]->Add();
+}
+
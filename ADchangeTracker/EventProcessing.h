@@ -1,5 +1,11 @@
 #pragma once
 #include "AdoSqlServer.h"
+#include "EventStats.h"
+#include "MetricsExporter.h"
+#include "Watermarks.h"
+#include "GapTracker.h"
+#include "EventFilter.h"
+#include "XmlArena.h"
 
 // Note - NT service code used is on MSDN: https://msdn.microsoft.com/en-us/library/windows/desktop/bb540475(v=vs.85).aspx
 
@@ -7,32 +13,67 @@
 #define SVCDISPNAME		L"Active Directory change tracker"
 #define SVCDESCRIPTION	L"Collects selected Active Directory change events into a SQL database."
 
+#define REPLAY_MAX_EVENT_SIZE	65536	// Max length (chars) of one event XML in replay file.
+#define CONFIG_RELOAD_DELAY_MS	2000	// Config file is reloaded this long after it changed.
+// Exported buckets of capture-to-commit lag: 2^30 ns (~1s) to 2^47 ns (~39h), so lag
+// around LagWarningSeconds (300 by default) falls in a bucket and not in +Inf.
+#define LAG_EXPORT_MIN_EXP		30
+#define LAG_EXPORT_MAX_EXP		47
+
 VOID WINAPI SvcMain(DWORD dwArgc, LPTSTR *lpszArgv);
 VOID WINAPI SvcCtrlHandler(DWORD dwCtrl);
 
-// structure to store ObjClass of ignored events with EventID in the range 5136 to 5141
-typedef struct tagIgnoreEvents
-{
-	TCHAR szObjectClass[128];
-} IGNORE_EVENTS;
-
 // Configuration settings for service.
+// Note - AcceptedEventIDs, IgnoredEvents and DropRule settings are in CFilterRules (see
+// CEventProcessing::GetFilterRules).
 typedef struct tagEvtProcConf
 {
-	int narrAcceptedEvents[128];		// EventIDs of accepted events.
-	int nNumElemAcceptedEvts;			// Number of elements in above array.
-
-	IGNORE_EVENTS sarrIgnoreEvts[16];	// Events to ignore (5136...5141).
-	int nNumElemIgnoreEvts;				// Number of elements used in above array.
-
 	TCHAR szConnectionString[1024];		// SQL connection string.
 
 	BOOL fIsVerboseLogging;				// TRUE when log level is verbose.
 
 	int nDaysToKeepOldLogFiles;			// Number of days to keep old log files.
+
+	BOOL fIsStagedIngest;				// TRUE when events are sent to usp_ADchgEventStage.
+
+	BOOL fIsAsyncLogging;				// TRUE when log records are written by a background thread.
+	BOOL fIsAsyncLogDropWhenFull;		// TRUE = drop, FALSE = block when async log ring is full.
+	BOOL fIsBinaryLogFormat;			// TRUE when log files are written in binary format.
+
+	int nMaxLogFileSizeMB;				// Start new log file at this size (0 = only at day change).
+	BOOL fIsCompressOldLogFiles;		// TRUE when old log files are NTFS compressed.
+
+	int nStatisticsInterval;			// Seconds between event statistics log records (0 = off).
+
+	int nMetricsInterval;				// Seconds between metrics file updates (0 = no file).
+	BOOL fIsMetricsPipe;				// TRUE when metrics are served on named pipe.
+
+	int nLagWarningSeconds;				// Warn when capture-to-commit lag is above (0 = off).
+	int nBacklogWarningEvents;			// Warn when events not yet processed are above (0 = off).
 }	
 EVENT_PROCESSING_CONFIG;
 
+// Compiled filter and the settings events are processed with. Replaced as a whole when the
+// config file is reloaded - see CEventProcessing::ReloadConfig.
+typedef struct tagActiveConfig
+{
+	EVENT_PROCESSING_CONFIG config;
+	CEventFilter filter;
+}
+ACTIVE_CONFIG;
+
+// Event processing stages timed in metrics (adct_stage_duration_seconds).
+enum EVENT_STAGE
+{
+	STAGE_RENDER = 0,		// EvtRender of event XML.
+	STAGE_PARSE,			// Get event fields - scan, or XML parse if the scan fails.
+	STAGE_FILTER,			// Accepted / ignored checks.
+	STAGE_SQL,				// Send event to SQL.
+	STAGE_BOOKMARK,			// EvtUpdateBookmark.
+	STAGE_TOTAL,			// Whole ProcessEvent.
+	STAGE_COUNT
+};
+
 class CEventProcessing
 {
 public:
@@ -44,7 +85,13 @@ public:
 
 	void Start();
 
+	// Feed events from file (one event XML per line, e.g. written by ADeventGen) to SQL
+	// through the same filter as events from the Security log. For load testing.
+	// szFile = "-" reads from stdin. Returns FALSE if error.
+	BOOL Replay(const TCHAR *szFile);
+
 	EVENT_PROCESSING_CONFIG & GetConfigStruct() { return m_config; }
+	CFilterRules & GetFilterRules() { return m_filterRules; }
 
 protected:
 	void ReportServiceStatus(DWORD dwCurrentState, DWORD dwWin32ExitCode, DWORD dwWaitHint);
@@ -57,25 +104,63 @@ protected:
 
 	void ProcessEvent(EVT_HANDLE hEvent);
 
-	// dwBufferSize = length of XML in bytes - including terminating zero.
+	// bstrXML = event XML (UTF-16) as rendered by EvtRender, sent to SQL unchanged.
 	// Returns FALSE if error.
-	BOOL FilterAndSendEventToSql(LPWSTR pXML, DWORD dwXMLlen);
+	BOOL FilterAndSendEventToSql(BSTR bstrXML);
+	BOOL FilterAndSendEventToSql(const ACTIVE_CONFIG &active, BSTR bstrXML);
 
 	BOOL GetBookmark();
 	BOOL SaveBookmark();
 
-	BOOL IsAcceptedEvent(int EventID);
-	BOOL IsIgnoredEvent(int nEventID, TCHAR *szObjectClass);
+	// Compile accepted EventIDs and drop rules of m_filterRules into m_pActive.
+	void InitFilter();
+	ACTIVE_CONFIG *CompileConfig(const EVENT_PROCESSING_CONFIG &config, const CFilterRules &rules);
+	// Log hits of each drop rule of active that had any.
+	void LogDropRuleHits(const ACTIVE_CONFIG &active);
+	void FreeConfig();
+
+	// Config file reload (on change of the file or SERVICE_CONTROL_PARAMCHANGE).
+	static void SetDefaultConfig(EVENT_PROCESSING_CONFIG &config);
+	void StartConfigWatch();
+	void StopConfigWatch();
+	void CheckConfigFileChange();
+	void ReloadConfig();
+	void FreeRetiredConfig();
 
 	// Log if log level set to verbose.
-	void LogInfo(const char *szLogEvent, const char *szDescription = 0, const char *szNotes = 0);
+	void LogInfo(const ACTIVE_CONFIG &active, const char *szLogEvent, const char *szDescription = 0,
+		const char *szNotes = 0);
+
+	void RegisterMetrics();
+	void AddEventResult(int nEventID, const char *szObjClass, EVENT_RESULT eResult);
 
 	EVT_HANDLE m_hSubscription;
 	EVT_HANDLE m_hBookmark;
 	CAdoSqlServer	m_sqlServer;
+	CEventStats		m_stats;
+	CMetricsRegistry m_metrics;
+	CMetricsExporter m_metricsExporter;
+	CMetricHistogram *m_parrStageHist[STAGE_COUNT];
+	CMetricCounter *m_parrEventCounter[EVT_RESULT_COUNT];
+	CWatermarks		m_watermarks;
+	CGapTracker		m_gaps;
+	CFilterRules	m_filterRules;
+	char m_szGapFile[MAX_PATH];		// EventRecordID range file (saved with bookmark).
 	EVENT_PROCESSING_CONFIG m_config;
 	HANDLE m_hEvent_SqlConnLost, m_hEvent_ServiceStop;
 
+	// Config events are processed with. An event takes the pointer once (m_nActiveEvents counted
+	// before) and uses that config until done. ReloadConfig swaps in a new one and keeps the old
+	// in m_pRetired until no event is in flight.
+	ACTIVE_CONFIG *volatile m_pActive;
+	ACTIVE_CONFIG *m_pRetired;
+	volatile LONG m_nActiveEvents;		// Events in FilterAndSendEventToSql.
+	HANDLE m_hEvent_ConfigReload;		// Set by SERVICE_CONTROL_PARAMCHANGE.
+	HANDLE m_hConfigChange;				// Change notification of config file folder (NULL if none).
+	char m_szConfigFile[MAX_PATH];
+	FILETIME m_ftConfigWrite;			// Last write time of config file read.
+	ULONGLONG m_nReloadTick;			// Reload config at this GetTickCount64 (0 = not pending).
+
 	// NT service data
 	SERVICE_STATUS_HANDLE	m_hSvcStatusHandle;		// Note - the handle does not have to be closed.
 	SERVICE_STATUS			m_sSvcStatus;
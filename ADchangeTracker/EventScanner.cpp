@@ -0,0 +1,543 @@
+// Stop-early event scanner - see EventScanner.h.
+// Note - portable C++, compiled without precompiled header.
+#include "EventScanner.h"
+#include <string.h>
+
+using namespace pugi;
+
+// Attribute of a start tag - pointers into the XML.
+typedef struct tagScanAttr
+{
+	const unsigned short *pName;
+	size_t nNameLen;
+	const unsigned short *pValue;
+	size_t nValueLen;
+} SCAN_ATTR;
+
+// Character classes of the characters below 64 - one table lookup instead of a compare for
+// each character of the class (names and attributes are read character by character).
+#define SCAN_CC_SPACE		1
+#define SCAN_CC_NAME_END	2
+static const unsigned char s_barrCharClass[64] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 3, 0, 0, 3, 0, 0,		// '\t' '\n' '\r'
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2,		// ' ' '/'
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 0 };	// '=' '>'
+
+static inline bool IsSpace(unsigned short c)
+{
+	return c < 64 && (s_barrCharClass[c] & SCAN_CC_SPACE);
+}
+
+static inline bool IsNameEnd(unsigned short c)
+{
+	return c < 64 && (s_barrCharClass[c] & SCAN_CC_NAME_END);
+}
+
+static bool IsSpaceOnly(const unsigned short *p, const unsigned short *pEnd)
+{
+	for (; p < pEnd; p++)
+	{
+		if (!IsSpace(*p))
+			return false;
+	}
+	return true;
+}
+
+// Name or value in the XML equal to ASCII sz.
+static inline bool IsName(const unsigned short *p, size_t nLen, const char *sz)
+{
+	for (size_t i = 0; i < nLen; i++)
+	{
+		if (!sz[i] || p[i] != (unsigned char)sz[i])
+			return false;
+	}
+	return sz[nLen] == 0;
+}
+
+// Name in the XML at p equal to ASCII sz (followed by the end of the name). Returns length
+// of sz or 0 if the name is not sz.
+static inline size_t IsNameAt(const unsigned short *p, const unsigned short *pEnd, const char *sz)
+{
+	size_t i = 0;
+	for (; sz[i]; i++)
+	{
+		if (p + i == pEnd || p[i] != (unsigned char)sz[i])
+			return 0;
+	}
+	return (p + i < pEnd && IsNameEnd(p[i])) ? i : 0;
+}
+
+// First c in [p, pEnd) - pEnd if none.
+// Note - runs between markup characters of an event are short (names, small values), a
+// character loop is faster here than a SIMD search (as in GetRawEventFields) with its setup.
+static inline const unsigned short *FindChar(const unsigned short *p, const unsigned short *pEnd,
+	unsigned short c)
+{
+	for (; p < pEnd && *p != c; p++)
+		;
+	return p;
+}
+
+// First c1, c2 or c3 in [p, pEnd) - pEnd if none.
+static inline const unsigned short *FindChar(const unsigned short *p, const unsigned short *pEnd,
+	unsigned short c1, unsigned short c2, unsigned short c3)
+{
+	for (; p < pEnd && *p != c1 && *p != c2 && *p != c3; p++)
+		;
+	return p;
+}
+
+// Attributes of a start tag from p (after the element name) up to and including '>' or "/>".
+// Up to nMax attributes are stored in pAttrs, nNumAttrs is the number of all attributes.
+// Returns false if the tag is not well-formed.
+static bool ReadTag(const unsigned short *&p, const unsigned short *pEnd, SCAN_ATTR *pAttrs,
+	int nMax, int &nNumAttrs, bool &fEmpty)
+{
+	for (nNumAttrs = 0; ; nNumAttrs++)
+	{
+		while (p < pEnd && IsSpace(*p))
+			p++;
+		if (p == pEnd)
+			return false;
+		if (*p == '>')
+		{
+			p++;
+			fEmpty = false;
+			return true;
+		}
+		if (*p == '/')
+		{
+			if (pEnd - p < 2 || p[1] != '>')
+				return false;
+			p += 2;
+			fEmpty = true;
+			return true;
+		}
+		const unsigned short *pName = p;
+		while (p < pEnd && !IsNameEnd(*p))
+			p++;
+		size_t nNameLen = p - pName;
+		while (p < pEnd && IsSpace(*p))
+			p++;
+		if (!nNameLen || p == pEnd || *p != '=')
+			return false;
+		for (p++; p < pEnd && IsSpace(*p); p++)
+			;
+		if (p == pEnd || (*p != '\'' && *p != '"'))
+			return false;
+		unsigned short cQuote = *p++;
+		const unsigned short *pValue = p;
+		p = FindChar(p, pEnd, cQuote);
+		if (p == pEnd)
+			return false;
+		if (nNumAttrs < nMax)
+		{
+			pAttrs[nNumAttrs].pName = pName;
+			pAttrs[nNumAttrs].nNameLen = nNameLen;
+			pAttrs[nNumAttrs].pValue = pValue;
+			pAttrs[nNumAttrs].nValueLen = p - pValue;
+		}
+		p++;
+	}
+}
+
+// Rest of a tag that is not on a path, from p (after '<') up to and including '>' - only
+// quoted attribute values are looked at.
+static bool SkipTag(const unsigned short *&p, const unsigned short *pEnd, bool &fEmpty)
+{
+	for (;;)
+	{
+		p = FindChar(p, pEnd, '>', '\'', '"');
+		if (p == pEnd)
+			return false;
+		if (*p == '>')
+		{
+			fEmpty = p[-1] == '/';
+			p++;
+			return true;
+		}
+		p = FindChar(p + 1, pEnd, *p);
+		if (p == pEnd)
+			return false;
+		p++;
+	}
+}
+
+static const SCAN_ATTR *FindAttr(const SCAN_ATTR *pAttrs, int nNumAttrs, const char *szName)
+{
+	for (int i = 0; i < nNumAttrs; i++)
+	{
+		if (IsName(pAttrs[i].pName, pAttrs[i].nNameLen, szName))
+			return &pAttrs[i];
+	}
+	return NULL;
+}
+
+// Processing instruction from p (after "<?") - p is set after "?>".
+static bool SkipPI(const unsigned short *&p, const unsigned short *pEnd)
+{
+	for (;;)
+	{
+		p = FindChar(p + 1, pEnd, '?');
+		if (pEnd - p < 2)
+			return false;
+		if (p[1] == '>')
+		{
+			p += 2;
+			return true;
+		}
+	}
+}
+
+// Content of an element from p (after its start tag) up to and including its end tag.
+static bool SkipElement(const unsigned short *&p, const unsigned short *pEnd)
+{
+	bool fEmpty;
+	for (int nDepth = 1; nDepth; )
+	{
+		p = FindChar(p, pEnd, '<');
+		if (pEnd - p < 2)
+			return false;
+		p++;
+		if (*p == '/')
+		{
+			p = FindChar(p, pEnd, '>');
+			if (p == pEnd)
+				return false;
+			p++;
+			nDepth--;
+		}
+		else if (*p == '?')
+		{
+			if (!SkipPI(p, pEnd))
+				return false;
+		}
+		else if (*p == '!')
+			return false;
+		else
+		{
+			if (!SkipTag(p, pEnd, fEmpty))
+				return false;
+			if (!fEmpty)
+				nDepth++;
+		}
+	}
+	return true;
+}
+
+// Entity from p (after '&') - p is set after ';'. Returns false if not a known entity.
+static bool DecodeEntity(const unsigned short *&p, const unsigned short *pEnd, unsigned int &c)
+{
+	const unsigned short *pLimit = pEnd - p > 12 ? p + 12 : pEnd;
+	const unsigned short *pSemi = FindChar(p, pLimit, ';');
+	if (pSemi == pLimit)
+		return false;
+	size_t nLen = pSemi - p;
+	if (nLen >= 2 && p[0] == '#')
+	{
+		bool fHex = p[1] == 'x';
+		c = 0;
+		for (size_t i = fHex ? 2 : 1; i < nLen; i++)
+		{
+			unsigned int d = p[i];
+			if (d >= '0' && d <= '9')
+				d -= '0';
+			else if (fHex && (d | 0x20) >= 'a' && (d | 0x20) <= 'f')
+				d = (d | 0x20) - 'a' + 10;
+			else
+				return false;
+			c = c * (fHex ? 16 : 10) + d;
+			if (c > 0x10FFFF)
+				return false;
+		}
+		if (nLen == (fHex ? 2u : 1u) || c == 0)
+			return false;
+	}
+	else if (IsName(p, nLen, "amp"))
+		c = '&';
+	else if (IsName(p, nLen, "lt"))
+		c = '<';
+	else if (IsName(p, nLen, "gt"))
+		c = '>';
+	else if (IsName(p, nLen, "quot"))
+		c = '"';
+	else if (IsName(p, nLen, "apos"))
+		c = '\'';
+	else
+		return false;
+	p = pSemi + 1;
+	return true;
+}
+
+// Code point c as pugi::char_t. Returns false if pOutEnd is reached.
+static bool PutChar(char_t *&pOut, char_t *pOutEnd, unsigned int c)
+{
+#ifdef PUGIXML_WCHAR_MODE
+	if (sizeof(wchar_t) == 2 && c >= 0x10000)
+	{
+		if (pOutEnd - pOut < 2)
+			return false;
+		c -= 0x10000;
+		*pOut++ = (char_t)(0xD800 + (c >> 10));
+		*pOut++ = (char_t)(0xDC00 + (c & 0x3FF));
+		return true;
+	}
+	if (pOut == pOutEnd)
+		return false;
+	*pOut++ = (char_t)c;
+#else
+	static const unsigned char s_barrLead[] = { 0, 0xC0, 0xE0, 0xF0 };
+	int nMore = c < 0x80 ? 0 : c < 0x800 ? 1 : c < 0x10000 ? 2 : 3;
+	if (pOutEnd - pOut <= nMore)
+		return false;
+	*pOut++ = (char_t)(s_barrLead[nMore] | (c >> (6 * nMore)));
+	while (nMore--)
+		*pOut++ = (char_t)(0x80 | ((c >> (6 * nMore)) & 0x3F));
+#endif
+	return true;
+}
+
+// Copy value [p, pEnd) to the result buffer as pugixml with parse_default has it: entities
+// decoded, CR LF and CR to LF in text, CR LF, CR, LF and tab to space in attribute values.
+// Returns the terminated value or NULL if buffer is full or there is an unknown entity.
+static const char_t *AddValue(SCAN_RESULT &result, const unsigned short *p,
+	const unsigned short *pEnd, bool fAttr)
+{
+	char_t *szValue = result.szBuffer + result.nBufferUsed;
+	char_t *pOut = szValue, *pOutEnd = result.szBuffer + SCAN_BUFFER_LEN - 1;
+	while (p < pEnd)
+	{
+		unsigned int c = *p++;
+		if (c == '&')
+		{
+			if (!DecodeEntity(p, pEnd, c))
+				return NULL;
+		}
+		else if (c == '\r')
+		{
+			if (p < pEnd && *p == '\n')
+				p++;
+			c = fAttr ? ' ' : '\n';
+		}
+		else if (fAttr && (c == '\n' || c == '\t'))
+			c = ' ';
+		else if ((c & 0xFC00) == 0xD800 && p < pEnd && (*p & 0xFC00) == 0xDC00)
+			c = 0x10000 + ((c - 0xD800) << 10) + (*p++ - 0xDC00);
+		if (!PutChar(pOut, pOutEnd, c))
+			return NULL;
+	}
+	*pOut++ = 0;
+	result.nBufferUsed = pOut - result.szBuffer;
+	return szValue;
+}
+
+// Value of paths found - pfnValue can end other paths.
+static void SetValue(SCAN_RESULT &result, unsigned int nPaths, const char_t *szValue,
+	unsigned int &nPending, SCAN_VALUE_FUNC pfnValue, void *pContext)
+{
+	nPending &= ~nPaths;
+	for (int i = 0; nPaths >> i; i++)
+	{
+		if (nPaths & (1u << i))
+		{
+			result.szarrValues[i] = szValue;
+			if (pfnValue)
+				nPending &= ~pfnValue(i, szValue, pContext);
+		}
+	}
+}
+
+// Copy name from szPath up to the next path character. Returns false if empty or too long.
+static bool CopyName(const char *&p, char *szName)
+{
+	size_t nLen = 0;
+	for (; *p && !strchr("/[]@='\" ", *p); p++)
+	{
+		if (nLen == SCAN_NAME_LEN - 1)
+			return false;
+		szName[nLen++] = *p;
+	}
+	szName[nLen] = 0;
+	return nLen != 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+int CEventScanner::AddPath(const char *szPath)
+{
+	if (m_nNumPaths >= SCAN_MAX_PATHS)
+		return -1;
+	SCAN_PATH &path = m_paths[m_nNumPaths];
+	memset(&path, 0, sizeof(path));
+	const char *p = szPath;
+	while (*p == '/')
+	{
+		if (*++p == '@')
+		{	// Attribute of the last element.
+			if (!path.nNumSteps || !CopyName(++p, path.szValueAttr))
+				return -1;
+			break;
+		}
+		if (path.nNumSteps == SCAN_MAX_STEPS)
+			return -1;
+		SCAN_STEP &step = path.steps[path.nNumSteps++];
+		if (!CopyName(p, step.szName))
+			return -1;
+		if (*p == '[')
+		{	// [@Name='value']
+			if (*++p != '@' || !CopyName(++p, step.szAttr) || *p++ != '=')
+				return -1;
+			char cQuote = *p++;
+			const char *pQuote = (cQuote == '\'' || cQuote == '"') ? strchr(p, cQuote) : NULL;
+			if (!pQuote || pQuote - p >= SCAN_NAME_LEN || pQuote[1] != ']')
+				return -1;
+			memcpy(step.szAttrValue, p, pQuote - p);
+			p = pQuote + 2;
+		}
+	}
+	if (*p || !path.nNumSteps)
+		return -1;
+	return m_nNumPaths++;
+}
+
+bool CEventScanner::Scan(const unsigned short *pXML, size_t nChars, SCAN_RESULT &result,
+	SCAN_VALUE_FUNC pfnValue /*= NULL*/, void *pContext /*= NULL*/) const
+{
+	const unsigned short *p = pXML, *pEnd = pXML + nChars;
+	unsigned int narrLive[SCAN_MAX_STEPS + 1];	// Paths matching the open elements to depth.
+	unsigned int narrText[SCAN_MAX_STEPS + 1];	// Paths whose value is text of element at depth.
+	SCAN_ATTR attrs[SCAN_MAX_ATTRS];
+	unsigned int nPending = (1u << m_nNumPaths) - 1;	// Paths without value.
+	int nDepth = 0, nNumAttrs;
+	bool fEmpty;
+
+	for (int i = 0; i < m_nNumPaths; i++)
+		result.szarrValues[i] = NULL;
+	result.nBufferUsed = 0;
+	narrLive[0] = nPending;
+	narrText[0] = 0;
+	while (nPending)
+	{
+		// Text up to next markup - only read if it is a value.
+		const unsigned short *pText = p;
+		p = FindChar(p, pEnd, '<');
+		if (narrText[nDepth] && !IsSpaceOnly(pText, p))
+		{	// First text of element (whitespace only text is no text, as in pugixml).
+			const char_t *szValue = AddValue(result, pText, p, false);
+			if (!szValue)
+				return false;
+			SetValue(result, narrText[nDepth], szValue, nPending, pfnValue, pContext);
+			narrText[nDepth] = 0;
+		}
+		if (p == pEnd)
+			break;
+		if (++p == pEnd)
+			return false;
+
+		if (*p == '/')
+		{	// End tag of element at nDepth.
+			p = FindChar(p, pEnd, '>');
+			if (p == pEnd || nDepth == 0)
+				return false;
+			p++;
+			if (narrText[nDepth])	// Element has no text.
+				SetValue(result, narrText[nDepth], PUGIXML_TEXT(""), nPending, pfnValue, pContext);
+			nDepth--;
+			continue;
+		}
+		if (*p == '?')
+		{	// XML declaration.
+			if (!SkipPI(p, pEnd))
+				return false;
+			continue;
+		}
+		if (*p == '!')
+			return false;	// Comment, CDATA or DOCTYPE - EvtRender does not write them.
+
+		// Start tag - paths that go on with this element. The path names are compared with
+		// the XML, the length of the element name is only needed if it is on a path.
+		if (IsNameEnd(*p))
+			return false;
+		unsigned int nMatch = 0;
+		size_t nNameLen = 0;
+		if (nDepth < SCAN_MAX_STEPS)
+		{
+			unsigned int nLive = narrLive[nDepth] & nPending;
+			for (int i = 0; nLive >> i; i++)
+			{
+				if ((nLive & (1u << i)) && m_paths[i].nNumSteps > nDepth)
+				{
+					size_t nLen = IsNameAt(p, pEnd, m_paths[i].steps[nDepth].szName);
+					if (nLen)
+					{
+						nMatch |= 1u << i;
+						nNameLen = nLen;
+					}
+				}
+			}
+		}
+		if (!nMatch)
+		{	// Element and its content are on no path.
+			if (!SkipTag(p, pEnd, fEmpty) || (!fEmpty && !SkipElement(p, pEnd)))
+				return false;
+			continue;
+		}
+		p += nNameLen;
+		if (!ReadTag(p, pEnd, attrs, SCAN_MAX_ATTRS, nNumAttrs, fEmpty) || nNumAttrs > SCAN_MAX_ATTRS)
+			return false;
+
+		unsigned int nText = 0;
+		for (int i = 0; nMatch >> i; i++)
+		{
+			if (!(nMatch & (1u << i)))
+				continue;
+			const SCAN_PATH &path = m_paths[i];
+			const SCAN_STEP &step = path.steps[nDepth];
+			if (step.szAttr[0])
+			{	// Predicate - compared with the value as in the XML.
+				const SCAN_ATTR *pAttr = FindAttr(attrs, nNumAttrs, step.szAttr);
+				if (pAttr && FindChar(pAttr->pValue, pAttr->pValue + pAttr->nValueLen, '&')
+					!= pAttr->pValue + pAttr->nValueLen)
+					return false;
+				if (!pAttr || !IsName(pAttr->pValue, pAttr->nValueLen, step.szAttrValue))
+				{
+					nMatch &= ~(1u << i);
+					continue;
+				}
+			}
+			if (path.nNumSteps > nDepth + 1)
+				continue;
+
+			// Last element of path.
+			nMatch &= ~(1u << i);
+			if (path.szValueAttr[0])
+			{
+				const SCAN_ATTR *pAttr = FindAttr(attrs, nNumAttrs, path.szValueAttr);
+				const char_t *szValue = pAttr ? AddValue(result, pAttr->pValue,
+					pAttr->pValue + pAttr->nValueLen, true) : PUGIXML_TEXT("");
+				if (!szValue)
+					return false;
+				SetValue(result, 1u << i, szValue, nPending, pfnValue, pContext);
+			}
+			else if (fEmpty)
+				SetValue(result, 1u << i, PUGIXML_TEXT(""), nPending, pfnValue, pContext);
+			else
+				nText |= 1u << i;
+		}
+		if (fEmpty)
+			continue;
+		if (nMatch || nText)
+		{
+			nDepth++;
+			narrLive[nDepth] = nMatch;
+			narrText[nDepth] = nText;
+		}
+		else if (!SkipElement(p, pEnd))
+			return false;
+	}
+	if (nPending && nDepth)
+		return false;	// End of XML in an element.
+	result.nScannedChars = p - pXML;
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+// Stop-early scan of a rendered event for a few values - see CEventScanner.
+// Note - this file (and EventScanner.cpp) is portable C++ and is also used by PipelineBench.
+// Do not include Windows headers here.
+#include "pugixml.hpp"
+#include <stddef.h>
+
+#define SCAN_MAX_PATHS			31		// Path masks are unsigned int.
+#define SCAN_MAX_STEPS			4		// Elements of a path.
+#define SCAN_MAX_ATTRS			16		// Attributes of an element on a path.
+#define SCAN_NAME_LEN			32
+#define SCAN_BUFFER_LEN			1024	// pugi::char_t for the values of one event.
+
+typedef struct tagScanStep
+{
+	char szName[SCAN_NAME_LEN];			// Element name.
+	char szAttr[SCAN_NAME_LEN];			// Predicate [@szAttr='szAttrValue'] - empty if none.
+	char szAttrValue[SCAN_NAME_LEN];
+} SCAN_STEP;
+
+typedef struct tagScanPath
+{
+	SCAN_STEP steps[SCAN_MAX_STEPS];
+	int nNumSteps;
+	char szValueAttr[SCAN_NAME_LEN];	// Value is this attribute of the last element.
+										// Empty - value is the element's text.
+} SCAN_PATH;
+
+// Called by CEventScanner::Scan for each value found. Returns paths (bit i: path index i) that
+// are not needed any more given the value - e.g. a path only needed for some EventIDs.
+typedef unsigned int (*SCAN_VALUE_FUNC)(int nPath, const pugi::char_t *szValue, void *pContext);
+
+// Values found by CEventScanner::Scan.
+typedef struct tagScanResult
+{
+	const pugi::char_t *szarrValues[SCAN_MAX_PATHS];	// NULL if path is not in event.
+	size_t nScannedChars;	// Characters of the event read - less than the event if all values
+							// were found before its end.
+	pugi::char_t szBuffer[SCAN_BUFFER_LEN];				// Values (terminated).
+	size_t nBufferUsed;
+} SCAN_RESULT;
+
+// Gets the values of a list of paths from an event XML (UTF-16, as from EvtRender) without
+// building a document: elements that are on no path (e.g. RenderingInfo, EventData other than
+// the Data wanted) are skipped as a whole, and the scan stops as soon as every path has a
+// value. Values are as pugixml with parse_default gives them (entities decoded, end of line
+// normalized).
+//
+// Paths are absolute, elements with an optional attribute predicate and an optional attribute
+// at the end, e.g.:
+//   /Event/System/EventID                          text of element
+//   /Event/System/TimeCreated/@SystemTime          attribute value
+//   /Event/EventData/Data[@Name='ObjectClass']     text of the first Data element with Name
+// Value of a path is from the first element in document order that matches it (empty if that
+// element has no text or attribute).
+//
+// Add the paths once, then Scan is const and can be called by any number of threads.
+class CEventScanner
+{
+public:
+	CEventScanner() { m_nNumPaths = 0; }
+
+	// Returns index of the path's value in SCAN_RESULT, -1 if the path is not supported or
+	// there are SCAN_MAX_PATHS paths.
+	int AddPath(const char *szPath);
+	int GetNumPaths() const { return m_nNumPaths; }
+	void Clear() { m_nNumPaths = 0; }
+
+	// Returns false if the XML could not be scanned: not well-formed (as far as scanned),
+	// a comment, CDATA or DOCTYPE, an unknown entity, a predicate attribute with an entity
+	// or values longer than SCAN_BUFFER_LEN. Parse the event with pugixml instead then.
+	// pfnValue (if not NULL) is called for each value found and can end the scan earlier.
+	bool Scan(const unsigned short *pXML, size_t nChars, SCAN_RESULT &result,
+		SCAN_VALUE_FUNC pfnValue = NULL, void *pContext = NULL) const;
+
+protected:
+	SCAN_PATH m_paths[SCAN_MAX_PATHS];
+	int m_nNumPaths;
+};
@@ -0,0 +1,151 @@
+#include "stdafx.h"
+#include "EventStats.h"
+#include "LogSys.h"
+
+// Name used in Log when 'this' module logs.
+#define MOD_NAME "Event statistics"
+
+CEventStats::CEventStats()
+{
+	::InitializeCriticalSection( &m_critsect );
+	m_nIntervalMs = 0;
+	m_nLastSummaryTick = 0;
+	memset( m_narrTotal, 0, sizeof(m_narrTotal) );
+	memset( m_sarrEventIDs, 0, sizeof(m_sarrEventIDs) );
+	m_nNumEventIDs = 0;
+	memset( m_sarrObjClasses, 0, sizeof(m_sarrObjClasses) );
+	strcpy_s( m_sarrObjClasses[STATS_MAX_OBJCLASSES].szObjClass, STATS_OBJCLASS_LEN, "(other)" );
+	m_nNumObjClasses = 0;
+}
+
+CEventStats::~CEventStats()
+{
+	::DeleteCriticalSection( &m_critsect );
+}
+
+void CEventStats::SetInterval(int nIntervalSeconds)
+{
+	::EnterCriticalSection( &m_critsect );
+	m_nIntervalMs = nIntervalSeconds > 0 ? (ULONGLONG)nIntervalSeconds * 1000 : 0;
+	m_nLastSummaryTick = ::GetTickCount64();
+	::LeaveCriticalSection( &m_critsect );
+}
+
+// Note - caller must hold m_critsect.
+EVENTID_STATS *CEventStats::FindEventID(int nEventID)
+{
+	for( int i = 0; i < m_nNumEventIDs; i++ )
+	{
+		if( m_sarrEventIDs[i].nEventID == nEventID )
+			return &m_sarrEventIDs[i];
+	}
+	if( m_nNumEventIDs >= STATS_MAX_EVENTIDS )
+		return NULL;
+	m_sarrEventIDs[m_nNumEventIDs].nEventID = nEventID;
+	return &m_sarrEventIDs[m_nNumEventIDs++];
+}
+
+// Note - caller must hold m_critsect.
+OBJCLASS_STATS *CEventStats::FindObjClass(const char *szObjClass)
+{
+	for( int i = 0; i < m_nNumObjClasses; i++ )
+	{
+		if( strcmp( m_sarrObjClasses[i].szObjClass, szObjClass ) == 0 )
+			return &m_sarrObjClasses[i];
+	}
+	if( m_nNumObjClasses >= STATS_MAX_OBJCLASSES )
+		return &m_sarrObjClasses[STATS_MAX_OBJCLASSES];	// "(other)"
+	strncpy_s( m_sarrObjClasses[m_nNumObjClasses].szObjClass, STATS_OBJCLASS_LEN,
+		szObjClass, _TRUNCATE );
+	return &m_sarrObjClasses[m_nNumObjClasses++];
+}
+
+void CEventStats::AddEvent(int nEventID, const char *szObjClass, EVENT_RESULT eResult)
+{
+	if( !m_nIntervalMs )
+		return;
+
+	::EnterCriticalSection( &m_critsect );
+
+	m_narrTotal[eResult]++;
+	// Events not accepted are only counted in total (the subscription gets all Security events).
+	if( eResult != EVT_RESULT_NOT_ACCEPTED )
+	{
+		EVENTID_STATS *pEvt = FindEventID( nEventID );
+		if( pEvt )
+			pEvt->narrCount[eResult]++;
+		if( szObjClass && szObjClass[0] )
+			FindObjClass( szObjClass )->narrCount[eResult]++;
+	}
+
+	::LeaveCriticalSection( &m_critsect );
+}
+
+DWORD CEventStats::LogSummaryIfDue()
+{
+	if( !m_nIntervalMs )
+		return INFINITE;
+
+	ULONGLONG nElapsed = ::GetTickCount64() - m_nLastSummaryTick;
+	if( nElapsed < m_nIntervalMs )
+		return (DWORD)(m_nIntervalMs - nElapsed);
+
+	LogSummary();
+	return (DWORD)m_nIntervalMs;
+}
+
+// Append " name=accepted/ignored/sent/failed" to sz.
+static void AppendCounts(char *sz, size_t nSize, const char *szName, const LONG *pnarrCount)
+{
+	size_t nLen = strlen( sz );
+	// Note - list is truncated if it doesn't fit in buffer.
+	_snprintf_s( sz + nLen, nSize - nLen, _TRUNCATE, "%s%s=%d/%d/%d/%d", nLen ? " " : "", szName,
+		pnarrCount[EVT_RESULT_IGNORED] + pnarrCount[EVT_RESULT_SENT] + pnarrCount[EVT_RESULT_FAILED],
+		pnarrCount[EVT_RESULT_IGNORED], pnarrCount[EVT_RESULT_SENT], pnarrCount[EVT_RESULT_FAILED] );
+}
+
+void CEventStats::LogSummary()
+{
+	char szTotals[256], szEventIDs[LOG_RECORD_SIZE], szObjClasses[LOG_RECORD_SIZE];
+	szEventIDs[0] = szObjClasses[0] = 0;
+
+	::EnterCriticalSection( &m_critsect );
+
+	ULONGLONG nNow = ::GetTickCount64();
+	const LONG *pn = m_narrTotal;
+	sprintf_s( szTotals, sizeof(szTotals),
+		"Interval %llus: accepted %d, ignored %d, sent %d, failed %d, not accepted %d",
+		(nNow - m_nLastSummaryTick) / 1000,
+		pn[EVT_RESULT_IGNORED] + pn[EVT_RESULT_SENT] + pn[EVT_RESULT_FAILED],
+		pn[EVT_RESULT_IGNORED], pn[EVT_RESULT_SENT], pn[EVT_RESULT_FAILED],
+		pn[EVT_RESULT_NOT_ACCEPTED] );
+
+	char szName[16];
+	for( int i = 0; i < m_nNumEventIDs; i++ )
+	{
+		sprintf_s( szName, sizeof(szName), "%d", m_sarrEventIDs[i].nEventID );
+		AppendCounts( szEventIDs, sizeof(szEventIDs), szName, m_sarrEventIDs[i].narrCount );
+	}
+	for( int i = 0; i <= STATS_MAX_OBJCLASSES; i++ )
+	{
+		if( i == m_nNumObjClasses )
+			i = STATS_MAX_OBJCLASSES;	// Skip unused elements.
+		const LONG *pnCount = m_sarrObjClasses[i].narrCount;
+		if( pnCount[EVT_RESULT_IGNORED] + pnCount[EVT_RESULT_SENT] + pnCount[EVT_RESULT_FAILED] )
+			AppendCounts( szObjClasses, sizeof(szObjClasses), m_sarrObjClasses[i].szObjClass, pnCount );
+	}
+
+	// Reset counters for next interval (the EventIDs and ObjectClasses seen are kept).
+	memset( m_narrTotal, 0, sizeof(m_narrTotal) );
+	for( int i = 0; i < m_nNumEventIDs; i++ )
+		memset( m_sarrEventIDs[i].narrCount, 0, sizeof(m_sarrEventIDs[i].narrCount) );
+	for( int i = 0; i <= STATS_MAX_OBJCLASSES; i++ )
+		memset( m_sarrObjClasses[i].narrCount, 0, sizeof(m_sarrObjClasses[i].narrCount) );
+	m_nLastSummaryTick = nNow;
+
+	::LeaveCriticalSection( &m_critsect );
+
+	theLog.Info( MOD_NAME, "Events by EventID (accepted/ignored/sent/failed)", szTotals, szEventIDs );
+	if( szObjClasses[0] )
+		theLog.Info( MOD_NAME, "Events by ObjectClass (accepted/ignored/sent/failed)", szTotals, szObjClasses );
+}
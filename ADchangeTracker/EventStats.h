@@ -0,0 +1,71 @@
+#pragma once
+
+#define STATS_MAX_EVENTIDS		128		// Max EventIDs counted separately.
+#define STATS_MAX_OBJCLASSES	64		// Max ObjectClasses counted separately (others in "(other)").
+#define STATS_OBJCLASS_LEN		64
+
+// Result of processing one event.
+enum EVENT_RESULT
+{
+	EVT_RESULT_NOT_ACCEPTED = 0,	// EventID not in AcceptedEventIDs.
+	EVT_RESULT_IGNORED,				// Accepted, but dropped by a DropRule (or IgnoredEvents).
+	EVT_RESULT_SENT,				// Sent to SQL.
+	EVT_RESULT_FAILED,				// Send to SQL failed.
+	EVT_RESULT_COUNT
+};
+
+typedef struct tagEventIdStats
+{
+	int nEventID;
+	LONG narrCount[EVT_RESULT_COUNT];
+} EVENTID_STATS;
+
+typedef struct tagObjClassStats
+{
+	char szObjClass[STATS_OBJCLASS_LEN];
+	LONG narrCount[EVT_RESULT_COUNT];
+} OBJCLASS_STATS;
+
+// Counters of processed events per EventID and ObjectClass. A summary is written
+// to the log every N seconds and the counters are reset (see LogSummaryIfDue).
+class CEventStats
+{
+public:
+	CEventStats();
+	~CEventStats();
+
+private:	// Make assignment operator and copy constructor private to prevent
+			// accidental object copy.
+	void operator=(CEventStats &source) {  }
+	CEventStats(CEventStats &source) {  }
+
+public:
+	// nIntervalSeconds = 0: statistics off.
+	void SetInterval(int nIntervalSeconds);
+	BOOL IsEnabled() { return m_nIntervalMs != 0; }
+
+	// Count one processed event. szObjClass may be empty.
+	void AddEvent(int nEventID, const char *szObjClass, EVENT_RESULT eResult);
+
+	// Write summary to log (and reset counters) if the interval has passed.
+	// Returns milliseconds until next summary is due (INFINITE if statistics off).
+	DWORD LogSummaryIfDue();
+
+	// Write summary to log now and reset counters.
+	void LogSummary();
+
+protected:
+	EVENTID_STATS *FindEventID(int nEventID);
+	OBJCLASS_STATS *FindObjClass(const char *szObjClass);
+
+	ULONGLONG m_nIntervalMs;
+	ULONGLONG m_nLastSummaryTick;
+
+	LONG m_narrTotal[EVT_RESULT_COUNT];
+	EVENTID_STATS m_sarrEventIDs[STATS_MAX_EVENTIDS];
+	int m_nNumEventIDs;
+	OBJCLASS_STATS m_sarrObjClasses[STATS_MAX_OBJCLASSES + 1];	// Last element = "(other)".
+	int m_nNumObjClasses;
+
+	CRITICAL_SECTION m_critsect;
+};
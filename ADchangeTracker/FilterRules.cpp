@@ -0,0 +1,505 @@
+// Accept and drop rules of the event filter - see FilterRules.h.
+// Note - portable C++, compiled without precompiled header.
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS		// sprintf is used with messages of known length.
+#endif
+#include "FilterRules.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+
+using namespace pugi;
+
+#define RULE_KEY_EMPTY		INT_MIN
+
+// Key of the rules for an EventID (-1: any) with the key field nField.
+static inline int EventKey(int nEventID, int nField)
+{
+	return ((nEventID + 1) << 5) | nField;
+}
+
+// Key of the values of a condition that is not a rule's key.
+static inline int ConditionKey(int nCondition)
+{
+	return -1 - nCondition;
+}
+
+static inline bool IsSpace(char_t c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static const char_t *SkipSpace(const char_t *p)
+{
+	while (IsSpace(*p))
+		p++;
+	return p;
+}
+
+// ASCII lower case - field values compared are names (LDAP display names, accounts, ...).
+static inline unsigned int FoldCase(char_t c)
+{
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : (unsigned int)c;
+}
+
+// FNV-1a of the folded value. Also returns its length.
+static unsigned int HashValue(const char_t *sz, size_t &nLen)
+{
+	unsigned int nHash = 2166136261u;
+	const char_t *p = sz;
+	for (; *p; p++)
+		nHash = (nHash ^ FoldCase(*p)) * 16777619u;
+	nLen = p - sz;
+	return nHash;
+}
+
+static inline unsigned int HashKey(int nKey, unsigned int nValueHash)
+{
+	unsigned int nHash = nValueHash ^ ((unsigned int)nKey * 0x9E3779B1u);
+	return nHash ^ (nHash >> 16);
+}
+
+// Smallest power of 2 table with at least 2 slots per entry.
+static size_t TableSize(size_t nEntries)
+{
+	size_t nSize = 8;
+	while (nSize < 2 * nEntries)
+		nSize *= 2;
+	return nSize;
+}
+
+static std::string ToUtf8(const char_t *sz)
+{
+#ifdef PUGIXML_WCHAR_MODE
+	return as_utf8(sz);
+#else
+	return sz;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// CFilterRules
+
+bool CFilterRules::SetError(const char *szError, const char_t *p)
+{
+	sprintf(m_szError, "%s at column %d", szError, (int)(p - m_pText) + 1);
+	return false;
+}
+
+// List of EventIDs and ranges separated by comma or space (spaces around , and - allowed).
+bool CFilterRules::ParseEventIDs(const char_t *&p, std::vector<int> &eventIDs)
+{
+	for (;;)
+	{
+		int narrRange[2] = { 0, 0 };
+		for (int i = 0; i < 2; i++)
+		{
+			p = SkipSpace(p);
+			if (*p < '0' || *p > '9')
+				return SetError("EventID expected", p);
+			for (; *p >= '0' && *p <= '9'; p++)
+			{
+				narrRange[i] = narrRange[i] * 10 + (*p - '0');
+				if (narrRange[i] > RULE_MAX_EVENTID)
+					return SetError("EventID above 65535", p);
+			}
+			p = SkipSpace(p);
+			if (i == 0)
+			{
+				if (*p != '-')
+				{
+					narrRange[1] = narrRange[0];
+					break;
+				}
+				p++;
+			}
+		}
+		if (narrRange[1] < narrRange[0])
+			return SetError("EventID range ends before it starts", p);
+		for (int nEventID = narrRange[0]; nEventID <= narrRange[1]; nEventID++)
+			eventIDs.push_back(nEventID);
+		if (*p == ',')
+			p++;
+		else if (*p < '0' || *p > '9')
+			return true;
+	}
+}
+
+// Values separated by comma, in double quotes if they have space or comma.
+bool CFilterRules::ParseValues(const char_t *&p, std::vector<RULE_STRING> &values)
+{
+	for (;;)
+	{
+		p = SkipSpace(p);
+		if (*p == '"')
+		{
+			const char_t *pValue = ++p;
+			while (*p && *p != '"')
+				p++;
+			if (!*p)
+				return SetError("Missing \" at end of value", pValue - 1);
+			values.push_back(RULE_STRING(pValue, p++));
+		}
+		else
+		{
+			const char_t *pValue = p;
+			while (*p && !IsSpace(*p) && *p != ',')
+				p++;
+			if (p == pValue)
+				return SetError("Value expected", p);
+			values.push_back(RULE_STRING(pValue, p));
+		}
+		p = SkipSpace(p);
+		if (*p != ',')
+			return true;
+		p++;
+	}
+}
+
+bool CFilterRules::AddRule(FILTER_RULE &rule, const std::vector<RULE_STRING> &fields)
+{
+	std::vector<RULE_STRING> allFields(m_fields);
+	for (size_t i = 0; i < rule.conditions.size(); i++)
+	{
+		RULE_CONDITION &condition = rule.conditions[i];
+		size_t nField = std::find(allFields.begin(), allFields.end(), fields[condition.nField])
+			- allFields.begin();
+		if (nField == allFields.size())
+		{
+			if (nField == RULE_MAX_FIELDS)
+			{
+				sprintf(m_szError, "Drop rules test more than %d fields", RULE_MAX_FIELDS);
+				return false;
+			}
+			allFields.push_back(fields[condition.nField]);
+		}
+		condition.nField = (int)nField;
+	}
+	m_fields.swap(allFields);
+	m_dropRules.push_back(rule);
+	return true;
+}
+
+bool CFilterRules::AddAcceptedEventIDs(const char_t *szList)
+{
+	m_pText = szList;
+	std::vector<int> eventIDs;
+	const char_t *p = szList;
+	if (!ParseEventIDs(p, eventIDs))
+		return false;
+	if (*p)
+		return SetError("EventID expected", p);
+	m_acceptedEventIDs.insert(m_acceptedEventIDs.end(), eventIDs.begin(), eventIDs.end());
+	return true;
+}
+
+bool CFilterRules::AddIgnoredObjClasses(const char_t *szList)
+{
+	std::vector<RULE_STRING> fields(1, PUGIXML_TEXT("ObjectClass"));
+	for (const char_t *p = szList; *p; )
+	{
+		while (IsSpace(*p) || *p == ',')
+			p++;
+		const char_t *pObjClass = p;
+		while (*p && !IsSpace(*p) && *p != ',')
+			p++;
+		if (p == pObjClass)
+			break;
+		FILTER_RULE rule;
+		for (int nEventID = 5136; nEventID <= 5141; nEventID++)
+			rule.eventIDs.push_back(nEventID);
+		RULE_CONDITION condition;
+		condition.nField = 0;
+		condition.values.push_back(RULE_STRING(pObjClass, p));
+		rule.conditions.push_back(condition);
+		rule.strText = "5136-5141 ObjectClass=" + ToUtf8(condition.values[0].c_str());
+		if (!AddRule(rule, fields))
+			return false;
+	}
+	return true;
+}
+
+bool CFilterRules::AddDropRule(const char_t *szRule)
+{
+	m_pText = szRule;
+	FILTER_RULE rule;
+	std::vector<RULE_STRING> fields;		// Of rule - condition i tests fields[i].
+	const char_t *p = SkipSpace(szRule);
+	if (*p == '*')
+		p = SkipSpace(p + 1);
+	else if (!ParseEventIDs(p, rule.eventIDs))
+		return false;
+	while (*p)
+	{
+		const char_t *pField = p;
+		while (*p && !IsSpace(*p) && *p != '=' && *p != ',')
+			p++;
+		if (p == pField)
+			return SetError("Field name expected", p);
+		RULE_STRING field(pField, p);
+		if (std::find(fields.begin(), fields.end(), field) != fields.end())
+			return SetError("Field is already in rule", pField);
+		if (field.compare(0, 7, PUGIXML_TEXT("System/")) == 0
+			&& (field.size() == 7 || field.find_first_of(PUGIXML_TEXT("/@[]\"'"), 7) != RULE_STRING::npos))
+			return SetError("System element name expected", pField + 7);
+		p = SkipSpace(p);
+		if (*p != '=')
+			return SetError("= expected", p);
+		p++;
+		RULE_CONDITION condition;
+		condition.nField = (int)fields.size();
+		if (!ParseValues(p, condition.values))
+			return false;
+		fields.push_back(field);
+		rule.conditions.push_back(condition);
+	}
+	RULE_STRING text(SkipSpace(szRule));
+	while (!text.empty() && IsSpace(text[text.size() - 1]))
+		text.erase(text.size() - 1);
+	rule.strText = ToUtf8(text.c_str());
+	return AddRule(rule, fields);
+}
+
+void CFilterRules::Clear()
+{
+	m_acceptedEventIDs.clear();
+	m_dropRules.clear();
+	m_fields.clear();
+	m_szError[0] = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// CDropRules
+
+CDropRules::CDropRules()
+{
+	m_parrHits = NULL;
+	CFilterRules none;
+	Compile(none);
+}
+
+CDropRules::~CDropRules()
+{
+	delete[] m_parrHits;
+}
+
+void CDropRules::Compile(const CFilterRules &rules)
+{
+	const std::vector<FILTER_RULE> &source = rules.GetDropRules();
+	m_fields = rules.GetFields();
+	m_rules.clear();
+	m_narrConditionFields.clear();
+	m_anyEventID.nEventID = -1;
+	m_anyEventID.nFieldMask = m_anyEventID.nKeyFieldMask = 0;
+	m_anyEventID.nDropAllRule = -1;
+
+	// Rules per key value, EventIDs - in maps first, then in hash tables.
+	std::map<std::pair<int, RULE_STRING>, std::vector<int> > values;
+	std::map<int, RULE_EVENTID> eventIDs;
+	for (size_t nRule = 0; nRule < source.size(); nRule++)
+	{
+		const FILTER_RULE &rule = source[nRule];
+		COMPILED_RULE compiled;
+		compiled.nFirstCondition = (int)m_narrConditionFields.size();
+		compiled.nNumConditions = (int)rule.conditions.size();
+		compiled.strText = rule.strText;
+		m_rules.push_back(compiled);
+
+		unsigned int nFieldMask = 0;
+		std::vector<std::pair<int, RULE_STRING> > conditionValues;	// Lower case.
+		for (size_t i = 0; i < rule.conditions.size(); i++)
+		{
+			const RULE_CONDITION &condition = rule.conditions[i];
+			int nCondition = (int)m_narrConditionFields.size();
+			m_narrConditionFields.push_back(condition.nField);
+			nFieldMask |= 1u << condition.nField;
+			for (size_t j = 0; j < condition.values.size(); j++)
+			{
+				RULE_STRING value(condition.values[j]);
+				for (size_t k = 0; k < value.size(); k++)
+					value[k] = (char_t)FoldCase(value[k]);
+				if (i == 0)
+					conditionValues.push_back(std::make_pair(condition.nField, value));
+				else
+					values[std::make_pair(ConditionKey(nCondition), value)];
+			}
+		}
+
+		size_t nNumEventIDs = rule.eventIDs.empty() ? 1 : rule.eventIDs.size();
+		for (size_t i = 0; i < nNumEventIDs; i++)
+		{
+			int nEventID = rule.eventIDs.empty() ? -1 : rule.eventIDs[i];
+			RULE_EVENTID *pEventID = &m_anyEventID;
+			if (nEventID >= 0)
+			{
+				if (eventIDs.find(nEventID) == eventIDs.end())
+				{
+					RULE_EVENTID empty = { nEventID, 0, 0, -1 };
+					eventIDs[nEventID] = empty;
+				}
+				pEventID = &eventIDs[nEventID];
+			}
+			pEventID->nFieldMask |= nFieldMask;
+			if (rule.conditions.empty())
+			{
+				if (pEventID->nDropAllRule < 0)
+					pEventID->nDropAllRule = (int)nRule;
+				continue;
+			}
+			pEventID->nKeyFieldMask |= 1u << rule.conditions[0].nField;
+			for (size_t j = 0; j < conditionValues.size(); j++)
+			{
+				std::vector<int> &keyRules = values[std::make_pair(
+					EventKey(nEventID, conditionValues[j].first), conditionValues[j].second)];
+				if (keyRules.empty() || keyRules.back() != (int)nRule)
+					keyRules.push_back((int)nRule);
+			}
+		}
+	}
+
+	// EventIDs - rules for any EventID apply too.
+	RULE_EVENTID emptyEventID = { -1, 0, 0, -1 };
+	m_eventIDs.assign(TableSize(eventIDs.size()), emptyEventID);
+	for (std::map<int, RULE_EVENTID>::iterator it = eventIDs.begin(); it != eventIDs.end(); ++it)
+	{
+		RULE_EVENTID eventID = it->second;
+		eventID.nFieldMask |= m_anyEventID.nFieldMask;
+		if (eventID.nDropAllRule < 0)
+			eventID.nDropAllRule = m_anyEventID.nDropAllRule;
+		size_t nSlot = ((unsigned int)eventID.nEventID * 0x9E3779B1u) & (m_eventIDs.size() - 1);
+		while (m_eventIDs[nSlot].nEventID >= 0)
+			nSlot = (nSlot + 1) & (m_eventIDs.size() - 1);
+		m_eventIDs[nSlot] = eventID;
+	}
+
+	// Values - interned, with their rules.
+	RULE_VALUE_KEY emptyValue = { RULE_KEY_EMPTY, 0, 0, 0, 0, 0 };
+	m_values.assign(TableSize(values.size()), emptyValue);
+	m_pool.clear();
+	m_narrRuleLists.clear();
+	typedef std::map<std::pair<int, RULE_STRING>, std::vector<int> >::iterator VALUE_ITERATOR;
+	for (VALUE_ITERATOR it = values.begin(); it != values.end(); ++it)
+	{
+		RULE_VALUE_KEY value;
+		size_t nLen;
+		value.nKey = it->first.first;
+		value.nHash = HashKey(value.nKey, HashValue(it->first.second.c_str(), nLen));
+		value.nOffset = (unsigned int)m_pool.size();
+		value.nLen = (unsigned int)nLen;
+		value.nFirstRule = (int)m_narrRuleLists.size();
+		value.nNumRules = (int)it->second.size();
+		m_pool.insert(m_pool.end(), it->first.second.begin(), it->first.second.end());
+		m_narrRuleLists.insert(m_narrRuleLists.end(), it->second.begin(), it->second.end());
+		size_t nSlot = value.nHash & (m_values.size() - 1);
+		while (m_values[nSlot].nKey != RULE_KEY_EMPTY)
+			nSlot = (nSlot + 1) & (m_values.size() - 1);
+		m_values[nSlot] = value;
+	}
+	m_pool.push_back(0);	// m_pool[0] is valid if there are no values.
+
+	delete[] m_parrHits;
+	m_parrHits = new std::atomic<unsigned long long>[m_rules.size()];
+	for (size_t i = 0; i < m_rules.size(); i++)
+		m_parrHits[i].store(0, std::memory_order_relaxed);
+}
+
+const CDropRules::RULE_EVENTID *CDropRules::FindEventID(int nEventID) const
+{
+	size_t nMask = m_eventIDs.size() - 1;
+	for (size_t nSlot = ((unsigned int)nEventID * 0x9E3779B1u) & nMask; ; nSlot = (nSlot + 1) & nMask)
+	{
+		const RULE_EVENTID &eventID = m_eventIDs[nSlot];
+		if (eventID.nEventID == nEventID)
+			return &eventID;
+		if (eventID.nEventID < 0)
+			return &m_anyEventID;
+	}
+}
+
+// Value of field nField of the event with key nKey (NULL if not in table or field not in event).
+const CDropRules::RULE_VALUE_KEY *CDropRules::FindValue(int nKey, const char_t *const *pszarrFields,
+	int nField, RULE_FIELD_HASHES &hashes) const
+{
+	const char_t *szValue = pszarrFields[nField];
+	if (!szValue)
+		return NULL;
+	if (!(hashes.nDone & (1u << nField)))
+	{
+		hashes.narrHash[nField] = HashValue(szValue, hashes.narrLen[nField]);
+		hashes.nDone |= 1u << nField;
+	}
+	unsigned int nHash = HashKey(nKey, hashes.narrHash[nField]);
+	size_t nLen = hashes.narrLen[nField], nMask = m_values.size() - 1;
+	for (size_t nSlot = nHash & nMask; ; nSlot = (nSlot + 1) & nMask)
+	{
+		const RULE_VALUE_KEY &value = m_values[nSlot];
+		if (value.nKey == RULE_KEY_EMPTY)
+			return NULL;
+		if (value.nHash == nHash && value.nKey == nKey && value.nLen == nLen)
+		{
+			const char_t *szInterned = &m_pool[value.nOffset];
+			size_t i = 0;
+			while (i < nLen && FoldCase(szValue[i]) == (unsigned int)szInterned[i])
+				i++;
+			if (i == nLen)
+				return &value;
+		}
+	}
+}
+
+// Conditions of rule other than its key.
+bool CDropRules::IsMatch(int nRule, const char_t *const *pszarrFields, RULE_FIELD_HASHES &hashes) const
+{
+	const COMPILED_RULE &rule = m_rules[nRule];
+	for (int i = 1; i < rule.nNumConditions; i++)
+	{
+		int nCondition = rule.nFirstCondition + i;
+		if (!FindValue(ConditionKey(nCondition), pszarrFields, m_narrConditionFields[nCondition], hashes))
+			return false;
+	}
+	return true;
+}
+
+int CDropRules::Hit(int nRule) const
+{
+	m_parrHits[nRule].fetch_add(1, std::memory_order_relaxed);
+	return nRule;
+}
+
+int CDropRules::Find(int nEventID, const char_t *const *pszarrFields) const
+{
+	if (m_rules.empty())
+		return -1;
+	const RULE_EVENTID *pEventID = FindEventID(nEventID);
+	if (pEventID->nDropAllRule >= 0)
+		return Hit(pEventID->nDropAllRule);
+
+	RULE_FIELD_HASHES hashes;
+	hashes.nDone = 0;
+	unsigned int nKeyFields = pEventID->nKeyFieldMask | m_anyEventID.nKeyFieldMask;
+	const RULE_EVENTID *parrEventIDs[2] = { pEventID != &m_anyEventID ? pEventID : NULL, &m_anyEventID };
+	for (int nField = 0; nKeyFields >> nField; nField++)
+	{
+		unsigned int nBit = 1u << nField;
+		if (!(nKeyFields & nBit) || !pszarrFields[nField])
+			continue;
+		for (int i = 0; i < 2; i++)
+		{
+			if (!parrEventIDs[i] || !(parrEventIDs[i]->nKeyFieldMask & nBit))
+				continue;
+			const RULE_VALUE_KEY *pValue = FindValue(EventKey(i == 0 ? nEventID : -1, nField),
+				pszarrFields, nField, hashes);
+			if (!pValue)
+				continue;
+			for (int j = 0; j < pValue->nNumRules; j++)
+			{
+				int nRule = m_narrRuleLists[pValue->nFirstRule + j];
+				if (IsMatch(nRule, pszarrFields, hashes))
+					return Hit(nRule);
+			}
+		}
+	}
+	return -1;
+}
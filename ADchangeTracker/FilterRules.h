@@ -0,0 +1,161 @@
+#pragma once
+// Accept and drop rules of the event filter - see CFilterRules (rules as in the .cfg file) and
+// CDropRules (compiled drop rules).
+// Note - this file (and FilterRules.cpp) is portable C++ and is also used by PipelineBench.
+// Do not include Windows headers here.
+#include "pugixml.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define RULE_MAX_EVENTID		65535
+#define RULE_MAX_FIELDS			24		// Different fields drop rules can test.
+#define RULE_ERROR_LEN			128
+
+typedef std::basic_string<pugi::char_t> RULE_STRING;
+
+// Drop rule (.cfg DropRule):
+//   <EventIDs> [<Field>=<Values> ...]
+// EventIDs  * (any) or a list of EventIDs and ranges, e.g. 5136-5141,4738.
+// Field     Name of an EventData Data element (e.g. AttributeLDAPDisplayName), or System/ and
+//           the name of a System element (e.g. System/Computer).
+// Values    One or more values separated by comma, e.g. lastLogonTimestamp,dnsRecord. A value
+//           with space or comma is written in double quotes.
+// An accepted event is dropped if its EventID is in the list and each field of the rule has
+// one of the values (not case sensitive - ASCII). A rule without fields drops all events with
+// the EventIDs. Examples:
+//   5136 AttributeLDAPDisplayName=lastLogonTimestamp,dnsRecord
+//   4738 SubjectUserName=svcProvisioning
+//   5136-5141 ObjectClass=dnsNode System/Computer="DC01.contoso.com"
+typedef struct tagRuleCondition
+{
+	int nField;							// Index in CFilterRules::GetFields.
+	std::vector<RULE_STRING> values;
+} RULE_CONDITION;
+
+typedef struct tagFilterRule
+{
+	std::vector<int> eventIDs;			// Empty - any EventID.
+	std::vector<RULE_CONDITION> conditions;	// One per field.
+	std::string strText;				// Rule as written (UTF-8) - for log.
+} FILTER_RULE;
+
+// Accepted EventIDs and drop rules as read from the .cfg file (any number of each).
+class CFilterRules
+{
+public:
+	CFilterRules() { m_pText = NULL; m_szError[0] = 0; }
+
+	// Each returns false if the text is not valid (nothing is added) - see GetError.
+	// szList = EventIDs and ranges separated by comma or space, e.g. 4720,4722-4726.
+	bool AddAcceptedEventIDs(const pugi::char_t *szList);
+	// szList = ObjectClasses separated by comma or space - adds the drop rule
+	// 5136-5141 ObjectClass=<ObjectClass> for each (.cfg IgnoredEvents).
+	bool AddIgnoredObjClasses(const pugi::char_t *szList);
+	bool AddDropRule(const pugi::char_t *szRule);
+	void Clear();
+
+	const char *GetError() const { return m_szError; }
+	const std::vector<int> &GetAcceptedEventIDs() const { return m_acceptedEventIDs; }
+	const std::vector<FILTER_RULE> &GetDropRules() const { return m_dropRules; }
+	// Fields tested by drop rules, e.g. ObjectClass, System/Computer (max RULE_MAX_FIELDS).
+	const std::vector<RULE_STRING> &GetFields() const { return m_fields; }
+
+protected:
+	bool ParseEventIDs(const pugi::char_t *&p, std::vector<int> &eventIDs);
+	bool ParseValues(const pugi::char_t *&p, std::vector<RULE_STRING> &values);
+	// Adds rule with field names in conditions (nField = index in fields).
+	bool AddRule(FILTER_RULE &rule, const std::vector<RULE_STRING> &fields);
+	bool SetError(const char *szError, const pugi::char_t *p);
+
+	std::vector<int> m_acceptedEventIDs;
+	std::vector<FILTER_RULE> m_dropRules;
+	std::vector<RULE_STRING> m_fields;
+	const pugi::char_t *m_pText;		// Text being parsed - for column in error.
+	char m_szError[RULE_ERROR_LEN];
+};
+
+// Hashes of the field values of one event - computed by CDropRules::Find when first needed.
+typedef struct tagRuleFieldHashes
+{
+	unsigned int nDone;					// Bit i: field i hashed.
+	unsigned int narrHash[RULE_MAX_FIELDS];
+	size_t narrLen[RULE_MAX_FIELDS];
+} RULE_FIELD_HASHES;
+
+// Drop rules compiled for a check per event that does not grow with the number of rules.
+// For each rule one condition is its key: a hash table maps (EventID, field, value) to the
+// rules with that key value, so the event's value of each key field is looked up once and
+// only the rules found are checked further (their other conditions are lookups of
+// (condition, value) in the same table). Values are interned lower case.
+// Compile once, then Find is const and can be called by any number of threads.
+class CDropRules
+{
+public:
+	CDropRules();
+	~CDropRules();
+
+private:	// Make assignment operator and copy constructor private to prevent
+			// accidental object copy.
+	void operator=(CDropRules &source) {  }
+	CDropRules(CDropRules &source) {  }
+
+public:
+	void Compile(const CFilterRules &rules);
+
+	int GetNumRules() const { return (int)m_rules.size(); }
+	int GetNumFields() const { return (int)m_fields.size(); }
+	const pugi::char_t *GetField(int nField) const { return m_fields[nField].c_str(); }
+	// Fields rules for the EventID test (bit i: field i) - the others need not be got.
+	unsigned int GetFieldMask(int nEventID) const { return FindEventID(nEventID)->nFieldMask; }
+
+	// Returns index of a rule that drops the event and counts a hit for it, -1 if no rule
+	// does. pszarrFields[i] = value of field i, NULL if not in event (only fields of
+	// GetFieldMask are read). If more rules match, the hit is counted for one of them.
+	int Find(int nEventID, const pugi::char_t *const *pszarrFields) const;
+
+	unsigned long long GetHits(int nRule) const { return m_parrHits[nRule].load(std::memory_order_relaxed); }
+	const char *GetRuleText(int nRule) const { return m_rules[nRule].strText.c_str(); }
+
+protected:
+	typedef struct tagRuleEventID
+	{
+		int nEventID;					// -1: slot is empty.
+		unsigned int nFieldMask;		// Fields of rules for EventID (and for any EventID).
+		unsigned int nKeyFieldMask;		// Key fields of rules for EventID.
+		int nDropAllRule;				// Rule without fields (-1 if none).
+	} RULE_EVENTID;
+
+	typedef struct tagRuleValueKey
+	{
+		int nKey;						// RULE_KEY_EMPTY: slot is empty.
+		unsigned int nHash;
+		unsigned int nOffset;			// Of value in m_pool.
+		unsigned int nLen;
+		int nFirstRule;					// Of rules in m_narrRuleLists.
+		int nNumRules;					// 0 for a value of a condition that is not a key.
+	} RULE_VALUE_KEY;
+
+	typedef struct tagCompiledRule
+	{
+		int nFirstCondition;			// Of fields in m_narrConditionFields - first is key.
+		int nNumConditions;
+		std::string strText;
+	} COMPILED_RULE;
+
+	const RULE_EVENTID *FindEventID(int nEventID) const;
+	const RULE_VALUE_KEY *FindValue(int nKey, const pugi::char_t *const *pszarrFields, int nField,
+		RULE_FIELD_HASHES &hashes) const;
+	bool IsMatch(int nRule, const pugi::char_t *const *pszarrFields, RULE_FIELD_HASHES &hashes) const;
+	int Hit(int nRule) const;
+
+	std::vector<RULE_STRING> m_fields;
+	std::vector<COMPILED_RULE> m_rules;
+	std::vector<int> m_narrConditionFields;
+	std::vector<RULE_EVENTID> m_eventIDs;		// Hash table of EventIDs with rules.
+	RULE_EVENTID m_anyEventID;					// Rules for any EventID (* rules).
+	std::vector<RULE_VALUE_KEY> m_values;		// Hash table.
+	std::vector<pugi::char_t> m_pool;			// Values (lower case).
+	std::vector<int> m_narrRuleLists;
+	std::atomic<unsigned long long> *m_parrHits;
+};
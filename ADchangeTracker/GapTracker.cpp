@@ -0,0 +1,302 @@
+#include "stdafx.h"
+#include "GapTracker.h"
+#include "LogSys.h"
+#include <algorithm>
+
+// Name used in Log when 'this' module logs.
+#define MOD_NAME "Gap tracker"
+
+static bool RangeFirstLess(ULONGLONG nID, const RECORDID_RANGE &range)
+{
+	return nID < range.nFirst;
+}
+
+BOOL CRecordIdRanges::Add(ULONGLONG nID, RECORDID_RANGE *pGap)
+{
+	if( m_vRanges.empty() )
+	{
+		AppendRange( nID, nID );
+		return FALSE;
+	}
+
+	// Fast path - next ID in order.
+	RECORDID_RANGE &last = m_vRanges.back();
+	if( nID == last.nLast + 1 )
+	{
+		last.nLast = nID;
+		return FALSE;
+	}
+	if( nID > last.nLast )
+	{	// New gap after last range.
+		pGap->nFirst = last.nLast + 1;
+		pGap->nLast = nID - 1;
+		AppendRange( nID, nID );
+		if( m_vRanges.size() > GAP_MAX_RANGES )
+			m_vRanges.erase( m_vRanges.begin() );	// Forget oldest gap.
+		return TRUE;
+	}
+
+	// Out of order - find first range starting after nID.
+	std::vector<RECORDID_RANGE>::iterator it =
+		std::upper_bound( m_vRanges.begin(), m_vRanges.end(), nID, RangeFirstLess );
+	if( it != m_vRanges.begin() )
+	{
+		std::vector<RECORDID_RANGE>::iterator prev = it - 1;
+		if( nID <= prev->nLast )
+			return FALSE;	// Already in set.
+		if( nID == prev->nLast + 1 )
+		{	// Extend previous range, merge with next if gap is closed.
+			prev->nLast = nID;
+			if( it != m_vRanges.end() && it->nFirst == nID + 1 )
+			{
+				prev->nLast = it->nLast;
+				m_vRanges.erase( it );
+			}
+			return FALSE;
+		}
+	}
+	if( it != m_vRanges.end() && it->nFirst == nID + 1 )
+	{
+		it->nFirst = nID;
+		return FALSE;
+	}
+	RECORDID_RANGE range = { nID, nID };
+	m_vRanges.insert( it, range );
+	return FALSE;
+}
+
+ULONGLONG CRecordIdRanges::GetMissingCount() const
+{
+	ULONGLONG nMissing = 0;
+	for( size_t i = 1; i < m_vRanges.size(); i++ )
+		nMissing += m_vRanges[i].nFirst - m_vRanges[i - 1].nLast - 1;
+	return nMissing;
+}
+
+void CRecordIdRanges::AppendRange(ULONGLONG nFirst, ULONGLONG nLast)
+{
+	RECORDID_RANGE range = { nFirst, nLast };
+	m_vRanges.push_back( range );
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+CGapTracker::CGapTracker()
+{
+	::InitializeCriticalSection( &m_critsect );
+	m_nNumSourceDCs = 0;
+	m_fLoaded = FALSE;
+	m_fChanged = FALSE;
+	m_nLastSaveTick = ::GetTickCount64();
+	m_pGapsGauge = NULL;
+	m_pMissingGauge = NULL;
+}
+
+CGapTracker::~CGapTracker()
+{
+	::DeleteCriticalSection( &m_critsect );
+}
+
+void CGapTracker::SetMetrics(CMetricCounter *pGapsGauge, CMetricCounter *pMissingGauge)
+{
+	m_pGapsGauge = pGapsGauge;
+	m_pMissingGauge = pMissingGauge;
+}
+
+// Note - caller must hold m_critsect. Returns NULL if too many SourceDCs.
+SOURCEDC_RANGES *CGapTracker::FindSourceDC(const char *szSourceDC)
+{
+	for( int i = 0; i < m_nNumSourceDCs; i++ )
+	{
+		if( _stricmp( m_sarrSourceDCs[i].szSourceDC, szSourceDC ) == 0 )
+			return &m_sarrSourceDCs[i];
+	}
+	if( m_nNumSourceDCs >= GAP_MAX_SOURCEDCS )
+		return NULL;
+	strncpy_s( m_sarrSourceDCs[m_nNumSourceDCs].szSourceDC, GAP_SOURCEDC_LEN, szSourceDC, _TRUNCATE );
+	m_sarrSourceDCs[m_nNumSourceDCs].ranges.Clear();
+	return &m_sarrSourceDCs[m_nNumSourceDCs++];
+}
+
+// Note - caller must hold m_critsect.
+void CGapTracker::UpdateMetrics()
+{
+	if( !m_pGapsGauge )
+		return;
+	ULONGLONG nGaps = 0, nMissing = 0;
+	for( int i = 0; i < m_nNumSourceDCs; i++ )
+	{
+		nGaps += m_sarrSourceDCs[i].ranges.GetNumGaps();
+		nMissing += m_sarrSourceDCs[i].ranges.GetMissingCount();
+	}
+	m_pGapsGauge->Set( nGaps );
+	m_pMissingGauge->Set( nMissing );
+}
+
+void CGapTracker::AddEvent(const char *szSourceDC, ULONGLONG nEventRecordID)
+{
+	::EnterCriticalSection( &m_critsect );
+	SOURCEDC_RANGES *pDC = FindSourceDC( szSourceDC );
+	RECORDID_RANGE gap;
+	if( pDC && pDC->ranges.Add( nEventRecordID, &gap ) )
+	{
+		char szNotes[128];
+		sprintf_s( szNotes, sizeof(szNotes), "EventRecordIDs %llu-%llu (%llu events) not stored",
+			gap.nFirst, gap.nLast, gap.nLast - gap.nFirst + 1 );
+		theLog.Warning( MOD_NAME, "EventRecordID gap detected", pDC->szSourceDC, szNotes );
+		UpdateMetrics();
+	}
+	m_fChanged = TRUE;
+	::LeaveCriticalSection( &m_critsect );
+}
+
+// File format - one range per line: SourceDC <tab> first EventRecordID <tab> last EventRecordID
+BOOL CGapTracker::Load(const char *szFile)
+{
+	::EnterCriticalSection( &m_critsect );
+	BOOL fReturn = TRUE;
+	FILE *pFile = NULL;
+	if( m_fLoaded )
+		goto cleanup;
+	m_fLoaded = TRUE;
+
+	if( fopen_s( &pFile, szFile, "r" ) != 0 )
+	{
+		theLog.Info( MOD_NAME, "EventRecordID range file not found", szFile );
+		goto cleanup;
+	}
+	char szLine[256], szSourceDC[GAP_SOURCEDC_LEN];
+	ULONGLONG nFirst, nLast;
+	int nRanges = 0;
+	while( fgets( szLine, sizeof(szLine), pFile ) )
+	{
+		if( szLine[0] == '#' )
+			continue;
+		if( sscanf_s( szLine, "%127[^\t]\t%llu\t%llu", szSourceDC, (unsigned)sizeof(szSourceDC),
+			&nFirst, &nLast ) != 3 || nFirst > nLast )
+		{
+			theLog.Warning( MOD_NAME, "Bad line in EventRecordID range file", szFile, szLine );
+			continue;
+		}
+		SOURCEDC_RANGES *pDC = FindSourceDC( szSourceDC );
+		if( pDC )
+		{
+			pDC->ranges.AppendRange( nFirst, nLast );
+			nRanges++;
+		}
+	}
+	fclose( pFile );
+
+	char szNotes[64];
+	sprintf_s( szNotes, sizeof(szNotes), "%d ranges", nRanges );
+	theLog.Info( MOD_NAME, "EventRecordID ranges loaded", szFile, szNotes );
+	UpdateMetrics();
+
+cleanup:
+	::LeaveCriticalSection( &m_critsect );
+	return fReturn;
+}
+
+// Write to temp file, then replace range file - a crash never leaves a partial file.
+BOOL CGapTracker::Save(const char *szFile)
+{
+	std::string str = "# EventRecordIDs delivered by ADchangeTracker: SourceDC <tab> first <tab> last\n";
+	char szLine[GAP_SOURCEDC_LEN + 64];
+
+	::EnterCriticalSection( &m_critsect );
+	for( int i = 0; i < m_nNumSourceDCs; i++ )
+	{
+		const std::vector<RECORDID_RANGE> &vRanges = m_sarrSourceDCs[i].ranges.GetRanges();
+		for( size_t j = 0; j < vRanges.size(); j++ )
+		{
+			sprintf_s( szLine, sizeof(szLine), "%s\t%llu\t%llu\n", m_sarrSourceDCs[i].szSourceDC,
+				vRanges[j].nFirst, vRanges[j].nLast );
+			str += szLine;
+		}
+	}
+	m_fChanged = FALSE;
+	m_nLastSaveTick = ::GetTickCount64();
+	::LeaveCriticalSection( &m_critsect );
+
+	char szTempFile[MAX_PATH];
+	strcpy_s( szTempFile, sizeof(szTempFile), szFile );
+	strcat_s( szTempFile, sizeof(szTempFile), ".tmp" );
+	HANDLE hFile = CreateFileA( szTempFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL );
+	if( INVALID_HANDLE_VALUE == hFile )
+	{
+		theLog.SysErr( MOD_NAME, "Create EventRecordID range file failed", szTempFile, GetLastError() );
+		return FALSE;
+	}
+	DWORD dwBytesWritten = 0;
+	BOOL fOk = WriteFile( hFile, str.c_str(), (DWORD)str.length(), &dwBytesWritten, NULL );
+	CloseHandle( hFile );
+	if( !fOk || !MoveFileExA( szTempFile, szFile, MOVEFILE_REPLACE_EXISTING ) )
+	{
+		theLog.SysErr( MOD_NAME, "Write EventRecordID range file failed", szFile, GetLastError() );
+		return FALSE;
+	}
+	return TRUE;
+}
+
+DWORD CGapTracker::SaveIfDue(const char *szFile)
+{
+	ULONGLONG nElapsed = ::GetTickCount64() - m_nLastSaveTick;
+	if( nElapsed < GAP_SAVE_INTERVAL_MS )
+		return (DWORD)(GAP_SAVE_INTERVAL_MS - nElapsed);
+
+	if( m_fChanged )
+		Save( szFile );
+	else m_nLastSaveTick = ::GetTickCount64();
+	return GAP_SAVE_INTERVAL_MS;
+}
+
+void CGapTracker::PrintGaps(const char *szFile)
+{
+	CGapTracker tracker;
+	FILE *pFile = NULL;
+	if( fopen_s( &pFile, szFile, "r" ) != 0 )
+	{
+		printf( "EventRecordID range file %s not found.\n", szFile );
+		return;
+	}
+	fclose( pFile );
+	tracker.Load( szFile );
+
+	// Gaps of the local DC can be backfilled if still in the local Security log.
+	char szLocalDC[GAP_SOURCEDC_LEN] = { 0 };
+	DWORD dwSize = sizeof(szLocalDC);
+	GetComputerNameExA( ComputerNameDnsFullyQualified, szLocalDC, &dwSize );
+	ULONGLONG nOldest = 0;
+	EVT_HANDLE hLog = EvtOpenLog( NULL, L"Security", EvtOpenChannelPath );
+	if( hLog )
+	{
+		EVT_VARIANT var;
+		DWORD dwUsed = 0;
+		if( EvtGetLogInfo( hLog, EvtLogOldestRecordNumber, sizeof(var), &var, &dwUsed ) )
+			nOldest = var.UInt64Val;
+		EvtClose( hLog );
+	}
+
+	for( int i = 0; i < tracker.m_nNumSourceDCs; i++ )
+	{
+		const SOURCEDC_RANGES &dc = tracker.m_sarrSourceDCs[i];
+		const std::vector<RECORDID_RANGE> &vRanges = dc.ranges.GetRanges();
+		BOOL fLocal = nOldest && _stricmp( dc.szSourceDC, szLocalDC ) == 0;
+		printf( "SourceDC %s: EventRecordIDs %llu-%llu, %u gaps, %llu events missing\n", dc.szSourceDC,
+			vRanges.front().nFirst, vRanges.back().nLast, (unsigned)dc.ranges.GetNumGaps(),
+			dc.ranges.GetMissingCount() );
+		for( size_t j = 1; j < vRanges.size(); j++ )
+		{
+			ULONGLONG nFirst = vRanges[j - 1].nLast + 1, nLast = vRanges[j].nFirst - 1;
+			const char *szState = !fLocal ? "" : nLast < nOldest ? " - lost (overwritten in Security log)"
+				: nFirst < nOldest ? " - partly in Security log" : " - in Security log";
+			printf( "  gap %llu-%llu (%llu events)%s\n", nFirst, nLast, nLast - nFirst + 1, szState );
+			if( fLocal && nLast >= nOldest )
+				printf( "    backfill query: *[System[EventRecordID>=%llu and EventRecordID<=%llu]]\n",
+					nFirst < nOldest ? nOldest : nFirst, nLast );
+		}
+	}
+	if( !tracker.m_nNumSourceDCs )
+		printf( "No EventRecordIDs in %s.\n", szFile );
+}
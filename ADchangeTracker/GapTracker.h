@@ -0,0 +1,94 @@
+#pragma once
+#include "Metrics.h"
+#include <vector>
+
+#define GAP_MAX_SOURCEDCS		16			// Max SourceDCs tracked (events from others are not tracked).
+#define GAP_SOURCEDC_LEN		128
+#define GAP_MAX_RANGES			65536		// Max ranges per SourceDC - oldest ranges are dropped.
+#define GAP_SAVE_INTERVAL_MS	60000		// Range file is saved every 60 seconds (if changed).
+#define GAP_FILE_NAME			"RecordIDs.txt"
+
+// Range of EventRecordIDs (inclusive).
+typedef struct tagRecordIdRange
+{
+	ULONGLONG nFirst;
+	ULONGLONG nLast;
+} RECORDID_RANGE;
+
+// Set of EventRecordIDs stored as a sorted list of ranges. Events are delivered in
+// EventRecordID order, so the list has one range per gap - a log with hundreds of millions
+// of records and no gaps is one range.
+class CRecordIdRanges
+{
+public:
+	// Add nID to set. Returns TRUE if nID is after the last range and not adjacent to it
+	// (a new gap), the gap is returned in pGap.
+	BOOL Add(ULONGLONG nID, RECORDID_RANGE *pGap);
+
+	// Number of IDs missing between first and last ID in set.
+	ULONGLONG GetMissingCount() const;
+	size_t GetNumGaps() const { return m_vRanges.empty() ? 0 : m_vRanges.size() - 1; }
+	const std::vector<RECORDID_RANGE> &GetRanges() const { return m_vRanges; }
+	void Clear() { m_vRanges.clear(); }
+
+	// Add a range read from file. Ranges must be added in order.
+	void AppendRange(ULONGLONG nFirst, ULONGLONG nLast);
+
+protected:
+	std::vector<RECORDID_RANGE> m_vRanges;
+};
+
+typedef struct tagSourceDcRanges
+{
+	char szSourceDC[GAP_SOURCEDC_LEN];
+	CRecordIdRanges ranges;
+} SOURCEDC_RANGES;
+
+// Tracks EventRecordIDs seen and delivered (bookmark updated) per SourceDC. A gap is
+// a range of EventRecordIDs never delivered - e.g. Security log wrapped while the service
+// was stopped, or an event failed to be sent to SQL. New gaps are logged as warnings.
+// The ranges are saved to GAP_FILE_NAME in the log folder, "ADchangeTracker -gaps" lists
+// the gaps from that file with the query to backfill them.
+class CGapTracker
+{
+public:
+	CGapTracker();
+	~CGapTracker();
+
+private:	// Make assignment operator and copy constructor private to prevent
+			// accidental object copy.
+	void operator=(CGapTracker &source) {  }
+	CGapTracker(CGapTracker &source) {  }
+
+public:
+	// Optional - number of gaps and missing IDs (all SourceDCs) are set in the gauges.
+	void SetMetrics(CMetricCounter *pGapsGauge, CMetricCounter *pMissingGauge);
+
+	void AddEvent(const char *szSourceDC, ULONGLONG nEventRecordID);
+
+	// Load ranges from file. Only done once - later calls keep the ranges in memory.
+	BOOL Load(const char *szFile);
+	BOOL Save(const char *szFile);
+
+	// Save to file if ranges changed and GAP_SAVE_INTERVAL_MS has passed.
+	// Returns milliseconds until next save is due.
+	DWORD SaveIfDue(const char *szFile);
+
+	// Print gaps from range file to stdout (for "-gaps" command line option).
+	static void PrintGaps(const char *szFile);
+
+protected:
+	SOURCEDC_RANGES *FindSourceDC(const char *szSourceDC);
+	void UpdateMetrics();
+
+	SOURCEDC_RANGES m_sarrSourceDCs[GAP_MAX_SOURCEDCS];
+	int m_nNumSourceDCs;
+	BOOL m_fLoaded;
+	BOOL m_fChanged;				// TRUE when ranges changed since last save.
+	ULONGLONG m_nLastSaveTick;
+
+	CMetricCounter *m_pGapsGauge;
+	CMetricCounter *m_pMissingGauge;
+
+	CRITICAL_SECTION m_critsect;
+};
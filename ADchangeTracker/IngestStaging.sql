@@ -0,0 +1,247 @@
+-- Optional staged ingest path for AD_DW (requires SQL Server 2016 or later).
+-- Run once on an existing AD_DW database after MoveEventXmlToSideTable.sql,
+-- then set StagedIngest = ON in ADchangeTracker.cfg on the domain controllers.
+--
+-- With staged ingest the service calls the natively compiled usp_ADchgEventStage,
+-- which only appends the event XML to the memory-optimized ADeventStaging table.
+-- No latches are taken on the ADevents indexes while events arrive in bursts.
+-- The SQL Agent job 'AD_DW - Move staged AD events' runs usp_MoveStagedADevents
+-- every minute, which moves the staged rows into ADevents in batches (one
+-- transaction and one set-based insert per batch). The columns are derived the
+-- same way as in usp_ADchgEventEx.
+--
+-- ADeventStaging is created with DURABILITY = SCHEMA_AND_DATA. The service
+-- advances its bookmark as soon as an event is staged, so with SCHEMA_ONLY
+-- any rows not yet moved are lost if SQL Server restarts. Use SCHEMA_ONLY only
+-- if that is acceptable for the extra throughput.
+
+USE [master]
+GO
+-- Natively compiled procedures need compatibility level 130 or higher; do not
+-- lower a database that is already at a higher level.
+IF (SELECT compatibility_level FROM sys.databases WHERE name = 'AD_DW') < 130
+	ALTER DATABASE [AD_DW] SET COMPATIBILITY_LEVEL = 130
+GO
+ALTER DATABASE [AD_DW] SET MEMORY_OPTIMIZED_ELEVATE_TO_SNAPSHOT = ON
+GO
+ALTER DATABASE [AD_DW] ADD FILEGROUP [AD_DW_mod] CONTAINS MEMORY_OPTIMIZED_DATA
+GO
+-- Memory-optimized container is placed in the same folder as the AD_DW data file.
+USE [AD_DW]
+GO
+DECLARE @Dir nvarchar(260), @SQL nvarchar(1000);
+SELECT @Dir = LEFT(physical_name, LEN(physical_name) - CHARINDEX('\', REVERSE(physical_name)) + 1)
+	FROM sys.database_files WHERE file_id = 1;
+SET @SQL = 'ALTER DATABASE [AD_DW] ADD FILE (NAME = N''AD_DW_mod'', FILENAME = N'''
+	+ @Dir + 'AD_DW_mod'') TO FILEGROUP [AD_DW_mod]';
+EXEC sp_executesql @SQL;
+GO
+
+SET ANSI_NULLS ON
+GO
+SET QUOTED_IDENTIFIER ON
+GO
+CREATE TABLE [dbo].[ADeventStaging](
+	[StageID] [bigint] IDENTITY(1,1) NOT NULL,
+	[StagedTime] [datetime2](7) NOT NULL,
+	[XmlData] [nvarchar](max) NOT NULL,
+ CONSTRAINT [PK_ADeventStaging] PRIMARY KEY NONCLUSTERED ([StageID] ASC)
+) WITH (MEMORY_OPTIMIZED = ON, DURABILITY = SCHEMA_AND_DATA)
+GO
+-- Staged events that usp_ADchgEventEx failed to store (e.g. malformed XML).
+CREATE TABLE [dbo].[ADeventStagingError](
+	[StageID] [bigint] NOT NULL,
+	[StagedTime] [datetime2](7) NOT NULL,
+	[ErrorTime] [datetime2](7) NOT NULL,
+	[ErrorMessage] [nvarchar](2048) NULL,
+	[XmlData] [nvarchar](max) NOT NULL,
+ CONSTRAINT [PK_ADeventStagingError] PRIMARY KEY CLUSTERED ([StageID] ASC)
+) ON [PRIMARY] TEXTIMAGE_ON [PRIMARY]
+GO
+
+-- =============================================
+-- Create date: 19.10.2026
+-- Description:	Receives AD changes event data as XML (staged ingest).
+-- Called from ADchangeTracker service when StagedIngest = ON.
+-- The XML is stored unchanged in ADeventStaging, columns are derived
+-- later by usp_MoveStagedADevents.
+-- =============================================
+CREATE PROCEDURE [dbo].[usp_ADchgEventStage]
+	@XmlData nvarchar(max)
+WITH NATIVE_COMPILATION, SCHEMABINDING, EXECUTE AS OWNER
+AS
+BEGIN ATOMIC WITH (TRANSACTION ISOLATION LEVEL = SNAPSHOT, LANGUAGE = N'us_english')
+	INSERT INTO dbo.ADeventStaging (StagedTime, XmlData)
+		VALUES (SYSUTCDATETIME(), @XmlData);
+END
+GO
+
+SET ANSI_NULLS ON
+GO
+SET QUOTED_IDENTIFIER ON
+GO
+-- =============================================
+-- Create date: 19.10.2026
+-- Description:	Move staged events from ADeventStaging into ADevents.
+-- Rows are moved @BatchSize at a time, each batch in one transaction with
+-- one INSERT ... SELECT into ADevents and one into ADeventXml. Columns are
+-- derived as in usp_ADchgEventEx; events already in ADevents are skipped.
+-- If a batch fails (e.g. malformed XML) it is retried one row at a time
+-- through usp_ADchgEventEx and rows that still fail are moved to
+-- ADeventStagingError.
+-- Runs until the staging table is empty or @MaxSeconds have passed.
+-- Returns number of rows moved.
+-- =============================================
+CREATE PROCEDURE [dbo].[usp_MoveStagedADevents]
+	@BatchSize int = 500,
+	@MaxSeconds int = 55,
+	@RowsMoved int = 0 OUTPUT
+AS
+BEGIN
+	SET NOCOUNT ON;
+	SET XACT_ABORT OFF;
+
+	DECLARE @Start datetime2 = SYSUTCDATETIME();
+	DECLARE @Batch TABLE (StageID bigint PRIMARY KEY, StagedTime datetime2(7), XmlData nvarchar(max));
+	DECLARE @Event TABLE (StageID bigint PRIMARY KEY, SourceDC nvarchar(128), EventRecordID bigint,
+		EventTime datetime2, EventID int, ObjClass nvarchar(128), [Target] nvarchar(256),
+		[Changes] nvarchar(256), ModifiedBy nvarchar(130), EventXml xml);
+	DECLARE @StageID bigint, @StagedTime datetime2(7), @XmlData nvarchar(max);
+	SET @RowsMoved = 0;
+
+	WHILE DATEDIFF(second, @Start, SYSUTCDATETIME()) < @MaxSeconds
+	BEGIN
+		DELETE FROM @Batch;
+		INSERT INTO @Batch (StageID, StagedTime, XmlData)
+			SELECT TOP (@BatchSize) StageID, StagedTime, XmlData
+			FROM dbo.ADeventStaging
+			ORDER BY StageID;
+		IF @@ROWCOUNT = 0
+			BREAK;
+
+		BEGIN TRY
+			-- Derive the ADevents columns of the whole batch.
+			DELETE FROM @Event;
+			;WITH XMLNAMESPACES ( DEFAULT 'http://schemas.microsoft.com/win/2004/08/events/event')
+			INSERT INTO @Event (StageID, SourceDC, EventRecordID, EventTime, EventID, ObjClass, [Target], [Changes], ModifiedBy, EventXml)
+				SELECT b.StageID, e.SourceDC, e.EventRecordID, e.EventTime, e.EventID,
+					CASE
+						WHEN e.EventID IN (4740, 4738, 4725, 4724, 4723, 4722, 4720, 4767) THEN 'user'
+						WHEN e.EventID IN (4781) THEN 'unknown'
+						WHEN e.EventID IN (4728, 4732, 4733, 4756) THEN 'group'
+						WHEN e.EventID IN (5136, 5137, 5139, 5141)
+							THEN x.x.value('(/Event/EventData/Data[@Name="ObjectClass"])[1]', 'nvarchar(64)')
+					END,
+					CASE
+						WHEN e.EventID IN (4740)
+							THEN x.x.value('(/Event/EventData/Data[@Name="SubjectDomainName"])[1]', 'nvarchar(64)') + '\'
+							+ x.x.value('(/Event/EventData/Data[@Name="TargetUserName"])[1]', 'nvarchar(64)')
+						WHEN e.EventID IN (4738, 4725, 4724, 4723, 4722, 4720, 4728, 4732, 4733, 4756, 4767)
+							THEN x.x.value('(/Event/EventData/Data[@Name="TargetDomainName"])[1]', 'nvarchar(64)') + '\'
+							+ x.x.value('(/Event/EventData/Data[@Name="TargetUserName"])[1]', 'nvarchar(64)')
+						WHEN e.EventID IN (4781)
+							THEN x.x.value('(/Event/EventData/Data[@Name="TargetDomainName"])[1]', 'nvarchar(64)') + '\'
+							+ x.x.value('(/Event/EventData/Data[@Name="OldTargetUserName"])[1]', 'nvarchar(64)')
+						WHEN e.EventID IN (5136, 5137, 5141)
+							THEN x.x.value('(/Event/EventData/Data[@Name="ObjectDN"])[1]', 'nvarchar(128)')
+						WHEN e.EventID IN (5139)
+							THEN x.x.value('(/Event/EventData/Data[@Name="OldObjectDN"])[1]', 'nvarchar(128)')
+						ELSE ''
+					END,
+					CAST(CASE
+						WHEN e.EventID IN (4740) THEN 'Calling computer: '
+							+ x.x.value('(/Event/EventData/Data[@Name="TargetDomainName"])[1]', 'nvarchar(128)')
+						WHEN e.EventID IN (4781) THEN 'NewTargetUserName: '
+							+ x.x.value('(/Event/EventData/Data[@Name="NewTargetUserName"])[1]', 'nvarchar(128)')
+						WHEN e.EventID IN (4728, 4756) THEN 'MemberName: '
+							+ x.x.value('(/Event/EventData/Data[@Name="MemberName"])[1]', 'nvarchar(128)')
+						WHEN e.EventID IN (4732, 4733) THEN 'MemberSID: '
+							+ x.x.value('(/Event/EventData/Data[@Name="MemberSid"])[1]', 'nvarchar(128)')
+						WHEN e.EventID IN (5139) THEN 'NewObjectDN: '
+							+ x.x.value('(/Event/EventData/Data[@Name="NewObjectDN"])[1]', 'nvarchar(128)')
+						WHEN e.EventID = 5136 THEN '('
+							+ CASE o.OpType WHEN '%%14674' THEN 'Value Added' WHEN '%%14675' THEN 'Value Deleted' ELSE o.OpType END
+							+ ') ' + x.x.value('(/Event/EventData/Data[@Name="AttributeLDAPDisplayName"])[1]', 'nvarchar(128)')
+							+ ': ' + x.x.value('(/Event/EventData/Data[@Name="AttributeValue"])[1]', 'nvarchar(128)')
+						ELSE ''
+					END AS nvarchar(256)),
+					x.x.value('(/Event/EventData/Data[@Name="SubjectDomainName"])[1]', 'nvarchar(64)') + '\'
+						+ x.x.value('(/Event/EventData/Data[@Name="SubjectUserName"])[1]', 'nvarchar(64)'),
+					x.x
+				FROM @Batch b
+				CROSS APPLY (SELECT CAST(b.XmlData AS xml) AS x) x
+				CROSS APPLY (SELECT
+					x.x.value('(/Event/System/Computer)[1]', 'nvarchar(128)') AS SourceDC,
+					x.x.value('(/Event/System/EventRecordID)[1]', 'bigint') AS EventRecordID,
+					x.x.value('(/Event/System/TimeCreated/@SystemTime)[1]', 'datetime2') AS EventTime,
+					x.x.value('(/Event/System/EventID)[1]', 'int') AS EventID) e
+				CROSS APPLY (SELECT
+					x.x.value('(/Event/EventData/Data[@Name="OperationType"])[1]', 'nvarchar(32)') AS OpType) o;
+
+			-- Skip events already processed, and repeats of an event within the batch.
+			DELETE e FROM @Event e
+				WHERE EXISTS (SELECT EventRecordID FROM dbo.ADevents a
+					WHERE a.EventRecordID = e.EventRecordID AND a.SourceDC = e.SourceDC);
+			;WITH Repeated AS (
+				SELECT ROW_NUMBER() OVER (PARTITION BY SourceDC, EventRecordID ORDER BY StageID) AS n
+				FROM @Event
+			)
+			DELETE FROM Repeated WHERE n > 1;
+
+			BEGIN TRANSACTION;
+			INSERT INTO dbo.ADevents (SourceDC, EventRecordID, EventTime, EventID, ObjClass, [Target], [Changes], ModifiedBy)
+				SELECT SourceDC, EventRecordID, EventTime, EventID, ObjClass, [Target], [Changes], ModifiedBy
+				FROM @Event
+				ORDER BY StageID;
+			INSERT INTO dbo.ADeventXml (SourceDC, EventRecordID, EventXml)
+				SELECT SourceDC, EventRecordID, EventXml
+				FROM @Event;
+			-- Delete exactly the rows moved - IDENTITY values can commit out of order, so
+			-- a row with a lower StageID may have been staged after the batch was read.
+			DELETE s FROM dbo.ADeventStaging s WHERE s.StageID IN (SELECT StageID FROM @Batch);
+			COMMIT TRANSACTION;
+		END TRY
+		BEGIN CATCH
+			IF @@TRANCOUNT > 0
+				ROLLBACK TRANSACTION;
+
+			-- Retry the batch one row at a time.
+			SET @StageID = 0;
+			WHILE 1 = 1
+			BEGIN
+				SELECT TOP (1) @StageID = StageID, @StagedTime = StagedTime, @XmlData = XmlData
+					FROM @Batch WHERE StageID > @StageID ORDER BY StageID;
+				IF @@ROWCOUNT = 0
+					BREAK;
+				BEGIN TRY
+					EXEC dbo.usp_ADchgEventEx @XmlData;
+				END TRY
+				BEGIN CATCH
+					IF @@TRANCOUNT > 0
+						ROLLBACK TRANSACTION;
+					INSERT INTO dbo.ADeventStagingError (StageID, StagedTime, ErrorTime, ErrorMessage, XmlData)
+						VALUES (@StageID, @StagedTime, SYSUTCDATETIME(), ERROR_MESSAGE(), @XmlData);
+				END CATCH
+				DELETE FROM dbo.ADeventStaging WHERE StageID = @StageID;
+			END
+		END CATCH
+
+		SELECT @RowsMoved = @RowsMoved + COUNT(*) FROM @Batch;
+	END
+	RETURN @RowsMoved;
+END
+GO
+
+-- SQL Agent job that runs usp_MoveStagedADevents every minute.
+USE [msdb]
+GO
+EXEC dbo.sp_add_job @job_name = N'AD_DW - Move staged AD events',
+	@description = N'Moves events staged by usp_ADchgEventStage into ADevents.';
+EXEC dbo.sp_add_jobstep @job_name = N'AD_DW - Move staged AD events',
+	@step_name = N'Move staged events', @subsystem = N'TSQL', @database_name = N'AD_DW',
+	@command = N'EXEC dbo.usp_MoveStagedADevents @BatchSize = 500, @MaxSeconds = 55;';
+EXEC dbo.sp_add_jobschedule @job_name = N'AD_DW - Move staged AD events',
+	@name = N'Every minute', @freq_type = 4, @freq_interval = 1,
+	@freq_subday_type = 4, @freq_subday_interval = 1;
+EXEC dbo.sp_add_jobserver @job_name = N'AD_DW - Move staged AD events';
+GO
@@ -0,0 +1,80 @@
+// Log time cache and text log record formatting - see LogFormat.h.
+// Note - portable C++, compiled without precompiled header.
+#include "LogFormat.h"
+#include <string.h>
+
+#ifdef _MSC_VER
+#define localtime_r(pt, ptm)	(localtime_s(ptm, pt) == 0 ? (ptm) : NULL)
+#define gmtime_r(pt, ptm)		(gmtime_s(ptm, pt) == 0 ? (ptm) : NULL)
+#define timegm					_mkgmtime
+#endif
+
+CLogTimeCache::CLogTimeCache()
+	: m_nSeq(0), m_nLock(0), m_tSecond(0), m_nUtcDate(0), m_tLocal(0)
+{
+	m_szTime[0] = 0;
+}
+
+void CLogTimeCache::GetLogTime(char *szTime, int *pnUtcDate, long long *ptLocal /*= NULL*/)
+{
+	time_t tNow = time(NULL);
+
+	unsigned nSeq = m_nSeq.load(std::memory_order_acquire);
+	if (!(nSeq & 1) && m_tSecond == tNow)
+	{
+		memcpy(szTime, m_szTime, LOG_TIME_LEN + 1);
+		*pnUtcDate = m_nUtcDate;
+		if (ptLocal)
+			*ptLocal = m_tLocal;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_nSeq.load(std::memory_order_relaxed) == nSeq)
+			return;	// Cache was not updated while we copied it.
+	}
+
+	// New second - format time and update the cache (if no other thread is updating it).
+	struct tm lt, ut;
+	localtime_r(&tNow, &lt);
+	gmtime_r(&tNow, &ut);
+	strftime(szTime, LOG_TIME_LEN + 1, "%Y-%m-%d %H:%M:%S", &lt);
+	*pnUtcDate = (ut.tm_year + 1900) * 10000 + (ut.tm_mon + 1) * 100 + ut.tm_mday;
+	long long tLocal = timegm(&lt);	// Local broken down time as if it was UTC.
+	if (ptLocal)
+		*ptLocal = tLocal;
+
+	int nUnlocked = 0;
+	if (m_nLock.compare_exchange_strong(nUnlocked, 1, std::memory_order_acquire))
+	{
+		m_nSeq.fetch_add(1, std::memory_order_relaxed);	// Odd = update in progress.
+		std::atomic_thread_fence(std::memory_order_release);
+		m_tSecond = tNow;
+		m_nUtcDate = *pnUtcDate;
+		m_tLocal = tLocal;
+		memcpy(m_szTime, szTime, LOG_TIME_LEN + 1);
+		m_nSeq.fetch_add(1, std::memory_order_release);
+		m_nLock.store(0, std::memory_order_release);
+	}
+}
+
+int FormatLogFields(char *pBuf, int nBufSize, const char *szThreadID, const char *szTime,
+	const char *szStaticColumns, const char *szModule, const char *szLogEvent,
+	const char *szLogLevel, const char *szDescription, const char *szNotes)
+{
+	// Note - 3 chars reserved for CRLF and terminating 0.
+	int nMax = nBufSize - 3;
+	int nPos = AppendToRecord(pBuf, 0, nMax, szThreadID);
+	nPos = AppendToRecord(pBuf, nPos, nMax, szTime);
+	nPos = AppendToRecord(pBuf, nPos, nMax, szStaticColumns);
+	nPos = AppendToRecord(pBuf, nPos, nMax, szModule);
+	nPos = AppendToRecord(pBuf, nPos, nMax, "\t");
+	nPos = AppendToRecord(pBuf, nPos, nMax, szLogLevel);
+	nPos = AppendToRecord(pBuf, nPos, nMax, "\t");
+	nPos = AppendToRecord(pBuf, nPos, nMax, szLogEvent);
+	nPos = AppendToRecord(pBuf, nPos, nMax, "\t");
+	nPos = AppendToRecord(pBuf, nPos, nMax, szDescription);
+	nPos = AppendToRecord(pBuf, nPos, nMax, "\t");
+	nPos = AppendToRecord(pBuf, nPos, nMax, szNotes);
+	pBuf[nPos++] = '\r';
+	pBuf[nPos++] = '\n';
+	pBuf[nPos] = 0;
+	return nPos;
+}
@@ -0,0 +1,46 @@
+#pragma once
+// Log time cache and text log record formatting - used by CLogSys (see LogSys.h).
+// Note - this file (and LogFormat.cpp) is portable C++ and is also used by LogBench.
+// Do not include Windows headers here.
+#include <atomic>
+#include <time.h>
+
+#define LOG_TIME_LEN		19		// Length of "YYYY-MM-DD HH:MM:SS".
+
+// Formatted log time - updated at most once per second.
+class CLogTimeCache
+{
+public:
+	CLogTimeCache();
+
+	// Get current local time as "YYYY-MM-DD HH:MM:SS" and UTC date as YYYYMMDD.
+	// ptLocal (optional) = local wall clock time as seconds since 1970.
+	// Note - the formatted time is cached and only re-formatted once per second.
+	void GetLogTime(char *szTime, int *pnUtcDate, long long *ptLocal = NULL);
+
+protected:
+	std::atomic<unsigned> m_nSeq;	// Odd while the cache is being updated.
+	std::atomic<int> m_nLock;		// 1 while a thread updates the cache.
+	time_t m_tSecond;				// Second the cache is valid for.
+	int m_nUtcDate;					// UTC date as YYYYMMDD (for daily log file rollover).
+	long long m_tLocal;				// Local wall clock time, seconds since 1970 (binary log).
+	char m_szTime[LOG_TIME_LEN + 1];	// Local time as "YYYY-MM-DD HH:MM:SS".
+};
+
+// Append string to log record - stops at nMax.
+inline int AppendToRecord(char *pBuf, int nPos, int nMax, const char *sz)
+{
+	if (sz)
+	{
+		while (*sz && nPos < nMax)
+			pBuf[nPos++] = *sz++;
+	}
+	return nPos;
+}
+
+// Format one text log record (incl. CRLF) into pBuf. Returns length of record.
+// szThreadID = "ThreadID\t" and szStaticColumns = "\tWorkStation\tUserName\t" are
+// preformatted by the caller. Long records are truncated.
+int FormatLogFields(char *pBuf, int nBufSize, const char *szThreadID, const char *szTime,
+	const char *szStaticColumns, const char *szModule, const char *szLogEvent,
+	const char *szLogLevel, const char *szDescription, const char *szNotes);
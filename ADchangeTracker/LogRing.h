@@ -0,0 +1,109 @@
+#pragma once
+// Bounded lock-free ring of log records: many producers, one consumer (the log flusher).
+// Each slot has a sequence number that tells if it is free or holds a published record
+// (as in Vyukov's bounded MPMC queue). Used by CLogSys for async logging.
+// Note - this file is portable C++ and is also used by LogBench.
+// Do not include Windows headers here.
+#include <atomic>
+#include <new>
+#include <stddef.h>
+
+#define LOG_RING_CACHE_LINE		64
+
+template<class T, unsigned N>	// N = number of slots (must be power of 2).
+class CLogRing
+{
+public:
+	CLogRing() : m_pSlots(NULL), m_nEnqueuePos(0), m_nDequeuePos(0) {}
+	~CLogRing() { Free(); }
+
+private:	// Make assignment operator and copy constructor private to prevent
+			// accidental object copy.
+	void operator=(CLogRing &source) {  }
+	CLogRing(CLogRing &source) {  }
+
+public:
+	// Allocate the slots (all free). Returns false if out of memory.
+	bool Alloc()
+	{
+		Free();
+		m_pSlots = new(std::nothrow) RING_SLOT[N];
+		if (!m_pSlots)
+			return false;
+		// Slot i is free for the producer that claims position i.
+		for (unsigned i = 0; i < N; i++)
+			m_pSlots[i].nSequence.store(i, std::memory_order_relaxed);
+		m_nEnqueuePos.store(0, std::memory_order_relaxed);
+		m_nDequeuePos.store(0, std::memory_order_release);
+		return true;
+	}
+
+	void Free()
+	{
+		delete[] m_pSlots;
+		m_pSlots = NULL;
+	}
+
+	// Producer: claim the next free slot. *pnPos is passed to Publish when the record
+	// has been written to the slot. Returns NULL if the ring is full.
+	T *Claim(unsigned *pnPos)
+	{
+		unsigned nPos = m_nEnqueuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			RING_SLOT *pSlot = &m_pSlots[nPos & (N - 1)];
+			int nDiff = (int)(pSlot->nSequence.load(std::memory_order_acquire) - nPos);
+			if (nDiff == 0)
+			{	// Slot is free - try to claim it (nPos is reloaded if another thread did).
+				if (m_nEnqueuePos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed))
+				{
+					*pnPos = nPos;
+					return &pSlot->record;
+				}
+			}
+			else if (nDiff < 0)
+				return NULL;	// Ring is full.
+			else nPos = m_nEnqueuePos.load(std::memory_order_relaxed);	// Another thread claimed the slot.
+		}
+	}
+
+	// Producer: hand the record in the slot claimed at nPos to the consumer.
+	void Publish(unsigned nPos)
+	{
+		m_pSlots[nPos & (N - 1)].nSequence.store(nPos + 1, std::memory_order_release);
+	}
+
+	// Consumer: record at nPos, or NULL if not published yet (or ring empty).
+	T *Peek(unsigned nPos)
+	{
+		RING_SLOT *pSlot = &m_pSlots[nPos & (N - 1)];
+		if (pSlot->nSequence.load(std::memory_order_acquire) != nPos + 1)
+			return NULL;
+		return &pSlot->record;
+	}
+
+	// Consumer: give the slot at nPos back to producers.
+	void Release(unsigned nPos)
+	{
+		m_pSlots[nPos & (N - 1)].nSequence.store(nPos + N, std::memory_order_release);
+	}
+
+	// Consumer: all records before nPos have been written.
+	void SetConsumed(unsigned nPos) { m_nDequeuePos.store(nPos, std::memory_order_release); }
+	unsigned GetConsumed() const { return m_nDequeuePos.load(std::memory_order_acquire); }
+
+protected:
+	struct RING_SLOT
+	{
+		std::atomic<unsigned> nSequence;
+		T record;
+	};
+
+	RING_SLOT *m_pSlots;
+	// Note - producer and consumer positions are kept on separate cache lines.
+	char m_padding1[LOG_RING_CACHE_LINE];
+	std::atomic<unsigned> m_nEnqueuePos;	// Next slot producers will claim.
+	char m_padding2[LOG_RING_CACHE_LINE - sizeof(std::atomic<unsigned>)];
+	std::atomic<unsigned> m_nDequeuePos;	// Next slot consumer will write.
+	char m_padding3[LOG_RING_CACHE_LINE - sizeof(std::atomic<unsigned>)];
+};
@@ -17,6 +17,23 @@ CLogSys::CLogSys(void)
 	m_hModule = 0;
 	m_nDaysToKeepOldLogFiles = 30;
 	memset(&m_stCurFileStartTime, 0, sizeof(SYSTEMTIME));
+	m_nCurFileUtcDate = 0;
+	m_szStaticColumns[0] = 0;
+
+	m_pWriteBuf = NULL;
+	m_nDroppedRecords = 0;
+	m_nQueueingThreads = 0;
+	m_fAsync = m_fStopFlusher = m_fDropWhenFull = FALSE;
+	m_hFlusherThread = m_hFlushRequest = NULL;
+
+	m_fBinaryFormat = FALSE;
+	m_pBinWriter = NULL;
+	m_hIndexFile = 0;
+
+	m_hMaintenanceThread = m_hMaintenanceRequest = NULL;
+	m_fStopMaintenance = m_fCompressOldLogFiles = FALSE;
+	m_nMaxLogFileSize = m_nCurFileSize = 0;
+	m_szCurLogFile[0] = 0;
 }
 
 void CLogSys::InitLogSys( HMODULE hModule, int nDaysToKeepOldLogFiles )
@@ -28,7 +45,10 @@ void CLogSys::InitLogSys( HMODULE hModule, int nDaysToKeepOldLogFiles )
 
 CLogSys::~CLogSys(void)
 {
+	StopAsyncLogging();
+	StopLogMaintenance();
 	SaveAndCloseLogFile();
+	delete m_pBinWriter;
 	::DeleteCriticalSection( &m_critsect );
 }
 
@@ -60,46 +80,322 @@ void CLogSys::Add2LogLvl( const char *szModule, const char *szLogEvent,
 	if( !m_hLogFile )
 		CreateNewLogFile();
 
+	if( m_fAsync )
+	{	// Note - m_nQueueingThreads lets StopAsyncLogging wait for threads queuing a record.
+		::InterlockedIncrement( &m_nQueueingThreads );
+		if( m_fAsync )
+		{
+			QueueLogRecord( szModule, szLogEvent, szLogLevel, szDescription, szNotes );
+			::InterlockedDecrement( &m_nQueueingThreads );
+			return;
+		}
+		::InterlockedDecrement( &m_nQueueingThreads );
+	}
+
+	if( m_fBinaryFormat )
+	{	// Note - the binary writer keeps state, so records are encoded in file order.
+		LOG_SLOT sSlot;
+		char szBinRecord[LOG_BIN_RECORD_SIZE];
+		PackLogFields( &sSlot, szModule, szLogEvent, szLogLevel, szDescription, szNotes );
+
+		::EnterCriticalSection( &m_critsect );
+
+		CheckLogFileRollover();
+		int nBinLen = EncodeBinaryRecord( &sSlot, szBinRecord, sizeof(szBinRecord) );
+		WriteToLogFile( szBinRecord, nBinLen );
+
+		::LeaveCriticalSection( &m_critsect );
+		return;
+	}
+
+	// Format record into one buffer, then write it with one call.
+	char szRecord[LOG_RECORD_SIZE];
+	int nLen = FormatLogRecord( szRecord, sizeof(szRecord), 
+		szModule, szLogEvent, szLogLevel, szDescription, szNotes );
+
 	::EnterCriticalSection( &m_critsect );
 
-	// Detect if current log file was created yesterday.
-	SYSTEMTIME now, &cur = m_stCurFileStartTime;
-	GetSystemTime(&now);
-	if (now.wYear != cur.wYear || now.wMonth != cur.wMonth || now.wDay != cur.wDay)
+	CheckLogFileRollover();
+	WriteToLogFile( szRecord, nLen );
+
+	::LeaveCriticalSection( &m_critsect );
+}
+
+// Detect if current log file was created yesterday or is full.
+// Note - only closes and creates a file, cleanup is done by the maintenance thread.
+void CLogSys::CheckLogFileRollover()
+{
+	char szTime[LOG_TIME_LEN + 1];
+	int nUtcDate;
+	m_timeCache.GetLogTime( szTime, &nUtcDate );
+	if( nUtcDate != m_nCurFileUtcDate )
 	{
 		CreateNewLogFile();	// Create new log file every day.
 	}
+	else if( m_nMaxLogFileSize && m_nCurFileSize >= m_nMaxLogFileSize )
+	{
+		CreateNewLogFile();	// and when the file is full.
+	}
+}
 
-	DWORD dwThreadID = ::GetCurrentThreadId();
-	char szThreadID[20];
-	sprintf_s( szThreadID, sizeof(szThreadID), "%u", dwThreadID );
-	WriteToLogFile( szThreadID );
-	WriteToLogFile( "\t" );
+// Thread ID column is formatted once per thread.
+static __declspec(thread) char t_szThreadID[16];
+static __declspec(thread) int t_nThreadIDLen = 0;
 
-	char szTM[128];
-	struct tm newtime;
-	time_t aclock;
-	time( &aclock );   // Get time in seconds
-	localtime_s( &newtime, &aclock );   // Convert time to struct tm form 
-	strftime( szTM, 128, "%Y-%m-%d %H:%M:%S", &newtime );
-	WriteToLogFile( szTM );
-	WriteToLogFile( "\t" );
-	WriteToLogFile( m_szWorkstationName );
-	WriteToLogFile( "\t" );
-	WriteToLogFile( m_szUserName );
-	WriteToLogFile( "\t" );
-	WriteToLogFile( szModule );
-	WriteToLogFile( "\t" );
-	WriteToLogFile( szLogLevel );
-	WriteToLogFile( "\t" );
-	WriteToLogFile( szLogEvent );
-	WriteToLogFile( "\t" );
-	WriteToLogFile( szDescription );
-	WriteToLogFile( "\t" );
-	WriteToLogFile( szNotes );
-	WriteToLogFile( "\r\n" );
+int CLogSys::FormatLogRecord( char *pBuf, int nBufSize, const char *szModule, 
+	const char *szLogEvent, const char *szLogLevel, const char *szDescription, 
+	const char *szNotes )
+{
+	if( !t_nThreadIDLen )
+		t_nThreadIDLen = sprintf_s( t_szThreadID, sizeof(t_szThreadID), "%u\t", ::GetCurrentThreadId() );
+
+	char szTime[LOG_TIME_LEN + 1];
+	int nUtcDate;
+	m_timeCache.GetLogTime( szTime, &nUtcDate );
+
+	return FormatLogFields( pBuf, nBufSize, t_szThreadID, szTime, m_szStaticColumns,
+		szModule, szLogEvent, szLogLevel, szDescription, szNotes );
+}
+
+// Store fields of a binary log record in slot as 5 zero terminated strings
+// (level, module, event, description, notes). Long fields are truncated.
+void CLogSys::PackLogFields( LOG_SLOT *pSlot, const char *szModule, const char *szLogEvent,
+	const char *szLogLevel, const char *szDescription, const char *szNotes )
+{
+	char szTime[LOG_TIME_LEN + 1];
+	int nUtcDate;
+	m_timeCache.GetLogTime( szTime, &nUtcDate, &pSlot->tLocal );
+	pSlot->dwThreadID = ::GetCurrentThreadId();
+	pSlot->nLen = 0;
+
+	const char *szarrFields[5] = { szLogLevel, szModule, szLogEvent, szDescription, szNotes };
+	int nPos = 0, nMax = sizeof(pSlot->szRecord) - 5;	// Room for the 5 terminating zeros.
+	for( int i = 0; i < 5; i++ )
+	{
+		nPos = AppendToRecord( pSlot->szRecord, nPos, nMax, szarrFields[i] );
+		pSlot->szRecord[nPos++] = 0;
+		nMax++;
+	}
+}
+
+// Encode fields packed in slot as binary record into pBuf. Returns length of record.
+// Index entries are written directly to the index file.
+// Note - caller must hold m_critsect. pBuf must hold LOG_BIN_RECORD_SIZE bytes.
+int CLogSys::EncodeBinaryRecord( const LOG_SLOT *pSlot, char *pBuf, int nBufSize )
+{
+	if( !m_pBinWriter )
+		return 0;
+
+	BINLOG_FIELDS sFields;
+	const char *sz = pSlot->szRecord;
+	sFields.tLocal = pSlot->tLocal;
+	sFields.nThreadID = pSlot->dwThreadID;
+	sFields.szLevel = sz;
+	sFields.szModule = sz += strlen( sz ) + 1;
+	sFields.szEvent = sz += strlen( sz ) + 1;
+	sFields.szDescription = sz += strlen( sz ) + 1;
+	sFields.szNotes = sz += strlen( sz ) + 1;
+
+	unsigned char idx[LOG_RECORD_SIZE + BINLOG_IDX_BLOCK_SIZE + 128];
+	int nIdxLen = 0;
+	int nLen = m_pBinWriter->EncodeRecord( &sFields, (unsigned char *)pBuf, nBufSize, 
+		idx, sizeof(idx), &nIdxLen );
+	if( nIdxLen )
+		WriteToIndexFile( idx, nIdxLen );
+	return nLen;
+}
+
+BOOL CLogSys::SetBinaryLogFormat(BOOL fBinary)
+{
+	if( m_fAsync )
+	{
+		Warning( "Log system", "Log format can't be changed while async logging is on" );
+		return FALSE;
+	}
+
+	::EnterCriticalSection( &m_critsect );
+
+	BOOL fRetVal = TRUE;
+	if( fBinary && !m_pBinWriter )
+	{
+		m_pBinWriter = new CBinLogWriter;
+	}
+	if( fBinary != m_fBinaryFormat )
+	{
+		m_fBinaryFormat = fBinary;
+		if( m_hLogFile )
+			fRetVal = CreateNewLogFile();	// Continue log in new format.
+	}
 
 	::LeaveCriticalSection( &m_critsect );
+	return fRetVal;
+}
+
+BOOL CLogSys::StartAsyncLogging(BOOL fDropWhenFull)
+{
+	if( m_fAsync )
+		return TRUE;
+
+	m_pWriteBuf = (char *)malloc( LOG_WRITE_BUF_SIZE );
+	if( !m_ring.Alloc() || !m_pWriteBuf )
+	{
+		Error( "Log system", "Failed to allocate memory for async logging" );
+		goto failed;
+	}
+	m_nDroppedRecords = 0;
+	m_fDropWhenFull = fDropWhenFull;
+	m_fStopFlusher = FALSE;
+
+	m_hFlushRequest = ::CreateEvent( NULL, FALSE, FALSE, NULL );
+	if( !m_hFlushRequest )
+	{
+		SysErr( "Log system", "Create log flush event failed", "", GetLastError() );
+		goto failed;
+	}
+	m_hFlusherThread = ::CreateThread( NULL, 0, FlusherThreadProc, this, 0, NULL );
+	if( !m_hFlusherThread )
+	{
+		SysErr( "Log system", "Create log flusher thread failed", "", GetLastError() );
+		goto failed;
+	}
+	m_fAsync = TRUE;
+	Info( "Log system", "Async logging started", fDropWhenFull ? "Drop when full" : "Block when full" );
+	return TRUE;
+
+failed:
+	if( m_hFlushRequest )
+		::CloseHandle( m_hFlushRequest );
+	m_hFlushRequest = NULL;
+	m_ring.Free();
+	free( m_pWriteBuf );
+	m_pWriteBuf = NULL;
+	return FALSE;
+}
+
+void CLogSys::StopAsyncLogging()
+{
+	if( !m_fAsync )
+		return;
+
+	// New records are written directly to file from now on.
+	m_fAsync = FALSE;
+	// Note - full fence so the store above is visible before m_nQueueingThreads is read
+	// (pairs with InterlockedIncrement before the m_fAsync check in Add2LogLvl).
+	::MemoryBarrier();
+	while( m_nQueueingThreads > 0 )
+		::Sleep( 1 );
+
+	// Flusher writes what is left in the ring before it exits.
+	m_fStopFlusher = TRUE;
+	::SetEvent( m_hFlushRequest );
+	::WaitForSingleObject( m_hFlusherThread, INFINITE );
+	::CloseHandle( m_hFlusherThread );
+	m_hFlusherThread = NULL;
+	::CloseHandle( m_hFlushRequest );
+	m_hFlushRequest = NULL;
+
+	m_ring.Free();
+	free( m_pWriteBuf );
+	m_pWriteBuf = NULL;
+}
+
+// Claim a slot in the ring (multi-producer), format record into it and publish it.
+void CLogSys::QueueLogRecord( const char *szModule, const char *szLogEvent, 
+	const char *szLogLevel, const char *szDescription, const char *szNotes )
+{
+	LOG_SLOT *pSlot;
+	unsigned nPos;
+	while( (pSlot = m_ring.Claim( &nPos )) == NULL )
+	{	// Ring is full.
+		if( m_fDropWhenFull )
+		{
+			::InterlockedIncrement( &m_nDroppedRecords );
+			return;
+		}
+		::SetEvent( m_hFlushRequest );
+		::Sleep( 1 );
+	}
+
+	if( m_fBinaryFormat )
+		PackLogFields( pSlot, szModule, szLogEvent, szLogLevel, szDescription, szNotes );
+	else
+		pSlot->nLen = FormatLogRecord( pSlot->szRecord, sizeof(pSlot->szRecord), 
+			szModule, szLogEvent, szLogLevel, szDescription, szNotes );
+
+	// Publish record to the flusher.
+	m_ring.Publish( nPos );
+}
+
+DWORD WINAPI CLogSys::FlusherThreadProc(LPVOID pParam)
+{
+	((CLogSys *)pParam)->FlusherLoop();
+	return 0;
+}
+
+void CLogSys::FlusherLoop()
+{
+	while( !m_fStopFlusher )
+	{
+		::WaitForSingleObject( m_hFlushRequest, 100 );
+		DrainRing();
+	}
+	DrainRing();
+}
+
+// Write all published records to file, coalesced into as few WriteFile calls as possible.
+// Note - only called by the flusher thread (single consumer). m_critsect is held while
+// draining, so binary records are encoded and written to the same file.
+void CLogSys::DrainRing()
+{
+	::EnterCriticalSection( &m_critsect );
+	CheckLogFileRollover();
+
+	unsigned nPos = m_ring.GetConsumed();
+	DWORD dwBufUsed = 0;
+	for( ;; )
+	{
+		LOG_SLOT *pSlot = m_ring.Peek( nPos );
+		if( !pSlot )
+			break;	// Ring empty (or record not published yet).
+		int nMaxLen = pSlot->nLen ? pSlot->nLen : LOG_BIN_RECORD_SIZE;
+		if( dwBufUsed + nMaxLen > LOG_WRITE_BUF_SIZE )
+		{
+			WriteToLogFile( m_pWriteBuf, dwBufUsed );
+			dwBufUsed = 0;
+		}
+		if( pSlot->nLen )
+		{
+			memcpy( m_pWriteBuf + dwBufUsed, pSlot->szRecord, pSlot->nLen );
+			dwBufUsed += pSlot->nLen;
+		}
+		else dwBufUsed += EncodeBinaryRecord( pSlot, m_pWriteBuf + dwBufUsed, LOG_BIN_RECORD_SIZE );
+
+		// Release slot to producers.
+		m_ring.Release( nPos );
+		nPos++;
+	}
+	if( dwBufUsed )
+		WriteToLogFile( m_pWriteBuf, dwBufUsed );
+	m_ring.SetConsumed( nPos );
+
+	LONG nDropped = ::InterlockedExchange( &m_nDroppedRecords, 0 );
+	if( nDropped )
+	{
+		char szRecord[LOG_BIN_RECORD_SIZE], szDropped[32];
+		sprintf_s( szDropped, sizeof(szDropped), "%d", nDropped );
+		int nLen;
+		if( m_fBinaryFormat )
+		{
+			LOG_SLOT sSlot;
+			PackLogFields( &sSlot, "Log system", "Log records dropped - async log ring full", 
+				"Warning", szDropped, 0 );
+			nLen = EncodeBinaryRecord( &sSlot, szRecord, sizeof(szRecord) );
+		}
+		else nLen = FormatLogRecord( szRecord, sizeof(szRecord), "Log system", 
+			"Log records dropped - async log ring full", "Warning", szDropped, 0 );
+		WriteToLogFile( szRecord, nLen );
+	}
+	::LeaveCriticalSection( &m_critsect );
 }
 
 void CLogSys::SysErr( const char *szModule, const char *szLogEvent, 
@@ -144,6 +440,140 @@ void CLogSys::SetDaysToKeepOldLogFiles(int nDays)
 	::LeaveCriticalSection( &m_critsect );
 }
 
+void CLogSys::SetLogRotation(int nMaxFileSizeMB, BOOL fCompressOldFiles)
+{
+	::EnterCriticalSection( &m_critsect );
+
+	m_nMaxLogFileSize = nMaxFileSizeMB > 0 ? (ULONGLONG)nMaxFileSizeMB * 1024 * 1024 : 0;
+	m_fCompressOldLogFiles = fCompressOldFiles;
+
+	::LeaveCriticalSection( &m_critsect );
+
+	RequestLogMaintenance();
+}
+
+// Wake up the maintenance thread (started on first call).
+void CLogSys::RequestLogMaintenance()
+{
+	::EnterCriticalSection( &m_critsect );
+
+	// Note - log file path is not known until Init has been called.
+	if( !m_hMaintenanceThread && !m_fStopMaintenance && m_fInit )
+	{
+		m_hMaintenanceRequest = ::CreateEvent( NULL, FALSE, FALSE, NULL );
+		if( m_hMaintenanceRequest )
+			m_hMaintenanceThread = ::CreateThread( NULL, 0, MaintenanceThreadProc, this, 0, NULL );
+		if( !m_hMaintenanceThread )
+		{	// Note - no logging here, we may be called while a new log file is created.
+			if( m_hMaintenanceRequest )
+				::CloseHandle( m_hMaintenanceRequest );
+			m_hMaintenanceRequest = NULL;
+		}
+	}
+	if( m_hMaintenanceRequest )
+		::SetEvent( m_hMaintenanceRequest );
+
+	::LeaveCriticalSection( &m_critsect );
+}
+
+void CLogSys::StopLogMaintenance()
+{
+	::EnterCriticalSection( &m_critsect );
+	HANDLE hThread = m_hMaintenanceThread;
+	m_fStopMaintenance = TRUE;
+	if( m_hMaintenanceRequest )
+		::SetEvent( m_hMaintenanceRequest );
+	::LeaveCriticalSection( &m_critsect );
+
+	if( !hThread )
+		return;
+	// Note - critical section is not held while waiting, the thread may be logging.
+	::WaitForSingleObject( hThread, INFINITE );
+	::CloseHandle( hThread );
+	::CloseHandle( m_hMaintenanceRequest );
+	m_hMaintenanceThread = m_hMaintenanceRequest = NULL;
+}
+
+DWORD WINAPI CLogSys::MaintenanceThreadProc(LPVOID pParam)
+{
+	((CLogSys *)pParam)->MaintenanceLoop();
+	return 0;
+}
+
+// Delete and compress old log files. Runs when a log file has been closed and every hour.
+void CLogSys::MaintenanceLoop()
+{
+	::SetThreadPriority( ::GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL );
+	while( !m_fStopMaintenance )
+	{
+		DeleteOldLogFiles( m_nDaysToKeepOldLogFiles );	// Delete Log files older than X days
+
+		if( m_fCompressOldLogFiles )
+		{
+			int nCompressed = CompressOldLogFiles();
+			if( nCompressed )
+			{
+				char sz[32];
+				sprintf_s( sz, sizeof(sz), "%d", nCompressed );
+				Info( "Log system", "Old log files compressed", sz );
+			}
+		}
+		::WaitForSingleObject( m_hMaintenanceRequest, 3600 * 1000 );
+	}
+}
+
+// NTFS compress log files not already compressed, except the current log file.
+// Returns number of files compressed.
+int CLogSys::CompressOldLogFiles()
+{
+	char szCurFile[MAX_PATH];
+	::EnterCriticalSection( &m_critsect );
+	strcpy_s( szCurFile, sizeof(szCurFile), m_szCurLogFile );
+	::LeaveCriticalSection( &m_critsect );
+	// Current index file has same name as current log file (up to the '.').
+	size_t nCurBaseLen = strlen( szCurFile );
+	while( nCurBaseLen > 0 && szCurFile[nCurBaseLen] != '.' )
+		nCurBaseLen--;
+
+	int nCompressed = 0;
+	char szFile[MAX_PATH];
+	char szDirSrch[MAX_PATH];
+	const char *szarrExt[] = { "*.log", "*.blog", "*.bidx" };
+	for( int i = 0; i < (int)(sizeof(szarrExt) / sizeof(szarrExt[0])) && !m_fStopMaintenance; i++ )
+	{
+		strcpy_s( szDirSrch, sizeof(szDirSrch), m_szLogFilenameBase );
+		strcat_s( szDirSrch, sizeof(szDirSrch), szarrExt[i] );
+
+		WIN32_FIND_DATAA stFindFileData;
+		HANDLE hFileFind = ::FindFirstFileA( szDirSrch, &stFindFileData );
+		if( hFileFind == INVALID_HANDLE_VALUE )
+			continue;
+		do
+		{
+			if( stFindFileData.dwFileAttributes & FILE_ATTRIBUTE_COMPRESSED )
+				continue;
+			strcpy_s( szFile, sizeof(szFile), m_szLogFilePath );
+			strcat_s( szFile, sizeof(szFile), stFindFileData.cFileName );
+			if( nCurBaseLen && _strnicmp( szFile, szCurFile, nCurBaseLen + 1 ) == 0 )
+				continue;	// File currently written to.
+
+			// Note - fails with sharing violation if the file is still open for writing.
+			HANDLE hFile = ::CreateFileA( szFile, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+			if( hFile == INVALID_HANDLE_VALUE )
+				continue;
+			USHORT nFormat = COMPRESSION_FORMAT_DEFAULT;
+			DWORD dwBytesReturned;
+			if( ::DeviceIoControl( hFile, FSCTL_SET_COMPRESSION, &nFormat, sizeof(nFormat),
+				NULL, 0, &dwBytesReturned, NULL ) )
+				nCompressed++;
+			::CloseHandle( hFile );
+		} while( !m_fStopMaintenance && ::FindNextFileA( hFileFind, &stFindFileData ) != 0 );
+		::FindClose( hFileFind );
+	}
+	return nCompressed;
+}
+
 BOOL CLogSys::CreateNewLogFile()
 {
 	::EnterCriticalSection( &m_critsect );
@@ -151,8 +581,6 @@ BOOL CLogSys::CreateNewLogFile()
 	if( !m_fInit )
 		Init();
 
-	DeleteOldLogFiles(m_nDaysToKeepOldLogFiles);	// Delete Log files older than X days
-
 	BOOL fRetVal = TRUE;
 
 	if( m_hLogFile )
@@ -169,26 +597,60 @@ BOOL CLogSys::CreateNewLogFile()
 	char szFileName[MAX_PATH];
 	strcpy_s( szFileName, sizeof(szFileName), m_szLogFilenameBase );
 	strcat_s(szFileName, sizeof(szFileName), szTM);
-	strcat_s(szFileName, sizeof(szFileName), ".log");
+	const char *szExt = m_fBinaryFormat ? ".blog" : ".log";
+	if( _strnicmp( szFileName, m_szCurLogFile, strlen(szFileName) ) == 0 )
+	{	// File rotated by size within the same second - add a sequence number.
+		size_t nLen = strlen( szFileName );
+		for( int nSeq = 2; nSeq < 1000; nSeq++ )
+		{
+			sprintf_s( &szFileName[nLen], sizeof(szFileName) - nLen, "_%d%s", nSeq, szExt );
+			if( ::GetFileAttributesA( szFileName ) == INVALID_FILE_ATTRIBUTES )
+				break;
+		}
+		szFileName[strlen(szFileName) - strlen(szExt)] = 0;
+	}
+	strcat_s(szFileName, sizeof(szFileName), szExt);
+	strcpy_s( m_szCurLogFile, sizeof(m_szCurLogFile), szFileName );
+	m_nCurFileSize = 0;
 
 	m_hLogFile = ::CreateFileA( szFileName, GENERIC_WRITE, FILE_SHARE_READ, NULL,
 		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( m_hLogFile != INVALID_HANDLE_VALUE && m_fBinaryFormat )
+	{	// Sparse index file "*.bidx" next to the binary log file.
+		strcpy_s( &szFileName[strlen(szFileName) - 4], 5, "bidx" );
+		m_hIndexFile = ::CreateFileA( szFileName, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+			CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+		if( m_hIndexFile == INVALID_HANDLE_VALUE )
+			m_hIndexFile = 0;
+	}
 	if( m_hLogFile == INVALID_HANDLE_VALUE )
 	{
 		m_hLogFile = 0;
 		memset(&m_stCurFileStartTime, 0, sizeof(SYSTEMTIME));
+		m_nCurFileUtcDate = 0;
 		fRetVal = FALSE;
 	}
 	else
 	{	
 		GetSystemTime(&m_stCurFileStartTime);	// Save create time for current file.
+		m_nCurFileUtcDate = m_stCurFileStartTime.wYear * 10000 
+			+ m_stCurFileStartTime.wMonth * 100 + m_stCurFileStartTime.wDay;
 
 		// Write header to log file.
-		WriteToLogFile( 
-			"ThreadID\tLogDate\tWorkStation\tUserName\tModule\tLogLevel\tLogEvent\tDescription\tNotes\r\n" );
+		if( m_fBinaryFormat )
+		{
+			unsigned char header[512];
+			int nLen = m_pBinWriter->BeginFile( header, sizeof(header), 
+				m_szWorkstationName, m_szUserName );
+			WriteToLogFile( (const char *)header, nLen );
+		}
+		else WriteToLogFile( BINLOG_HEADER_LINE );
 	}
 
 	::LeaveCriticalSection( &m_critsect );
+
+	// Delete / compress old log files in the background.
+	RequestLogMaintenance();
 	return fRetVal;
 }
 
@@ -196,8 +658,6 @@ void CLogSys::DeleteOldLogFiles( int nOlderThanXdays )
 {
 	char szDelFile[MAX_PATH];
 	char szDirSrch[MAX_PATH];
-	strcpy_s( szDirSrch, sizeof(szDirSrch), m_szLogFilenameBase );
-	strcat_s( szDirSrch, sizeof(szDirSrch), "*.log" );
 
 	// Calculate 'now' - 30 days as FILETIME data structure.
 	SYSTEMTIME stCurSysTime;
@@ -218,20 +678,28 @@ void CLogSys::DeleteOldLogFiles( int nOlderThanXdays )
 	// Impl. note - to specify a 64bit constant the 'i64' integer suffix can be used.
 	// But - '10000000i64' just seems ugly :)
 
-	WIN32_FIND_DATAA stFindFileData;
-	HANDLE hFileFind = ::FindFirstFileA( szDirSrch, &stFindFileData );
-	if( hFileFind != INVALID_HANDLE_VALUE )
+	// Text log files, binary log files and their index files.
+	const char *szarrExt[] = { "*.log", "*.blog", "*.bidx" };
+	for( int i = 0; i < (int)(sizeof(szarrExt) / sizeof(szarrExt[0])); i++ )
 	{
-		do
-		{	// Is file older then X days.
-			if( ::CompareFileTime( &stFindFileData.ftCreationTime, &stFT ) < 0 )
-			{
-				strcpy_s( szDelFile, sizeof(szDelFile), m_szLogFilePath );
-				strcat_s( szDelFile, sizeof(szDelFile), stFindFileData.cFileName );
-				::DeleteFileA( szDelFile );
-			}
-		} while( ::FindNextFileA( hFileFind, &stFindFileData ) != 0 );
-		::FindClose( hFileFind );
+		strcpy_s( szDirSrch, sizeof(szDirSrch), m_szLogFilenameBase );
+		strcat_s( szDirSrch, sizeof(szDirSrch), szarrExt[i] );
+
+		WIN32_FIND_DATAA stFindFileData;
+		HANDLE hFileFind = ::FindFirstFileA( szDirSrch, &stFindFileData );
+		if( hFileFind != INVALID_HANDLE_VALUE )
+		{
+			do
+			{	// Is file older then X days.
+				if( ::CompareFileTime( &stFindFileData.ftCreationTime, &stFT ) < 0 )
+				{
+					strcpy_s( szDelFile, sizeof(szDelFile), m_szLogFilePath );
+					strcat_s( szDelFile, sizeof(szDelFile), stFindFileData.cFileName );
+					::DeleteFileA( szDelFile );
+				}
+			} while( ::FindNextFileA( hFileFind, &stFindFileData ) != 0 );
+			::FindClose( hFileFind );
+		}
 	}
 }
 
@@ -239,6 +707,16 @@ void CLogSys::SaveAndCloseLogFile()
 {
 	::EnterCriticalSection( &m_critsect );
 
+	if( m_hIndexFile )
+	{	// Index entry for the last block of records in file.
+		unsigned char idx[BINLOG_IDX_BLOCK_SIZE + 1];
+		int nIdxLen = m_pBinWriter ? m_pBinWriter->FinishBlock( idx, sizeof(idx) ) : 0;
+		if( nIdxLen )
+			WriteToIndexFile( idx, nIdxLen );
+		::CloseHandle( m_hIndexFile );
+	}
+	m_hIndexFile = 0;
+
 	if( m_hLogFile )
 		::CloseHandle( m_hLogFile );
 	m_hLogFile = 0;
@@ -251,12 +729,31 @@ void CLogSys::WriteToLogFile( const char *szString )
 	if( !szString )
 		return;
 
+	WriteToLogFile( szString, strlen( szString ) );
+}
+
+void CLogSys::WriteToLogFile( const char *pData, DWORD dwLen )
+{
 	::EnterCriticalSection( &m_critsect );
 
 	if( m_hLogFile )
 	{
 		DWORD dwBytesWritten;
-		::WriteFile( m_hLogFile, szString, strlen( szString ), &dwBytesWritten, NULL );
+		::WriteFile( m_hLogFile, pData, dwLen, &dwBytesWritten, NULL );
+		m_nCurFileSize += dwLen;
+	}
+
+	::LeaveCriticalSection( &m_critsect );
+}
+
+void CLogSys::WriteToIndexFile( const unsigned char *pData, DWORD dwLen )
+{
+	::EnterCriticalSection( &m_critsect );
+
+	if( m_hIndexFile )
+	{
+		DWORD dwBytesWritten;
+		::WriteFile( m_hIndexFile, pData, dwLen, &dwBytesWritten, NULL );
 	}
 
 	::LeaveCriticalSection( &m_critsect );
@@ -322,6 +819,10 @@ void CLogSys::Init()
 	}
 
 	strcpy_s(m_szUserName, sizeof(m_szUserName), m_szLoggedOnUsername);
+
+	// Workstation and user name columns never change - preformat them.
+	sprintf_s(m_szStaticColumns, sizeof(m_szStaticColumns), "\t%s\t%s\t", 
+		m_szWorkstationName, m_szUserName);
 	strcpy_s(m_szApplication, sizeof(m_szApplication), m_szAppFilename);
 	nLen = strlen(m_szApplication);
 	if (nLen)
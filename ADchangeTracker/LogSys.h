@@ -1,5 +1,25 @@
 #pragma once
 
+#include "BinLog.h"
+#include "LogFormat.h"
+#include "LogRing.h"
+
+#define LOG_RING_SIZE		1024	// Number of slots in the async log ring (must be power of 2).
+#define LOG_RECORD_SIZE		2048	// Max length of one formatted log record (longer is truncated).
+#define LOG_WRITE_BUF_SIZE	65536	// Size of buffer used to coalesce records before WriteFile.
+#define LOG_BIN_RECORD_SIZE	(2 * LOG_RECORD_SIZE + 256)	// Max length of one binary record.
+
+// One record in the async log ring (see LogRing.h).
+// Text format: szRecord holds the formatted record, nLen is its length.
+// Binary format: nLen = 0 and szRecord holds the fields (see CLogSys::PackLogFields).
+typedef struct tagLogSlot
+{
+	int nLen;
+	long long tLocal;
+	DWORD dwThreadID;
+	char szRecord[LOG_RECORD_SIZE];
+} LOG_SLOT;
+
 class CLogSys
 {	// NOTE - only one instance of this object should be instantiated.
 public:
@@ -20,8 +40,14 @@ public:
 	// Create new log file in same directory as .exe file.
 	// If an log file is open it is closed.
 	// Log file will be named as: "exefilename_YYYY-MM-DD_HH-MM-SS.log"
+	// (".blog" and index file ".bidx" in binary format).
 	BOOL CreateNewLogFile();
 
+	// Write log in compact binary format (see BinLog.h) instead of tab separated text.
+	// Use ADlogTool to decode or query binary log files.
+	// Note - call before StartAsyncLogging. A new log file is created if one is open.
+	BOOL SetBinaryLogFormat(BOOL fBinary);
+
 	void DeleteOldLogFiles( int nOlderThanXdays );
 
 	// Add to log - 'Info' level.
@@ -52,12 +78,80 @@ public:
 	char *GetLogPath() { return m_szLogFilePath; }
 
 	// Set number of days to keep old log files (mi.n is 1 day).
-	// Note - old files are deleted when CreateNewLogFile is called.
+	// Note - old files are deleted by the log maintenance thread when a new log file
+	// is created and once every hour.
 	void SetDaysToKeepOldLogFiles(int nDays);
 
+	// Start a new log file when the current file reaches nMaxFileSizeMB (0 = only at
+	// day change). fCompressOldFiles = TRUE: NTFS compress log files that are no longer
+	// written to (done by the log maintenance thread).
+	void SetLogRotation(int nMaxFileSizeMB, BOOL fCompressOldFiles);
+
+	// Stop the log maintenance thread (waits for current cleanup to finish).
+	void StopLogMaintenance();
+
+	// Start asynchronous logging. Log records are formatted by the calling thread into
+	// a slot of a lock-free ring and written to file by a background (flusher) thread.
+	// fDropWhenFull = TRUE: records are dropped (and counted) when the ring is full.
+	// fDropWhenFull = FALSE: the calling thread waits until there is room in the ring.
+	BOOL StartAsyncLogging(BOOL fDropWhenFull);
+
+	// Write all queued records to file and stop the flusher thread.
+	void StopAsyncLogging();
+
 protected:
 	void SaveAndCloseLogFile();
 	void WriteToLogFile( const char *szString );
+	void WriteToLogFile( const char *pData, DWORD dwLen );
+
+	// Format one log record (incl. CRLF) into pBuf. Returns length of record.
+	int FormatLogRecord( char *pBuf, int nBufSize, const char *szModule, const char *szLogEvent,
+		const char *szLogLevel, const char *szDescription, const char *szNotes );
+
+	// Async logging.
+	void QueueLogRecord( const char *szModule, const char *szLogEvent, const char *szLogLevel,
+		const char *szDescription, const char *szNotes );
+	static DWORD WINAPI FlusherThreadProc(LPVOID pParam);
+	void FlusherLoop();
+	void DrainRing();
+	void CheckLogFileRollover();
+
+	// Log maintenance (retention cleanup and compression of old log files).
+	void RequestLogMaintenance();
+	static DWORD WINAPI MaintenanceThreadProc(LPVOID pParam);
+	void MaintenanceLoop();
+	int CompressOldLogFiles();
+	HANDLE m_hMaintenanceThread;
+	HANDLE m_hMaintenanceRequest;		// Signaled when a log file has been closed.
+	volatile BOOL m_fStopMaintenance;
+	volatile BOOL m_fCompressOldLogFiles;
+	ULONGLONG m_nMaxLogFileSize;		// Bytes, 0 = no size limit.
+	ULONGLONG m_nCurFileSize;			// Bytes written to current log file.
+	char m_szCurLogFile[MAX_PATH];		// Full path of current log file.
+
+	// Binary format.
+	void PackLogFields( LOG_SLOT *pSlot, const char *szModule, const char *szLogEvent,
+		const char *szLogLevel, const char *szDescription, const char *szNotes );
+	int EncodeBinaryRecord( const LOG_SLOT *pSlot, char *pBuf, int nBufSize );
+	void WriteToIndexFile( const unsigned char *pData, DWORD dwLen );
+	BOOL m_fBinaryFormat;
+	CBinLogWriter *m_pBinWriter;
+	HANDLE m_hIndexFile;
+
+	CLogTimeCache m_timeCache;
+	int m_nCurFileUtcDate;				// UTC date of current log file as YYYYMMDD.
+	char m_szStaticColumns[260];		// "\tWorkStation\tUserName\t" - preformatted.
+
+	CLogRing<LOG_SLOT, LOG_RING_SIZE> m_ring;
+	char *m_pWriteBuf;
+	volatile LONG m_nDroppedRecords;
+	volatile LONG m_nQueueingThreads;	// Threads currently in QueueLogRecord.
+	volatile BOOL m_fAsync;
+	volatile BOOL m_fStopFlusher;
+	BOOL m_fDropWhenFull;
+	HANDLE m_hFlusherThread;
+	HANDLE m_hFlushRequest;		// Signaled to make flusher drain the ring now.
+
 	HANDLE m_hLogFile;
 	SYSTEMTIME m_stCurFileStartTime;
 	int m_nDaysToKeepOldLogFiles;	// Default is 30 days
@@ -0,0 +1,265 @@
+// Metrics registry - see Metrics.h.
+// Note - portable C++, compiled without precompiled header.
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS		// sprintf is used with buffers of known size.
+#endif
+#include "Metrics.h"
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <time.h>
+#endif
+
+unsigned long long MetricsNowNs()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER s_nFreq = { 0 };
+	if (!s_nFreq.QuadPart)
+		::QueryPerformanceFrequency(&s_nFreq);	// Note - same value on all threads.
+	LARGE_INTEGER nCounter;
+	::QueryPerformanceCounter(&nCounter);
+	// Split to avoid overflow of nCounter * 1e9.
+	unsigned long long nSec = nCounter.QuadPart / s_nFreq.QuadPart;
+	unsigned long long nRem = nCounter.QuadPart % s_nFreq.QuadPart;
+	return nSec * 1000000000ULL + nRem * 1000000000ULL / s_nFreq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// Index of most significant bit set (n > 0).
+static inline int MostSignificantBit(unsigned long long n)
+{
+#ifdef _MSC_VER
+	unsigned long nIndex;
+	if (_BitScanReverse(&nIndex, (unsigned long)(n >> 32)))
+		return (int)nIndex + 32;
+	_BitScanReverse(&nIndex, (unsigned long)n);
+	return (int)nIndex;
+#else
+	return 63 - __builtin_clzll(n);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+CMetric::CMetric(METRIC_TYPE eType, const char *szName, const char *szLabels, const char *szHelp)
+{
+	m_eType = eType;
+	m_szName[0] = m_szLabels[0] = m_szHelp[0] = 0;
+	strncat(m_szName, szName, METRIC_NAME_LEN - 1);
+	if (szLabels)
+		strncat(m_szLabels, szLabels, METRIC_LABELS_LEN - 1);
+	if (szHelp)
+		strncat(m_szHelp, szHelp, METRIC_HELP_LEN - 1);
+}
+
+CMetricCounter::CMetricCounter(METRIC_TYPE eType, const char *szName, const char *szLabels,
+	const char *szHelp) : CMetric(eType, szName, szLabels, szHelp), m_nValue(0)
+{
+}
+
+CMetricHistogram::CMetricHistogram(const char *szName, const char *szLabels, const char *szHelp,
+	int nExportMinExp /*= HIST_EXPORT_MIN_EXP*/, int nExportMaxExp /*= HIST_EXPORT_MAX_EXP*/)
+	: CMetric(METRIC_HISTOGRAM, szName, szLabels, szHelp), m_nExportMinExp(nExportMinExp),
+	m_nExportMaxExp(nExportMaxExp), m_nCount(0), m_nSum(0), m_nMax(0)
+{
+	for (int i = 0; i < HIST_NUM_BUCKETS; i++)
+		m_narrBuckets[i].store(0, std::memory_order_relaxed);
+}
+
+int CMetricHistogram::BucketIndex(unsigned long long nValue)
+{
+	if (nValue < HIST_SUB_BUCKETS)
+		return (int)nValue;
+	int nExp = MostSignificantBit(nValue);
+	int nSub = (int)(nValue >> (nExp - HIST_SUB_BUCKET_BITS)) & (HIST_SUB_BUCKETS - 1);
+	return (nExp - HIST_SUB_BUCKET_BITS + 1) * HIST_SUB_BUCKETS + nSub;
+}
+
+unsigned long long CMetricHistogram::BucketUpperBound(int nIndex)
+{
+	if (nIndex < HIST_SUB_BUCKETS)
+		return (unsigned long long)nIndex + 1;
+	int nExp = nIndex / HIST_SUB_BUCKETS + HIST_SUB_BUCKET_BITS - 1;
+	int nSub = nIndex % HIST_SUB_BUCKETS;
+	if (nExp == 63 && nSub == HIST_SUB_BUCKETS - 1)
+		return ~0ULL;
+	return (unsigned long long)(HIST_SUB_BUCKETS + nSub + 1) << (nExp - HIST_SUB_BUCKET_BITS);
+}
+
+unsigned long long CMetricHistogram::ValueAtQuantile(double q) const
+{
+	unsigned long long nCount = Count();
+	if (!nCount)
+		return 0;
+	unsigned long long nTarget = (unsigned long long)(q * nCount + 0.5);
+	if (nTarget < 1)
+		nTarget = 1;
+	unsigned long long nSeen = 0;
+	for (int i = 0; i < HIST_NUM_BUCKETS; i++)
+	{
+		nSeen += m_narrBuckets[i].load(std::memory_order_relaxed);
+		if (nSeen >= nTarget)
+		{	// Note - never above the max value recorded.
+			unsigned long long nUpper = BucketUpperBound(i), nMax = Max();
+			return nUpper < nMax ? nUpper : nMax;
+		}
+	}
+	return Max();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+CMetricsRegistry::CMetricsRegistry()
+{
+	m_nNumMetrics = 0;
+	memset(m_parrMetrics, 0, sizeof(m_parrMetrics));
+}
+
+CMetricsRegistry::~CMetricsRegistry()
+{
+	for (int i = 0; i < m_nNumMetrics; i++)
+		delete m_parrMetrics[i];
+}
+
+bool CMetricsRegistry::Add(CMetric *pMetric)
+{
+	if (m_nNumMetrics >= METRICS_MAX)
+	{
+		delete pMetric;
+		return false;
+	}
+	m_parrMetrics[m_nNumMetrics++] = pMetric;
+	return true;
+}
+
+CMetricCounter *CMetricsRegistry::AddCounter(const char *szName, const char *szLabels, const char *szHelp)
+{
+	CMetricCounter *p = new CMetricCounter(METRIC_COUNTER, szName, szLabels, szHelp);
+	return Add(p) ? p : NULL;
+}
+
+CMetricCounter *CMetricsRegistry::AddGauge(const char *szName, const char *szLabels, const char *szHelp)
+{
+	CMetricCounter *p = new CMetricCounter(METRIC_GAUGE, szName, szLabels, szHelp);
+	return Add(p) ? p : NULL;
+}
+
+CMetricHistogram *CMetricsRegistry::AddHistogram(const char *szName, const char *szLabels, const char *szHelp,
+	int nExportMinExp /*= HIST_EXPORT_MIN_EXP*/, int nExportMaxExp /*= HIST_EXPORT_MAX_EXP*/)
+{
+	CMetricHistogram *p = new CMetricHistogram(szName, szLabels, szHelp, nExportMinExp, nExportMaxExp);
+	return Add(p) ? p : NULL;
+}
+
+// "name{labels,extra}" - braces only if there are labels.
+static void AppendSeries(std::string &str, const char *szName, const char *szSuffix,
+	const char *szLabels, const char *szExtraLabel)
+{
+	str += szName;
+	str += szSuffix;
+	if (szLabels[0] || szExtraLabel[0])
+	{
+		str += '{';
+		str += szLabels;
+		if (szLabels[0] && szExtraLabel[0])
+			str += ',';
+		str += szExtraLabel;
+		str += '}';
+	}
+	str += ' ';
+}
+
+static void AppendHelpAndType(std::string &str, const char *szName, const char *szSuffix,
+	const char *szHelp, const char *szType)
+{
+	str += "# HELP ";
+	str += szName;
+	str += szSuffix;
+	str += ' ';
+	str += szHelp;
+	str += "\n# TYPE ";
+	str += szName;
+	str += szSuffix;
+	str += ' ';
+	str += szType;
+	str += '\n';
+}
+
+void CMetricsRegistry::Export(std::string &str) const
+{
+	static const char *s_szarrType[] = { "counter", "gauge", "histogram" };
+	static const double s_darrQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	char sz[64];
+
+	for (int i = 0; i < m_nNumMetrics; i++)
+	{
+		const CMetric *pMetric = m_parrMetrics[i];
+		bool fFirstOfFamily = i == 0 || strcmp(m_parrMetrics[i - 1]->m_szName, pMetric->m_szName) != 0;
+		if (fFirstOfFamily)
+			AppendHelpAndType(str, pMetric->m_szName, "", pMetric->m_szHelp, s_szarrType[pMetric->m_eType]);
+
+		if (pMetric->m_eType != METRIC_HISTOGRAM)
+		{
+			AppendSeries(str, pMetric->m_szName, "", pMetric->m_szLabels, "");
+			sprintf(sz, "%llu\n", ((const CMetricCounter *)pMetric)->Get());
+			str += sz;
+			continue;
+		}
+
+		// Cumulative buckets. Note - buckets are read without a lock, so a value recorded
+		// during export may be in _count but not in a bucket (or the other way round).
+		const CMetricHistogram *pHist = (const CMetricHistogram *)pMetric;
+		unsigned long long nCumulative = 0;
+		int nBucket = 0;
+		for (int nExp = pHist->m_nExportMinExp; nExp <= pHist->m_nExportMaxExp; nExp++)
+		{
+			unsigned long long nBound = 1ULL << nExp;
+			for (; nBucket < HIST_NUM_BUCKETS && CMetricHistogram::BucketUpperBound(nBucket) <= nBound; nBucket++)
+				nCumulative += pHist->m_narrBuckets[nBucket].load(std::memory_order_relaxed);
+			char szLe[32];
+			sprintf(szLe, "le=\"%.9g\"", nBound / 1e9);
+			AppendSeries(str, pMetric->m_szName, "_bucket", pMetric->m_szLabels, szLe);
+			sprintf(sz, "%llu\n", nCumulative);
+			str += sz;
+		}
+		unsigned long long nCount = pHist->Count();
+		AppendSeries(str, pMetric->m_szName, "_bucket", pMetric->m_szLabels, "le=\"+Inf\"");
+		sprintf(sz, "%llu\n", nCount);
+		str += sz;
+		AppendSeries(str, pMetric->m_szName, "_sum", pMetric->m_szLabels, "");
+		sprintf(sz, "%.9f\n", pHist->Sum() / 1e9);
+		str += sz;
+		AppendSeries(str, pMetric->m_szName, "_count", pMetric->m_szLabels, "");
+		sprintf(sz, "%llu\n", nCount);
+		str += sz;
+	}
+
+	// Quantile gauges for histograms (separate family per histogram name).
+	for (int i = 0; i < m_nNumMetrics; i++)
+	{
+		const CMetric *pMetric = m_parrMetrics[i];
+		if (pMetric->m_eType != METRIC_HISTOGRAM)
+			continue;
+		if (i == 0 || strcmp(m_parrMetrics[i - 1]->m_szName, pMetric->m_szName) != 0)
+			AppendHelpAndType(str, pMetric->m_szName, "_quantile",
+				"Latency quantiles since service start (histogram resolution 12.5%).", "gauge");
+		const CMetricHistogram *pHist = (const CMetricHistogram *)pMetric;
+		for (int q = 0; q < (int)(sizeof(s_darrQuantiles) / sizeof(s_darrQuantiles[0])); q++)
+		{
+			char szQuantile[32];
+			sprintf(szQuantile, "quantile=\"%g\"", s_darrQuantiles[q]);
+			AppendSeries(str, pMetric->m_szName, "_quantile", pMetric->m_szLabels, szQuantile);
+			sprintf(sz, "%.9g\n", pHist->ValueAtQuantile(s_darrQuantiles[q]) / 1e9);
+			str += sz;
+		}
+	}
+}
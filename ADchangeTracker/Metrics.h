@@ -0,0 +1,128 @@
+#pragma once
+// In-process metrics registry: lock-free counters and latency histograms, exported in
+// Prometheus text format.
+// Note - this file (and Metrics.cpp) is portable C++ and is also used by MetricsBench.
+// Do not include Windows headers here.
+#include <atomic>
+#include <string>
+
+#define METRICS_MAX				64		// Max metrics in one registry.
+#define METRIC_NAME_LEN			64
+#define METRIC_LABELS_LEN		64
+#define METRIC_HELP_LEN			128
+
+// Histogram buckets are log-linear (as in HdrHistogram): each power of 2 range is split
+// in 8 sub-buckets, so a recorded value is off by max 12.5%. Values 0...7 are exact.
+#define HIST_SUB_BUCKET_BITS	3
+#define HIST_SUB_BUCKETS		(1 << HIST_SUB_BUCKET_BITS)
+#define HIST_NUM_BUCKETS		((64 - HIST_SUB_BUCKET_BITS + 1) * HIST_SUB_BUCKETS)
+
+// Prometheus "le" buckets exported by default: powers of 2 nanoseconds from 2^10 (~1us)
+// to 2^36 (~69s). A histogram can have its own range (see AddHistogram).
+#define HIST_EXPORT_MIN_EXP		10
+#define HIST_EXPORT_MAX_EXP		36
+
+// Monotonic clock in nanoseconds.
+unsigned long long MetricsNowNs();
+
+enum METRIC_TYPE
+{
+	METRIC_COUNTER = 0,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM
+};
+
+class CMetric
+{
+public:
+	CMetric(METRIC_TYPE eType, const char *szName, const char *szLabels, const char *szHelp);
+	virtual ~CMetric() {}
+
+	METRIC_TYPE m_eType;
+	char m_szName[METRIC_NAME_LEN];		// Prometheus metric name, e.g. "adct_events_total".
+	char m_szLabels[METRIC_LABELS_LEN];	// Labels without braces, e.g. "result=\"sent\"" (or empty).
+	char m_szHelp[METRIC_HELP_LEN];
+};
+
+// Counter (only goes up) or gauge (set to any value).
+class CMetricCounter : public CMetric
+{
+public:
+	CMetricCounter(METRIC_TYPE eType, const char *szName, const char *szLabels, const char *szHelp);
+
+	void Add(unsigned long long n = 1) { m_nValue.fetch_add(n, std::memory_order_relaxed); }
+	void Set(unsigned long long n) { m_nValue.store(n, std::memory_order_relaxed); }
+	unsigned long long Get() const { return m_nValue.load(std::memory_order_relaxed); }
+
+protected:
+	std::atomic<unsigned long long> m_nValue;
+};
+
+// Latency histogram. Values are recorded in nanoseconds and exported in seconds.
+class CMetricHistogram : public CMetric
+{
+public:
+	CMetricHistogram(const char *szName, const char *szLabels, const char *szHelp,
+		int nExportMinExp = HIST_EXPORT_MIN_EXP, int nExportMaxExp = HIST_EXPORT_MAX_EXP);
+
+	void Record(unsigned long long nValueNs)
+	{
+		m_narrBuckets[BucketIndex(nValueNs)].fetch_add(1, std::memory_order_relaxed);
+		m_nCount.fetch_add(1, std::memory_order_relaxed);
+		m_nSum.fetch_add(nValueNs, std::memory_order_relaxed);
+		unsigned long long nMax = m_nMax.load(std::memory_order_relaxed);
+		while (nValueNs > nMax
+			&& !m_nMax.compare_exchange_weak(nMax, nValueNs, std::memory_order_relaxed))
+			;
+	}
+
+	// Record time since nStartNs (from MetricsNowNs). Returns current time.
+	unsigned long long RecordSince(unsigned long long nStartNs)
+	{
+		unsigned long long nNow = MetricsNowNs();
+		Record(nNow - nStartNs);
+		return nNow;
+	}
+
+	unsigned long long Count() const { return m_nCount.load(std::memory_order_relaxed); }
+	unsigned long long Sum() const { return m_nSum.load(std::memory_order_relaxed); }
+	unsigned long long Max() const { return m_nMax.load(std::memory_order_relaxed); }
+
+	// Value (upper bound of bucket) at quantile q (0...1). 0 if no values recorded.
+	unsigned long long ValueAtQuantile(double q) const;
+
+	static int BucketIndex(unsigned long long nValue);
+	static unsigned long long BucketUpperBound(int nIndex);	// Exclusive.
+
+	std::atomic<unsigned long long> m_narrBuckets[HIST_NUM_BUCKETS];
+	int m_nExportMinExp, m_nExportMaxExp;	// Exported "le" buckets: 2^min ... 2^max ns.
+
+protected:
+	std::atomic<unsigned long long> m_nCount, m_nSum, m_nMax;
+};
+
+// Registry of metrics. Metrics are added at startup (not thread safe), after that
+// updates and Export may be called from any thread.
+class CMetricsRegistry
+{
+public:
+	CMetricsRegistry();
+	~CMetricsRegistry();
+
+	// Returns NULL if registry is full. Metrics with same name must be added one after another.
+	CMetricCounter *AddCounter(const char *szName, const char *szLabels, const char *szHelp);
+	CMetricCounter *AddGauge(const char *szName, const char *szLabels, const char *szHelp);
+	// nExportMinExp, nExportMaxExp = range of exported buckets (powers of 2 nanoseconds).
+	CMetricHistogram *AddHistogram(const char *szName, const char *szLabels, const char *szHelp,
+		int nExportMinExp = HIST_EXPORT_MIN_EXP, int nExportMaxExp = HIST_EXPORT_MAX_EXP);
+
+	// Append all metrics in Prometheus text exposition format (version 0.0.4) to str.
+	// Histograms also get a "<name>_quantile" gauge family with p50, p90, p99 and p99.9.
+	void Export(std::string &str) const;
+
+protected:
+	bool Add(CMetric *pMetric);
+
+	CMetric *m_parrMetrics[METRICS_MAX];
+	int m_nNumMetrics;
+};
@@ -0,0 +1,202 @@
+#include "stdafx.h"
+#include "MetricsExporter.h"
+#include "LogSys.h"
+
+// Name used in Log when 'this' module logs an error.
+#define MOD_NAME "Metrics"
+
+CMetricsExporter::CMetricsExporter()
+{
+	m_pRegistry = NULL;
+	m_szFile[0] = 0;
+	m_dwIntervalMs = 0;
+	m_fPipe = FALSE;
+	m_hThread = m_hStopEvent = NULL;
+	m_hPipe = INVALID_HANDLE_VALUE;
+	m_fPipeCreated = FALSE;
+	memset(&m_sPipeOverlapped, 0, sizeof(m_sPipeOverlapped));
+}
+
+CMetricsExporter::~CMetricsExporter()
+{
+	Stop();
+}
+
+BOOL CMetricsExporter::Start(const CMetricsRegistry *pRegistry, const char *szFile,
+	int nIntervalSeconds, BOOL fPipe)
+{
+	m_pRegistry = pRegistry;
+	m_szFile[0] = 0;
+	if (szFile && nIntervalSeconds > 0)
+		strcpy_s(m_szFile, sizeof(m_szFile), szFile);
+	m_dwIntervalMs = m_szFile[0] ? nIntervalSeconds * 1000 : INFINITE;
+	m_fPipe = fPipe;
+	if (!m_szFile[0] && !m_fPipe)
+		return TRUE;	// Nothing to export.
+
+	m_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	m_sPipeOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!m_hStopEvent || !m_sPipeOverlapped.hEvent)
+	{
+		theLog.SysErr(MOD_NAME, "Create metrics exporter event failed", "", GetLastError());
+		goto failed;
+	}
+	m_hThread = CreateThread(NULL, 0, ExporterThreadProc, this, 0, NULL);
+	if (!m_hThread)
+	{
+		theLog.SysErr(MOD_NAME, "Create metrics exporter thread failed", "", GetLastError());
+		goto failed;
+	}
+	theLog.Info(MOD_NAME, "Metrics exporter started", m_szFile, m_fPipe ? METRICS_PIPE_NAME : "");
+	return TRUE;
+
+failed:
+	if (m_hStopEvent)
+		CloseHandle(m_hStopEvent);
+	if (m_sPipeOverlapped.hEvent)
+		CloseHandle(m_sPipeOverlapped.hEvent);
+	m_hStopEvent = m_sPipeOverlapped.hEvent = NULL;
+	return FALSE;
+}
+
+void CMetricsExporter::Stop()
+{
+	if (!m_hThread)
+		return;
+
+	SetEvent(m_hStopEvent);
+	WaitForSingleObject(m_hThread, INFINITE);
+	CloseHandle(m_hThread);
+	m_hThread = NULL;
+	CloseHandle(m_hStopEvent);
+	m_hStopEvent = NULL;
+	CloseHandle(m_sPipeOverlapped.hEvent);
+	m_sPipeOverlapped.hEvent = NULL;
+}
+
+DWORD WINAPI CMetricsExporter::ExporterThreadProc(LPVOID pParam)
+{
+	((CMetricsExporter *)pParam)->ExporterLoop();
+	return 0;
+}
+
+void CMetricsExporter::ExporterLoop()
+{
+	BOOL fListening = m_fPipe ? ListenOnPipe() : FALSE;
+	ULONGLONG nNextFileWrite = GetTickCount64();
+
+	while (TRUE)
+	{
+		DWORD dwTimeout = INFINITE;
+		if (m_szFile[0])
+		{
+			ULONGLONG nNow = GetTickCount64();
+			if (nNow >= nNextFileWrite)
+			{
+				WriteMetricsFile();
+				nNextFileWrite = nNow + m_dwIntervalMs;
+			}
+			dwTimeout = (DWORD)(nNextFileWrite - nNow);
+		}
+
+		HANDLE harrEvents[2] = { m_hStopEvent, m_sPipeOverlapped.hEvent };
+		DWORD dwWaitResult = WaitForMultipleObjects(fListening ? 2 : 1, harrEvents, FALSE, dwTimeout);
+		if (dwWaitResult == WAIT_OBJECT_0)
+			break;	// Stop.
+		if (dwWaitResult == WAIT_OBJECT_0 + 1)
+		{	// Client connected to pipe.
+			ServePipeClient();
+			fListening = ListenOnPipe();
+		}
+	}
+
+	if (m_hPipe != INVALID_HANDLE_VALUE)
+	{
+		CancelIo(m_hPipe);
+		CloseHandle(m_hPipe);
+		m_hPipe = INVALID_HANDLE_VALUE;
+	}
+}
+
+// Write metrics to temp file, then replace metrics file - readers never see a partial file.
+void CMetricsExporter::WriteMetricsFile()
+{
+	std::string str;
+	m_pRegistry->Export(str);
+
+	char szTempFile[MAX_PATH];
+	strcpy_s(szTempFile, sizeof(szTempFile), m_szFile);
+	strcat_s(szTempFile, sizeof(szTempFile), ".tmp");
+	HANDLE hFile = CreateFileA(szTempFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == hFile)
+	{
+		theLog.SysErr(MOD_NAME, "Create metrics file failed", szTempFile, GetLastError());
+		return;
+	}
+	DWORD dwBytesWritten = 0;
+	BOOL fOk = WriteFile(hFile, str.c_str(), (DWORD)str.length(), &dwBytesWritten, NULL);
+	CloseHandle(hFile);
+	if (!fOk || !MoveFileExA(szTempFile, m_szFile, MOVEFILE_REPLACE_EXISTING))
+		theLog.SysErr(MOD_NAME, "Write metrics file failed", m_szFile, GetLastError());
+}
+
+// Create pipe instance (if needed) and start waiting for a client.
+// Returns TRUE while waiting (m_sPipeOverlapped.hEvent is signaled when a client connects).
+BOOL CMetricsExporter::ListenOnPipe()
+{
+	if (m_hPipe == INVALID_HANDLE_VALUE)
+	{	// Note - the first instance must be created by us (no other process owns the name).
+		// Instances served earlier live on until their client has read all data.
+		m_hPipe = CreateNamedPipeA(METRICS_PIPE_NAME, PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED
+			| (m_fPipeCreated ? 0 : FILE_FLAG_FIRST_PIPE_INSTANCE),
+			PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES,
+			65536, 0, 0, NULL);
+		if (m_hPipe == INVALID_HANDLE_VALUE)
+		{
+			theLog.SysErr(MOD_NAME, "Create metrics pipe failed", METRICS_PIPE_NAME, GetLastError());
+			return FALSE;
+		}
+		m_fPipeCreated = TRUE;
+	}
+
+	ResetEvent(m_sPipeOverlapped.hEvent);
+	if (ConnectNamedPipe(m_hPipe, &m_sPipeOverlapped))
+	{
+		SetEvent(m_sPipeOverlapped.hEvent);
+		return TRUE;
+	}
+	switch (GetLastError())
+	{
+	case ERROR_IO_PENDING:
+		return TRUE;
+	case ERROR_PIPE_CONNECTED:	// Client connected between CreateNamedPipe and ConnectNamedPipe.
+		SetEvent(m_sPipeOverlapped.hEvent);
+		return TRUE;
+	default:
+		theLog.SysErr(MOD_NAME, "Connect metrics pipe failed", METRICS_PIPE_NAME, GetLastError());
+		CloseHandle(m_hPipe);
+		m_hPipe = INVALID_HANDLE_VALUE;
+		return FALSE;
+	}
+}
+
+// Write metrics to connected client and close our end of the pipe (gives up after 2 seconds).
+// Note - DisconnectNamedPipe would discard data the client has not read yet.
+void CMetricsExporter::ServePipeClient()
+{
+	std::string str;
+	m_pRegistry->Export(str);
+
+	ResetEvent(m_sPipeOverlapped.hEvent);
+	DWORD dwBytesWritten = 0;
+	if (!WriteFile(m_hPipe, str.c_str(), (DWORD)str.length(), NULL, &m_sPipeOverlapped)
+		&& GetLastError() == ERROR_IO_PENDING)
+	{
+		if (WaitForSingleObject(m_sPipeOverlapped.hEvent, 2000) != WAIT_OBJECT_0)
+			CancelIo(m_hPipe);
+		GetOverlappedResult(m_hPipe, &m_sPipeOverlapped, &dwBytesWritten, TRUE);
+	}
+	CloseHandle(m_hPipe);
+	m_hPipe = INVALID_HANDLE_VALUE;
+}
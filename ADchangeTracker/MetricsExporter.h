@@ -0,0 +1,44 @@
+#pragma once
+#include "Metrics.h"
+
+#define METRICS_PIPE_NAME	"\\\\.\\pipe\\ADchangeTracker_metrics"
+
+// Exports a metrics registry in Prometheus text format from a background thread:
+//  - to a file that is rewritten every N seconds (e.g. for the windows_exporter
+//    textfile collector), and/or
+//  - to each client that connects to the local named pipe METRICS_PIPE_NAME
+//    (e.g. PowerShell: Get-Content \\.\pipe\ADchangeTracker_metrics).
+class CMetricsExporter
+{
+public:
+	CMetricsExporter();
+	~CMetricsExporter();
+
+private:	// Make assignment operator and copy constructor private to prevent
+			// accidental object copy.
+	void operator=(CMetricsExporter &source) {  }
+	CMetricsExporter(CMetricsExporter &source) {  }
+
+public:
+	// szFile = NULL or nIntervalSeconds = 0: no metrics file.
+	BOOL Start(const CMetricsRegistry *pRegistry, const char *szFile, int nIntervalSeconds, BOOL fPipe);
+	void Stop();
+
+protected:
+	static DWORD WINAPI ExporterThreadProc(LPVOID pParam);
+	void ExporterLoop();
+	void WriteMetricsFile();
+	BOOL ListenOnPipe();
+	void ServePipeClient();
+
+	const CMetricsRegistry *m_pRegistry;
+	char m_szFile[MAX_PATH];
+	DWORD m_dwIntervalMs;
+	BOOL m_fPipe;
+
+	HANDLE m_hThread;
+	HANDLE m_hStopEvent;
+	HANDLE m_hPipe;
+	BOOL m_fPipeCreated;			// TRUE after first pipe instance has been created.
+	OVERLAPPED m_sPipeOverlapped;	// Used for ConnectNamedPipe and WriteFile on the pipe.
+};
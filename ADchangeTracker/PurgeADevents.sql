@@ -0,0 +1,136 @@
+-- Retention for AD_DW: usp_PurgeADevents deletes events older than a given number
+-- of days in small batches, so usp_ADchgEventEx is never blocked for long.
+-- Run once on an existing AD_DW database. The script also creates the SQL Agent
+-- job 'AD_DW - Purge old AD events' that runs usp_PurgeADeventsNightly at 02:00.
+-- Change @DaysToKeep in the job step to set the retention period.
+--
+-- Counts in ADeventSummary (see ADeventSummary.sql) are not purged.
+
+USE [AD_DW]
+GO
+SET ANSI_NULLS ON
+GO
+SET QUOTED_IDENTIFIER ON
+GO
+-- =============================================
+-- Create date: 19.10.2026
+-- Description:	Delete events older than @DaysToKeep days.
+-- Rows are deleted in EventTime key ranges of about @BatchSize rows, each range
+-- in its own short transaction, with a @PauseBetweenBatches delay ('hh:mm:ss')
+-- between ranges. Stops when done or when @MaxSeconds have passed.
+-- @BatchSize is capped at 4000 to stay below the lock escalation threshold.
+-- The purge runs with low deadlock priority and a short lock timeout, so the
+-- ingest procedure always wins. Returns number of rows removed.
+-- =============================================
+CREATE PROCEDURE [dbo].[usp_PurgeADevents]
+	@DaysToKeep int,
+	@BatchSize int = 1000,
+	@PauseBetweenBatches char(8) = '00:00:01',
+	@MaxSeconds int = 3600,
+	@RowsRemoved int = 0 OUTPUT
+AS
+BEGIN
+	SET NOCOUNT ON;
+	SET XACT_ABORT OFF;
+	SET DEADLOCK_PRIORITY LOW;
+	SET LOCK_TIMEOUT 2000;
+
+	IF @DaysToKeep IS NULL OR @DaysToKeep < 1
+	BEGIN
+		RAISERROR('usp_PurgeADevents: @DaysToKeep must be 1 or more', 16, 1);
+		RETURN 0;
+	END
+	IF @BatchSize > 4000
+		SET @BatchSize = 4000;
+
+	DECLARE @Start datetime2 = SYSUTCDATETIME();
+	DECLARE @Cutoff datetime2 = DATEADD(day, -@DaysToKeep, SYSUTCDATETIME());
+	DECLARE @RangeEnd datetime2, @Rows int, @Msg nvarchar(256);
+	DECLARE @Deleted TABLE (SourceDC nvarchar(128), EventRecordID bigint);
+	SET @RowsRemoved = 0;
+
+	WHILE DATEDIFF(second, @Start, SYSUTCDATETIME()) < @MaxSeconds
+	BEGIN
+		-- Upper bound of the next key range.
+		SET @RangeEnd = NULL;
+		SELECT @RangeEnd = MAX(EventTime) FROM (
+			SELECT TOP (@BatchSize) EventTime
+			FROM dbo.ADevents
+			WHERE EventTime < @Cutoff
+			ORDER BY EventTime) r;
+		IF @RangeEnd IS NULL
+			BREAK;	-- Nothing more to purge.
+
+		BEGIN TRY
+			DELETE FROM @Deleted;
+			BEGIN TRANSACTION;
+
+			DELETE FROM dbo.ADevents
+				OUTPUT deleted.SourceDC, deleted.EventRecordID INTO @Deleted
+				WHERE EventTime <= @RangeEnd AND EventTime < @Cutoff;
+			SET @Rows = @@ROWCOUNT;
+
+			IF OBJECT_ID(N'dbo.ADeventXml') IS NOT NULL
+				DELETE x FROM dbo.ADeventXml x
+				JOIN @Deleted d ON x.SourceDC = d.SourceDC AND x.EventRecordID = d.EventRecordID;
+
+			COMMIT TRANSACTION;
+			SET @RowsRemoved = @RowsRemoved + @Rows;
+		END TRY
+		BEGIN CATCH
+			IF @@TRANCOUNT > 0
+				ROLLBACK TRANSACTION;
+			-- Lock timeout (1222) or deadlock victim (1205) - back off and retry.
+			IF ERROR_NUMBER() NOT IN (1222, 1205)
+			BEGIN
+				SET @Msg = 'usp_PurgeADevents failed: ' + ERROR_MESSAGE();
+				RAISERROR(@Msg, 16, 1);
+				BREAK;
+			END
+		END CATCH
+
+		WAITFOR DELAY @PauseBetweenBatches;
+	END
+
+	SET @Msg = 'usp_PurgeADevents: ' + CONVERT(nvarchar, @RowsRemoved) + ' rows removed';
+	RAISERROR(@Msg, 0, 1) WITH NOWAIT;
+	RETURN @RowsRemoved;
+END
+GO
+
+SET ANSI_NULLS ON
+GO
+SET QUOTED_IDENTIFIER ON
+GO
+-- =============================================
+-- Create date: 19.10.2026
+-- Description:	Nightly retention run for the SQL Agent job.
+-- Returns one row with the number of rows removed.
+-- =============================================
+CREATE PROCEDURE [dbo].[usp_PurgeADeventsNightly]
+	@DaysToKeep int = 365
+AS
+BEGIN
+	SET NOCOUNT ON;
+
+	DECLARE @RowsRemoved int = 0;
+	EXEC dbo.usp_PurgeADevents @DaysToKeep = @DaysToKeep, @BatchSize = 1000,
+		@PauseBetweenBatches = '00:00:01', @MaxSeconds = 3600, @RowsRemoved = @RowsRemoved OUTPUT;
+
+	SELECT @RowsRemoved AS RowsRemoved;
+END
+GO
+
+-- SQL Agent job that runs usp_PurgeADeventsNightly every night at 02:00.
+USE [msdb]
+GO
+EXEC dbo.sp_add_job @job_name = N'AD_DW - Purge old AD events',
+	@description = N'Deletes AD events older than the retention period from AD_DW.';
+EXEC dbo.sp_add_jobstep @job_name = N'AD_DW - Purge old AD events',
+	@step_name = N'Purge old events', @subsystem = N'TSQL', @database_name = N'AD_DW',
+	@command = N'EXEC dbo.usp_PurgeADeventsNightly @DaysToKeep = 365;';
+EXEC dbo.sp_add_jobschedule @job_name = N'AD_DW - Purge old AD events',
+	@name = N'Nightly 02:00', @freq_type = 4, @freq_interval = 1,
+	@active_start_time = 020000;
+EXEC dbo.sp_add_jobserver @job_name = N'AD_DW - Purge old AD events';
+GO
@@ -0,0 +1,243 @@
+#include "stdafx.h"
+#include "Watermarks.h"
+#include "LogSys.h"
+
+// Name used in Log when 'this' module logs.
+#define MOD_NAME "Watermarks"
+
+CWatermarks::CWatermarks()
+{
+	::InitializeCriticalSection( &m_critsect );
+	m_nLagWarningMs = 0;
+	m_nBacklogWarningEvents = 0;
+	m_nLastCheckTick = ::GetTickCount64();
+	m_szLocalDC[0] = 0;
+	memset( m_sarrSourceDCs, 0, sizeof(m_sarrSourceDCs) );
+	m_nNumSourceDCs = 0;
+	m_pLagHist = NULL;
+	m_pBacklogGauge = NULL;
+}
+
+CWatermarks::~CWatermarks()
+{
+	::DeleteCriticalSection( &m_critsect );
+}
+
+void CWatermarks::SetThresholds(int nLagWarningSeconds, int nBacklogWarningEvents)
+{
+	::EnterCriticalSection( &m_critsect );
+	m_nLagWarningMs = nLagWarningSeconds > 0 ? (LONGLONG)nLagWarningSeconds * 1000 : 0;
+	m_nBacklogWarningEvents = nBacklogWarningEvents > 0 ? nBacklogWarningEvents : 0;
+
+	// Note - Computer in event XML is the DNS name of the DC.
+	DWORD dwSize = sizeof(m_szLocalDC);
+	if( !::GetComputerNameExA( ComputerNameDnsFullyQualified, m_szLocalDC, &dwSize ) )
+	{
+		theLog.SysErr( MOD_NAME, "GetComputerNameEx failed", "Backlog is not tracked", GetLastError() );
+		m_szLocalDC[0] = 0;
+	}
+	::LeaveCriticalSection( &m_critsect );
+}
+
+void CWatermarks::SetMetrics(CMetricHistogram *pLagHist, CMetricCounter *pBacklogGauge)
+{
+	m_pLagHist = pLagHist;
+	m_pBacklogGauge = pBacklogGauge;
+}
+
+BOOL CWatermarks::ParseSystemTime(const char *szTime, ULONGLONG *pnFileTime)
+{
+	SYSTEMTIME st;
+	memset( &st, 0, sizeof(st) );
+	int nYear, nMonth, nDay, nHour, nMinute, nSecond;
+	if( sscanf_s( szTime, "%4d-%2d-%2dT%2d:%2d:%2d", &nYear, &nMonth, &nDay,
+		&nHour, &nMinute, &nSecond ) != 6 )
+		return FALSE;
+	st.wYear = (WORD)nYear;
+	st.wMonth = (WORD)nMonth;
+	st.wDay = (WORD)nDay;
+	st.wHour = (WORD)nHour;
+	st.wMinute = (WORD)nMinute;
+	st.wSecond = (WORD)nSecond;
+
+	FILETIME ft;
+	if( !::SystemTimeToFileTime( &st, &ft ) )
+		return FALSE;
+	ULONGLONG nTime = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+
+	// Fraction of second - up to 7 digits (100 ns units).
+	const char *p = strchr( szTime, '.' );
+	if( p )
+	{
+		ULONGLONG nScale = 1000000;
+		for( p++; *p >= '0' && *p <= '9' && nScale; p++, nScale /= 10 )
+			nTime += (*p - '0') * nScale;
+	}
+	*pnFileTime = nTime;
+	return TRUE;
+}
+
+// Note - caller must hold m_critsect. Returns NULL if too many SourceDCs.
+SOURCEDC_WATERMARK *CWatermarks::FindSourceDC(const char *szSourceDC)
+{
+	for( int i = 0; i < m_nNumSourceDCs; i++ )
+	{
+		if( _stricmp( m_sarrSourceDCs[i].szSourceDC, szSourceDC ) == 0 )
+			return &m_sarrSourceDCs[i];
+	}
+	if( m_nNumSourceDCs >= WM_MAX_SOURCEDCS )
+		return NULL;
+	strncpy_s( m_sarrSourceDCs[m_nNumSourceDCs].szSourceDC, WM_SOURCEDC_LEN, szSourceDC, _TRUNCATE );
+	return &m_sarrSourceDCs[m_nNumSourceDCs++];
+}
+
+void CWatermarks::AddEvent(const char *szSourceDC, ULONGLONG nEventRecordID, const char *szTimeCreated,
+	BOOL fSent)
+{
+	LONGLONG nLagMs = -1;
+	if( fSent )
+	{
+		FILETIME ftNow;
+		::GetSystemTimeAsFileTime( &ftNow );
+		ULONGLONG nNow = ((ULONGLONG)ftNow.dwHighDateTime << 32) | ftNow.dwLowDateTime;
+		ULONGLONG nCreated;
+		if( ParseSystemTime( szTimeCreated, &nCreated ) )
+		{	// Note - lag can't be negative (clock adjusted after event was created).
+			nLagMs = nNow > nCreated ? (LONGLONG)((nNow - nCreated) / 10000) : 0;
+			if( m_pLagHist )
+				m_pLagHist->Record( (ULONGLONG)nLagMs * 1000000 );
+		}
+	}
+
+	::EnterCriticalSection( &m_critsect );
+	SOURCEDC_WATERMARK *pDC = FindSourceDC( szSourceDC );
+	if( pDC )
+	{
+		if( nEventRecordID > pDC->nLastRecordID )
+			pDC->nLastRecordID = nEventRecordID;
+		if( nLagMs >= 0 )
+		{
+			pDC->nLastLagMs = nLagMs;
+			if( nLagMs > pDC->nMaxLagMs )
+				pDC->nMaxLagMs = nLagMs;
+			pDC->nNumSent++;
+		}
+	}
+	::LeaveCriticalSection( &m_critsect );
+}
+
+DWORD CWatermarks::CheckIfDue()
+{
+	ULONGLONG nElapsed = ::GetTickCount64() - m_nLastCheckTick;
+	if( nElapsed < WM_CHECK_INTERVAL_MS )
+		return (DWORD)(WM_CHECK_INTERVAL_MS - nElapsed);
+
+	Check();
+	return WM_CHECK_INTERVAL_MS;
+}
+
+void CWatermarks::Check()
+{
+	char szDesc[256], szNotes[256];
+
+	// Copy the watermarks and reset the per-check counters under the lock. The Security
+	// log is queried and log lines are written after the lock is released, as AddEvent
+	// (called for every event) waits on it.
+	SOURCEDC_WATERMARK sarrDCs[WM_MAX_SOURCEDCS];
+	::EnterCriticalSection( &m_critsect );
+	m_nLastCheckTick = ::GetTickCount64();
+	LONGLONG nLagWarningMs = m_nLagWarningMs;
+	ULONGLONG nBacklogWarningEvents = m_nBacklogWarningEvents;
+	int nNumDCs = m_nNumSourceDCs, nLocal = -1;
+	for( int i = 0; i < nNumDCs; i++ )
+	{
+		sarrDCs[i] = m_sarrSourceDCs[i];
+		m_sarrSourceDCs[i].nMaxLagMs = 0;
+		m_sarrSourceDCs[i].nNumSent = 0;
+		if( m_szLocalDC[0] && _stricmp( m_sarrSourceDCs[i].szSourceDC, m_szLocalDC ) == 0 )
+			nLocal = i;
+	}
+	::LeaveCriticalSection( &m_critsect );
+
+	// Note - warning flags are only used here (one thread), entries are never moved.
+	for( int i = 0; i < nNumDCs; i++ )
+	{
+		SOURCEDC_WATERMARK *pDC = &sarrDCs[i];
+		if( nLagWarningMs && pDC->nNumSent )
+		{
+			sprintf_s( szDesc, sizeof(szDesc), "SourceDC %s", pDC->szSourceDC );
+			sprintf_s( szNotes, sizeof(szNotes), "Max lag %llds, last lag %llds, %d events sent in last %ds",
+				pDC->nMaxLagMs / 1000, pDC->nLastLagMs / 1000, pDC->nNumSent, WM_CHECK_INTERVAL_MS / 1000 );
+			if( pDC->nMaxLagMs >= nLagWarningMs )
+			{
+				theLog.Warning( MOD_NAME, "Capture-to-commit lag above threshold", szDesc, szNotes );
+				m_sarrSourceDCs[i].fLagWarning = TRUE;
+			}
+			else if( pDC->fLagWarning )
+			{
+				theLog.Info( MOD_NAME, "Capture-to-commit lag back below threshold", szDesc, szNotes );
+				m_sarrSourceDCs[i].fLagWarning = FALSE;
+			}
+		}
+	}
+
+	if( nLocal >= 0 && sarrDCs[nLocal].nLastRecordID )
+		CheckBacklog( &m_sarrSourceDCs[nLocal], sarrDCs[nLocal].nLastRecordID, nBacklogWarningEvents );
+}
+
+// Compare bookmark (nLast) with newest and oldest EventRecordID in local Security log.
+// Note - called without m_critsect, only pLocal's name and fBacklogWarning are used.
+void CWatermarks::CheckBacklog(SOURCEDC_WATERMARK *pLocal, ULONGLONG nLast, ULONGLONG nBacklogWarningEvents)
+{
+	EVT_HANDLE hLog = EvtOpenLog( NULL, L"Security", EvtOpenChannelPath );
+	if( !hLog )
+	{
+		theLog.SysErr( MOD_NAME, "EvtOpenLog failed", "Security", GetLastError() );
+		return;
+	}
+	EVT_VARIANT varCount, varOldest;
+	DWORD dwUsed = 0;
+	BOOL fOk = EvtGetLogInfo( hLog, EvtLogNumberOfLogRecords, sizeof(varCount), &varCount, &dwUsed )
+		&& EvtGetLogInfo( hLog, EvtLogOldestRecordNumber, sizeof(varOldest), &varOldest, &dwUsed );
+	DWORD dwError = GetLastError();
+	EvtClose( hLog );
+	if( !fOk )
+	{
+		theLog.SysErr( MOD_NAME, "EvtGetLogInfo failed", "Security", dwError );
+		return;
+	}
+	ULONGLONG nCount = varCount.UInt64Val, nOldest = varOldest.UInt64Val;
+	if( !nCount )
+		return;
+	ULONGLONG nNewest = nOldest + nCount - 1;
+	ULONGLONG nBacklog = nNewest > nLast ? nNewest - nLast : 0;
+	if( m_pBacklogGauge )
+		m_pBacklogGauge->Set( nBacklog );
+
+	char szDesc[256], szNotes[256];
+	sprintf_s( szDesc, sizeof(szDesc), "SourceDC %s", pLocal->szSourceDC );
+	sprintf_s( szNotes, sizeof(szNotes), "Backlog %llu events (bookmark %llu, newest %llu, oldest %llu)",
+		nBacklog, nLast, nNewest, nOldest );
+
+	if( nLast + 1 < nOldest )
+	{	// Events after bookmark have been overwritten.
+		theLog.Error( MOD_NAME, "Security log wrapped - events lost before stored", szDesc, szNotes );
+	}
+	else if( nBacklog && nLast + 1 - nOldest < nCount / 10 )
+	{	// Next event to process is in the oldest 10% of the log.
+		theLog.Warning( MOD_NAME, "Security log may wrap before backlog is stored", szDesc, szNotes );
+	}
+
+	if( !nBacklogWarningEvents )
+		return;
+	if( nBacklog >= nBacklogWarningEvents )
+	{
+		theLog.Warning( MOD_NAME, "Backlog above threshold", szDesc, szNotes );
+		pLocal->fBacklogWarning = TRUE;
+	}
+	else if( pLocal->fBacklogWarning )
+	{
+		theLog.Info( MOD_NAME, "Backlog back below threshold", szDesc, szNotes );
+		pLocal->fBacklogWarning = FALSE;
+	}
+}
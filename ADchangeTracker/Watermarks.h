@@ -0,0 +1,74 @@
+#pragma once
+#include "Metrics.h"
+
+#define WM_MAX_SOURCEDCS		16		// Max SourceDCs tracked (events from others are not tracked).
+#define WM_SOURCEDC_LEN			128
+#define WM_CHECK_INTERVAL_MS	60000	// Thresholds are checked every 60 seconds.
+
+// Watermarks of one SourceDC (Computer in event XML).
+typedef struct tagSourceDcWatermark
+{
+	char szSourceDC[WM_SOURCEDC_LEN];
+	ULONGLONG nLastRecordID;		// EventRecordID of last event processed (= bookmark).
+	LONGLONG nLastLagMs;			// Capture-to-commit lag of last event sent to SQL.
+	LONGLONG nMaxLagMs;				// Max lag since last check.
+	LONG nNumSent;					// Events sent to SQL since last check.
+	BOOL fLagWarning;				// TRUE while lag is above threshold (used by Check only).
+	BOOL fBacklogWarning;			// TRUE while backlog is above threshold (local DC only, Check only).
+} SOURCEDC_WATERMARK;
+
+// Tracks how far behind real time the service is, per SourceDC:
+//  - lag = time event was committed to SQL - TimeCreated of event.
+//  - backlog = newest EventRecordID in Security log - EventRecordID of bookmark.
+//    The Security log read is the local one, so backlog is known for the local DC only.
+// A warning is logged when a threshold is passed, and when the Security log may wrap
+// (overwrite events) before the backlog is stored.
+class CWatermarks
+{
+public:
+	CWatermarks();
+	~CWatermarks();
+
+private:	// Make assignment operator and copy constructor private to prevent
+			// accidental object copy.
+	void operator=(CWatermarks &source) {  }
+	CWatermarks(CWatermarks &source) {  }
+
+public:
+	// Threshold 0 = no warning.
+	void SetThresholds(int nLagWarningSeconds, int nBacklogWarningEvents);
+	// Optional - lag is also recorded in pLagHist, local backlog is set in pBacklogGauge.
+	void SetMetrics(CMetricHistogram *pLagHist, CMetricCounter *pBacklogGauge);
+
+	// Track one processed event (bookmark updated). szTimeCreated = TimeCreated/@SystemTime
+	// from event XML. fSent = TRUE if event was committed to SQL (lag is then measured).
+	void AddEvent(const char *szSourceDC, ULONGLONG nEventRecordID, const char *szTimeCreated,
+		BOOL fSent);
+
+	// Check thresholds if WM_CHECK_INTERVAL_MS has passed.
+	// Returns milliseconds until next check is due.
+	DWORD CheckIfDue();
+
+	// Check thresholds now.
+	void Check();
+
+	// Parse "2016-09-07T12:34:56.1234567Z" to FILETIME units. Returns FALSE if bad format.
+	static BOOL ParseSystemTime(const char *szTime, ULONGLONG *pnFileTime);
+
+protected:
+	SOURCEDC_WATERMARK *FindSourceDC(const char *szSourceDC);
+	void CheckBacklog(SOURCEDC_WATERMARK *pLocal, ULONGLONG nLast, ULONGLONG nBacklogWarningEvents);
+
+	LONGLONG m_nLagWarningMs;
+	ULONGLONG m_nBacklogWarningEvents;
+	ULONGLONG m_nLastCheckTick;
+	char m_szLocalDC[WM_SOURCEDC_LEN];	// DNS name of this computer (as in event XML).
+
+	SOURCEDC_WATERMARK m_sarrSourceDCs[WM_MAX_SOURCEDCS];
+	int m_nNumSourceDCs;
+
+	CMetricHistogram *m_pLagHist;
+	CMetricCounter *m_pBacklogGauge;
+
+	CRITICAL_SECTION m_critsect;
+};
@@ -0,0 +1,85 @@
+// Per-thread pugixml parse context - see XmlArena.h.
+// Note - portable C++, compiled without precompiled header.
+#include "XmlArena.h"
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#ifdef _MSC_VER
+#define XML_THREAD_LOCAL	__declspec(thread)
+#else
+#define XML_THREAD_LOCAL	__thread
+#endif
+
+// Arena of calling thread (NULL if thread has no parse context).
+static XML_THREAD_LOCAL CXmlArena *s_pThreadArena;
+static XML_THREAD_LOCAL CXmlParseContext *s_pThreadContext;
+static std::atomic<unsigned long long> s_nHeapAllocs;
+
+static void *ArenaAllocate(size_t nSize)
+{
+	CXmlArena *pArena = s_pThreadArena;
+	if (pArena)
+	{
+		void *p = pArena->Allocate(nSize);
+		if (p)
+			return p;
+	}
+	s_nHeapAllocs.fetch_add(1, std::memory_order_relaxed);
+	return malloc(nSize);
+}
+
+static void ArenaDeallocate(void *p)
+{
+	CXmlArena *pArena = s_pThreadArena;
+	if (pArena && pArena->Contains(p))
+		return;		// Taken back by Rewind.
+	free(p);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+CXmlArena::CXmlArena(size_t nSize /*= XML_ARENA_SIZE*/)
+{
+	m_pBase = (char *)malloc(nSize);
+	m_nSize = m_pBase ? nSize : 0;	// If malloc failed all allocations go to heap.
+	m_nUsed = 0;
+	m_nHighWater = 0;
+}
+
+CXmlArena::~CXmlArena()
+{
+	if (m_pBase)
+		free(m_pBase);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+void CXmlParseContext::InstallAllocator()
+{
+	pugi::set_memory_management_functions(ArenaAllocate, ArenaDeallocate);
+}
+
+CXmlParseContext *CXmlParseContext::GetForThread()
+{
+	if (!s_pThreadContext)
+	{
+		s_pThreadContext = new (std::nothrow) CXmlParseContext;
+		if (s_pThreadContext)
+			s_pThreadArena = &s_pThreadContext->m_arena;
+	}
+	return s_pThreadContext;
+}
+
+pugi::xml_parse_result CXmlParseContext::Parse(const void *pXML, size_t nBytes,
+	pugi::xml_encoding encoding /*= pugi::encoding_auto*/)
+{
+	m_doc.reset();		// Frees heap memory of previous event, arena memory is a no-op.
+	m_arena.Rewind();
+	return m_doc.load_buffer(pXML, nBytes, pugi::parse_default, encoding);
+}
+
+unsigned long long CXmlParseContext::GetHeapAllocations()
+{
+	return s_nHeapAllocs.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,87 @@
+#pragma once
+// Per-thread pugixml parse context with a bump arena - see CXmlParseContext.
+// Note - this file (and XmlArena.cpp) is portable C++ and is also used by PipelineBench.
+// Do not include Windows headers here.
+#include "pugixml.hpp"
+#include <stddef.h>
+
+#define XML_ARENA_SIZE			(256 * 1024)	// Arena per thread - holds a document page
+												// (32 KB), the UTF-8 copy of the event and XPath blocks.
+#define XML_ARENA_ALIGNMENT		16
+
+// Bump allocator. Memory is given out from one block and taken back all at once by Rewind.
+class CXmlArena
+{
+public:
+	CXmlArena(size_t nSize = XML_ARENA_SIZE);
+	~CXmlArena();
+
+private:	// Make assignment operator and copy constructor private to prevent
+			// accidental object copy.
+	void operator=(CXmlArena &source) {  }
+	CXmlArena(CXmlArena &source) {  }
+
+public:
+	// Returns NULL if arena is full.
+	void *Allocate(size_t nSize)
+	{
+		size_t nAligned = (nSize + XML_ARENA_ALIGNMENT - 1) & ~(size_t)(XML_ARENA_ALIGNMENT - 1);
+		if (nAligned > m_nSize - m_nUsed)
+			return NULL;
+		void *p = m_pBase + m_nUsed;
+		m_nUsed += nAligned;
+		if (m_nUsed > m_nHighWater)
+			m_nHighWater = m_nUsed;
+		return p;
+	}
+
+	bool Contains(const void *p) const
+	{
+		return (const char *)p >= m_pBase && (const char *)p < m_pBase + m_nSize;
+	}
+
+	void Rewind() { m_nUsed = 0; }
+
+	size_t GetHighWater() const { return m_nHighWater; }
+
+protected:
+	char *m_pBase;
+	size_t m_nSize;
+	size_t m_nUsed;
+	size_t m_nHighWater;
+};
+
+// Parse context of a thread: one xml_document kept alive and reset between events, with
+// all pugixml memory of the thread taken from an arena that is rewound for each event.
+// Normal case is no heap allocation per event - only if the arena is full (very large event)
+// pugixml memory comes from the heap (and is freed when the document is reset).
+//
+// Note - after GetForThread all pugixml allocations on the thread use the arena. Documents
+// and XPath objects on the thread must not be kept after the next call to Parse.
+class CXmlParseContext
+{
+public:
+	// Install arena allocation functions in pugixml. Call once before events are parsed.
+	static void InstallAllocator();
+
+	// Context of calling thread - created on first call, never freed (as the arena).
+	// Returns NULL if out of memory.
+	static CXmlParseContext *GetForThread();
+
+	// Parse XML (e.g. UTF-16 event from EvtRender) into the context document. The previous
+	// document of the context is gone.
+	pugi::xml_parse_result Parse(const void *pXML, size_t nBytes,
+		pugi::xml_encoding encoding = pugi::encoding_auto);
+
+	pugi::xml_document &GetDocument() { return m_doc; }
+	const CXmlArena &GetArena() const { return m_arena; }
+
+	// Number of pugixml allocations from heap (arena not installed on thread or full).
+	static unsigned long long GetHeapAllocations();
+
+protected:
+	CXmlParseContext() {}
+
+	CXmlArena m_arena;
+	pugi::xml_document m_doc;
+};
@@ -13,9 +13,8 @@
 
 //#ifndef SOURCE_PUGIXML_CPP
 //#define SOURCE_PUGIXML_CPP
-#include "stdafx.h"
-
-//#include "pugixml.hpp"
+// Note - compiled without precompiled header (also used by PipelineBench).
+#include "pugixml.hpp"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -43,6 +42,21 @@
 // For placement new
 #include <new>
 
+// SIMD scanning of text and attribute values (see simd_scan). SSE2 is always there on x64
+// (and with /arch:SSE2 on x86); AVX2 is compiled in where the compiler allows AVX2 code in
+// single functions and is used if the CPU supports it. Define PUGIXML_NO_SIMD to disable.
+#if !defined(PUGIXML_NO_SIMD) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__))
+#	define PUGI__SIMD
+#	include <emmintrin.h>
+#	if defined(_MSC_VER) || defined(__AVX2__) || (defined(__GNUC__) && !defined(__clang__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#		define PUGI__SIMD_AVX2
+#		include <immintrin.h>
+#	endif
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#	endif
+#endif
+
 #ifdef _MSC_VER
 #	pragma warning(push)
 #	pragma warning(disable: 4127) // conditional expression is constant
@@ -1032,6 +1046,165 @@ PUGI__NS_BEGIN
 	typedef wchar_selector<sizeof(wchar_t)>::counter wchar_counter;
 	typedef wchar_selector<sizeof(wchar_t)>::writer wchar_writer;
 
+#ifdef PUGI__SIMD
+	// SIMD support (ADchangeTracker addition) - level in use, see set_simd_level
+	template <typename T> struct simd_level_storage
+	{
+		static int level; // xml_simd_level in use, -1 until first parse or set_simd_level
+	};
+
+	template <typename T> int simd_level_storage<T>::level = -1;
+
+	typedef simd_level_storage<int> simd_level;
+
+	PUGI__FN int simd_supported_level()
+	{
+	#ifdef PUGI__SIMD_AVX2
+	#	ifdef _MSC_VER
+		int info[4];
+
+		__cpuid(info, 0);
+		if (info[0] < 7) return simd_sse2;
+
+		__cpuid(info, 1);
+		if ((info[2] & (3 << 27)) != (3 << 27)) return simd_sse2; // OSXSAVE and AVX
+		if ((_xgetbv(0) & 6) != 6) return simd_sse2; // OS saves XMM and YMM registers
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) ? simd_avx2 : simd_sse2;
+	#	else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? simd_avx2 : simd_sse2;
+	#	endif
+	#else
+		return simd_sse2;
+	#endif
+	}
+
+	PUGI__FN int simd_get_level()
+	{
+		int level = simd_level::level;
+
+		if (PUGI__UNLIKELY(level < 0))
+			simd_level::level = level = simd_supported_level();
+
+		return level;
+	}
+
+	PUGI__FN unsigned int simd_first_bit(unsigned int mask)
+	{
+	#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+	#else
+		return static_cast<unsigned int>(__builtin_ctz(mask));
+	#endif
+	}
+
+	// All-ASCII runs of UTF-16 input (see decode_utf16_block_simd): 16 code units per step are checked
+	// for U+0000..U+007F and converted with one pack (UTF-8) or two unpacks (UTF-32); counters
+	// add the run length. Returns number of code units done (0 if next 16 are not all ASCII).
+	template <typename Traits> struct utf16_ascii_run
+	{
+		enum { enabled = 0 };
+
+		static size_t process(typename Traits::value_type&, const uint16_t*, size_t) { return 0; }
+	};
+
+	PUGI__FN bool simd_utf16_is_ascii(__m128i v)
+	{
+		__m128i high = _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xff80)));
+
+		return _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xffff;
+	}
+
+	PUGI__FN size_t simd_utf16_ascii_length(const uint16_t* data, size_t size)
+	{
+		size_t i = 0;
+
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 8));
+
+			if (!simd_utf16_is_ascii(_mm_or_si128(lo, hi))) break;
+		}
+
+		return i;
+	}
+
+	template <typename Counter> struct utf16_ascii_count
+	{
+		enum { enabled = 1 };
+
+		static size_t process(size_t& result, const uint16_t* data, size_t size)
+		{
+			size_t length = simd_utf16_ascii_length(data, size);
+
+			result += length;
+
+			return length;
+		}
+	};
+
+	template <> struct utf16_ascii_run<utf8_counter>: utf16_ascii_count<utf8_counter> {};
+	template <> struct utf16_ascii_run<utf16_counter>: utf16_ascii_count<utf16_counter> {};
+	template <> struct utf16_ascii_run<utf32_counter>: utf16_ascii_count<utf32_counter> {};
+
+	template <> struct utf16_ascii_run<utf8_writer>
+	{
+		enum { enabled = 1 };
+
+		static size_t process(uint8_t*& result, const uint16_t* data, size_t size)
+		{
+			size_t i = 0;
+
+			for (; i + 16 <= size; i += 16)
+			{
+				__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+				__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 8));
+
+				if (!simd_utf16_is_ascii(_mm_or_si128(lo, hi))) break;
+
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(result + i), _mm_packus_epi16(lo, hi));
+			}
+
+			result += i;
+
+			return i;
+		}
+	};
+
+	template <> struct utf16_ascii_run<utf32_writer>
+	{
+		enum { enabled = 1 };
+
+		static size_t process(uint32_t*& result, const uint16_t* data, size_t size)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			size_t i = 0;
+
+			for (; i + 16 <= size; i += 16)
+			{
+				__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+				__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 8));
+
+				if (!simd_utf16_is_ascii(_mm_or_si128(lo, hi))) break;
+
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(result + i), _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(result + i + 4), _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(result + i + 8), _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(result + i + 12), _mm_unpackhi_epi16(hi, zero));
+			}
+
+			result += i;
+
+			return i;
+		}
+	};
+#endif
+
 	template <typename Traits, typename opt_swap = opt_false> struct utf_decoder
 	{
 		static inline typename Traits::value_type decode_utf8_block(const uint8_t* data, size_t size, typename Traits::value_type result)
@@ -1140,6 +1313,35 @@ PUGI__NS_BEGIN
 			return result;
 		}
 
+		// decode_utf16_block for the load path: ASCII runs are done 16 code units at a time
+		// (SIMD), the code units after a run (up to 16, a surrogate pair is not split) one by one
+		static inline typename Traits::value_type decode_utf16_block_simd(const uint16_t* data, size_t size, typename Traits::value_type result)
+		{
+		#ifdef PUGI__SIMD
+			if (!utf16_ascii_run<Traits>::enabled || opt_swap::value || simd_get_level() == simd_scalar)
+				return decode_utf16_block(data, size, result);
+
+			const uint16_t* end = data + size;
+
+			while (data < end)
+			{
+				data += utf16_ascii_run<Traits>::process(result, data, static_cast<size_t>(end - data));
+
+				size_t rest = static_cast<size_t>(end - data);
+				size_t length = rest < 16 ? rest : 16;
+
+				if (length < rest && static_cast<unsigned int>(data[length - 1] - 0xD800) < 0x400) ++length;
+
+				result = decode_utf16_block(data, length, result);
+				data += length;
+			}
+
+			return result;
+		#else
+			return decode_utf16_block(data, size, result);
+		#endif
+		}
+
 		static inline typename Traits::value_type decode_utf32_block(const uint32_t* data, size_t size, typename Traits::value_type result)
 		{
 			const uint32_t* end = data + size;
@@ -1439,7 +1641,7 @@ PUGI__NS_BEGIN
 		size_t data_length = size / sizeof(uint16_t);
 
 		// first pass: get length in wchar_t units
-		size_t length = utf_decoder<wchar_counter, opt_swap>::decode_utf16_block(data, data_length, 0);
+		size_t length = utf_decoder<wchar_counter, opt_swap>::decode_utf16_block_simd(data, data_length, 0);
 
 		// allocate buffer of suitable length
 		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
@@ -1447,7 +1649,7 @@ PUGI__NS_BEGIN
 
 		// second pass: convert utf16 input to wchar_t
 		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
-		wchar_writer::value_type oend = utf_decoder<wchar_writer, opt_swap>::decode_utf16_block(data, data_length, obegin);
+		wchar_writer::value_type oend = utf_decoder<wchar_writer, opt_swap>::decode_utf16_block_simd(data, data_length, obegin);
 
 		assert(oend == obegin + length);
 		*oend = 0;
@@ -1555,7 +1757,7 @@ PUGI__NS_BEGIN
 		size_t data_length = size / sizeof(uint16_t);
 
 		// first pass: get length in utf8 units
-		size_t length = utf_decoder<utf8_counter, opt_swap>::decode_utf16_block(data, data_length, 0);
+		size_t length = utf_decoder<utf8_counter, opt_swap>::decode_utf16_block_simd(data, data_length, 0);
 
 		// allocate buffer of suitable length
 		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
@@ -1563,7 +1765,7 @@ PUGI__NS_BEGIN
 
 		// second pass: convert utf16 input to utf8
 		uint8_t* obegin = reinterpret_cast<uint8_t*>(buffer);
-		uint8_t* oend = utf_decoder<utf8_writer, opt_swap>::decode_utf16_block(data, data_length, obegin);
+		uint8_t* oend = utf_decoder<utf8_writer, opt_swap>::decode_utf16_block_simd(data, data_length, obegin);
 
 		assert(oend == obegin + length);
 		*oend = 0;
@@ -1997,6 +2199,168 @@ PUGI__NS_BEGIN
 	#define PUGI__THROW_ERROR(err, m)   return error_offset = m, error_status = err, static_cast<char_t*>(0)
 	#define PUGI__CHECK_ERROR(err, m)   { if (*s == 0) PUGI__THROW_ERROR(err, m); }
 
+#ifdef PUGI__SIMD
+	// SIMD scanning: skip characters that are not in the stop set of chartype ct (parse_pcdata,
+	// parse_attr, parse_attr_ws, parse_attr_ws | space) 16 or 32 bytes at a time. The stop set
+	// always contains 0, so only whole vectors up to the one holding the terminating zero are read.
+	// Loads are aligned and therefore never cross a page boundary; bytes before s in the first
+	// vector are masked off. Result is the same position as the scalar PUGI__SCANWHILE_UNROLL.
+
+	// Compare of char_t lanes (character size 1, 2 or 4 bytes)
+	template <size_t size> struct simd_sse2_char;
+
+	template <> struct simd_sse2_char<1>
+	{
+		static __m128i splat(int ch) { return _mm_set1_epi8(static_cast<char>(ch)); }
+		static __m128i eq(__m128i lhs, __m128i rhs) { return _mm_cmpeq_epi8(lhs, rhs); }
+	};
+
+	template <> struct simd_sse2_char<2>
+	{
+		static __m128i splat(int ch) { return _mm_set1_epi16(static_cast<short>(ch)); }
+		static __m128i eq(__m128i lhs, __m128i rhs) { return _mm_cmpeq_epi16(lhs, rhs); }
+	};
+
+	template <> struct simd_sse2_char<4>
+	{
+		static __m128i splat(int ch) { return _mm_set1_epi32(ch); }
+		static __m128i eq(__m128i lhs, __m128i rhs) { return _mm_cmpeq_epi32(lhs, rhs); }
+	};
+
+	// Bit per byte of v that is part of a stop character of ct
+	template <int ct> PUGI__FN unsigned int simd_match_sse2(__m128i v)
+	{
+		typedef simd_sse2_char<sizeof(char_t)> lane;
+
+		__m128i m = _mm_or_si128(lane::eq(v, _mm_setzero_si128()), lane::eq(v, lane::splat('&')));
+		m = _mm_or_si128(m, lane::eq(v, lane::splat('\r')));
+
+		if (ct & ct_parse_pcdata)
+			m = _mm_or_si128(m, lane::eq(v, lane::splat('<')));
+
+		if (ct & (ct_parse_attr | ct_parse_attr_ws))
+			m = _mm_or_si128(_mm_or_si128(m, lane::eq(v, lane::splat('"'))), lane::eq(v, lane::splat('\'')));
+
+		if (ct & ct_parse_attr_ws)
+			m = _mm_or_si128(_mm_or_si128(m, lane::eq(v, lane::splat('\n'))), lane::eq(v, lane::splat('\t')));
+
+		if (ct & ct_space)
+			m = _mm_or_si128(m, lane::eq(v, lane::splat(' ')));
+
+		return static_cast<unsigned int>(_mm_movemask_epi8(m));
+	}
+
+	template <int ct> PUGI__FN char_t* simd_scan_sse2(char_t* s)
+	{
+		size_t offset = reinterpret_cast<size_t>(s) & 15;
+		const char* p = reinterpret_cast<const char*>(s) - offset;
+
+		unsigned int mask = simd_match_sse2<ct>(_mm_load_si128(reinterpret_cast<const __m128i*>(p))) & (~0u << offset);
+
+		while (!mask)
+		{
+			p += 16;
+			mask = simd_match_sse2<ct>(_mm_load_si128(reinterpret_cast<const __m128i*>(p)));
+		}
+
+		return reinterpret_cast<char_t*>(const_cast<char*>(p) + simd_first_bit(mask));
+	}
+
+#ifdef PUGI__SIMD_AVX2
+#	if defined(__GNUC__) && !defined(__AVX2__)
+#		pragma GCC push_options
+#		pragma GCC target("avx2")
+#		define PUGI__SIMD_AVX2_TARGET
+#	endif
+	template <size_t size> struct simd_avx2_char;
+
+	template <> struct simd_avx2_char<1>
+	{
+		static __m256i splat(int ch) { return _mm256_set1_epi8(static_cast<char>(ch)); }
+		static __m256i eq(__m256i lhs, __m256i rhs) { return _mm256_cmpeq_epi8(lhs, rhs); }
+	};
+
+	template <> struct simd_avx2_char<2>
+	{
+		static __m256i splat(int ch) { return _mm256_set1_epi16(static_cast<short>(ch)); }
+		static __m256i eq(__m256i lhs, __m256i rhs) { return _mm256_cmpeq_epi16(lhs, rhs); }
+	};
+
+	template <> struct simd_avx2_char<4>
+	{
+		static __m256i splat(int ch) { return _mm256_set1_epi32(ch); }
+		static __m256i eq(__m256i lhs, __m256i rhs) { return _mm256_cmpeq_epi32(lhs, rhs); }
+	};
+
+	template <int ct> PUGI__FN unsigned int simd_match_avx2(__m256i v)
+	{
+		typedef simd_avx2_char<sizeof(char_t)> lane;
+
+		__m256i m = _mm256_or_si256(lane::eq(v, _mm256_setzero_si256()), lane::eq(v, lane::splat('&')));
+		m = _mm256_or_si256(m, lane::eq(v, lane::splat('\r')));
+
+		if (ct & ct_parse_pcdata)
+			m = _mm256_or_si256(m, lane::eq(v, lane::splat('<')));
+
+		if (ct & (ct_parse_attr | ct_parse_attr_ws))
+			m = _mm256_or_si256(_mm256_or_si256(m, lane::eq(v, lane::splat('"'))), lane::eq(v, lane::splat('\'')));
+
+		if (ct & ct_parse_attr_ws)
+			m = _mm256_or_si256(_mm256_or_si256(m, lane::eq(v, lane::splat('\n'))), lane::eq(v, lane::splat('\t')));
+
+		if (ct & ct_space)
+			m = _mm256_or_si256(m, lane::eq(v, lane::splat(' ')));
+
+		return static_cast<unsigned int>(_mm256_movemask_epi8(m));
+	}
+
+	template <int ct> PUGI__FN char_t* simd_scan_avx2(char_t* s)
+	{
+		size_t offset = reinterpret_cast<size_t>(s) & 31;
+		const char* p = reinterpret_cast<const char*>(s) - offset;
+
+		unsigned int mask = simd_match_avx2<ct>(_mm256_load_si256(reinterpret_cast<const __m256i*>(p))) & (~0u << offset);
+
+		while (!mask)
+		{
+			p += 32;
+			mask = simd_match_avx2<ct>(_mm256_load_si256(reinterpret_cast<const __m256i*>(p)));
+		}
+
+		_mm256_zeroupper(); // no AVX/SSE transition penalty in the (non-VEX) code that follows
+
+		return reinterpret_cast<char_t*>(const_cast<char*>(p) + simd_first_bit(mask));
+	}
+#	ifdef PUGI__SIMD_AVX2_TARGET
+#		pragma GCC pop_options
+#		undef PUGI__SIMD_AVX2_TARGET
+#	endif
+#endif
+
+	template <int ct> PUGI__FN char_t* simd_scan(char_t* s)
+	{
+		int level = simd_get_level();
+
+		// vector lanes must line up with characters (always true for buffers allocated by pugixml)
+		if (level != simd_scalar && reinterpret_cast<size_t>(s) % sizeof(char_t) == 0)
+		{
+		#ifdef PUGI__SIMD_AVX2
+			if (level == simd_avx2) return simd_scan_avx2<ct>(s);
+		#endif
+
+			return simd_scan_sse2<ct>(s);
+		}
+
+		PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct));
+
+		return s;
+	}
+
+	#define PUGI__SCANWHILE_SIMD(ct)    { s = simd_scan<ct>(s); }
+#else
+	#define PUGI__SCANWHILE_SIMD(ct)    PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct))
+#endif
+
 	PUGI__FN char_t* strconv_comment(char_t* s, char_t endch)
 	{
 		gap g;
@@ -2065,7 +2429,7 @@ PUGI__NS_BEGIN
 
 			while (true)
 			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_pcdata));
+				PUGI__SCANWHILE_SIMD(ct_parse_pcdata);
 
 				if (*s == '<') // PCDATA ends here
 				{
@@ -2145,7 +2509,7 @@ PUGI__NS_BEGIN
 
 			while (true)
 			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_attr_ws | ct_space));
+				PUGI__SCANWHILE_SIMD(ct_parse_attr_ws | ct_space);
 				
 				if (*s == end_quote)
 				{
@@ -2186,7 +2550,7 @@ PUGI__NS_BEGIN
 
 			while (true)
 			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_attr_ws));
+				PUGI__SCANWHILE_SIMD(ct_parse_attr_ws);
 				
 				if (*s == end_quote)
 				{
@@ -2222,7 +2586,7 @@ PUGI__NS_BEGIN
 
 			while (true)
 			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_attr));
+				PUGI__SCANWHILE_SIMD(ct_parse_attr);
 				
 				if (*s == end_quote)
 				{
@@ -2254,7 +2618,7 @@ PUGI__NS_BEGIN
 
 			while (true)
 			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_attr));
+				PUGI__SCANWHILE_SIMD(ct_parse_attr);
 				
 				if (*s == end_quote)
 				{
@@ -6250,6 +6614,30 @@ namespace pugi
 	{
 		return impl::xml_memory::deallocate;
 	}
+
+	PUGI__FN xml_simd_level PUGIXML_FUNCTION set_simd_level(xml_simd_level level)
+	{
+	#ifdef PUGI__SIMD
+		int supported = impl::simd_supported_level();
+
+		impl::simd_level::level = (level == simd_auto || level > supported) ? supported : level;
+
+		return static_cast<xml_simd_level>(impl::simd_level::level);
+	#else
+		(void)level;
+
+		return simd_scalar;
+	#endif
+	}
+
+	PUGI__FN xml_simd_level PUGIXML_FUNCTION get_simd_level()
+	{
+	#ifdef PUGI__SIMD
+		return static_cast<xml_simd_level>(impl::simd_get_level());
+	#else
+		return simd_scalar;
+	#endif
+	}
 }
 
 #if !defined(PUGIXML_NO_STL) && (defined(_MSC_VER) || defined(__ICC))
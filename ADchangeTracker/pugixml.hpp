@@ -1309,6 +1309,22 @@ namespace pugi
 	// Get current memory management functions
 	allocation_function PUGIXML_FUNCTION get_memory_allocation_function();
 	deallocation_function PUGIXML_FUNCTION get_memory_deallocation_function();
+
+	// Instruction set used to scan text and attribute values while parsing (ADchangeTracker addition)
+	enum xml_simd_level
+	{
+		simd_scalar,	// One character at a time (chartype table)
+		simd_sse2,		// 16 bytes at a time
+		simd_avx2,		// 32 bytes at a time
+		simd_auto		// Best level supported by compiler and CPU (default)
+	};
+
+	// Select scanning level for all subsequent parsing; a level the CPU does not support is lowered. Returns the level in use.
+	// Note: this is global state; call it before parsing starts on other threads.
+	xml_simd_level PUGIXML_FUNCTION set_simd_level(xml_simd_level level);
+
+	// Get scanning level in use
+	xml_simd_level PUGIXML_FUNCTION get_simd_level();
 }
 
 #if !defined(PUGIXML_NO_STL) && (defined(_MSC_VER) || defined(__ICC))
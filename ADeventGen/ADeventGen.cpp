@@ -0,0 +1,427 @@
+// ADeventGen - generate synthetic Security event log events (as rendered by EvtRender)
+// for load testing ADchangeTracker. One event XML per line, to a file or stdout.
+//
+// Usage:
+//   ADeventGen [-count N] [-rate EPS] [-burst PEAK:SECONDS:EVERY] [-paced] [-dcs N]
+//              [-domain NAME] [-start RecordID] [-seed N] [-weights ID=W,...]
+//              [-classes Class=W,...] [-out file]
+//
+//   -count     Number of events (default 10000).
+//   -rate      Events per second (default 100). Sets TimeCreated of the events.
+//   -burst     Every EVERY seconds the rate is PEAK for SECONDS (e.g. 2000:10:60).
+//   -paced     Write events in real time (at the rate) - e.g. to feed
+//              "ADchangeTracker -replay -". Default is as fast as possible.
+//   -dcs       Number of fake domain controllers (Computer), default 2. EventRecordIDs
+//              are numbered per DC.
+//   -domain    DNS domain of the fake DCs (default contoso.local).
+//   -start     First EventRecordID (default 1000000).
+//   -seed      Random seed (default 1) - same seed gives same events.
+//   -weights   Weight per EventID, replaces the default mix. EventID 0 = other
+//              Security events (logons etc.) that are not AD changes.
+//   -classes   Weight per ObjectClass of 5136...5141 events, replaces the default.
+//   -out       Output file (default stdout).
+//
+// Example - 1 hour at 50 events/s with a 10 s storm of 3000 events/s every 5 minutes:
+//   ADeventGen -count 500000 -rate 50 -burst 3000:10:300 -dcs 4 -out events.xml
+//
+// Portable C++ - builds with Visual Studio (ADeventGen.vcxproj) and on Linux with:
+//   g++ -O2 -o ADeventGen ADeventGen.cpp
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+typedef unsigned long long UINT64;
+
+// Default mix of events - EventIDs accepted in ADchangeTracker.cfg and other Security events.
+static const char *s_szDefaultWeights =
+	"4720=2,4722=2,4723=1,4724=4,4725=2,4726=1,4727=1,4728=4,4729=3,4730=1,4731=1,"
+	"4732=3,4733=2,4734=1,4735=1,4737=1,4738=10,4740=5,4741=1,4742=6,4743=1,4754=1,"
+	"4755=1,4756=3,4757=2,4758=1,4764=1,4767=2,4781=1,"
+	"5136=200,5137=40,5138=1,5139=5,5141=30,0=100";
+
+// Default ObjectClass mix of 5136...5141 events. Note - DNS and SCCM objects are the
+// noise that IgnoredEvents in ADchangeTracker.cfg filters.
+static const char *s_szDefaultClasses =
+	"dnsNode=35,user=20,group=8,computer=8,msExchActiveSyncDevice=6,printQueue=4,"
+	"mSSMSSite=3,mSSMSRoamingBoundaryRange=3,mSSMSManagementPoint=2,organizationalUnit=3,"
+	"groupPolicyContainer=3,serviceConnectionPoint=3,contact=2";
+
+static const char *s_szarrAttributes[] = { "description", "telephoneNumber", "member",
+	"userAccountControl", "dnsRecord", "displayName", "mail", "gPLink", "dNSTombstoned" };
+
+// Other (not AD change) Security events mixed in - the service subscribes to all events.
+static const int s_narrOtherEventIDs[] = { 4624, 4634, 4662, 4672, 4768, 4769, 4776 };
+
+typedef struct tagWeighted
+{
+	std::string strName;
+	int nValue;			// EventID (for EventID weights).
+	UINT64 nCumWeight;	// Cumulative weight.
+} WEIGHTED;
+
+// xorshift64* - small, fast and same sequence on all platforms.
+class CRandom
+{
+public:
+	CRandom(UINT64 nSeed) : m_n(nSeed ? nSeed : 1) {}
+	UINT64 Next()
+	{
+		m_n ^= m_n >> 12;
+		m_n ^= m_n << 25;
+		m_n ^= m_n >> 27;
+		return m_n * 2685821657736338717ULL;
+	}
+	unsigned Below(unsigned n) { return (unsigned)(Next() % n); }
+
+protected:
+	UINT64 m_n;
+};
+
+// Parse "name=weight,name=weight". Returns false if bad format.
+static bool ParseWeights(const char *sz, std::vector<WEIGHTED> &v)
+{
+	v.clear();
+	UINT64 nCum = 0;
+	while (*sz)
+	{
+		const char *pEq = strchr(sz, '=');
+		if (!pEq)
+			return false;
+		WEIGHTED w;
+		w.strName.assign(sz, pEq - sz);
+		w.nValue = atoi(w.strName.c_str());
+		char *pEnd;
+		UINT64 nWeight = strtoull(pEq + 1, &pEnd, 10);
+		if (pEnd == pEq + 1 || (*pEnd && *pEnd != ','))
+			return false;
+		if (nWeight)
+		{
+			nCum += nWeight;
+			w.nCumWeight = nCum;
+			v.push_back(w);
+		}
+		sz = *pEnd ? pEnd + 1 : pEnd;
+	}
+	return !v.empty();
+}
+
+static const WEIGHTED &Pick(const std::vector<WEIGHTED> &v, CRandom &rnd)
+{
+	UINT64 n = rnd.Next() % v.back().nCumWeight;
+	size_t nLow = 0, nHigh = v.size() - 1;
+	while (nLow < nHigh)
+	{
+		size_t nMid = (nLow + nHigh) / 2;
+		if (v[nMid].nCumWeight > n)
+			nHigh = nMid;
+		else nLow = nMid + 1;
+	}
+	return v[nLow];
+}
+
+// "2016-09-07T12:34:56.1234567Z" from 100 ns units since 1970.
+static void FormatSystemTime(UINT64 nTime, char *sz, size_t nSize)
+{
+	time_t t = (time_t)(nTime / 10000000);
+	struct tm tmUtc;
+#ifdef _WIN32
+	gmtime_s(&tmUtc, &t);
+#else
+	gmtime_r(&t, &tmUtc);
+#endif
+	snprintf(sz, nSize, "%04d-%02d-%02dT%02d:%02d:%02d.%07uZ", tmUtc.tm_year + 1900, tmUtc.tm_mon + 1,
+		tmUtc.tm_mday, tmUtc.tm_hour, tmUtc.tm_min, tmUtc.tm_sec, (unsigned)(nTime % 10000000));
+}
+
+class CEventWriter
+{
+public:
+	CEventWriter(CRandom &rnd, const std::string &strDomain) : m_rnd(rnd), m_strDomain(strDomain)
+	{
+		m_strNetbios = strDomain.substr(0, strDomain.find('.'));
+		for (size_t i = 0; i < m_strNetbios.size(); i++)
+			m_strNetbios[i] = (char)toupper((unsigned char)m_strNetbios[i]);
+		m_strDN = "DC=" + strDomain;
+		for (size_t i; (i = m_strDN.find('.')) != std::string::npos; )
+			m_strDN.replace(i, 1, ",DC=");
+	}
+
+	void Write(std::string &str, int nEventID, const char *szObjClass, const char *szComputer,
+		UINT64 nRecordID, UINT64 nTime)
+	{
+		char szTime[96];
+		FormatSystemTime(nTime, szTime, sizeof(szTime));
+		m_pstr = &str;
+		str = "<Event xmlns='http://schemas.microsoft.com/win/2004/08/events/event'><System>"
+			"<Provider Name='Microsoft-Windows-Security-Auditing' Guid='{54849625-5478-4994-A5BA-3E3B0328C30D}'/>";
+		Append("<EventID>%d</EventID><Version>0</Version><Level>0</Level><Task>%d</Task><Opcode>0</Opcode>"
+			"<Keywords>0x8020000000000000</Keywords><TimeCreated SystemTime='%s'/>"
+			"<EventRecordID>%llu</EventRecordID><Correlation/><Execution ProcessID='640' ThreadID='%u'/>"
+			"<Channel>Security</Channel><Computer>%s</Computer><Security/></System><EventData>",
+			nEventID, Task(nEventID), szTime, nRecordID, 700 + m_rnd.Below(5000), szComputer);
+
+		if (nEventID >= 5136 && nEventID <= 5141)
+			WriteDsChange(nEventID, szObjClass);
+		else if (nEventID == 4781)
+		{
+			unsigned nUser = m_rnd.Below(20000);
+			Append("<Data Name='OldTargetUserName'>user%u</Data><Data Name='NewTargetUserName'>user%u.renamed</Data>"
+				"<Data Name='TargetDomainName'>%s</Data><Data Name='TargetSid'>%s-%u</Data>",
+				nUser, nUser, m_strNetbios.c_str(), DomainSid(), 1100 + nUser);
+			WriteSubject();
+		}
+		else if (nEventID == 4740)
+		{
+			unsigned nUser = m_rnd.Below(20000);
+			Append("<Data Name='TargetUserName'>user%u</Data><Data Name='TargetDomainName'>WS%04u</Data>"
+				"<Data Name='TargetSid'>%s-%u</Data>", nUser, m_rnd.Below(5000), DomainSid(), 1100 + nUser);
+			WriteSubject();
+		}
+		else if (IsMembershipEvent(nEventID))
+		{
+			unsigned nUser = m_rnd.Below(20000);
+			Append("<Data Name='MemberName'>CN=User %u,OU=Users,%s</Data><Data Name='MemberSid'>%s-%u</Data>",
+				nUser, m_strDN.c_str(), DomainSid(), 1100 + nUser);
+			unsigned nGroup = m_rnd.Below(500);
+			Append("<Data Name='TargetUserName'>Group%u</Data><Data Name='TargetDomainName'>%s</Data>"
+				"<Data Name='TargetSid'>%s-%u</Data>", nGroup, m_strNetbios.c_str(), DomainSid(), 30000 + nGroup);
+			WriteSubject();
+			Append("<Data Name='PrivilegeList'>-</Data>");
+		}
+		else if (nEventID >= 4720 && nEventID <= 4767)
+		{
+			WriteTarget(m_rnd.Below(20000));
+			WriteSubject();
+		}
+		else
+		{	// Other Security event.
+			WriteSubject();
+			Append("<Data Name='TargetUserName'>user%u</Data><Data Name='IpAddress'>10.%u.%u.%u</Data>",
+				m_rnd.Below(20000), m_rnd.Below(256), m_rnd.Below(256), m_rnd.Below(256));
+		}
+		str += "</EventData></Event>";
+	}
+
+protected:
+	void Append(const char *szFormat, ...)
+	{
+		char sz[1024];
+		va_list args;
+		va_start(args, szFormat);
+		vsnprintf(sz, sizeof(sz), szFormat, args);
+		va_end(args);
+		*m_pstr += sz;
+	}
+
+	static int Task(int nEventID)
+	{
+		if (nEventID >= 5136 && nEventID <= 5141)
+			return 14081;	// Directory Service Changes
+		if (nEventID >= 4741 && nEventID <= 4743)
+			return 13825;	// Computer Account Management
+		if (IsMembershipEvent(nEventID) || (nEventID >= 4727 && nEventID <= 4737) || (nEventID >= 4754 && nEventID <= 4764))
+			return 13826;	// Security Group Management
+		if (nEventID >= 4720 && nEventID <= 4781)
+			return 13824;	// User Account Management
+		return 12544;		// Logon
+	}
+
+	static bool IsMembershipEvent(int nEventID)
+	{
+		return nEventID == 4728 || nEventID == 4729 || nEventID == 4732 || nEventID == 4733
+			|| nEventID == 4746 || nEventID == 4747 || nEventID == 4751 || nEventID == 4752
+			|| nEventID == 4756 || nEventID == 4757 || nEventID == 4761 || nEventID == 4762;
+	}
+
+	static const char *DomainSid() { return "S-1-5-21-1004336348-1177238915-682003330"; }
+
+	void WriteTarget(unsigned nUser)
+	{
+		Append("<Data Name='TargetUserName'>user%u</Data><Data Name='TargetDomainName'>%s</Data>"
+			"<Data Name='TargetSid'>%s-%u</Data>", nUser, m_strNetbios.c_str(), DomainSid(), 1100 + nUser);
+	}
+
+	void WriteSubject()
+	{
+		unsigned nAdmin = m_rnd.Below(8);
+		Append("<Data Name='SubjectUserSid'>%s-%u</Data><Data Name='SubjectUserName'>%s%u</Data>"
+			"<Data Name='SubjectDomainName'>%s</Data><Data Name='SubjectLogonId'>0x%llx</Data>",
+			DomainSid(), 500 + nAdmin, nAdmin < 2 ? "svc_sync" : "admin", nAdmin, m_strNetbios.c_str(),
+			(unsigned long long)(0x10000 + m_rnd.Below(0x1000000)));
+	}
+
+	void WriteDsChange(int nEventID, const char *szObjClass)
+	{
+		char szDN[256];
+		unsigned nObj = m_rnd.Below(50000);
+		if (strcmp(szObjClass, "dnsNode") == 0)
+			snprintf(szDN, sizeof(szDN), "DC=host%u,DC=%s,CN=MicrosoftDNS,DC=DomainDnsZones,%s",
+				nObj, m_strDomain.c_str(), m_strDN.c_str());
+		else if (strncmp(szObjClass, "mSSMS", 5) == 0)
+			snprintf(szDN, sizeof(szDN), "CN=SMS-Object-%u,CN=System Management,CN=System,%s",
+				nObj, m_strDN.c_str());
+		else snprintf(szDN, sizeof(szDN), "CN=%s%u,OU=Managed,%s", szObjClass, nObj, m_strDN.c_str());
+
+		Append("<Data Name='OpCorrelationID'>{%08x-1c2d-4e5f-8a9b-%012llx}</Data>"
+			"<Data Name='AppCorrelationID'>-</Data>", (unsigned)m_rnd.Next(),
+			(unsigned long long)(m_rnd.Next() & 0xffffffffffffULL));
+		WriteSubject();
+		Append("<Data Name='DSName'>%s</Data><Data Name='DSType'>%%%%14676</Data>", m_strDomain.c_str());
+		if (nEventID == 5139)
+			Append("<Data Name='OldObjectDN'>%s</Data><Data Name='NewObjectDN'>%s-moved</Data>", szDN, szDN);
+		else Append("<Data Name='ObjectDN'>%s</Data>", szDN);
+		Append("<Data Name='ObjectGUID'>{%08x-4b2c-4d3e-9f10-%012llx}</Data><Data Name='ObjectClass'>%s</Data>",
+			(unsigned)m_rnd.Next(), (unsigned long long)(m_rnd.Next() & 0xffffffffffffULL), szObjClass);
+		if (nEventID == 5136)
+		{
+			const char *szAttr = s_szarrAttributes[m_rnd.Below(sizeof(s_szarrAttributes) / sizeof(s_szarrAttributes[0]))];
+			Append("<Data Name='AttributeLDAPDisplayName'>%s</Data><Data Name='AttributeSyntaxOID'>2.5.5.12</Data>"
+				"<Data Name='AttributeValue'>Value %u</Data><Data Name='OperationType'>%%%%%u</Data>",
+				szAttr, m_rnd.Below(100000), m_rnd.Below(2) ? 14674 : 14675);
+		}
+	}
+
+	CRandom &m_rnd;
+	std::string m_strDomain, m_strNetbios, m_strDN;
+	std::string *m_pstr;
+};
+
+static void Usage()
+{
+	fprintf(stderr, "Usage: ADeventGen [-count N] [-rate EPS] [-burst PEAK:SECONDS:EVERY] [-paced] [-dcs N]\n"
+		"                  [-domain NAME] [-start RecordID] [-seed N] [-weights ID=W,...]\n"
+		"                  [-classes Class=W,...] [-out file]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	UINT64 nCount = 10000, nStart = 1000000, nSeed = 1;
+	double dRate = 100, dBurstRate = 0, dBurstSeconds = 0, dBurstEvery = 0;
+	bool fPaced = false;
+	int nDCs = 2;
+	std::string strDomain = "contoso.local";
+	const char *szWeights = s_szDefaultWeights, *szClasses = s_szDefaultClasses, *szOut = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *szArg = argv[i], *szVal = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(szArg, "-paced") == 0)
+		{
+			fPaced = true;
+			continue;
+		}
+		if (!szVal)
+		{
+			Usage();
+			return 1;
+		}
+		i++;
+		if (strcmp(szArg, "-count") == 0)
+			nCount = strtoull(szVal, NULL, 10);
+		else if (strcmp(szArg, "-rate") == 0)
+			dRate = atof(szVal);
+		else if (strcmp(szArg, "-burst") == 0)
+		{
+			if (sscanf(szVal, "%lf:%lf:%lf", &dBurstRate, &dBurstSeconds, &dBurstEvery) != 3
+				|| dBurstRate <= 0 || dBurstSeconds <= 0 || dBurstEvery <= dBurstSeconds)
+			{
+				fprintf(stderr, "Bad -burst %s (PEAK:SECONDS:EVERY, SECONDS < EVERY)\n", szVal);
+				return 1;
+			}
+		}
+		else if (strcmp(szArg, "-dcs") == 0)
+			nDCs = atoi(szVal);
+		else if (strcmp(szArg, "-domain") == 0)
+			strDomain = szVal;
+		else if (strcmp(szArg, "-start") == 0)
+			nStart = strtoull(szVal, NULL, 10);
+		else if (strcmp(szArg, "-seed") == 0)
+			nSeed = strtoull(szVal, NULL, 10);
+		else if (strcmp(szArg, "-weights") == 0)
+			szWeights = szVal;
+		else if (strcmp(szArg, "-classes") == 0)
+			szClasses = szVal;
+		else if (strcmp(szArg, "-out") == 0)
+			szOut = szVal;
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+	std::vector<WEIGHTED> vEventIDs, vClasses;
+	if (dRate <= 0 || nDCs <= 0 || !ParseWeights(szWeights, vEventIDs) || !ParseWeights(szClasses, vClasses))
+	{
+		fprintf(stderr, "Bad -rate, -dcs, -weights or -classes\n");
+		return 1;
+	}
+
+	FILE *pOut = stdout;
+	if (szOut && !(pOut = fopen(szOut, "wb")))
+	{
+		fprintf(stderr, "Can't create %s\n", szOut);
+		return 1;
+	}
+
+	std::vector<std::string> vComputers;
+	std::vector<UINT64> vNextRecordID;
+	for (int i = 0; i < nDCs; i++)
+	{
+		char sz[256];
+		snprintf(sz, sizeof(sz), "DC%02d.%s", i + 1, strDomain.c_str());
+		vComputers.push_back(sz);
+		vNextRecordID.push_back(nStart);
+	}
+
+	CRandom rnd(nSeed);
+	CEventWriter writer(rnd, strDomain);
+	std::string str;
+	str.reserve(4096);
+	// TimeCreated starts now - the time offset of each event follows the rate (and bursts).
+	UINT64 nTimeStart = (UINT64)time(NULL) * 10000000;
+	std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+	double dSeconds = 0;
+	for (UINT64 n = 0; n < nCount; n++)
+	{
+		const WEIGHTED &evt = Pick(vEventIDs, rnd);
+		int nEventID = evt.nValue ? evt.nValue
+			: s_narrOtherEventIDs[rnd.Below(sizeof(s_narrOtherEventIDs) / sizeof(s_narrOtherEventIDs[0]))];
+		const char *szObjClass = Pick(vClasses, rnd).strName.c_str();
+		int nDC = (int)rnd.Below(nDCs);
+
+		if (fPaced)
+		{
+			std::chrono::steady_clock::time_point tDue = tStart
+				+ std::chrono::microseconds((long long)(dSeconds * 1e6));
+			if (tDue > std::chrono::steady_clock::now())
+			{
+				fflush(pOut);
+				std::this_thread::sleep_until(tDue);
+			}
+		}
+		writer.Write(str, nEventID, szObjClass, vComputers[nDC].c_str(), vNextRecordID[nDC]++,
+			nTimeStart + (UINT64)(dSeconds * 1e7 + 0.5));
+		str += '\n';
+		if (fwrite(str.data(), 1, str.size(), pOut) != str.size())
+		{
+			fprintf(stderr, "Write failed\n");
+			return 1;
+		}
+
+		bool fBurst = dBurstEvery > 0 && fmod(dSeconds, dBurstEvery) < dBurstSeconds;
+		dSeconds += 1.0 / (fBurst ? dBurstRate : dRate);
+	}
+	if (pOut != stdout)
+		fclose(pOut);
+	else fflush(pOut);
+	fprintf(stderr, "%llu events, %.1f seconds of event time\n", nCount, dSeconds);
+	return 0;
+}
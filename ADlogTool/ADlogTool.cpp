@@ -0,0 +1,527 @@
+// ADlogTool - decode and query binary log files written by ADchangeTracker
+// (BinaryLogFormat = ON, see ADchangeTracker\BinLog.h).
+//
+// Usage:
+//   ADlogTool decode <file.blog> [out.log]
+//       Convert binary log file to the tab separated text log format.
+//   ADlogTool query <file.blog> [-from "YYYY-MM-DD HH:MM:SS"] [-to "YYYY-MM-DD HH:MM:SS"]
+//                   [-level Level] [-module Module] [-recid EventRecordID] [-stats]
+//       Print matching records (as text log lines). Blocks of records that can't match
+//       are skipped using the sparse index file (file.bidx).
+//
+// Portable C++ - builds with Visual Studio (ADlogTool.vcxproj) and on Linux with:
+//   g++ -O2 -o ADlogTool ADlogTool.cpp ../ADchangeTracker/BinLog.cpp
+#include "../ADchangeTracker/BinLog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read only memory mapped file.
+class CMappedFile
+{
+public:
+	CMappedFile() : m_pData(NULL), m_nSize(0)
+	{
+#ifdef _WIN32
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMap = NULL;
+#else
+		m_fd = -1;
+#endif
+	}
+	~CMappedFile() { Close(); }
+
+	bool Open(const char *szFile)
+	{
+#ifdef _WIN32
+		// Note - the service has the file open for writing.
+		m_hFile = ::CreateFileA(szFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER nSize;
+		if (!::GetFileSizeEx(m_hFile, &nSize))
+			return false;
+		m_nSize = (size_t)nSize.QuadPart;
+		if (m_nSize == 0)
+			return true;
+		m_hMap = ::CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!m_hMap)
+			return false;
+		m_pData = (const unsigned char *)::MapViewOfFile(m_hMap, FILE_MAP_READ, 0, 0, 0);
+#else
+		m_fd = open(szFile, O_RDONLY);
+		if (m_fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(m_fd, &st) != 0)
+			return false;
+		m_nSize = (size_t)st.st_size;
+		if (m_nSize == 0)
+			return true;
+		void *p = mmap(NULL, m_nSize, PROT_READ, MAP_SHARED, m_fd, 0);
+		m_pData = p == MAP_FAILED ? NULL : (const unsigned char *)p;
+#endif
+		return m_pData != NULL;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_pData)
+			::UnmapViewOfFile(m_pData);
+		if (m_hMap)
+			::CloseHandle(m_hMap);
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			::CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMap = NULL;
+#else
+		if (m_pData)
+			munmap((void *)m_pData, m_nSize);
+		if (m_fd >= 0)
+			close(m_fd);
+		m_fd = -1;
+#endif
+		m_pData = NULL;
+		m_nSize = 0;
+	}
+
+	const unsigned char *Data() { return m_pData; }
+	size_t Size() { return m_nSize; }
+
+private:
+	const unsigned char *m_pData;
+	size_t m_nSize;
+#ifdef _WIN32
+	HANDLE m_hFile, m_hMap;
+#else
+	int m_fd;
+#endif
+};
+
+// Query filter. Empty strings / zero values = no filter.
+struct QUERY_FILTER
+{
+	bool fFrom, fTo, fRecID;
+	long long tFrom, tTo;
+	unsigned long long nRecID;
+	std::string strLevel, strModule;
+};
+
+// Reader for one binary log file.
+class CBinLogReader
+{
+public:
+	CBinLogReader(FILE *pOut) : m_nRecords(0), m_nMatched(0), m_pOut(pOut), m_nHeaderLen(0) {}
+
+	bool Open(const char *szFile);
+	bool LoadIndex(const char *szIndexFile);
+
+	// Decode records in [nOffset, nEnd) and print those matching the filter (or all if NULL).
+	// Returns false if the data is corrupt.
+	bool Scan(size_t nOffset, size_t nEnd, const QUERY_FILTER *pFilter);
+
+	size_t HeaderLength() { return m_nHeaderLen; }
+	size_t Size() { return m_file.Size(); }
+	int StringID(const std::string &str);
+
+	std::vector<BINLOG_INDEX_BLOCK> m_vecBlocks;
+	unsigned long long m_nRecords, m_nMatched;
+
+protected:
+	bool GetString(const unsigned char *&p, const unsigned char *pEnd, std::string &str);
+	bool GetStrRef(const unsigned char *&p, const unsigned char *pEnd, std::string &str);
+	bool DefineString(const unsigned char *p, const unsigned char *pEnd);
+
+	FILE *m_pOut;
+	CMappedFile m_file;
+	size_t m_nHeaderLen;
+	std::string m_strWorkstation, m_strUser;
+	std::vector<std::string> m_vecStrings;	// Interned strings by id (id 0 = empty string).
+};
+
+bool CBinLogReader::GetString(const unsigned char *&p, const unsigned char *pEnd, std::string &str)
+{
+	unsigned long long nLen;
+	int n = BinLogGetVarint(p, pEnd, &nLen);
+	if (!n || nLen > (unsigned long long)(pEnd - p - n))
+		return false;
+	str.assign((const char *)p + n, (size_t)nLen);
+	p += n + nLen;
+	return true;
+}
+
+bool CBinLogReader::GetStrRef(const unsigned char *&p, const unsigned char *pEnd, std::string &str)
+{
+	unsigned long long nRef;
+	int n = BinLogGetVarint(p, pEnd, &nRef);
+	if (!n)
+		return false;
+	p += n;
+	if (nRef & 1)
+	{	// Literal string.
+		unsigned long long nLen = nRef >> 1;
+		if (nLen > (unsigned long long)(pEnd - p))
+			return false;
+		str.assign((const char *)p, (size_t)nLen);
+		p += nLen;
+		return true;
+	}
+	unsigned long long nID = nRef >> 1;
+	if (nID >= m_vecStrings.size())
+		return false;
+	str = m_vecStrings[(size_t)nID];
+	return true;
+}
+
+// Interned string definition: varint id, string.
+bool CBinLogReader::DefineString(const unsigned char *p, const unsigned char *pEnd)
+{
+	unsigned long long nID;
+	int n = BinLogGetVarint(p, pEnd, &nID);
+	if (!n || nID == 0 || nID > BINLOG_MAX_STRINGS)
+		return false;
+	p += n;
+	std::string str;
+	if (!GetString(p, pEnd, str))
+		return false;
+	if (m_vecStrings.size() <= nID)
+		m_vecStrings.resize((size_t)nID + 1);
+	m_vecStrings[(size_t)nID] = str;
+	return true;
+}
+
+int CBinLogReader::StringID(const std::string &str)
+{
+	for (size_t i = 1; i < m_vecStrings.size(); i++)
+		if (m_vecStrings[i] == str)
+			return (int)i;
+	return -1;
+}
+
+bool CBinLogReader::Open(const char *szFile)
+{
+	if (!m_file.Open(szFile))
+	{
+		fprintf(stderr, "Can't open file: %s\n", szFile);
+		return false;
+	}
+	const unsigned char *p = m_file.Data(), *pEnd = p + m_file.Size();
+	if (m_file.Size() < BINLOG_MAGIC_LEN || memcmp(p, BINLOG_MAGIC, BINLOG_MAGIC_LEN) != 0)
+	{
+		fprintf(stderr, "Not a binary log file: %s\n", szFile);
+		return false;
+	}
+	p += BINLOG_MAGIC_LEN;
+	unsigned long long nVersion;
+	int n = BinLogGetVarint(p, pEnd, &nVersion);
+	if (!n || nVersion != BINLOG_VERSION)
+	{
+		fprintf(stderr, "Unsupported binary log version: %s\n", szFile);
+		return false;
+	}
+	p += n;
+	if (!GetString(p, pEnd, m_strWorkstation) || !GetString(p, pEnd, m_strUser))
+	{
+		fprintf(stderr, "Invalid file header: %s\n", szFile);
+		return false;
+	}
+	m_nHeaderLen = p - m_file.Data();
+	m_vecStrings.resize(1);
+	return true;
+}
+
+// Load string definitions and block summaries from index file.
+// A missing or truncated index file is not an error - the data file is scanned instead.
+bool CBinLogReader::LoadIndex(const char *szIndexFile)
+{
+	CMappedFile idx;
+	if (!idx.Open(szIndexFile))
+		return false;
+	const unsigned char *p = idx.Data(), *pEnd = p + idx.Size();
+	while (p < pEnd)
+	{
+		unsigned char nType = *p++;
+		if (nType == BINLOG_IDX_STRING)
+		{
+			unsigned long long nID, nLen;
+			int n = BinLogGetVarint(p, pEnd, &nID);
+			int n2 = n ? BinLogGetVarint(p + n, pEnd, &nLen) : 0;
+			if (!n2 || nLen > (unsigned long long)(pEnd - p - n - n2))
+				break;
+			DefineString(p, p + n + n2 + nLen);
+			p += n + n2 + nLen;
+		}
+		else if (nType == BINLOG_IDX_BLOCK && pEnd - p >= BINLOG_IDX_BLOCK_SIZE)
+		{
+			BINLOG_INDEX_BLOCK sBlock;
+			BinLogGetIndexBlock(p, &sBlock);
+			p += BINLOG_IDX_BLOCK_SIZE;
+			if (sBlock.nOffset + sBlock.nLength > m_file.Size())
+				break;	// Block not written to data file yet.
+			m_vecBlocks.push_back(sBlock);
+		}
+		else break;
+	}
+	return true;
+}
+
+bool CBinLogReader::Scan(size_t nOffset, size_t nEnd, const QUERY_FILTER *pFilter)
+{
+	const unsigned char *pBase = m_file.Data();
+	const unsigned char *p = pBase + nOffset, *pEnd = pBase + nEnd;
+	std::string strLevel, strModule, strEvent, strDesc, strNotes;
+	char szTime[32], szDesc[32];
+
+	while (p < pEnd)
+	{
+		unsigned char nType = *p++;
+		unsigned long long nLen;
+		int n = BinLogGetVarint(p, pEnd, &nLen);
+		if (!n || nLen > (unsigned long long)(pEnd - p - n))
+		{	// Note - last record may be partly written if the service is running.
+			if (nEnd == m_file.Size())
+				return true;
+			fprintf(stderr, "Corrupt record at offset %llu\n", (unsigned long long)(p - 1 - pBase));
+			return false;
+		}
+		p += n;
+		const unsigned char *pRec = p, *pRecEnd = p + nLen;
+		p = pRecEnd;
+
+		if (nType == BINLOG_REC_STRING)
+		{
+			DefineString(pRec, pRecEnd);
+			continue;
+		}
+		if (nType != BINLOG_REC_LOG)
+			continue;	// Unknown record type - skip.
+
+		unsigned long long tLocal, nThreadID, nFlags, nRecID = 0;
+		bool fOk = false;
+		do
+		{
+			if (!(n = BinLogGetVarint(pRec, pRecEnd, &tLocal))) break;
+			pRec += n;
+			if (!(n = BinLogGetVarint(pRec, pRecEnd, &nThreadID))) break;
+			pRec += n;
+			if (!GetStrRef(pRec, pRecEnd, strLevel) || !GetStrRef(pRec, pRecEnd, strModule)
+				|| !GetStrRef(pRec, pRecEnd, strEvent))
+				break;
+			if (!(n = BinLogGetVarint(pRec, pRecEnd, &nFlags))) break;
+			pRec += n;
+			if (nFlags & BINLOG_FLAG_RECID)
+			{
+				if (!(n = BinLogGetVarint(pRec, pRecEnd, &nRecID))) break;
+				pRec += n;
+				sprintf(szDesc, "%llu", nRecID);
+				strDesc = szDesc;
+			}
+			else if (!GetString(pRec, pRecEnd, strDesc))
+				break;
+			if (!GetString(pRec, pRecEnd, strNotes))
+				break;
+			fOk = true;
+		} while (false);
+		if (!fOk)
+		{
+			fprintf(stderr, "Corrupt log record at offset %llu\n", (unsigned long long)(pRecEnd - nLen - pBase));
+			return false;
+		}
+		m_nRecords++;
+
+		if (pFilter)
+		{
+			if (pFilter->fFrom && (long long)tLocal < pFilter->tFrom)
+				continue;
+			if (pFilter->fTo && (long long)tLocal > pFilter->tTo)
+				continue;
+			if (pFilter->fRecID && (!(nFlags & BINLOG_FLAG_RECID) || nRecID != pFilter->nRecID))
+				continue;
+			if (!pFilter->strLevel.empty() && strLevel != pFilter->strLevel)
+				continue;
+			if (!pFilter->strModule.empty() && strModule != pFilter->strModule)
+				continue;
+		}
+		m_nMatched++;
+
+		BinLogFormatTime((long long)tLocal, szTime);
+		fprintf(m_pOut, "%llu\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\r\n", nThreadID, szTime,
+			m_strWorkstation.c_str(), m_strUser.c_str(), strModule.c_str(), strLevel.c_str(),
+			strEvent.c_str(), strDesc.c_str(), strNotes.c_str());
+	}
+	return true;
+}
+
+// "x.blog" -> "x.bidx"
+static std::string IndexFileName(const char *szFile)
+{
+	std::string str = szFile;
+	size_t nDot = str.rfind('.');
+	if (nDot != std::string::npos && str.find_first_of("/\\", nDot) == std::string::npos)
+		str.erase(nDot);
+	return str + ".bidx";
+}
+
+// Can block contain records matching the filter?
+static bool BlockMayMatch(const BINLOG_INDEX_BLOCK &b, const QUERY_FILTER &f, int nLevelID, int nModuleID)
+{
+	if (f.fFrom && b.tLast < f.tFrom)
+		return false;
+	if (f.fTo && b.tFirst > f.tTo)
+		return false;
+	if (f.fRecID && (b.nMinRecID > b.nMaxRecID || f.nRecID < b.nMinRecID || f.nRecID > b.nMaxRecID))
+		return false;
+	// Note - a literal (not interned) level or module in the block sets all bits of the mask.
+	if (!f.strLevel.empty())
+	{
+		if (nLevelID >= 0 ? !(b.nLevelMask & (1u << (nLevelID & 31))) : b.nLevelMask != ~0u)
+			return false;
+	}
+	if (!f.strModule.empty())
+	{
+		if (nModuleID >= 0 ? !(b.nModuleMask & (1ULL << (nModuleID & 63))) : b.nModuleMask != ~0ULL)
+			return false;
+	}
+	return true;
+}
+
+static int Decode(int argc, char *argv[])
+{
+	if (argc < 3)
+		return 1;
+	FILE *pOut = stdout;
+	if (argc > 3 && !(pOut = fopen(argv[3], "wb")))
+	{
+		fprintf(stderr, "Can't create file: %s\n", argv[3]);
+		return 2;
+	}
+	CBinLogReader reader(pOut);
+	bool fOk = reader.Open(argv[2]);
+	if (fOk)
+	{
+		fputs(BINLOG_HEADER_LINE, pOut);
+		fOk = reader.Scan(reader.HeaderLength(), reader.Size(), NULL);
+	}
+	if (pOut != stdout)
+		fclose(pOut);
+	return fOk ? 0 : 2;
+}
+
+static int Query(int argc, char *argv[])
+{
+	if (argc < 3)
+		return 1;
+	QUERY_FILTER filter;
+	filter.fFrom = filter.fTo = filter.fRecID = false;
+	filter.tFrom = filter.tTo = 0;
+	filter.nRecID = 0;
+	bool fStats = false;
+	for (int i = 3; i < argc; i++)
+	{
+		const char *szArg = argv[i];
+		const char *szVal = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(szArg, "-stats") == 0)
+		{
+			fStats = true;
+			continue;
+		}
+		if (!szVal)
+			return 1;
+		i++;
+		if (strcmp(szArg, "-from") == 0)
+			filter.fFrom = BinLogParseTime(szVal, &filter.tFrom);
+		else if (strcmp(szArg, "-to") == 0)
+		{
+			filter.fTo = BinLogParseTime(szVal, &filter.tTo);
+			if (filter.fTo && !strchr(szVal, ':'))
+				filter.tTo += 86399;	// Date only - to end of day.
+		}
+		else if (strcmp(szArg, "-level") == 0)
+			filter.strLevel = szVal;
+		else if (strcmp(szArg, "-module") == 0)
+			filter.strModule = szVal;
+		else if (strcmp(szArg, "-recid") == 0)
+			filter.fRecID = BinLogIsRecordID(szVal, &filter.nRecID);
+		else return 1;
+		if ((strcmp(szArg, "-from") == 0 && !filter.fFrom) || (strcmp(szArg, "-to") == 0 && !filter.fTo)
+			|| (strcmp(szArg, "-recid") == 0 && !filter.fRecID))
+		{
+			fprintf(stderr, "Invalid value for %s: %s\n", szArg, szVal);
+			return 1;
+		}
+	}
+
+	CBinLogReader reader(stdout);
+	if (!reader.Open(argv[2]))
+		return 2;
+	std::string strIndex = IndexFileName(argv[2]);
+	if (!reader.LoadIndex(strIndex.c_str()))
+		fprintf(stderr, "No index file (%s) - scanning whole file\n", strIndex.c_str());
+
+	int nLevelID = reader.StringID(filter.strLevel);
+	int nModuleID = reader.StringID(filter.strModule);
+
+	fputs(BINLOG_HEADER_LINE, stdout);
+	size_t nScanned = 0, nSkipped = 0, nPos = reader.HeaderLength();
+	for (size_t i = 0; i < reader.m_vecBlocks.size(); i++)
+	{
+		const BINLOG_INDEX_BLOCK &b = reader.m_vecBlocks[i];
+		if (b.nOffset < nPos)
+			continue;	// Overlaps data already scanned.
+		// Note - string definitions between blocks are in the index file, so gaps can be skipped.
+		if (BlockMayMatch(b, filter, nLevelID, nModuleID))
+		{
+			if (!reader.Scan((size_t)b.nOffset, (size_t)(b.nOffset + b.nLength), &filter))
+				return 2;
+			nScanned++;
+		}
+		else nSkipped++;
+		nPos = (size_t)(b.nOffset + b.nLength);
+	}
+	// Records after the last indexed block (file still being written).
+	if (!reader.Scan(nPos, reader.Size(), &filter))
+		return 2;
+
+	if (fStats)
+		fprintf(stderr, "Blocks scanned: %llu, skipped: %llu, records decoded: %llu, matched: %llu\n",
+			(unsigned long long)nScanned, (unsigned long long)nSkipped, reader.m_nRecords, reader.m_nMatched);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _WIN32
+	_setmode(_fileno(stdout), _O_BINARY);	// Records already end with CRLF.
+#endif
+	int nRetVal = 1;
+	if (argc >= 2 && strcmp(argv[1], "decode") == 0)
+		nRetVal = Decode(argc, argv);
+	else if (argc >= 2 && strcmp(argv[1], "query") == 0)
+		nRetVal = Query(argc, argv);
+
+	if (nRetVal == 1)
+	{
+		fprintf(stderr,
+			"Usage:\n"
+			"  ADlogTool decode <file.blog> [out.log]\n"
+			"  ADlogTool query <file.blog> [-from \"YYYY-MM-DD HH:MM:SS\"] [-to \"YYYY-MM-DD HH:MM:SS\"]\n"
+			"                  [-level Level] [-module Module] [-recid EventRecordID] [-stats]\n");
+	}
+	return nRetVal;
+}
@@ -0,0 +1,322 @@
+// LogBench - measure cost of ADchangeTracker log writes (see ADchangeTracker\LogSys.h) with
+// N threads logging at the same time:
+//   sync   Lock and one write per record - the synchronous path of CLogSys::Add2LogLvl
+//          (critical section + WriteFile).
+//   ring   Records are copied into a slot of the lock-free ring (LogRing.h) and a flusher
+//          thread writes them, coalesced into one write per LOG_WRITE_BUF_SIZE bytes - the
+//          async path (CLogSys::QueueLogRecord / DrainRing). Producers wait when the ring is
+//          full (StartAsyncLogging(FALSE)).
+//   old    The record is formatted and written as Add2LogLvl did before records were
+//          formatted into one buffer: lock, date check, thread ID sprintf, time / localtime /
+//          strftime for each record and one write (re-entering the lock) per field.
+//   format The record is formatted with the cached time and preformatted thread ID and
+//          static columns (LogFormat.h) and written with one write - the synchronous
+//          path of CLogSys::Add2LogLvl.
+// For each: ns per record as seen by the logging threads (wall time / records of all
+// threads), records per second written to file and number of write calls.
+//
+// Usage:
+//   LogBench [records] [threads] [file]
+//       Defaults: 200000 records per thread, 1, 2, 4 ... up to 8 threads,
+//       file LogBench.tmp in the current directory (deleted at exit).
+//
+// Portable C++ - builds with Visual Studio (LogBench.vcxproj) and on Linux with:
+//   g++ -O2 -std=c++11 -pthread -o LogBench LogBench.cpp ../ADchangeTracker/LogFormat.cpp ../ADchangeTracker/Metrics.cpp
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS		// sprintf is used with buffers of known size.
+#endif
+#include "../ADchangeTracker/LogFormat.h"
+#include "../ADchangeTracker/LogRing.h"
+#include "../ADchangeTracker/Metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _MSC_VER
+#include <io.h>
+#define BENCH_OPEN(szFile)	_open(szFile, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0666)
+#define BENCH_WRITE			_write
+#define BENCH_CLOSE			_close
+#else
+#include <unistd.h>
+#define BENCH_OPEN(szFile)	open(szFile, O_WRONLY | O_CREAT | O_TRUNC, 0666)
+#define BENCH_WRITE			write
+#define BENCH_CLOSE			close
+#endif
+
+// Same sizes as LogSys.h.
+#define LOG_RING_SIZE		1024
+#define LOG_RECORD_SIZE		2048
+#define LOG_WRITE_BUF_SIZE	65536
+
+// A typical record of the service (text format).
+static const char s_szRecord[] = "4711\t2026-10-19 12:00:00\tDC01\tSYSTEM\tEvent processing\tInfo\t"
+	"Event sent to SQL server\tEventID 5136 RecordID 123456789\t\r\n";
+// Fields of the same record.
+static const char s_szWorkstation[] = "DC01";
+static const char s_szUserName[] = "SYSTEM";
+static const char s_szStaticColumns[] = "\tDC01\tSYSTEM\t";
+static const char s_szModule[] = "Event processing";
+static const char s_szLogLevel[] = "Info";
+static const char s_szLogEvent[] = "Event sent to SQL server";
+static const char s_szDescription[] = "EventID 5136 RecordID 123456789";
+
+typedef struct tagBenchSlot
+{
+	int nLen;
+	char szRecord[LOG_RECORD_SIZE];
+} BENCH_SLOT;
+
+typedef CLogRing<BENCH_SLOT, LOG_RING_SIZE> BENCH_RING;
+
+static int s_nFile = -1;
+static std::atomic<long long> s_nWrites;
+
+static void WriteToFile(const char *pData, int nLen)
+{
+	if (BENCH_WRITE(s_nFile, pData, nLen) != nLen)
+	{
+		fprintf(stderr, "Write failed\n");
+		exit(1);
+	}
+	s_nWrites.fetch_add(1, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// sync
+
+static std::mutex s_lock;
+
+static void SyncProducer(long long nRecords, unsigned)
+{
+	int nLen = (int)strlen(s_szRecord);
+	for (long long i = 0; i < nRecords; i++)
+	{
+		std::lock_guard<std::mutex> guard(s_lock);
+		WriteToFile(s_szRecord, nLen);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ring
+
+static BENCH_RING s_ring;
+static char *s_pWriteBuf;
+static std::atomic<bool> s_fStopFlusher;
+
+static void RingProducer(long long nRecords, unsigned)
+{
+	int nLen = (int)strlen(s_szRecord);
+	for (long long i = 0; i < nRecords; i++)
+	{
+		BENCH_SLOT *pSlot;
+		unsigned nPos;
+		while ((pSlot = s_ring.Claim(&nPos)) == NULL)
+			std::this_thread::yield();	// Ring is full - wait for the flusher.
+		memcpy(pSlot->szRecord, s_szRecord, nLen);
+		pSlot->nLen = nLen;
+		s_ring.Publish(nPos);
+	}
+}
+
+// As CLogSys::DrainRing. Returns number of records written.
+static int DrainRing()
+{
+	unsigned nPos = s_ring.GetConsumed();
+	int nBufUsed = 0, nRecords = 0;
+	for (;;)
+	{
+		BENCH_SLOT *pSlot = s_ring.Peek(nPos);
+		if (!pSlot)
+			break;
+		if (nBufUsed + pSlot->nLen > LOG_WRITE_BUF_SIZE)
+		{
+			WriteToFile(s_pWriteBuf, nBufUsed);
+			nBufUsed = 0;
+		}
+		memcpy(s_pWriteBuf + nBufUsed, pSlot->szRecord, pSlot->nLen);
+		nBufUsed += pSlot->nLen;
+		s_ring.Release(nPos);
+		nPos++;
+		nRecords++;
+	}
+	if (nBufUsed)
+		WriteToFile(s_pWriteBuf, nBufUsed);
+	s_ring.SetConsumed(nPos);
+	return nRecords;
+}
+
+static void Flusher()
+{
+	while (!s_fStopFlusher.load(std::memory_order_acquire))
+	{
+		if (!DrainRing())
+			std::this_thread::yield();
+	}
+	DrainRing();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// old
+
+static std::recursive_mutex s_oldLock;	// Re-entered as the critical section was.
+static int s_nOldFileDate;
+
+static void OldWriteToFile(const char *szString)
+{
+	if (!szString)
+		return;
+	std::lock_guard<std::recursive_mutex> guard(s_oldLock);
+	WriteToFile(szString, (int)strlen(szString));
+}
+
+static void OldProducer(long long nRecords, unsigned nThreadID)
+{
+	for (long long i = 0; i < nRecords; i++)
+	{
+		std::lock_guard<std::recursive_mutex> guard(s_oldLock);
+
+		// Detect if current log file was created yesterday.
+		time_t tNow = time(NULL);
+		struct tm ut;
+#ifdef _MSC_VER
+		gmtime_s(&ut, &tNow);
+#else
+		gmtime_r(&tNow, &ut);
+#endif
+		int nDate = (ut.tm_year + 1900) * 10000 + (ut.tm_mon + 1) * 100 + ut.tm_mday;
+		if (nDate != s_nOldFileDate)
+			s_nOldFileDate = nDate;
+
+		char szThreadID[20];
+		sprintf(szThreadID, "%u", nThreadID);
+		OldWriteToFile(szThreadID);
+		OldWriteToFile("\t");
+
+		char szTM[128];
+		struct tm newtime;
+		time_t aclock;
+		time(&aclock);
+#ifdef _MSC_VER
+		localtime_s(&newtime, &aclock);
+#else
+		localtime_r(&aclock, &newtime);
+#endif
+		strftime(szTM, 128, "%Y-%m-%d %H:%M:%S", &newtime);
+		OldWriteToFile(szTM);
+		OldWriteToFile("\t");
+		OldWriteToFile(s_szWorkstation);
+		OldWriteToFile("\t");
+		OldWriteToFile(s_szUserName);
+		OldWriteToFile("\t");
+		OldWriteToFile(s_szModule);
+		OldWriteToFile("\t");
+		OldWriteToFile(s_szLogLevel);
+		OldWriteToFile("\t");
+		OldWriteToFile(s_szLogEvent);
+		OldWriteToFile("\t");
+		OldWriteToFile(s_szDescription);
+		OldWriteToFile("\t");
+		OldWriteToFile(NULL);	// Notes
+		OldWriteToFile("\r\n");
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// format
+
+static CLogTimeCache s_timeCache;
+
+static void FormatProducer(long long nRecords, unsigned nThreadID)
+{
+	char szThreadID[16];	// Formatted once per thread.
+	sprintf(szThreadID, "%u\t", nThreadID);
+	for (long long i = 0; i < nRecords; i++)
+	{
+		char szTime[LOG_TIME_LEN + 1], szRecord[LOG_RECORD_SIZE];
+		int nUtcDate;
+		s_timeCache.GetLogTime(szTime, &nUtcDate);
+		int nLen = FormatLogFields(szRecord, sizeof(szRecord), szThreadID, szTime, s_szStaticColumns,
+			s_szModule, s_szLogEvent, s_szLogLevel, s_szDescription, NULL);
+
+		std::lock_guard<std::mutex> guard(s_lock);
+		s_timeCache.GetLogTime(szTime, &nUtcDate);	// Log file rollover check.
+		WriteToFile(szRecord, nLen);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+typedef void(*PRODUCER_FUNC)(long long nRecords, unsigned nThreadID);
+
+// Run func on nThreads threads, print ns per record and records written per second.
+static void Run(const char *szName, PRODUCER_FUNC func, long long nRecords, int nThreads, bool fRing)
+{
+	s_nWrites = 0;
+	std::thread flusher;
+	if (fRing)
+	{
+		s_fStopFlusher = false;
+		flusher = std::thread(Flusher);
+	}
+
+	unsigned long long nStart = MetricsNowNs();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < nThreads; i++)
+		threads.push_back(std::thread(func, nRecords, 4000u + i * 4));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	unsigned long long nProduced = MetricsNowNs();
+	if (fRing)
+	{
+		s_fStopFlusher.store(true, std::memory_order_release);
+		flusher.join();
+	}
+	unsigned long long nWritten = MetricsNowNs();
+
+	long long nTotal = nRecords * nThreads;
+	printf("%-7s %2d thread(s) %8.1f ns/record %10.0f records/s written %8lld writes\n",
+		szName, nThreads, (double)(nProduced - nStart) / nTotal,
+		nTotal * 1e9 / (double)(nWritten - nStart), s_nWrites.load());
+}
+
+int main(int argc, char *argv[])
+{
+	long long nRecords = argc > 1 ? atoll(argv[1]) : 200000;
+	int nMaxThreads = argc > 2 ? atoi(argv[2]) : 8;
+	const char *szFile = argc > 3 ? argv[3] : "LogBench.tmp";
+	if (nRecords <= 0 || nMaxThreads <= 0)
+	{
+		fprintf(stderr, "Usage: LogBench [records] [threads] [file]\n");
+		return 1;
+	}
+
+	s_nFile = BENCH_OPEN(szFile);
+	s_pWriteBuf = (char *)malloc(LOG_WRITE_BUF_SIZE);
+	if (s_nFile < 0 || !s_pWriteBuf || !s_ring.Alloc())
+	{
+		fprintf(stderr, "Cannot create %s\n", szFile);
+		return 1;
+	}
+
+	for (int nThreads = 1; ; nThreads *= 2)
+	{
+		if (nThreads > nMaxThreads)
+			nThreads = nMaxThreads;
+		Run("sync", SyncProducer, nRecords, nThreads, false);
+		Run("ring", RingProducer, nRecords, nThreads, true);
+		Run("old", OldProducer, nRecords, nThreads, false);
+		Run("format", FormatProducer, nRecords, nThreads, false);
+		if (nThreads == nMaxThreads)
+			break;
+	}
+
+	BENCH_CLOSE(s_nFile);
+	remove(szFile);
+	free(s_pWriteBuf);
+	return 0;
+}
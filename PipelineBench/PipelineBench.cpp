@@ -0,0 +1,1431 @@
+// PipelineBench - measure the ADchangeTracker filter-and-deliver pipeline on a corpus of
+// Security events (one event XML per line, e.g. corpus\SecurityEvents.xml written by
+// ADeventGen). Stages are measured one by one and end to end:
+//   parse     XML parse of the UTF-16 event (as rendered by EvtRender).
+//   extract   Get EventRecordID, EventID, Computer, TimeCreated and ObjectClass (GetEventFields).
+//   scan      The same fields from the UTF-16 event without parse (ScanEventFields).
+//   xpath     ObjectClass XPath of GetEventFields with the query path parsed for each event.
+//   xpath_c   The same with the compiled query (CompileEventQueries) - as extract does.
+//   filter    Accepted EventIDs / ignored ObjectClasses (CEventFilter, default .cfg lists).
+//   columns   Derive ADevents columns from the XML as usp_ADchgEventEx does.
+//   deliver   Batch rows (BATCH_ROWS) and hand batches to a stand-in sink (serialize + checksum).
+//   prefilter Find the System fields in the UTF-16 event (GetRawEventFields) and check EventID.
+//   total_xml Parse, extract, filter, columns and deliver for each event.
+//   total     As the service does: events that are not accepted are rejected by the prefilter,
+//             the fields of the others are scanned. Columns of delivered events are derived
+//             from the corpus document (usp_ADchgEventEx parses the event on the SQL server).
+//
+// parse, total_xml and total run on a worker thread that parses in its CXmlParseContext (document and
+// arena reused for each event) as the service's subscription callback thread does.
+// -noarena parses into a new xml_document for each event instead (for comparison).
+// -simd selects pugixml's UTF-16 transcoding and scanning of text and attribute values
+// (default: best the CPU has).
+//
+// For each stage: events per second, p50 / p99 latency per event and heap allocations per event.
+// Note - p99 of deliver is the batch flush (1 in BATCH_ROWS events).
+// The prefilter and scan fields of each corpus event are checked against GetEventFields at load.
+// After the stages parse + extract and scan are compared per EventID (mean ns per event), and
+// the compiled filter with the EventID / ObjectClass lists it replaced (default and full .cfg
+// lists, mean ns per event).
+//
+// Usage:
+//   PipelineBench [-corpus file] [-iterations N] [-noarena] [-simd level] [-out results.json]
+//                 [-baseline results.json] [-threshold percent]
+//   PipelineBench [-corpus file] -verify N
+//
+//   -corpus     Event file (default corpus/SecurityEvents.xml). corpus/SecurityEventsReject99.xml
+//               is the mix of a busy DC - 99% of events are not accepted (ADeventGen -seed 46
+//               -count 2000 -dcs 4 -weights 0=990,5136=5,4738=2,4728=1,4726=1,4720=1).
+//   -iterations Passes over the corpus per stage (default 20).
+//   -noarena    Do not use the parse context.
+//   -simd       scalar, sse2, avx2 or auto (default).
+//   -out        Write results, one JSON object per stage per line.
+//   -baseline   Compare with results file of an earlier run. A stage is a regression if
+//               events/s dropped or allocations/event grew by more than -threshold percent
+//               (default 10). Exit code is 2 if any stage regressed.
+//   -verify     Check SIMD transcoding and scanning against scalar on the corpus and N mutated
+//               copies of each event (see VerifySimd) instead of benchmarking. Exit code is 3
+//               on a mismatch.
+//
+// Portable C++ - builds with Visual Studio (PipelineBench.vcxproj) and on Linux with:
+//   g++ -O2 -std=c++11 -pthread -I../ADchangeTracker -o PipelineBench PipelineBench.cpp
+//       ../ADchangeTracker/pugixml.cpp ../ADchangeTracker/Metrics.cpp ../ADchangeTracker/EventFilter.cpp
+//       ../ADchangeTracker/EventScanner.cpp ../ADchangeTracker/FilterRules.cpp ../ADchangeTracker/XmlArena.cpp
+//   Add -DPUGIXML_WCHAR_MODE for the service's pugixml mode (PipelineBench.vcxproj sets it).
+//   Note - wchar_t is 32-bit on Linux, so there the UTF-16 event is converted to UTF-32;
+//   on Windows it is parsed as is. The parser buffer size is printed (and in -out file).
+#include "../ADchangeTracker/pugixml.hpp"
+#include "../ADchangeTracker/Metrics.h"
+#include "../ADchangeTracker/EventFilter.h"
+#include "../ADchangeTracker/XmlArena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pugi;
+
+#define MAX_EVENT_SIZE		65536	// Max length of one event XML line in corpus.
+#define BATCH_ROWS			100		// Rows per batch delivered to sink.
+
+// Allocation counting - all operator new and pugixml allocations (-noarena) go through here.
+// With the arena pugixml heap allocations are counted by CXmlParseContext.
+static unsigned long long s_nAllocs;
+
+void *operator new(size_t nSize)
+{
+	s_nAllocs++;
+	void *p = malloc(nSize ? nSize : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void *operator new[](size_t nSize) { return operator new(nSize); }
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+// The replaced operator new allocates with malloc, so free is the matching deallocation.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+void operator delete(void *p, size_t) throw() { free(p); }
+void operator delete[](void *p, size_t) throw() { free(p); }
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+static void *PugiAlloc(size_t nSize)
+{
+	s_nAllocs++;
+	return malloc(nSize);
+}
+
+static unsigned long long GetAllocs()
+{
+	return s_nAllocs + CXmlParseContext::GetHeapAllocations();
+}
+
+static volatile unsigned long long s_nSink;	// Keeps results alive - prevents optimizing away.
+static unsigned long long s_nBufferBytes;	// Parser buffer bytes of all corpus events.
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Corpus
+
+typedef struct tagCorpusEvent
+{
+	std::vector<unsigned short> xml;	// UTF-16LE with terminating zero (as from EvtRender).
+	xml_document doc;					// Parsed once - input of stages after parse.
+	EVENT_FIELDS fields;
+	bool fRaw;							// Prefilter found the fields.
+	bool fScanned;						// ScanEventFields got the fields.
+	double dScannedPart;				// Part of the event read by the scan.
+} CORPUS_EVENT;
+
+// UTF-8 to UTF-16 (code points above U+FFFF as surrogate pairs).
+static void Utf8ToUtf16(const char *sz, std::vector<unsigned short> &out)
+{
+	const unsigned char *p = (const unsigned char *)sz;
+	out.clear();
+	while (*p)
+	{
+		unsigned int c = *p++;
+		int nMore = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+		if (nMore)
+			c &= 0x3F >> nMore;
+		for (; nMore && (*p & 0xC0) == 0x80; nMore--)
+			c = (c << 6) | (*p++ & 0x3F);
+		if (c >= 0x10000)
+		{
+			c -= 0x10000;
+			out.push_back((unsigned short)(0xD800 + (c >> 10)));
+			out.push_back((unsigned short)(0xDC00 + (c & 0x3FF)));
+		}
+		else
+			out.push_back((unsigned short)c);
+	}
+	out.push_back(0);
+}
+
+// UTF-16 (not terminated) to UTF-8.
+static std::string Utf16ToUtf8(const unsigned short *p, size_t nLen)
+{
+	std::string str;
+	for (size_t i = 0; i < nLen; i++)
+	{
+		unsigned int c = p[i];
+		if ((c & 0xFC00) == 0xD800 && i + 1 < nLen && (p[i + 1] & 0xFC00) == 0xDC00)
+			c = 0x10000 + ((c - 0xD800) << 10) + (p[++i] - 0xDC00);
+		if (c < 0x80)
+			str += (char)c;
+		else
+		{
+			int nMore = c < 0x800 ? 1 : c < 0x10000 ? 2 : 3;
+			static const unsigned char s_barrLead[] = { 0, 0xC0, 0xE0, 0xF0 };
+			str += (char)(s_barrLead[nMore] | (c >> (6 * nMore)));
+			while (nMore--)
+				str += (char)(0x80 | ((c >> (6 * nMore)) & 0x3F));
+		}
+	}
+	return str;
+}
+
+static std::string FieldToUtf8(const char_t *sz)
+{
+#ifdef PUGIXML_WCHAR_MODE
+	return as_utf8(sz);
+#else
+	return sz;
+#endif
+}
+
+// Prefilter and scan fields must be the same as from the parsed event. Returns false if different.
+static bool CheckFields(const CEventFilter &filter, CORPUS_EVENT *pEvent)
+{
+	const EVENT_FIELDS &fields = pEvent->fields;
+	RAW_EVENT_FIELDS raw;
+	pEvent->fRaw = GetRawEventFields(&pEvent->xml[0], pEvent->xml.size() - 1, raw);
+	if (pEvent->fRaw && (raw.nEventID != fields.nEventID || raw.nEventRecordID != fields.nEventRecordID
+		|| Utf16ToUtf8(raw.pComputer, raw.nComputerLen) != FieldToUtf8(fields.szComputer)
+		|| Utf16ToUtf8(raw.pTimeCreated, raw.nTimeCreatedLen) != FieldToUtf8(fields.szTimeCreated)))
+		return false;
+
+	EVENT_FIELDS scanned;
+	SCAN_RESULT scan;
+	pEvent->fScanned = ScanEventFields(filter, &pEvent->xml[0], pEvent->xml.size() - 1, scanned, scan);
+	pEvent->dScannedPart = pEvent->fScanned ? (double)scan.nScannedChars / (pEvent->xml.size() - 1) : 1;
+	if (!pEvent->fScanned)
+		return true;
+	for (int i = 0; i < RULE_MAX_FIELDS; i++)
+	{
+		if (!scanned.szarrRuleFields[i] != !fields.szarrRuleFields[i] || (scanned.szarrRuleFields[i]
+			&& FieldToUtf8(scanned.szarrRuleFields[i]) != FieldToUtf8(fields.szarrRuleFields[i])))
+			return false;
+	}
+	return scanned.nEventID == fields.nEventID
+		&& FieldToUtf8(scanned.szEventRecordID) == FieldToUtf8(fields.szEventRecordID)
+		&& FieldToUtf8(scanned.szComputer) == FieldToUtf8(fields.szComputer)
+		&& FieldToUtf8(scanned.szTimeCreated) == FieldToUtf8(fields.szTimeCreated)
+		&& FieldToUtf8(scanned.szObjClass) == FieldToUtf8(fields.szObjClass);
+}
+
+// Parser's copy of the event: the UTF-16 event converted to pugi::char_t - UTF-8 in char
+// mode, wchar_t in wchar_t mode (no conversion, only a copy, where wchar_t is UTF-16).
+static size_t ParserBufferBytes(const std::vector<unsigned short> &xml, size_t nUtf8Len)
+{
+#ifdef PUGIXML_WCHAR_MODE
+	(void)nUtf8Len;
+	size_t nUnits = 0;
+	for (size_t i = 0; i < xml.size(); i++)
+	{
+		if (sizeof(wchar_t) == 2 || (xml[i] & 0xFC00) != 0xDC00)	// UTF-32: pair is 1 unit.
+			nUnits++;
+	}
+	return nUnits * sizeof(wchar_t);
+#else
+	(void)xml;
+	return nUtf8Len + 1;
+#endif
+}
+
+static bool IsTranscoded()
+{
+#ifdef PUGIXML_WCHAR_MODE
+	return sizeof(wchar_t) != 2;
+#else
+	return true;
+#endif
+}
+
+// UTF-16 event as the service parses it: size without terminating zero.
+#define EVENT_XML(pEvent)	&(pEvent)->xml[0], ((pEvent)->xml.size() - 1) * 2, encoding_utf16_le
+
+static xml_parse_result LoadEvent(xml_document &doc, const CORPUS_EVENT *pEvent)
+{
+	return doc.load_buffer(EVENT_XML(pEvent));
+}
+
+// Fields of events are got with filter (rule fields).
+static bool LoadCorpus(const char *szFile, const CEventFilter &filter, std::vector<CORPUS_EVENT *> &events)
+{
+	FILE *pFile = fopen(szFile, "rb");
+	if (!pFile)
+	{
+		fprintf(stderr, "Can't open corpus %s\n", szFile);
+		return false;
+	}
+	std::vector<char> line(MAX_EVENT_SIZE);
+	while (fgets(&line[0], MAX_EVENT_SIZE, pFile))
+	{
+		size_t nLen = strlen(&line[0]);
+		while (nLen && (line[nLen - 1] == '\n' || line[nLen - 1] == '\r'))
+			line[--nLen] = 0;
+		if (nLen == 0)
+			continue;
+		CORPUS_EVENT *pEvent = new CORPUS_EVENT;
+		Utf8ToUtf16(&line[0], pEvent->xml);
+		s_nBufferBytes += ParserBufferBytes(pEvent->xml, nLen);
+		if (!LoadEvent(pEvent->doc, pEvent))
+		{
+			fprintf(stderr, "Bad event XML in corpus, line %u\n", (unsigned)events.size() + 1);
+			delete pEvent;
+			continue;
+		}
+		GetEventFields(filter, pEvent->doc, pEvent->fields);
+		if (!CheckFields(filter, pEvent))
+		{
+			fprintf(stderr, "Prefilter or scan fields differ from parsed event, line %u\n",
+				(unsigned)events.size() + 1);
+			fclose(pFile);
+			return false;
+		}
+		events.push_back(pEvent);
+	}
+	fclose(pFile);
+	return !events.empty();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Pipeline stages
+
+// Default AcceptedEventIDs / IgnoredEvents of ADchangeTracker.cfg.
+static const int s_narrDefaultAccepted[] = { 4728, 4732, 4756, 4751, 4746, 4761, 4729, 4733,
+	4757, 4752, 4747, 4762, 4727, 4731, 4754, 4730, 4734, 4758, 4749, 4744, 4759, 4753, 4748, 4763,
+	4720, 4722, 4723, 4724, 4725, 4726, 4738, 4740, 4767, 4781, 5136, 5137, 5138, 5139, 5141 };
+static const char_t *s_szarrDefaultIgnored[] = { PUGIXML_TEXT("dnsNode"), PUGIXML_TEXT("mSSMSSite"),
+	PUGIXML_TEXT("mSSMSRoamingBoundaryRange"), PUGIXML_TEXT("mSSMSManagementPoint"),
+	PUGIXML_TEXT("msExchActiveSyncDevice"), PUGIXML_TEXT("printQueue") };
+#define NUM_DEFAULT_ACCEPTED	(int)(sizeof(s_narrDefaultAccepted) / sizeof(int))
+#define NUM_DEFAULT_IGNORED		(int)(sizeof(s_szarrDefaultIgnored) / sizeof(char_t *))
+
+static RULE_STRING ToRuleString(const char *sz)
+{
+	RULE_STRING str;
+	for (; *sz; sz++)
+		str += (char_t)*sz;
+	return str;
+}
+
+// Filter with the EventIDs and ObjectClasses of the lists (as AcceptedEventIDs and IgnoredEvents).
+static void AddLists(CFilterRules &rules, const int *pnarrEventIDs, int nNumEventIDs,
+	const char_t *const *pszarrObjClasses, int nNumObjClasses)
+{
+	RULE_STRING strEventIDs, strObjClasses;
+	for (int i = 0; i < nNumEventIDs; i++)
+	{
+		char szEventID[16];
+		snprintf(szEventID, sizeof(szEventID), i ? ",%d" : "%d", pnarrEventIDs[i]);
+		strEventIDs += ToRuleString(szEventID);
+	}
+	for (int i = 0; i < nNumObjClasses; i++)
+	{
+		if (i)
+			strObjClasses += ',';
+		strObjClasses += pszarrObjClasses[i];
+	}
+	rules.AddAcceptedEventIDs(strEventIDs.c_str());
+	rules.AddIgnoredObjClasses(strObjClasses.c_str());
+}
+
+static void InitFilter(CEventFilter &filter)
+{
+	CFilterRules rules;
+	AddLists(rules, s_narrDefaultAccepted, NUM_DEFAULT_ACCEPTED, s_szarrDefaultIgnored,
+		NUM_DEFAULT_IGNORED);
+	filter.Compile(rules);
+}
+
+// ADevents row (column sizes as in table). Strings are pugi::char_t as the event fields.
+typedef struct tagEventRow
+{
+	char_t szSourceDC[128];
+	unsigned long long nEventRecordID;
+	char_t szEventTime[32];
+	int nEventID;
+	char_t szObjClass[64];
+	char_t szTarget[256];
+	char_t szChanges[256];
+	char_t szModifiedBy[128];
+} EVENT_ROW;
+
+static const char_t *GetData(const xml_node &eventData, const char_t *szName)
+{
+	return eventData.find_child_by_attribute(PUGIXML_TEXT("Data"), PUGIXML_TEXT("Name"), szName).child_value();
+}
+
+static bool IsIn(int nEventID, const int *pnarrIDs, size_t nNum)
+{
+	for (size_t i = 0; i < nNum; i++)
+	{
+		if (nEventID == pnarrIDs[i])
+			return true;
+	}
+	return false;
+}
+#define NUM_IDS(arr)	(sizeof(arr) / sizeof(int))
+
+static bool IsEqual(const char_t *sz1, const char_t *sz2)
+{
+	for (; *sz1 == *sz2; sz1++, sz2++)
+	{
+		if (!*sz1)
+			return true;
+	}
+	return false;
+}
+
+// sz = concatenation of up to 6 strings (truncated to nSize).
+#define CONCAT(sz, ...)	Concat(sz, sizeof(sz) / sizeof(char_t), __VA_ARGS__)
+static void Concat(char_t *sz, size_t nSize, const char_t *sz1, const char_t *sz2 = NULL,
+	const char_t *sz3 = NULL, const char_t *sz4 = NULL, const char_t *sz5 = NULL,
+	const char_t *sz6 = NULL)
+{
+	const char_t *szarrParts[] = { sz1, sz2, sz3, sz4, sz5, sz6 };
+	size_t n = 0;
+	for (int i = 0; i < 6 && szarrParts[i]; i++)
+	{
+		for (const char_t *p = szarrParts[i]; *p && n < nSize - 1; p++)
+			sz[n++] = *p;
+	}
+	sz[n] = 0;
+}
+
+#define T(s)	PUGIXML_TEXT(s)
+
+// Same rules as usp_ADchgEventEx (see header comment in FixEventRecordIDbug.sql).
+static void DeriveColumns(const xml_document &doc, const EVENT_FIELDS &fields, EVENT_ROW &row)
+{
+	static const int s_narrUser[] = { 4740, 4738, 4725, 4724, 4723, 4722, 4720, 4767 };
+	static const int s_narrGroup[] = { 4728, 4732, 4733, 4756 };
+	static const int s_narrObjClass[] = { 5136, 5137, 5139, 5141 };
+	static const int s_narrTargetUser[] = { 4738, 4725, 4724, 4723, 4722, 4720, 4728, 4732,
+		4733, 4756, 4767 };
+	static const int s_narrObjectDN[] = { 5136, 5137, 5141 };
+
+	xml_node eventData = doc.child(T("Event")).child(T("EventData"));
+	int nID = fields.nEventID;
+	CONCAT(row.szSourceDC, fields.szComputer);
+	row.nEventRecordID = fields.nEventRecordID;
+	CONCAT(row.szEventTime, fields.szTimeCreated);
+	row.nEventID = nID;
+
+	row.szObjClass[0] = 0;
+	if (IsIn(nID, s_narrUser, NUM_IDS(s_narrUser)))
+		CONCAT(row.szObjClass, T("user"));
+	else if (nID == 4781)
+		CONCAT(row.szObjClass, T("unknown"));
+	else if (IsIn(nID, s_narrGroup, NUM_IDS(s_narrGroup)))
+		CONCAT(row.szObjClass, T("group"));
+	else if (IsIn(nID, s_narrObjClass, NUM_IDS(s_narrObjClass)))
+		CONCAT(row.szObjClass, fields.szObjClass);
+
+	row.szTarget[0] = 0;
+	if (nID == 4740)
+		CONCAT(row.szTarget, GetData(eventData, T("SubjectDomainName")), T("\\"),
+			GetData(eventData, T("TargetUserName")));
+	else if (IsIn(nID, s_narrTargetUser, NUM_IDS(s_narrTargetUser)))
+		CONCAT(row.szTarget, GetData(eventData, T("TargetDomainName")), T("\\"),
+			GetData(eventData, T("TargetUserName")));
+	else if (nID == 4781)
+		CONCAT(row.szTarget, GetData(eventData, T("TargetDomainName")), T("\\"),
+			GetData(eventData, T("OldTargetUserName")));
+	else if (IsIn(nID, s_narrObjectDN, NUM_IDS(s_narrObjectDN)))
+		CONCAT(row.szTarget, GetData(eventData, T("ObjectDN")));
+	else if (nID == 5139)
+		CONCAT(row.szTarget, GetData(eventData, T("OldObjectDN")));
+
+	row.szChanges[0] = 0;
+	switch (nID)
+	{
+	case 4740:
+		CONCAT(row.szChanges, T("Calling computer: "), GetData(eventData, T("TargetDomainName")));
+		break;
+	case 4781:
+		CONCAT(row.szChanges, T("NewTargetUserName: "), GetData(eventData, T("NewTargetUserName")));
+		break;
+	case 4728: case 4756:
+		CONCAT(row.szChanges, T("MemberName: "), GetData(eventData, T("MemberName")));
+		break;
+	case 4732: case 4733:
+		CONCAT(row.szChanges, T("MemberSID: "), GetData(eventData, T("MemberSid")));
+		break;
+	case 5139:
+		CONCAT(row.szChanges, T("NewObjectDN: "), GetData(eventData, T("NewObjectDN")));
+		break;
+	case 5136:
+	{
+		const char_t *szOpType = GetData(eventData, T("OperationType"));
+		if (IsEqual(szOpType, T("%%14674")))
+			szOpType = T("Value Added");
+		else if (IsEqual(szOpType, T("%%14675")))
+			szOpType = T("Value Deleted");
+		CONCAT(row.szChanges, T("("), szOpType, T(") "),
+			GetData(eventData, T("AttributeLDAPDisplayName")), T(": "),
+			GetData(eventData, T("AttributeValue")));
+		break;
+	}
+	}
+
+	CONCAT(row.szModifiedBy, GetData(eventData, T("SubjectDomainName")), T("\\"),
+		GetData(eventData, T("SubjectUserName")));
+}
+
+// Stand-in for SQL: serializes a batch (as a bulk insert would) and checksums it.
+class CBatchSink
+{
+public:
+	CBatchSink() : m_nRows(0), m_nBatches(0), m_nChecksum(14695981039346656037ULL)
+	{
+		m_buffer.reserve(BATCH_ROWS * 1024);
+	}
+
+	void Add(const EVENT_ROW &row)
+	{
+		m_rows[m_nRows++] = row;
+		if (m_nRows == BATCH_ROWS)
+			Flush();
+	}
+
+	void Flush()
+	{
+		if (m_nRows == 0)
+			return;
+		m_buffer.clear();
+		for (int i = 0; i < m_nRows; i++)
+		{
+			const EVENT_ROW &row = m_rows[i];
+			m_buffer.append(row.szSourceDC).append(1, '\t');
+			AppendNumber(row.nEventRecordID);
+			m_buffer.append(1, '\t').append(row.szEventTime).append(1, '\t');
+			AppendNumber(row.nEventID);
+			m_buffer.append(1, '\t').append(row.szObjClass).append(1, '\t').append(row.szTarget)
+				.append(1, '\t').append(row.szChanges).append(1, '\t').append(row.szModifiedBy)
+				.append(1, '\n');
+		}
+		// FNV-1a of the characters - same checksum in char and wchar_t mode (for ASCII).
+		for (size_t i = 0; i < m_buffer.size(); i++)
+			m_nChecksum = (m_nChecksum ^ (unsigned int)m_buffer[i]) * 1099511628211ULL;
+		m_nRows = 0;
+		m_nBatches++;
+	}
+
+	unsigned long long GetChecksum() const { return m_nChecksum; }
+
+protected:
+	void AppendNumber(unsigned long long n)
+	{
+		char_t szNum[24];
+		int i = 23;
+		szNum[i] = 0;
+		do
+		{
+			szNum[--i] = (char_t)('0' + n % 10);
+			n /= 10;
+		} while (n);
+		m_buffer.append(szNum + i);
+	}
+
+	EVENT_ROW m_rows[BATCH_ROWS];
+	int m_nRows;
+	unsigned long long m_nBatches;
+	unsigned long long m_nChecksum;
+	std::basic_string<char_t> m_buffer;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Stage runners - process event i of corpus.
+
+enum BENCH_STAGE { BENCH_PARSE = 0, BENCH_EXTRACT, BENCH_SCAN, BENCH_XPATH, BENCH_XPATH_COMPILED,
+	BENCH_FILTER, BENCH_COLUMNS, BENCH_DELIVER, BENCH_PREFILTER, BENCH_TOTAL_XML, BENCH_TOTAL,
+	BENCH_STAGE_COUNT };
+static const char *s_szarrStageNames[BENCH_STAGE_COUNT] = { "parse", "extract", "scan", "xpath",
+	"xpath_c", "filter", "columns", "deliver", "prefilter", "total_xml", "total" };
+
+typedef struct tagBenchContext
+{
+	std::vector<CORPUS_EVENT *> events;
+	std::vector<EVENT_ROW> rows;		// Columns of accepted events (input of deliver stage).
+	CEventFilter filter;
+	CBatchSink sink;
+	unsigned long long nDelivered;		// Events delivered by total stage.
+	bool fArena;						// Parse in CXmlParseContext of thread.
+} BENCH_CONTEXT;
+
+// Parse, extract, filter, columns and deliver of one event.
+static void RunTotalParsed(BENCH_CONTEXT &ctx, CORPUS_EVENT *pEvent)
+{
+	xml_document local;
+	xml_document *pDoc = &local;
+	xml_parse_result result;
+	if (ctx.fArena)
+	{
+		CXmlParseContext *pParse = CXmlParseContext::GetForThread();
+		result = pParse->Parse(EVENT_XML(pEvent));
+		pDoc = &pParse->GetDocument();
+	}
+	else
+		result = LoadEvent(local, pEvent);
+	if (!result)
+		return;
+	EVENT_FIELDS fields;
+	GetEventFields(ctx.filter, *pDoc, fields);
+	if (ctx.filter.IsAccepted(fields.nEventID) && ctx.filter.FindDropRule(fields) < 0)
+	{
+		EVENT_ROW row;
+		DeriveColumns(*pDoc, fields, row);
+		ctx.sink.Add(row);
+		ctx.nDelivered++;
+	}
+}
+
+static void RunStage(BENCH_CONTEXT &ctx, int nStage, size_t i)
+{
+	CORPUS_EVENT *pEvent = ctx.events[i];
+	switch (nStage)
+	{
+	case BENCH_PARSE:
+		if (ctx.fArena)
+			s_nSink += CXmlParseContext::GetForThread()->Parse(EVENT_XML(pEvent)).status;
+		else
+		{
+			xml_document doc;
+			s_nSink += LoadEvent(doc, pEvent).status;
+		}
+		break;
+	case BENCH_EXTRACT:
+	{
+		EVENT_FIELDS fields;
+		GetEventFields(ctx.filter, pEvent->doc, fields);
+		s_nSink += fields.nEventID;
+		break;
+	}
+	case BENCH_SCAN:
+	{
+		EVENT_FIELDS fields;
+		SCAN_RESULT scan;
+		s_nSink += ScanEventFields(ctx.filter, &pEvent->xml[0], pEvent->xml.size() - 1, fields, scan)
+			? fields.nEventID : 0;
+		break;
+	}
+	case BENCH_XPATH:
+		s_nSink += pEvent->doc.select_node(GetEventQueryPath(QUERY_OBJCLASS)).node().value()[0];
+		break;
+	case BENCH_XPATH_COMPILED:
+		s_nSink += pEvent->doc.select_node(*GetEventQuery(QUERY_OBJCLASS)).node().value()[0];
+		break;
+	case BENCH_FILTER:
+		s_nSink += ctx.filter.IsAccepted(pEvent->fields.nEventID)
+			&& ctx.filter.FindDropRule(pEvent->fields) < 0;
+		break;
+	case BENCH_COLUMNS:
+	{
+		EVENT_ROW row;
+		DeriveColumns(pEvent->doc, pEvent->fields, row);
+		s_nSink += row.szChanges[0];
+		break;
+	}
+	case BENCH_DELIVER:
+		ctx.sink.Add(ctx.rows[i % ctx.rows.size()]);
+		break;
+	case BENCH_PREFILTER:
+	{
+		RAW_EVENT_FIELDS raw;
+		s_nSink += GetRawEventFields(&pEvent->xml[0], pEvent->xml.size() - 1, raw)
+			&& ctx.filter.IsAccepted(raw.nEventID);
+		break;
+	}
+	case BENCH_TOTAL:
+	{
+		RAW_EVENT_FIELDS raw;
+		if (GetRawEventFields(&pEvent->xml[0], pEvent->xml.size() - 1, raw)
+			&& !ctx.filter.IsAccepted(raw.nEventID))
+		{
+			s_nSink += raw.nEventRecordID + raw.nComputerLen;
+			break;
+		}
+		EVENT_FIELDS fields;
+		SCAN_RESULT scan;
+		if (!ScanEventFields(ctx.filter, &pEvent->xml[0], pEvent->xml.size() - 1, fields, scan))
+		{
+			RunTotalParsed(ctx, pEvent);	// As the service does.
+			break;
+		}
+		if (ctx.filter.IsAccepted(fields.nEventID) && ctx.filter.FindDropRule(fields) < 0)
+		{
+			EVENT_ROW row;
+			DeriveColumns(pEvent->doc, fields, row);
+			ctx.sink.Add(row);
+			ctx.nDelivered++;
+		}
+		break;
+	}
+	case BENCH_TOTAL_XML:
+		RunTotalParsed(ctx, pEvent);
+		break;
+	}
+}
+
+typedef struct tagStageResult
+{
+	char szStage[32];
+	double dEventsPerSec;
+	double dP50Ns;
+	double dP99Ns;
+	double dAllocsPerEvent;
+} STAGE_RESULT;
+
+static void BenchStage(BENCH_CONTEXT &ctx, int nStage, int nIterations, STAGE_RESULT &result)
+{
+	size_t nEvents = ctx.events.size();
+	for (size_t i = 0; i < nEvents; i++)	// Warm up.
+		RunStage(ctx, nStage, i);
+
+	// Throughput and allocations - no per-event clock reads.
+	unsigned long long nAllocs = GetAllocs();
+	unsigned long long nStart = MetricsNowNs();
+	for (int n = 0; n < nIterations; n++)
+	{
+		for (size_t i = 0; i < nEvents; i++)
+			RunStage(ctx, nStage, i);
+	}
+	unsigned long long nElapsedNs = MetricsNowNs() - nStart;
+	double dTotal = (double)nEvents * nIterations;
+	nAllocs = GetAllocs() - nAllocs;
+
+	// Latency per event.
+	CMetricHistogram hist("pipeline_event_ns", "", "");
+	for (int n = 0; n < nIterations; n++)
+	{
+		for (size_t i = 0; i < nEvents; i++)
+		{
+			unsigned long long nEventStart = MetricsNowNs();
+			RunStage(ctx, nStage, i);
+			hist.RecordSince(nEventStart);
+		}
+	}
+
+	snprintf(result.szStage, sizeof(result.szStage), "%s", s_szarrStageNames[nStage]);
+	result.dEventsPerSec = nElapsedNs ? dTotal * 1e9 / nElapsedNs : 0;
+	result.dP50Ns = (double)hist.ValueAtQuantile(0.5);
+	result.dP99Ns = (double)hist.ValueAtQuantile(0.99);
+	result.dAllocsPerEvent = nAllocs / dTotal;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Parse + extract against scan per EventID.
+
+typedef struct tagEventIDResult
+{
+	int nEventID;
+	unsigned long long nEvents;		// Corpus events with the EventID.
+	unsigned long long nParseNs;	// All iterations.
+	unsigned long long nScanNs;
+	double dScannedPart;			// Sum of parts of events read by the scan.
+} EVENTID_RESULT;
+
+static bool IsLowerEventID(const EVENTID_RESULT &r1, const EVENTID_RESULT &r2)
+{
+	return r1.nEventID < r2.nEventID;
+}
+
+static void BenchByEventID(BENCH_CONTEXT &ctx, int nIterations, std::vector<EVENTID_RESULT> &results)
+{
+	std::vector<size_t> index(ctx.events.size());
+	for (size_t i = 0; i < ctx.events.size(); i++)
+	{
+		const CORPUS_EVENT *pEvent = ctx.events[i];
+		size_t j = 0;
+		while (j < results.size() && results[j].nEventID != pEvent->fields.nEventID)
+			j++;
+		if (j == results.size())
+		{
+			EVENTID_RESULT r = { pEvent->fields.nEventID, 0, 0, 0, 0 };
+			results.push_back(r);
+		}
+		results[j].nEvents++;
+		results[j].dScannedPart += pEvent->dScannedPart;
+		index[i] = j;
+	}
+	for (int n = 0; n <= nIterations; n++)	// First pass is warm up.
+	{
+		for (size_t i = 0; i < ctx.events.size(); i++)
+		{
+			CORPUS_EVENT *pEvent = ctx.events[i];
+			EVENT_FIELDS fields;
+			unsigned long long nStart = MetricsNowNs();
+			if (ctx.fArena)
+			{
+				CXmlParseContext *pParse = CXmlParseContext::GetForThread();
+				pParse->Parse(EVENT_XML(pEvent));
+				GetEventFields(ctx.filter, pParse->GetDocument(), fields);
+			}
+			else
+			{
+				xml_document doc;
+				LoadEvent(doc, pEvent);
+				GetEventFields(ctx.filter, doc, fields);
+			}
+			unsigned long long nParsed = MetricsNowNs();
+			SCAN_RESULT scan;
+			s_nSink += fields.nEventID + ScanEventFields(ctx.filter, &pEvent->xml[0], pEvent->xml.size() - 1,
+				fields, scan);
+			if (n)
+			{
+				EVENTID_RESULT &r = results[index[i]];
+				r.nParseNs += nParsed - nStart;
+				r.nScanNs += MetricsNowNs() - nParsed;
+			}
+		}
+	}
+	std::sort(results.begin(), results.end(), IsLowerEventID);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Compiled filter (CEventFilter) against the lists it replaced, with the default lists and
+// with full lists (as many EventIDs and ObjectClasses as the .cfg can have).
+
+// Filter before CEventFilter was compiled: EventIDs and ObjectClasses are compared one by one
+// (ObjectClass case sensitive).
+class CListFilter
+{
+public:
+	CListFilter(const int *pnarrEventIDs, int nNumEventIDs, const char_t *const *pszarrObjClasses,
+		int nNumObjClasses)
+		: m_pnarrAccepted(pnarrEventIDs), m_nNumAccepted(nNumEventIDs),
+		m_pszarrIgnored(pszarrObjClasses), m_nNumIgnored(nNumObjClasses) {}
+
+	bool IsAccepted(int nEventID) const
+	{
+		for (int i = 0; i < m_nNumAccepted; i++)
+		{
+			if (nEventID == m_pnarrAccepted[i])
+				return true;
+		}
+		return false;
+	}
+	bool IsIgnored(int nEventID, const char_t *szObjClass) const
+	{
+		if (nEventID < 5136 || nEventID > 5141)
+			return false;
+		for (int i = 0; i < m_nNumIgnored; i++)
+		{
+			if (IsEqual(szObjClass, m_pszarrIgnored[i]))
+				return true;
+		}
+		return false;
+	}
+
+private:
+	const int *m_pnarrAccepted;
+	int m_nNumAccepted;
+	const char_t *const *m_pszarrIgnored;
+	int m_nNumIgnored;
+};
+
+// More Security EventIDs and ObjectClasses for the full lists.
+static const int s_narrMoreAccepted[] = { 4624, 4625, 4634, 4647, 4648, 4656, 4658, 4660, 4661,
+	4662, 4663, 4670, 4672, 4673, 4674, 4688, 4689, 4697, 4698, 4699, 4700, 4701, 4702, 4719, 4739,
+	4741, 4742, 4743, 4745, 4750, 4755, 4760, 4764, 4765, 4766, 4768, 4769, 4770, 4771, 4772, 4773,
+	4774, 4775, 4776, 4777, 4778, 4779, 4780, 4782, 4793, 4794, 4797, 4798, 4799, 4800, 4801, 4802,
+	4803, 4817, 4886, 4887, 4888, 4898, 4899, 4900, 4902, 4904, 4905, 4906, 4907, 4908, 4912, 4928,
+	4929, 4930, 4931, 4932, 4933, 4934, 4935, 4936, 4937, 4944, 4945, 4946, 4947, 4948, 4949, 4950 };
+static const char_t *s_szarrMoreIgnored[] = { PUGIXML_TEXT("serviceConnectionPoint"),
+	PUGIXML_TEXT("msDS-Device"), PUGIXML_TEXT("msDFSR-Subscription"),
+	PUGIXML_TEXT("msTPM-InformationObject"), PUGIXML_TEXT("rpcContainer"),
+	PUGIXML_TEXT("msDNS-ServerSettings"), PUGIXML_TEXT("dnsZone"), PUGIXML_TEXT("intellimirrorSCP"),
+	PUGIXML_TEXT("msFVE-RecoveryInformation"), PUGIXML_TEXT("msDS-ShadowPrincipal") };
+
+typedef struct tagFilterResult
+{
+	const char *szLists;
+	int nNumEventIDs;
+	int nNumObjClasses;
+	double dListNs;			// Mean per event.
+	double dCompiledNs;
+	size_t nDiffer;			// Corpus events the filters do not agree on.
+} FILTER_RESULT;
+
+static void BenchFilter(const BENCH_CONTEXT &ctx, const char *szLists, const int *pnarrEventIDs,
+	int nNumEventIDs, const char_t *const *pszarrObjClasses, int nNumObjClasses, int nIterations,
+	FILTER_RESULT &result)
+{
+	CListFilter list(pnarrEventIDs, nNumEventIDs, pszarrObjClasses, nNumObjClasses);
+	CFilterRules rules;
+	AddLists(rules, pnarrEventIDs, nNumEventIDs, pszarrObjClasses, nNumObjClasses);
+	CEventFilter compiled;	// ObjectClass is its only rule field - as in ctx.filter (fields of events).
+	compiled.Compile(rules);
+	result.szLists = szLists;
+	result.nNumEventIDs = nNumEventIDs;
+	result.nNumObjClasses = nNumObjClasses;
+	result.nDiffer = 0;
+	size_t nEvents = ctx.events.size();
+	for (size_t i = 0; i < nEvents; i++)
+	{
+		const EVENT_FIELDS &f = ctx.events[i]->fields;
+		if ((list.IsAccepted(f.nEventID) && !list.IsIgnored(f.nEventID, f.szObjClass))
+			!= (compiled.IsAccepted(f.nEventID) && compiled.FindDropRule(f) < 0))
+			result.nDiffer++;
+	}
+
+	// A check takes some ns - many passes, list and compiled passes interleaved (same noise).
+	unsigned long long nListNs = 0, nCompiledNs = 0;
+	int nPasses = nIterations * 50;
+	for (int n = 0; n <= nPasses; n++)	// First pass is warm up.
+	{
+		unsigned long long nStart = MetricsNowNs(), nSum = 0;
+		for (size_t i = 0; i < nEvents; i++)
+		{
+			const EVENT_FIELDS &f = ctx.events[i]->fields;
+			nSum += list.IsAccepted(f.nEventID) && !list.IsIgnored(f.nEventID, f.szObjClass);
+		}
+		unsigned long long nListEnd = MetricsNowNs();
+		for (size_t i = 0; i < nEvents; i++)
+		{
+			const EVENT_FIELDS &f = ctx.events[i]->fields;
+			nSum += compiled.IsAccepted(f.nEventID) && compiled.FindDropRule(f) < 0;
+		}
+		s_nSink += nSum;
+		if (n)
+		{
+			nListNs += nListEnd - nStart;
+			nCompiledNs += MetricsNowNs() - nListEnd;
+		}
+	}
+	double dChecks = (double)nEvents * nPasses;
+	result.dListNs = nListNs / dChecks;
+	result.dCompiledNs = nCompiledNs / dChecks;
+}
+
+static void BenchFilters(const BENCH_CONTEXT &ctx, int nIterations, std::vector<FILTER_RESULT> &results)
+{
+	FILTER_RESULT r;
+	BenchFilter(ctx, "default", s_narrDefaultAccepted, NUM_DEFAULT_ACCEPTED, s_szarrDefaultIgnored,
+		NUM_DEFAULT_IGNORED, nIterations, r);
+	results.push_back(r);
+
+	// Full lists - default entries first (the lists are compared in order).
+	std::vector<int> eventIDs(s_narrDefaultAccepted, s_narrDefaultAccepted + NUM_DEFAULT_ACCEPTED);
+	for (size_t i = 0; i < NUM_IDS(s_narrMoreAccepted) && eventIDs.size() < 128; i++)
+		eventIDs.push_back(s_narrMoreAccepted[i]);
+	std::vector<const char_t *> objClasses(s_szarrDefaultIgnored, s_szarrDefaultIgnored + NUM_DEFAULT_IGNORED);
+	for (size_t i = 0; i < sizeof(s_szarrMoreIgnored) / sizeof(char_t *) && objClasses.size() < 16; i++)
+		objClasses.push_back(s_szarrMoreIgnored[i]);
+	BenchFilter(ctx, "full", &eventIDs[0], (int)eventIDs.size(), &objClasses[0], (int)objClasses.size(),
+		nIterations, r);
+	results.push_back(r);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Drop rules - time per event with more and more rules.
+
+typedef struct tagDropRulesResult
+{
+	int nNumRules;
+	int nNumFields;
+	double dCompileMs;
+	double dNs;				// Mean per event (accepted check and drop rules).
+	size_t nDropped;		// Accepted corpus events dropped by a rule.
+} DROP_RULES_RESULT;
+
+// The default lists and nNumRules - NUM_DEFAULT_IGNORED drop rules. Most rules have values that
+// are not in the corpus (as rules for other DCs and accounts); the first ones drop some events.
+static void MakeDropRules(int nNumRules, CFilterRules &rules)
+{
+	static const char *s_szarrMatching[] = {
+		"5136 AttributeLDAPDisplayName=dnsRecord,dNSTombstoned",
+		"4738 SubjectUserName=svc_sync0",
+		"5136-5141 ObjectClass=user AttributeLDAPDisplayName=description" };
+	AddLists(rules, s_narrDefaultAccepted, NUM_DEFAULT_ACCEPTED, s_szarrDefaultIgnored,
+		NUM_DEFAULT_IGNORED);
+	for (int i = 0; i < nNumRules - NUM_DEFAULT_IGNORED; i++)
+	{
+		char szRule[128];
+		if (i < (int)(sizeof(s_szarrMatching) / sizeof(char *)))
+			snprintf(szRule, sizeof(szRule), "%s", s_szarrMatching[i]);
+		else if (i % 4 == 0)
+			snprintf(szRule, sizeof(szRule), "5136 AttributeLDAPDisplayName=attr%d,extAttr%d", i, i);
+		else if (i % 4 == 1)
+			snprintf(szRule, sizeof(szRule), "4720-4738 SubjectUserName=svc%d TargetUserName=user%d", i, i);
+		else if (i % 4 == 2)
+			snprintf(szRule, sizeof(szRule), "5136-5141 ObjectClass=class%d AttributeLDAPDisplayName=member", i);
+		else
+			snprintf(szRule, sizeof(szRule), "* System/Computer=\"dc%d.contoso.com\"", i);
+		rules.AddDropRule(ToRuleString(szRule).c_str());
+	}
+}
+
+static void BenchDropRules(const BENCH_CONTEXT &ctx, int nIterations, std::vector<DROP_RULES_RESULT> &results)
+{
+	static const int s_narrNumRules[] = { 10, 100, 1000, 10000 };
+	size_t nEvents = ctx.events.size();
+	for (size_t n = 0; n < NUM_IDS(s_narrNumRules); n++)
+	{
+		CFilterRules rules;
+		MakeDropRules(s_narrNumRules[n], rules);
+		CEventFilter *pFilter = new CEventFilter;	// Large - not on stack.
+		unsigned long long nStart = MetricsNowNs();
+		pFilter->Compile(rules);
+		DROP_RULES_RESULT r;
+		r.nNumRules = pFilter->GetDropRules().GetNumRules();
+		r.nNumFields = pFilter->GetDropRules().GetNumFields();
+		r.dCompileMs = (MetricsNowNs() - nStart) / 1e6;
+
+		// Rule fields of the events for this filter.
+		std::vector<EVENT_FIELDS> fields(nEvents);
+		for (size_t i = 0; i < nEvents; i++)
+			GetEventFields(*pFilter, ctx.events[i]->doc, fields[i]);
+		r.nDropped = 0;
+		for (size_t i = 0; i < nEvents; i++)
+		{
+			if (pFilter->IsAccepted(fields[i].nEventID) && pFilter->FindDropRule(fields[i]) >= 0)
+				r.nDropped++;
+		}
+
+		unsigned long long nNs = 0;
+		int nPasses = nIterations * 50;
+		for (int p = 0; p <= nPasses; p++)	// First pass is warm up.
+		{
+			unsigned long long nSum = 0;
+			nStart = MetricsNowNs();
+			for (size_t i = 0; i < nEvents; i++)
+				nSum += pFilter->IsAccepted(fields[i].nEventID) && pFilter->FindDropRule(fields[i]) < 0;
+			if (p)
+				nNs += MetricsNowNs() - nStart;
+			s_nSink += nSum;
+		}
+		r.dNs = nNs / ((double)nEvents * nPasses);
+		results.push_back(r);
+		delete pFilter;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Results file - one JSON object per line:
+// {"stage": "parse", "events_per_sec": 1.0, "p50_ns": 1, "p99_ns": 1, "allocs_per_event": 1.0}
+
+static const char *s_szarrSimdLevels[] = { "scalar", "sse2", "avx2", "auto" };
+
+static bool WriteResults(const char *szFile, const std::vector<STAGE_RESULT> &results,
+	const char *szCorpus, size_t nEvents, int nIterations)
+{
+	FILE *pFile = fopen(szFile, "w");
+	if (!pFile)
+	{
+		fprintf(stderr, "Can't create %s\n", szFile);
+		return false;
+	}
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const STAGE_RESULT &r = results[i];
+		fprintf(pFile, "{\"stage\": \"%s\", \"events_per_sec\": %.1f, \"p50_ns\": %.0f, \"p99_ns\": %.0f, "
+			"\"allocs_per_event\": %.2f, \"corpus\": \"%s\", \"events\": %u, \"iterations\": %d, "
+			"\"char_bytes\": %u, \"buffer_bytes_per_event\": %.0f, \"transcoded\": %s, \"simd\": \"%s\"}\n",
+			r.szStage, r.dEventsPerSec, r.dP50Ns, r.dP99Ns, r.dAllocsPerEvent, szCorpus,
+			(unsigned)nEvents, nIterations, (unsigned)sizeof(char_t),
+			(double)s_nBufferBytes / nEvents, IsTranscoded() ? "true" : "false",
+			s_szarrSimdLevels[get_simd_level()]);
+	}
+	fclose(pFile);
+	return true;
+}
+
+static bool ReadResults(const char *szFile, std::vector<STAGE_RESULT> &results)
+{
+	FILE *pFile = fopen(szFile, "r");
+	if (!pFile)
+	{
+		fprintf(stderr, "Can't open baseline %s\n", szFile);
+		return false;
+	}
+	char szLine[1024];
+	while (fgets(szLine, sizeof(szLine), pFile))
+	{
+		STAGE_RESULT r;
+		if (sscanf(szLine, "{\"stage\": \"%31[^\"]\", \"events_per_sec\": %lf, \"p50_ns\": %lf, "
+			"\"p99_ns\": %lf, \"allocs_per_event\": %lf", r.szStage, &r.dEventsPerSec, &r.dP50Ns,
+			&r.dP99Ns, &r.dAllocsPerEvent) == 5)
+		{
+			results.push_back(r);
+		}
+	}
+	fclose(pFile);
+	return true;
+}
+
+static double PercentChange(double dOld, double dNew)
+{
+	return dOld > 0 ? (dNew - dOld) * 100.0 / dOld : 0;
+}
+
+// Print change from baseline per stage. Returns number of stages that regressed.
+static int CompareResults(const std::vector<STAGE_RESULT> &baseline,
+	const std::vector<STAGE_RESULT> &results, double dThreshold)
+{
+	int nRegressions = 0;
+	printf("\n%-8s %12s %9s %9s %9s\n", "Stage", "events/s", "p50", "p99", "allocs");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const STAGE_RESULT &r = results[i];
+		const STAGE_RESULT *pBase = NULL;
+		for (size_t j = 0; j < baseline.size() && !pBase; j++)
+		{
+			if (strcmp(baseline[j].szStage, r.szStage) == 0)
+				pBase = &baseline[j];
+		}
+		if (!pBase)
+		{
+			printf("%-8s (not in baseline)\n", r.szStage);
+			continue;
+		}
+		double dRate = PercentChange(pBase->dEventsPerSec, r.dEventsPerSec);
+		double dAllocs = PercentChange(pBase->dAllocsPerEvent, r.dAllocsPerEvent);
+		if (pBase->dAllocsPerEvent == 0 && r.dAllocsPerEvent >= 0.01)
+			dAllocs = 100;
+		bool fRegression = dRate < -dThreshold || dAllocs > dThreshold;
+		printf("%-8s %+11.1f%% %+8.1f%% %+8.1f%% %+8.1f%%%s\n", r.szStage, dRate,
+			PercentChange(pBase->dP50Ns, r.dP50Ns), PercentChange(pBase->dP99Ns, r.dP99Ns),
+			dAllocs, fRegression ? "  REGRESSION" : "");
+		if (fRegression)
+			nRegressions++;
+	}
+	return nRegressions;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// SIMD check (-verify) - differential fuzz of pugixml's SIMD UTF-16 transcoding and text /
+// attribute scanning. Each corpus event and mutated copies of it (markup, entities, quotes,
+// CR / LF / tab, zero, non-ASCII, surrogates and long runs inserted; characters removed;
+// truncated) are parsed with each SIMD level the CPU supports and with parse options that
+// select each text / attribute conversion.
+// Parse status, error offset and the serialized document must be the same as with simd_scalar.
+
+#define VERIFY_MAX_REPORTED	10		// Mismatches printed.
+
+static const unsigned int s_narrParseOptions[] = { parse_default, parse_minimal,
+	parse_minimal | parse_escapes, parse_minimal | parse_eol, parse_default | parse_wnorm_attribute,
+	parse_default | parse_trim_pcdata, parse_full };
+
+class CStringWriter : public xml_writer
+{
+public:
+	virtual void write(const void *data, size_t size)
+	{
+		m_str.append((const char *)data, size);
+	}
+	std::string m_str;
+};
+
+// Parse result and serialized document (also of a partly parsed document).
+static std::string ParseToString(const std::vector<unsigned short> &xml, unsigned int nOptions)
+{
+	xml_document doc;
+	xml_parse_result result = doc.load_buffer(&xml[0], (xml.size() - 1) * 2, nOptions,
+		encoding_utf16_le);
+	char szResult[64];
+	snprintf(szResult, sizeof(szResult), "%d@%lld:", (int)result.status, (long long)result.offset);
+	CStringWriter writer;
+	writer.m_str = szResult;
+	doc.save(writer, PUGIXML_TEXT(""), format_raw, encoding_utf8);
+	return writer.m_str;
+}
+
+static unsigned int NextRandom(unsigned int &nState)
+{
+	nState ^= nState << 13;
+	nState ^= nState >> 17;
+	nState ^= nState << 5;
+	return nState;
+}
+
+// Apply 1...4 random edits to UTF-16 event (with terminating zero).
+static void MutateEvent(std::vector<unsigned short> &xml, unsigned int &nState)
+{
+	static const char *s_szarrInserts[] = { "<", ">", "&", "\"", "'", "\r", "\n", "\r\n", "\t", " ",
+		"  ", "&amp;", "&lt;&gt;", "&#x41;", "&#233;", "&quot;", "&bogus", "]]>", "<!---->",
+		"<![CDATA[x]]>", "<a b='c'/>", "=\"" };
+	int nEdits = 1 + NextRandom(nState) % 4;
+	for (int n = 0; n < nEdits; n++)
+	{
+		size_t nLen = xml.size() - 1;
+		size_t nPos = nLen ? NextRandom(nState) % nLen : 0;
+		switch (NextRandom(nState) % 6)
+		{
+		case 0:
+		case 1:
+		{
+			const char *sz = s_szarrInserts[NextRandom(nState) % (sizeof(s_szarrInserts) / sizeof(char *))];
+			for (size_t i = 0; sz[i]; i++)
+				xml.insert(xml.begin() + nPos + i, (unsigned short)(unsigned char)sz[i]);
+			break;
+		}
+		case 2:		// Run of plain characters - crosses several vectors.
+			xml.insert(xml.begin() + nPos, 1 + NextRandom(nState) % 70, (unsigned short)'a');
+			break;
+		case 3:		// Non-ASCII: Latin, CJK, surrogate pair, lone surrogate, zero.
+		{
+			static const unsigned short s_narrChars[] = { 0x00E9, 0x4E2D, 0xD83D, 0x0100, 0xDC00, 0 };
+			unsigned short c = s_narrChars[NextRandom(nState) % 6];
+			xml.insert(xml.begin() + nPos, c);
+			if (c == 0xD83D)
+				xml.insert(xml.begin() + nPos + 1, 0xDE00);
+			break;
+		}
+		case 4:
+			if (nLen)
+				xml.erase(xml.begin() + nPos);
+			break;
+		case 5:
+			if (NextRandom(nState) % 4 == 0)		// Truncate (less often - destroys the rest).
+			{
+				xml.resize(nPos);
+				xml.push_back(0);
+			}
+			break;
+		}
+	}
+}
+
+// Returns number of mismatches.
+static int VerifySimd(const std::vector<CORPUS_EVENT *> &events, int nMutations)
+{
+	xml_simd_level supported = set_simd_level(simd_auto);
+	unsigned int nState = 2463534242u;
+	unsigned long long nParses = 0;
+	int nMismatches = 0;
+	std::vector<unsigned short> xml;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		for (int n = 0; n <= nMutations; n++)
+		{
+			xml = events[i]->xml;
+			if (n)
+				MutateEvent(xml, nState);
+			for (size_t j = 0; j < sizeof(s_narrParseOptions) / sizeof(unsigned int); j++)
+			{
+				set_simd_level(simd_scalar);
+				std::string expected = ParseToString(xml, s_narrParseOptions[j]);
+				for (int nLevel = simd_sse2; nLevel <= supported; nLevel++)
+				{
+					set_simd_level((xml_simd_level)nLevel);
+					nParses++;
+					if (ParseToString(xml, s_narrParseOptions[j]) == expected)
+						continue;
+					if (++nMismatches <= VERIFY_MAX_REPORTED)
+						printf("MISMATCH event %u mutation %d options %#x level %d\n",
+							(unsigned)i + 1, n, s_narrParseOptions[j], nLevel);
+				}
+			}
+		}
+	}
+	set_simd_level(simd_auto);
+	printf("SIMD check: %u events x %d, %u parse options, levels up to %d: %llu parses compared, "
+		"%d mismatches\n", (unsigned)events.size(), nMutations + 1,
+		(unsigned)(sizeof(s_narrParseOptions) / sizeof(unsigned int)), (int)supported, nParses,
+		nMismatches);
+	return nMismatches;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static int Usage()
+{
+	fprintf(stderr, "Usage: PipelineBench [-corpus file] [-iterations N] [-noarena] [-simd level]\n"
+		"                     [-out results.json] [-baseline results.json] [-threshold percent]\n"
+		"       PipelineBench [-corpus file] -verify N\n");
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *szCorpus = "corpus/SecurityEvents.xml";
+	const char *szOut = NULL, *szBaseline = NULL;
+	int nIterations = 20, nVerify = -1;
+	double dThreshold = 10;
+	xml_simd_level simd = simd_auto;
+	bool fArena = true;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-noarena") == 0)
+		{
+			fArena = false;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return Usage();
+		if (strcmp(argv[i], "-corpus") == 0)
+			szCorpus = argv[++i];
+		else if (strcmp(argv[i], "-iterations") == 0)
+			nIterations = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-out") == 0)
+			szOut = argv[++i];
+		else if (strcmp(argv[i], "-baseline") == 0)
+			szBaseline = argv[++i];
+		else if (strcmp(argv[i], "-threshold") == 0)
+			dThreshold = atof(argv[++i]);
+		else if (strcmp(argv[i], "-verify") == 0)
+			nVerify = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-simd") == 0)
+		{
+			const char *szLevel = argv[++i];
+			int nLevel = 0;
+			while (nLevel <= simd_auto && strcmp(szLevel, s_szarrSimdLevels[nLevel]) != 0)
+				nLevel++;
+			if (nLevel > simd_auto)
+				return Usage();
+			simd = (xml_simd_level)nLevel;
+		}
+		else
+			return Usage();
+	}
+	if (nIterations <= 0)
+		return Usage();
+
+	// Corpus documents are parsed on this thread before any parse context exists - their
+	// memory is from heap in both cases.
+	if (fArena)
+		CXmlParseContext::InstallAllocator();
+	else
+		set_memory_management_functions(PugiAlloc, free);
+
+	if (!CompileEventQueries())		// Before corpus documents - as the service at startup.
+	{
+		fprintf(stderr, "Compile XPath queries failed\n");
+		return 1;
+	}
+
+	BENCH_CONTEXT *pCtx = new BENCH_CONTEXT;	// Large (sink batch) - not on stack.
+	BENCH_CONTEXT &ctx = *pCtx;
+	ctx.nDelivered = 0;
+	ctx.fArena = fArena;
+	InitFilter(ctx.filter);		// Before corpus - rule fields of events depend on it.
+	if (!LoadCorpus(szCorpus, ctx.filter, ctx.events))
+		return 1;
+	if (nVerify >= 0)
+		return VerifySimd(ctx.events, nVerify) ? 3 : 0;
+	xml_simd_level simdUsed = set_simd_level(simd);
+	size_t nAccepted = 0, nXmlBytes = 0, nRaw = 0, nRejected = 0, nScanned = 0;
+	for (size_t i = 0; i < ctx.events.size(); i++)
+	{
+		CORPUS_EVENT *pEvent = ctx.events[i];
+		nXmlBytes += (pEvent->xml.size() - 1) * 2;
+		if (pEvent->fScanned)
+			nScanned++;
+		if (pEvent->fRaw)
+		{
+			nRaw++;
+			if (!ctx.filter.IsAccepted(pEvent->fields.nEventID))
+				nRejected++;
+		}
+		if (ctx.filter.IsAccepted(pEvent->fields.nEventID)
+			&& ctx.filter.FindDropRule(pEvent->fields) < 0)
+		{
+			EVENT_ROW row;
+			DeriveColumns(pEvent->doc, pEvent->fields, row);
+			ctx.rows.push_back(row);
+			nAccepted++;
+		}
+	}
+	if (ctx.rows.empty())
+	{
+		fprintf(stderr, "No accepted events in corpus\n");
+		return 1;
+	}
+	printf("Corpus %s: %u events, %u delivered (accepted and not ignored), %d iterations, %s, "
+		"%s scanning\n", szCorpus, (unsigned)ctx.events.size(), (unsigned)nAccepted, nIterations,
+		fArena ? "parse context with arena" : "new document per event", s_szarrSimdLevels[simdUsed]);
+	printf("pugixml char_t %u bytes, UTF-16 event %s, parser buffer %.0f bytes/event (UTF-16 event %.0f bytes)\n",
+		(unsigned)sizeof(char_t), IsTranscoded() ? "transcoded" : "copied as is",
+		(double)s_nBufferBytes / ctx.events.size(), (double)nXmlBytes / ctx.events.size());
+	printf("Prefilter finds fields of %u events, rejects %u without parse\n", (unsigned)nRaw,
+		(unsigned)nRejected);
+	printf("Scan gets fields of %u events (others are parsed)\n\n", (unsigned)nScanned);
+
+	std::vector<STAGE_RESULT> results;
+	printf("%-8s %12s %9s %9s %12s\n", "Stage", "events/s", "p50 ns", "p99 ns", "allocs/event");
+	for (int nStage = 0; nStage < BENCH_STAGE_COUNT; nStage++)
+	{
+		STAGE_RESULT r;
+		if (nStage == BENCH_PARSE || nStage == BENCH_TOTAL_XML || nStage == BENCH_TOTAL)
+		{
+			std::thread worker(BenchStage, std::ref(ctx), nStage, nIterations, std::ref(r));
+			worker.join();
+		}
+		else
+			BenchStage(ctx, nStage, nIterations, r);
+		results.push_back(r);
+		printf("%-8s %12.0f %9.0f %9.0f %12.2f\n", r.szStage, r.dEventsPerSec, r.dP50Ns, r.dP99Ns,
+			r.dAllocsPerEvent);
+	}
+	ctx.sink.Flush();
+	const STAGE_RESULT &xpath = results[BENCH_XPATH], &xpathc = results[BENCH_XPATH_COMPILED];
+	printf("\nCompiled XPath saves %.0f ns and %.2f allocations per event (mean)\n",
+		1e9 / xpath.dEventsPerSec - 1e9 / xpathc.dEventsPerSec,
+		xpath.dAllocsPerEvent - xpathc.dAllocsPerEvent);
+
+	std::vector<EVENTID_RESULT> byEventID;
+	std::thread worker(BenchByEventID, std::ref(ctx), nIterations, std::ref(byEventID));
+	worker.join();
+	printf("\n%-8s %8s %14s %9s %8s %12s\n", "EventID", "events", "parse+extract", "scan", "speedup",
+		"event read");
+	for (size_t i = 0; i < byEventID.size(); i++)
+	{
+		const EVENTID_RESULT &r = byEventID[i];
+		double dRuns = (double)r.nEvents * nIterations;
+		printf("%-8d %8llu %11.0f ns %6.0f ns %7.2fx %11.0f%%\n", r.nEventID, r.nEvents,
+			r.nParseNs / dRuns, r.nScanNs / dRuns, r.nScanNs ? (double)r.nParseNs / r.nScanNs : 0,
+			100 * r.dScannedPart / r.nEvents);
+	}
+
+	std::vector<FILTER_RESULT> filters;
+	BenchFilters(ctx, nIterations, filters);
+	printf("\n%-8s %9s %13s %11s %13s %8s\n", "Lists", "EventIDs", "ObjectClasses",
+		"list", "compiled", "speedup");
+	for (size_t i = 0; i < filters.size(); i++)
+	{
+		const FILTER_RESULT &r = filters[i];
+		printf("%-8s %9d %13d %8.1f ns %10.1f ns %7.2fx\n", r.szLists, r.nNumEventIDs,
+			r.nNumObjClasses, r.dListNs, r.dCompiledNs,
+			r.dCompiledNs ? r.dListNs / r.dCompiledNs : 0);
+		if (r.nDiffer)
+			printf("  Note - filters do not agree on %u events (ObjectClass case)\n", (unsigned)r.nDiffer);
+	}
+
+	std::vector<DROP_RULES_RESULT> dropRules;
+	BenchDropRules(ctx, nIterations, dropRules);
+	printf("\n%-10s %7s %12s %12s %9s\n", "DropRules", "fields", "compile", "per event", "dropped");
+	for (size_t i = 0; i < dropRules.size(); i++)
+	{
+		const DROP_RULES_RESULT &r = dropRules[i];
+		printf("%-10d %7d %9.1f ms %9.1f ns %9u\n", r.nNumRules, r.nNumFields, r.dCompileMs, r.dNs,
+			(unsigned)r.nDropped);
+	}
+	printf("\n");
+
+	const STAGE_RESULT &totalXml = results[BENCH_TOTAL_XML], &total = results[BENCH_TOTAL];
+	printf("Prefilter and scan: %.0f events/s end to end, %.0f events/s with every event parsed (%.2fx)\n",
+		total.dEventsPerSec, totalXml.dEventsPerSec,
+		totalXml.dEventsPerSec ? total.dEventsPerSec / totalXml.dEventsPerSec : 0);
+	printf("Sink checksum %016llx\n", ctx.sink.GetChecksum());
+
+	int nReturn = 0;
+	if (szOut && !WriteResults(szOut, results, szCorpus, ctx.events.size(), nIterations))
+		nReturn = 1;
+	if (szBaseline)
+	{
+		std::vector<STAGE_RESULT> baseline;
+		if (!ReadResults(szBaseline, baseline))
+			nReturn = 1;
+		else if (CompareResults(baseline, results, dThreshold) > 0)
+		{
+			printf("\nRegression above %.0f%% - see above.\n", dThreshold);
+			nReturn = 2;
+		}
+	}
+	for (size_t i = 0; i < ctx.events.size(); i++)
+		delete ctx.events[i];
+	delete pCtx;
+	return nReturn;
+}